@@ -0,0 +1,31 @@
+# Linked in MVBC configuration generated at build time.
+#
+#   mvbc_generate_config(<target> <config.json> <symbol>)
+#
+# runs mvbc_gen on the JSON file and adds <symbol>.c/<symbol>.h to the target.
+# The application calls <symbol>_init(ctx) instead of mvbc_ctx_init(ctx, file).
+# When cross compiling set MVBC_GEN_EXECUTABLE to a mvbc_gen built for the host.
+
+function(mvbc_generate_config TARGET JSON SYMBOL)
+	get_filename_component(json_abs ${JSON} ABSOLUTE)
+	set(out_c ${CMAKE_CURRENT_BINARY_DIR}/${SYMBOL}.c)
+	set(out_h ${CMAKE_CURRENT_BINARY_DIR}/${SYMBOL}.h)
+
+	if(MVBC_GEN_EXECUTABLE)
+		set(gen ${MVBC_GEN_EXECUTABLE})
+		set(gen_dep "")
+	else()
+		set(gen $<TARGET_FILE:mvbc_gen>)
+		set(gen_dep mvbc_gen)
+	endif()
+
+	add_custom_command(
+		OUTPUT ${out_c} ${out_h}
+		COMMAND ${gen} ${json_abs} ${out_c} ${out_h} ${SYMBOL}
+		DEPENDS ${json_abs} ${gen_dep}
+		COMMENT "Generating MVBC configuration ${SYMBOL} from ${JSON}"
+		VERBATIM)
+
+	set_property(TARGET ${TARGET} APPEND PROPERTY SOURCES ${out_c} ${out_h})
+	set_property(TARGET ${TARGET} APPEND PROPERTY INCLUDE_DIRECTORIES ${CMAKE_CURRENT_BINARY_DIR})
+endfunction()
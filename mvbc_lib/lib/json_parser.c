@@ -21,7 +21,7 @@
  *
  */
 
-#include "mvbc_lib.h"
+#include "mvbc_internal.h"
 #include "parson.h"
 
 static int validateMode(const char *mode);
@@ -33,6 +33,7 @@ static int validateFunctionalCode(int fcode);
 static int validatePollingTimeout(int poll_ms);
 static int validateInterruptNumber(int irq);
 static int validateNumericalData(int num_data);
+static int validateLineMode(const char *line);
 
 /**
  * Validate MVB interface.
@@ -57,6 +58,35 @@ static int validateInterface(const char *mode)
 	return rc;
 }
 
+/**
+ * Validate MVB line mode,
+ * Allowed param values
+ * 	A: LineA only
+ * 	B: LineB only
+ * 	AB: redundant LineA & LineB
+ *
+ * @param line
+ * @return -1 in case of unknown line mode, else line mode number
+ */
+static int validateLineMode(const char *line)
+{
+	int rc =-1;
+
+	if (strcmp(line,"A") == 0)
+	{
+		rc = eLineA;
+	}
+	else if (strcmp(line,"B") == 0)
+	{
+		rc = eLineB;
+	}
+	else if (strcmp(line,"AB") == 0)
+	{
+		rc = eLineAB;
+	}
+	return rc;
+}
+
 /**
  * Validate MVB operational mode,
  * Allowed param values
@@ -280,241 +310,399 @@ static int validateNumericalData(int num_data)
 	return rc;
 }
 
+/* fields of a port set by a template or by an entry of config.static */
+#define PORT_FIELD_NAME			(1 << 0)
+#define PORT_FIELD_ADDR			(1 << 1)
+#define PORT_FIELD_TYPE			(1 << 2)
+#define PORT_FIELD_DIRECTION	(1 << 3)
+#define PORT_FIELD_FCODE		(1 << 4)
+#define PORT_FIELD_POLL_MS		(1 << 5)
+#define PORT_FIELD_IRQ			(1 << 6)
+#define PORT_FIELD_NUM_DATA		(1 << 7)
+
 /**
- * Parse port/s configuration from given JSON_Object *structObject
- * depending on operational mode param (enum eMode mode).
+ * port addresses of one entry of config.static.
+ */
+struct sPortRange
+{
+	int iFirst;
+	int iCount;
+	int iStride;
+};
+
+/**
+ * Parse an optional number field of a port.
  *
- * @param structObject
- * @param portSetup
- * @param mode
-* @return error_code ERROR_CONFIG_FILE_PARAMETER in case of error, else NO_ERROR
+ * @param obj
+ * @param key
+ * @param validate validator returning -1 for a wrong value
+ * @param value set if the field is present and valid
+ * @param uiSet gets bit if the field is present and valid
+ * @param bit PORT_FIELD_x
+ * @param i entry index for the debug output
+ * @return ERROR_CONFIG_FILE_PARAMETER if the field is present but invalid, else NO_ERROR
  */
-static int parse_port_config(JSON_Object *structObject, struct sMvbcPorts *portSetup, enum eMode mode)
+static int parse_port_number(JSON_Object *obj, const char *key, int (*validate)(int), int *value, unsigned *uiSet, unsigned bit, int i)
 {
 	int rc = NO_ERROR;
-	int i;
-	int iLocalValue = -1;
 
-	if (( mode == eStatic ) || (mode == eCombined))
+	if (json_object_has_value_of_type(obj, key, JSONNumber))
 	{
-		JSON_Array *staticList;
-		int count = 0;
+		int iLocalValue = validate((int)json_object_get_number(obj, key));
 
-		staticList = json_object_dotget_array(structObject, "config.static");
+		if (iLocalValue != -1)
+		{
+			*value = iLocalValue;
+			*uiSet |= bit;
+			DEBUG_OUT( "\t\t\tPORT[%d] %s[%d]\n",i,key,*value);
+		}
+		else
+		{
+			DEBUG_OUT( "'%s' validation failed\n",key);
+			rc = ERROR_CONFIG_FILE_PARAMETER;
+		}
+	}
+	return rc;
+}
 
-		count = json_array_get_count(staticList);
+/**
+ * Parse an optional string field of a port.
+ *
+ * @param obj
+ * @param key
+ * @param validate validator returning -1 for an unknown value
+ * @param value set if the field is present and valid
+ * @param uiSet gets bit if the field is present and valid
+ * @param bit PORT_FIELD_x
+ * @param i entry index for the debug output
+ * @return ERROR_CONFIG_FILE_PARAMETER if the field is present but invalid, else NO_ERROR
+ */
+static int parse_port_string(JSON_Object *obj, const char *key, int (*validate)(const char *), int *value, unsigned *uiSet, unsigned bit, int i)
+{
+	int rc = NO_ERROR;
 
-		portSetup->mvbc_port_count = count;
+	if (json_object_has_value_of_type(obj, key, JSONString))
+	{
+		int iLocalValue = validate(json_object_get_string(obj, key));
 
-		for (i = 0; i < count; i++)
+		if (iLocalValue != -1)
+		{
+			*value = iLocalValue;
+			*uiSet |= bit;
+			DEBUG_OUT( "\t\t\tPORT[%d] %s[%d]\n",i,key,*value);
+		}
+		else
 		{
-			JSON_Object *port = json_array_get_object(staticList, i);
-			const char *strResult;
+			DEBUG_OUT( "'%s' validation failed\n",key);
+			rc = ERROR_CONFIG_FILE_PARAMETER;
+		}
+	}
+	return rc;
+}
 
-			DEBUG_OUT( "\t\t**********static***********\n");
+/**
+ * Parse the address of an entry of config.static, either one port
+ *
+ * 	"addr": 256
+ *
+ * or a range of ports with an optional stride (default 1), given by count or last address
+ *
+ * 	"addr": { "first": 256, "count": 16, "stride": 2 }
+ * 	"addr": { "first": 256, "last": 286, "stride": 2 }
+ *
+ * @param obj
+ * @param range
+ * @param uiSet gets PORT_FIELD_ADDR
+ * @param i entry index for the debug output
+ * @return ERROR_CONFIG_FILE_PARAMETER in case of error, else NO_ERROR
+ */
+static int parse_port_range(JSON_Object *obj, struct sPortRange *range, unsigned *uiSet, int i)
+{
+	int rc = NO_ERROR;
 
-			/** OPTIONAL config.static.name (string) */
+	if (json_object_has_value_of_type(obj, "addr", JSONNumber))
+	{
+		range->iFirst = validatePortAddr((int)json_object_get_number(obj, "addr"));
+		range->iCount = 1;
+		range->iStride = 1;
+	}
+	else if (json_object_has_value_of_type(obj, "addr", JSONObject))
+	{
+		JSON_Object *addr = json_object_get_object(obj, "addr");
 
-			if (json_object_dothas_value_of_type(port, "name", JSONString))
-			{
-				strResult = json_object_dotget_string(port, "name");
-				if (strResult)
-				{
-					DEBUG_OUT( "\t\t\tPORT[%d] name[%s]\n",i,strResult);
-					strncpy(portSetup->port[i].cPortName, strResult, MAX_STRING_LENGTH);
-				}
-				else
-				{
-					DEBUG_OUT( "'name' parser error\n");
-					rc = ERROR_CONFIG_FILE_PARAMETER;
-					break;
-				}
-			}
-			else
+		range->iFirst = json_object_has_value_of_type(addr, "first", JSONNumber) ? validatePortAddr((int)json_object_get_number(addr, "first")) : -1;
+		range->iStride = json_object_has_value_of_type(addr, "stride", JSONNumber) ? (int)json_object_get_number(addr, "stride") : 1;
+		range->iCount = -1;
+
+		if (json_object_has_value_of_type(addr, "count", JSONNumber))
+		{
+			range->iCount = (int)json_object_get_number(addr, "count");
+		}
+		else if (json_object_has_value_of_type(addr, "last", JSONNumber) && (range->iFirst != -1) && (range->iStride > 0))
+		{
+			int last = validatePortAddr((int)json_object_get_number(addr, "last"));
+
+			if (last >= range->iFirst)
 			{
-				DEBUG_OUT( "'name' is not a string -> set default [%s]\n",MVBC_JSON_CONF_DEFAULT_PORT_NAME);
-				strncpy(portSetup->port[i].cPortName, MVBC_JSON_CONF_DEFAULT_PORT_NAME, MAX_STRING_LENGTH);
+				range->iCount = (last - range->iFirst) / range->iStride + 1;
 			}
+		}
 
-			/** MANDATORY config.static.addr (number) */
+		if ((range->iFirst != -1) && ((range->iStride <= 0) || (range->iStride > MAX_PORT_COUNT) || (range->iCount <= 0) || (range->iCount > MAX_PORT_COUNT) ||
+			(validatePortAddr(range->iFirst + (range->iCount - 1) * range->iStride) == -1)))
+		{
+			range->iFirst = -1;
+		}
+	}
+	else
+	{
+		return NO_ERROR;
+	}
 
-			if (json_object_dothas_value_of_type(port, "addr", JSONNumber))
-			{
-				iLocalValue = validatePortAddr((int)json_object_get_number(port, "addr"));
-				if (iLocalValue != -1)
-				{
-					portSetup->port[i].portCfg.iPortAddr = iLocalValue;
-					DEBUG_OUT( "\t\t\tPORT[%d] addr[%d]\n",i, portSetup->port[i].portCfg.iPortAddr);
+	if (range->iFirst != -1)
+	{
+		*uiSet |= PORT_FIELD_ADDR;
+		DEBUG_OUT( "\t\t\tPORT[%d] addr[%d] count[%d] stride[%d]\n",i,range->iFirst,range->iCount,range->iStride);
+	}
+	else
+	{
+		DEBUG_OUT( "'addr' validation failed\n");
+		rc = ERROR_CONFIG_FILE_PARAMETER;
+	}
+	return rc;
+}
 
-					iLocalValue = -1;
-				}
-				else
-				{
-					DEBUG_OUT( "'addr' validation failed\n");
-					rc = ERROR_CONFIG_FILE_PARAMETER;
-					break;
-				}
-			}
-			else
-			{
-				rc = ERROR_CONFIG_FILE_PARAMETER;
-				DEBUG_OUT( "'addr' is not a number\n");
-				break;
-			}
+/**
+ * Parse the fields of a template or an entry of config.static onto a port.
+ * Fields missing in the object are left as they are.
+ *
+ * @param obj
+ * @param proto
+ * @param cPattern name pattern, see expand_port_name()
+ * @param uiSet gets the PORT_FIELD_x bits of the fields found
+ * @param i entry index for the debug output
+ * @return ERROR_CONFIG_FILE_PARAMETER in case of error, else NO_ERROR
+ */
+static int parse_port_fields(JSON_Object *obj, struct sMvbcPortCfg *proto, char *cPattern, unsigned *uiSet, int i)
+{
+	int rc = NO_ERROR;
 
-			/** OPTIONAL config.static.type (string) */
+	if (json_object_has_value_of_type(obj, "name", JSONString))
+	{
+		strncpy(cPattern, json_object_get_string(obj, "name"), MAX_STRING_LENGTH - 1);
+		cPattern[MAX_STRING_LENGTH - 1] = 0;
+		*uiSet |= PORT_FIELD_NAME;
+		DEBUG_OUT( "\t\t\tPORT[%d] name[%s]\n",i,cPattern);
+	}
 
-			if (json_object_dothas_value_of_type(port, "type", JSONString))
-			{
-				iLocalValue = validatePortType(json_object_dotget_string(port, "type"));
-				if (iLocalValue != -1)
-				{
-					portSetup->port[i].portCfg.iPortType = iLocalValue;
-					DEBUG_OUT( " \t\t\tPORT[%d] type[%d]\n",i,portSetup->port[i].portCfg.iPortType);
+	if ((parse_port_string(obj, "type", validatePortType, &proto->iPortType, uiSet, PORT_FIELD_TYPE, i) != NO_ERROR) ||
+		(parse_port_string(obj, "direction", validatePortDirection, &proto->iPortDirection, uiSet, PORT_FIELD_DIRECTION, i) != NO_ERROR) ||
+		(parse_port_number(obj, "fcode", validateFunctionalCode, &proto->iFunctionCode, uiSet, PORT_FIELD_FCODE, i) != NO_ERROR) ||
+		(parse_port_number(obj, "poll_ms", validatePollingTimeout, &proto->iPollIntervalMS, uiSet, PORT_FIELD_POLL_MS, i) != NO_ERROR) ||
+		(parse_port_number(obj, "irq", validateInterruptNumber, &proto->iIrqNumber, uiSet, PORT_FIELD_IRQ, i) != NO_ERROR) ||
+		(parse_port_number(obj, "num_data", validateNumericalData, &proto->iNumData, uiSet, PORT_FIELD_NUM_DATA, i) != NO_ERROR))
+	{
+		rc = ERROR_CONFIG_FILE_PARAMETER;
+	}
+	return rc;
+}
 
-					iLocalValue = -1;
-				}
-				else
-				{
-					DEBUG_OUT( "'type' validation failed\n");
-					rc = ERROR_CONFIG_FILE_PARAMETER;
-					break;
-				}
-			}
-			else
-			{
-				DEBUG_OUT( "'type' is not a string -> set default [%d]\n",MVBC_JSON_CONF_DEFAULT_PORT_TYPE);
-				portSetup->port[i].portCfg.iPortType = MVBC_JSON_CONF_DEFAULT_PORT_TYPE;
-			}
+/**
+ * Name of one port of a range. In the pattern
+ * 	{i} is replaced by the index of the port in the range (0, 1, ...)
+ * 	{a} by the port address in decimal
+ * 	{x} by the port address in hex (3 digits)
+ * A pattern without placeholder names all ports of the range alike.
+ *
+ * @param cName
+ * @param cPattern
+ * @param index
+ * @param addr
+ */
+static void expand_port_name(char *cName, const char *cPattern, int index, int addr)
+{
+	size_t len = 0;
 
-			/** OPTIONAL config.static.direction (string) */
+	while (*cPattern && (len < MAX_STRING_LENGTH - 1))
+	{
+		if ((cPattern[0] == '{') && cPattern[1] && (cPattern[2] == '}') && strchr("iax", cPattern[1]))
+		{
+			int n = snprintf(cName + len, MAX_STRING_LENGTH - len, (cPattern[1] == 'x') ? "%03X" : "%d", (cPattern[1] == 'i') ? index : addr);
 
-			if (json_object_dothas_value_of_type(port, "direction", JSONString))
-			{
-				iLocalValue = validatePortDirection(json_object_dotget_string(port, "direction"));
-				if (iLocalValue != -1)
-				{
-					portSetup->port[i].portCfg.iPortDirection = iLocalValue;
-					DEBUG_OUT( "\t\t\tPORT[%d] direction[%d]\n",i,portSetup->port[i].portCfg.iPortDirection);
+			len = (n < 0) ? len : ((len + n < MAX_STRING_LENGTH - 1) ? len + n : MAX_STRING_LENGTH - 1);
+			cPattern += 3;
+		}
+		else
+		{
+			cName[len++] = *cPattern++;
+		}
+	}
+	cName[len] = 0;
+}
 
-					iLocalValue = -1;
-				}
-				else
-				{
-					DEBUG_OUT( "'direction' validation failed\n");
-					rc = ERROR_CONFIG_FILE_PARAMETER;
-					break;
-				}
-			}
-			else
-			{
-				DEBUG_OUT( "'direction' is not a string -> set default [%d]\n",MVBC_JSON_CONF_DEFAULT_PORT_DIRECTION);
-				portSetup->port[i].portCfg.iPortDirection = MVBC_JSON_CONF_DEFAULT_PORT_DIRECTION;
-			}
+/**
+ * Parse the static ports of a device into portSetup->port[]. An entry of
+ * config.static is one port or an address range of ports (see
+ * parse_port_range()); ranges are expanded straight into the port array.
+ * An entry may name a template
+ *
+ * 	"template": "door"
+ *
+ * from config.templates of the device or from project.templates. Its fields
+ * are the defaults of the entry, fields of the entry override them.
+ * Templates hold the same fields as entries except addr and do not nest.
+ *
+ * @param structObject device
+ * @param projectTemplates project.templates or NULL
+ * @param portSetup
+ * @return ERROR_CONFIG_FILE_PARAMETER in case of error, else NO_ERROR
+ */
+static int parse_static_ports(JSON_Object *structObject, JSON_Object *projectTemplates, struct sMvbcPorts *portSetup)
+{
+	int rc = NO_ERROR;
+	int i;
+	JSON_Array *staticList = json_object_dotget_array(structObject, "config.static");
+	JSON_Object *templates = json_object_dotget_object(structObject, "config.templates");
+	int count = json_array_get_count(staticList);
+	int ports = 0;
 
-			/** MANDATORY config.static.fcode (number) */
+	for (i = 0; (i < count) && (rc == NO_ERROR); i++)
+	{
+		JSON_Object *entry = json_array_get_object(staticList, i);
+		struct sMvbcPortCfg proto = {0};
+		struct sPortRange range = {-1, 0, 1};
+		char cPattern[MAX_STRING_LENGTH] = MVBC_JSON_CONF_DEFAULT_PORT_NAME;
+		unsigned uiSet = 0;
 
-			if (json_object_dothas_value_of_type(port, "fcode", JSONNumber))
-			{
-				iLocalValue = validateFunctionalCode((int)json_object_get_number(port, "fcode"));
-				if (iLocalValue != -1)
-				{
-					portSetup->port[i].portCfg.iFunctionCode = iLocalValue;
-					DEBUG_OUT( "\t\t\tPORT[%d] fcode[%d]\n",i,portSetup->port[i].portCfg.iFunctionCode);
+		DEBUG_OUT( "\t\t**********static***********\n");
 
-					iLocalValue = -1;
-				}
-				else
-				{
-					DEBUG_OUT( "'fcode' validation failed\n");
-					rc = ERROR_CONFIG_FILE_PARAMETER;
-					break;
-				}
-			}
-			else
-			{
-				rc = ERROR_CONFIG_FILE_PARAMETER;
-				DEBUG_OUT( "'fcode' is not a number\n");
-				break;
-			}
+		proto.iPortType = MVBC_JSON_CONF_DEFAULT_PORT_TYPE;
+		proto.iPortDirection = MVBC_JSON_CONF_DEFAULT_PORT_DIRECTION;
+		proto.iPollIntervalMS = MVBC_JSON_CONF_DEFAULT_PORT_POLL_MS;
+		proto.iIrqNumber = MVBC_JSON_CONF_DEFAULT_PORT_IRQ;
+		proto.iNumData = MVBC_JSON_CONF_DEFAULT_PORT_NUM_DATA;
 
-			/** OPTIONAL config.static.poll_ms (number) */
+		/** OPTIONAL config.static.template (string) */
 
-			if (json_object_dothas_value_of_type(port, "poll_ms", JSONNumber))
-			{
-				iLocalValue = validatePollingTimeout((int)json_object_get_number(port, "poll_ms"));
-				if (iLocalValue != -1)
-				{
-					portSetup->port[i].portCfg.iPollIntervalMS = iLocalValue;
-					DEBUG_OUT( "\t\t\tPORT[%d] poll_ms[%d]\n",i,portSetup->port[i].portCfg.iPollIntervalMS);
+		if (json_object_has_value_of_type(entry, "template", JSONString))
+		{
+			const char *name = json_object_get_string(entry, "template");
+			JSON_Object *tmpl = json_object_get_object(templates, name);
 
-					iLocalValue = -1;
-				}
-				else
-				{
-					DEBUG_OUT( "'poll_ms' validation failed\n");
-					rc = ERROR_CONFIG_FILE_PARAMETER;
-					break;
-				}
-			}
-			else
+			if (tmpl == NULL)
 			{
-				DEBUG_OUT( "'poll_ms' is not a number -> set default [%d]\n",MVBC_JSON_CONF_DEFAULT_PORT_POLL_MS);
-				portSetup->port[i].portCfg.iPollIntervalMS = MVBC_JSON_CONF_DEFAULT_PORT_POLL_MS;
+				tmpl = json_object_get_object(projectTemplates, name);
 			}
-
-			/** OPTIONAL config.static.irq (number) */
-
-			if (json_object_dothas_value_of_type(port, "irq", JSONNumber))
+			if (tmpl != NULL)
 			{
-				iLocalValue = validateInterruptNumber((int)json_object_get_number(port, "irq"));
-				if (iLocalValue != -1)
-				{
-					portSetup->port[i].portCfg.iIrqNumber = iLocalValue;
-					DEBUG_OUT( "\t\t\tPORT[%d] irq[%d]\n",i,portSetup->port[i].portCfg.iIrqNumber);
-
-					iLocalValue = -1;
-				}
-				else
-				{
-					DEBUG_OUT( "'irq' validation failed\n");
-					rc = ERROR_CONFIG_FILE_PARAMETER;
-					break;
-				}
+				DEBUG_OUT( "\t\t\tPORT[%d] template[%s]\n",i,name);
+				rc = parse_port_fields(tmpl, &proto, cPattern, &uiSet, i);
 			}
 			else
 			{
-				DEBUG_OUT( "'irq' is not a number -> set default [%d]\n",MVBC_JSON_CONF_DEFAULT_PORT_IRQ);
-				portSetup->port[i].portCfg.iIrqNumber = MVBC_JSON_CONF_DEFAULT_PORT_IRQ;
+				DEBUG_OUT( "'template' %s not found\n",name);
+				rc = ERROR_CONFIG_FILE_PARAMETER;
 			}
+		}
 
-			/** OPTIONAL config.static.num_data (number) */
+		/** MANDATORY config.static.addr (number or range), config.static.fcode (number, entry or template)
+		 *  OPTIONAL config.static.name, type, direction, poll_ms, irq, num_data */
 
-			if (json_object_dothas_value_of_type(port, "num_data", JSONNumber))
-			{
-				iLocalValue = validateNumericalData((int)json_object_get_number(port, "num_data"));
-				if (iLocalValue != -1)
-				{
-					portSetup->port[i].portCfg.iNumData = iLocalValue;
-					DEBUG_OUT( "\t\t\tPORT[%d] num_data[%d]\n",i,portSetup->port[i].portCfg.iNumData);
+		if (rc == NO_ERROR)
+		{
+			rc = parse_port_fields(entry, &proto, cPattern, &uiSet, i);
+		}
+		if (rc == NO_ERROR)
+		{
+			rc = parse_port_range(entry, &range, &uiSet, i);
+		}
 
-					iLocalValue = -1;
-				}
-				else
-				{
-					DEBUG_OUT( "'num_data' validation failed\n");
-					rc = ERROR_CONFIG_FILE_PARAMETER;
-					break;
-				}
-			}
-			else
-			{
-				DEBUG_OUT( "'num_data' is not a number -> set default [%d]\n",MVBC_JSON_CONF_DEFAULT_PORT_NUM_DATA);
-				portSetup->port[i].portCfg.iNumData = MVBC_JSON_CONF_DEFAULT_PORT_NUM_DATA;
-			}
+		if (rc != NO_ERROR)
+		{
+			break;
+		}
+		if ((uiSet & PORT_FIELD_ADDR) == 0)
+		{
+			DEBUG_OUT( "'addr' is not a number\n");
+			rc = ERROR_CONFIG_FILE_PARAMETER;
+			break;
+		}
+		if ((uiSet & PORT_FIELD_FCODE) == 0)
+		{
+			DEBUG_OUT( "'fcode' is not a number\n");
+			rc = ERROR_CONFIG_FILE_PARAMETER;
+			break;
+		}
+		if (ports + range.iCount > MAX_PORT_COUNT)
+		{
+			DEBUG_OUT( "Error: PORTS[%d] > ALLOWED [%d]\n",ports + range.iCount,MAX_PORT_COUNT);
+			rc = ERROR_CONFIG_FILE_PARAMETER;
+			break;
+		}
+
+		if ((uiSet & PORT_FIELD_NAME) == 0)
+		{
+			DEBUG_OUT( "'name' is not a string -> set default [%s]\n",MVBC_JSON_CONF_DEFAULT_PORT_NAME);
+		}
+		if ((uiSet & PORT_FIELD_TYPE) == 0)
+		{
+			/* the F-Code decides, mvbc_check_project() rejects a type that contradicts it */
+			proto.iPortType = mvbc_fcode_type(proto.iFunctionCode);
+			DEBUG_OUT( "'type' is not a string -> set from fcode [%d]\n",proto.iPortType);
+		}
+		if ((uiSet & PORT_FIELD_DIRECTION) == 0)
+		{
+			DEBUG_OUT( "'direction' is not a string -> set default [%d]\n",MVBC_JSON_CONF_DEFAULT_PORT_DIRECTION);
+		}
+		if ((uiSet & PORT_FIELD_POLL_MS) == 0)
+		{
+			DEBUG_OUT( "'poll_ms' is not a number -> set default [%d]\n",MVBC_JSON_CONF_DEFAULT_PORT_POLL_MS);
+		}
+		if ((uiSet & PORT_FIELD_IRQ) == 0)
+		{
+			DEBUG_OUT( "'irq' is not a number -> set default [%d]\n",MVBC_JSON_CONF_DEFAULT_PORT_IRQ);
+		}
+		if ((uiSet & PORT_FIELD_NUM_DATA) == 0)
+		{
+			DEBUG_OUT( "'num_data' is not a number -> set default [%d]\n",MVBC_JSON_CONF_DEFAULT_PORT_NUM_DATA);
+		}
+
+		/* one copy of the parsed entry per address, no JSON per port */
+		for (int n = 0; n < range.iCount; n++)
+		{
+			struct sMvbcPort *port = &portSetup->port[ports++];
+
+			port->portCfg = proto;
+			port->portCfg.iPortAddr = range.iFirst + n * range.iStride;
+			expand_port_name(port->cPortName, cPattern, n, port->portCfg.iPortAddr);
 		}
 	}
 
+	portSetup->mvbc_port_count = ports;
+
+	return rc;
+}
+
+/**
+ * Parse port/s configuration from given JSON_Object *structObject
+ * depending on operational mode param (enum eMode mode).
+ *
+ * @param structObject
+ * @param projectTemplates project.templates or NULL
+ * @param portSetup
+ * @param mode
+* @return error_code ERROR_CONFIG_FILE_PARAMETER in case of error, else NO_ERROR
+ */
+static int parse_port_config(JSON_Object *structObject, JSON_Object *projectTemplates, struct sMvbcPorts *portSetup, enum eMode mode)
+{
+	int rc = NO_ERROR;
+	int iLocalValue = -1;
+
+	if (( mode == eStatic ) || (mode == eCombined))
+	{
+		rc = parse_static_ports(structObject, projectTemplates, portSetup);
+	}
+
 	if (( mode == eDynamic ) || (mode == eCombined))
 	{
 		const char *strResult;
@@ -836,8 +1024,47 @@ int mvbc_parse_project_configuration(const char *configFile, struct sProject *pP
 						pProject->mvbc[i].iTestTrafficMemory = MVBC_JSON_CONF_DEFAULT_DEVICE_MEMORY_TEST;
 					}
 
+					/** OPTIONAL project.devices[i].line (string) */
+					if (json_object_dothas_value_of_type(structObject, "line", JSONString))
+					{
+						iLocalValue = validateLineMode(json_object_dotget_string(structObject, "line"));
+						if (iLocalValue != -1)
+						{
+							pProject->mvbc[i].iLine = iLocalValue;
+							DEBUG_OUT( "DEVICE[%d]	line[%d]\n",i, pProject->mvbc[i].iLine);
+
+							iLocalValue = -1;
+						}
+						else
+						{
+							DEBUG_OUT( "'line' validation failed\n");
+							rc = ERROR_CONFIG_FILE_PARAMETER;
+							break;
+						}
+					}
+					else
+					{
+						DEBUG_OUT( "'line' is not a string -> set default [%d]\n",MVBC_JSON_CONF_DEFAULT_DEVICE_LINE);
+						pProject->mvbc[i].iLine = MVBC_JSON_CONF_DEFAULT_DEVICE_LINE;
+					}
+
+					/** OPTIONAL project.devices[i].uio (string) */
+					if (json_object_dothas_value_of_type(structObject, "uio", JSONString))
+					{
+						strncpy(pProject->mvbc[i].cUioPath, json_object_dotget_string(structObject, "uio"), MAX_STRING_LENGTH - 1);
+						DEBUG_OUT( "DEVICE[%d]\tuio[%s]\n",i, pProject->mvbc[i].cUioPath);
+					}
+					else
+					{
+						pProject->mvbc[i].cUioPath[0] = 0;
+					}
+
 					/* depending on device mode static/dynamic/combined -> parse config values */
-					rc = parse_port_config(structObject,&pProject->mvbc[i].portSetup,pProject->mvbc[i].iMode);
+					rc = parse_port_config(structObject,json_object_dotget_object(rootObject, "project.templates"),&pProject->mvbc[i].portSetup,pProject->mvbc[i].iMode);
+					if (rc != NO_ERROR)
+					{
+						break;
+					}
 				}
 			}
 		}
@@ -851,5 +1078,11 @@ int mvbc_parse_project_configuration(const char *configFile, struct sProject *pP
 	/* cleanup */
 	json_value_free(rootValue);
 
+	/* same rules as linked in configurations: no port twice, F-Code and type agree, bus load */
+	if ((rc == NO_ERROR) && (mvbc_check_project(pProject) != 0))
+	{
+		rc = ERROR_CONFIG_FILE_PARAMETER;
+	}
+
 	return rc;
 }
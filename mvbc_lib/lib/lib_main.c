@@ -22,33 +22,50 @@
  */
 
 //#include "../include/mvbc_json_config.h_"
-#include "mvbc_lib.h"
+#include <stdlib.h>
 
+#include "mvbc_internal.h"
+#include "mvbc_cfg.h"
+#include "mvbc_cmd.h"
 
-/** global variable gProject to hold parsed project configuration */
-struct sProject gProject;
 
-static int send_cmd(const char *dev, int cmd, void* arg);
+/** context used by the functions without context parameter */
+static struct mvbc_ctx gDefaultCtx;
+static pthread_once_t gDefaultCtxOnce = PTHREAD_ONCE_INIT;
+
 static int mvbc_run_device(struct sMvbcDevCfg *mvbc);
-static int mvbc_reset_device(struct sMvbcDevCfg *mvbc);
+static int mvbc_reset_device(struct sMvbcDevCfg *mvbc, int test_memory);
 static int mvbc_set_device_configuration(struct sMvbcDevCfg *mvbc);
 static int mvbc_get_device_configuration(struct sMvbcDevCfg *mvbc);
-static int mvbc_set_port_configuration(struct sMvbcDevCfg *mvbc);
+static int mvbc_set_port_configuration(struct sMvbcDevCfg *mvbc, struct sMvbcDevState *state);
+static int mvbc_send_port_descriptors(const char *dev, const struct sMvbcPortConfig *desc, int count);
 
 /**
- * call driver IOCTL function
+ * call driver IOCTL function, see mvbc_cmd.h
  *
  * @param dev (e.g./dev/mvbc1)
  * @param cmd (e.g. EL_MVBC_SET_DEVICE_CONFIGURATION)
  * @param arg (e.g. (struct sMvbcDeviceConfig *)arg)
  * @return 0 in case of success, -1 for error
  */
-static int send_cmd(const char *dev, int cmd, void* arg)
+int mvbc_send_cmd(const char *dev, int cmd, void* arg)
 {
 	int rc = NO_ERROR;
 	int fd = -1;
+	struct sMvbcProfSample prof;
+	struct timespec start;
+	uint64_t latency;
+
+	mvbc_prof_begin(&prof);
 
-	if (strncmp(dev,"/dev",4)==0)
+	MVBC_TRACE2(cmd__entry, dev, cmd);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (strncmp(dev,MVBC_EMU_PREFIX,strlen(MVBC_EMU_PREFIX))==0)
+	{
+		rc = mvbc_emu_cmd(dev, cmd, arg);
+	}
+	else if (strncmp(dev,"/dev",4)==0)
 	{
 		fd = open(dev, O_RDWR);
 		if (fd < 0)
@@ -88,16 +105,52 @@ static int send_cmd(const char *dev, int cmd, void* arg)
 	{
 		rc = -1;
 	}
+
+	latency = mvbc_metric_cmd(cmd, rc, &start);
+	mvbc_prof_end(&prof, mvbc_prof_cmd_phase(cmd), 0);
+
+	MVBC_TRACE4(cmd__return, dev, cmd, rc, latency);
 	return rc;
 }
 
+/**
+ * Parse a JSON configuration into a private project, profiled as eProfParse and timed for the metrics.
+ * The context is not touched, readers keep the published configuration meanwhile.
+ *
+ * @param config_file
+ * @param rc gets the error_code
+ * @return parsed project to be freed by the caller, NULL for no memory
+ */
+static struct sProject *parse_project(const char *config_file, int *rc)
+{
+	struct sProject *project = calloc(1, sizeof(struct sProject));
+	struct sMvbcProfSample prof;
+	struct timespec mark;
+
+	if (project == NULL)
+	{
+		DEBUG_OUT( "ERROR no memory for the configuration\n");
+		*rc = ERROR_PARSE_CONFIGURATION;
+		return NULL;
+	}
+
+	mvbc_prof_begin(&prof);
+	clock_gettime(CLOCK_MONOTONIC, &mark);
+	*rc = mvbc_parse_project_configuration(config_file, project);
+	mvbc_metric_init_phase(eMetricInitParse, mvbc_metric_lap_ns(&mark));
+	mvbc_prof_end(&prof, eProfParse, 0);
+
+	return project;
+}
+
 /**
  * Reset MVBC devices
  *
  * @param mvbc sMvbcDevCfg
+ * @param test_memory run the traffic memory test (iTestTrafficMemory of the configuration at init)
  * @return 0 in case of success, -1 for error
  */
-static int mvbc_reset_device(struct sMvbcDevCfg *mvbc)
+static int mvbc_reset_device(struct sMvbcDevCfg *mvbc, int test_memory)
 {
 	int rc = NO_ERROR;
 
@@ -129,11 +182,11 @@ static int mvbc_reset_device(struct sMvbcDevCfg *mvbc)
 
 		deviceCfg.uiOperationMode = mvbc->iMode;
 
-		deviceCfg.uiTestTrafficMemory = mvbc->iTestTrafficMemory;
+		deviceCfg.uiTestTrafficMemory = test_memory;
 
 		deviceCfg.defaultPortCfg = mvbc->portSetup.defaultPortCfg;
 
-		rc |= send_cmd(mvbc->cDevPath, EL_MVBC_RESET_DEVICE,&deviceCfg);
+		rc |= mvbc_send_cmd(mvbc->cDevPath, EL_MVBC_RESET_DEVICE,&deviceCfg);
 	}
 
 	DEBUG_OUT( "RC[%X]\n",rc);
@@ -154,14 +207,14 @@ static int mvbc_set_device_configuration(struct sMvbcDevCfg *mvbc)
 	{
 		struct sMvbcDeviceConfig deviceCfg;
 
-		deviceCfg.uiLine = eLineAB;
+		deviceCfg.uiLine = mvbc->iLine;
 		deviceCfg.uiDevAddr = mvbc->iDeviceAddr;
 		deviceCfg.uiMode = mvbc->iInterface;
 
 		deviceCfg.uiSinkTimeInterval = 6; //32ms
 		deviceCfg.uiSinkTimeNumberOfDocks = 0xFFF; //activate sink-time supervision for all 4096 ports
 
-		rc |= send_cmd(mvbc->cDevPath, EL_MVBC_SET_DEVICE_CONFIGURATION,&deviceCfg);
+		rc |= mvbc_send_cmd(mvbc->cDevPath, EL_MVBC_SET_DEVICE_CONFIGURATION,&deviceCfg);
 	}
 
 	DEBUG_OUT( "RC[%X]\n", rc);
@@ -183,7 +236,7 @@ static int mvbc_get_device_configuration(struct sMvbcDevCfg *mvbc)
 	{
 		struct sMvbcDeviceConfig deviceCfg;
 
-		rc |= send_cmd(mvbc->cDevPath, EL_MVBC_GET_DEVICE_CONFIGURATION,&deviceCfg);
+		rc |= mvbc_send_cmd(mvbc->cDevPath, EL_MVBC_GET_DEVICE_CONFIGURATION,&deviceCfg);
 
 		DEBUG_OUT( "MCR[%X]\n", deviceCfg.regs.wMCR);
 		DEBUG_OUT( "DR[%X]\n", deviceCfg.regs.wDR);
@@ -199,9 +252,10 @@ static int mvbc_get_device_configuration(struct sMvbcDevCfg *mvbc)
  * Configure MVBC ports
  *
  * @param mvbc sMvbcDevCfg
+ * @param state gets the port descriptors for later recoveries
  * @return 0 in case of success, -1 for error
  */
-static int mvbc_set_port_configuration(struct sMvbcDevCfg *mvbc)
+static int mvbc_set_port_configuration(struct sMvbcDevCfg *mvbc, struct sMvbcDevState *state)
 {
 	int rc = ERROR_SET_PORT_CONFIG;
 
@@ -211,45 +265,35 @@ static int mvbc_set_port_configuration(struct sMvbcDevCfg *mvbc)
 		for (int j = 0; j < mvbc->portSetup.mvbc_port_count; j++)
 		{
 			/* MVBC driver port config struct */
-			struct sMvbcPortConfig portCfg;
+			struct sMvbcPortConfig *portCfg = &state->portDesc[j];
 
-			memset(&portCfg, 0, sizeof(struct sMvbcPortConfig));
+			memset(portCfg, 0, sizeof(struct sMvbcPortConfig));
 
 			int direction = mvbc->portSetup.port[j].portCfg.iPortDirection;
 			int num_data = mvbc->portSetup.port[j].portCfg.iNumData;
 			int irq_num = mvbc->portSetup.port[j].portCfg.iIrqNumber;
 
-			portCfg.bStaticConf = 1;
-
-			portCfg.wPortAddr = mvbc->portSetup.port[j].portCfg.iPortAddr;
-			portCfg.wFuncCode = mvbc->portSetup.port[j].portCfg.iFunctionCode;
-			portCfg.wPortType = mvbc->portSetup.port[j].portCfg.iPortType;
+			portCfg->bStaticConf = 1;
 
-			/* start with zero */
-			portCfg.wPCS_W0 = 0;
+			portCfg->wPortAddr = mvbc->portSetup.port[j].portCfg.iPortAddr;
+			portCfg->wFuncCode = mvbc->portSetup.port[j].portCfg.iFunctionCode;
+			portCfg->wPortType = mvbc->portSetup.port[j].portCfg.iPortType;
 
-			/* F-Code */
-			portCfg.wPCS_W0 |= (portCfg.wFuncCode << 12);
-			/* Source/Sink */
-			portCfg.wPCS_W0 |= (1 << (10 + direction));
-			/* Num. Data */
-			portCfg.wPCS_W0 |= (num_data << 1);
+			/* F-Code, Source/Sink, Interrupt, Num. Data; a precomputed word of a linked in configuration was checked to be the same */
+			portCfg->wPCS_W0 = MVBC_PCS_W0(portCfg->wFuncCode, direction, irq_num, num_data);
 
 			/* either interrupt or pollInterval should be used */
 			if (irq_num == 0)
 			{
-				portCfg.wPollInterval = mvbc->portSetup.port[j].portCfg.iPollIntervalMS;
-			}
-			else
-			{
-				/* Interrupt */
-				portCfg.wPCS_W0 |= (irq_num << 5);
+				portCfg->wPollInterval = mvbc->portSetup.port[j].portCfg.iPollIntervalMS;
 			}
 
-			DEBUG_OUT( "wPCS_W0[%X]\n", portCfg.wPCS_W0);
-
-			rc |= send_cmd(mvbc->cDevPath, EL_MVBC_SET_PORT_CONFIGURATION,&portCfg);
+			DEBUG_OUT( "wPCS_W0[%X]\n", portCfg->wPCS_W0);
+			MVBC_TRACE5(port__config, mvbc->cDevPath, portCfg->wPortAddr, portCfg->wFuncCode, direction, portCfg->wPollInterval);
 		}
+		state->iPortDescCount = mvbc->portSetup.mvbc_port_count;
+
+		rc |= mvbc_send_port_descriptors(mvbc->cDevPath, state->portDesc, state->iPortDescCount);
 	}
 
 	DEBUG_OUT( "RC[%X]\n", rc);
@@ -257,6 +301,27 @@ static int mvbc_set_port_configuration(struct sMvbcDevCfg *mvbc)
 	return rc;
 }
 
+/**
+ * Send prepared port descriptors to the driver.
+ *
+ * @param dev
+ * @param desc
+ * @param count
+ * @return 0 in case of success, -1 for error
+ */
+static int mvbc_send_port_descriptors(const char *dev, const struct sMvbcPortConfig *desc, int count)
+{
+	int rc = NO_ERROR;
+
+	for (int j = 0; j < count; j++)
+	{
+		struct sMvbcPortConfig portCfg = desc[j];
+
+		rc |= mvbc_send_cmd(dev, EL_MVBC_SET_PORT_CONFIGURATION,&portCfg);
+	}
+	return rc;
+}
+
 /**
  * Run MVBC devices
  *
@@ -269,7 +334,7 @@ static int mvbc_run_device(struct sMvbcDevCfg *mvbc)
 
 	if (mvbc != NULL)
 	{
-		rc |= send_cmd(mvbc->cDevPath, EL_MVBC_RUN_DEVICE,NULL);
+		rc |= mvbc_send_cmd(mvbc->cDevPath, EL_MVBC_RUN_DEVICE,NULL);
 	}
 
 	DEBUG_OUT( "RC[%X]\n", rc);
@@ -314,39 +379,394 @@ int mvbc_get_pld_firmware_version(int *version)
     return 0;
 }
 
+/**
+ * Initialise the locks of a context.
+ *
+ * @param ctx
+ */
+static void ctx_setup(struct mvbc_ctx *ctx)
+{
+	pthread_mutex_init(&ctx->ctxLock, NULL);
+
+	/* epoch 0 marks readers outside of a read section */
+	ctx->ullCfgEpoch = 1;
+
+	for (int i = 0; i < MAX_MVBC_DEVICES; i++)
+	{
+		pthread_mutex_init(&ctx->devLock[i], NULL);
+		ctx->dev[i].iFd = -1;
+		ctx->dev[i].uio.iFd = -1;
+	}
+
+	mvbc_cfg_setup(ctx);
+}
+
+static void default_ctx_setup(void)
+{
+	ctx_setup(&gDefaultCtx);
+}
+
+mvbc_ctx *mvbc_default_ctx(void)
+{
+	pthread_once(&gDefaultCtxOnce, default_ctx_setup);
+	return &gDefaultCtx;
+}
+
+mvbc_ctx *mvbc_ctx_create(void)
+{
+	struct mvbc_ctx *ctx = calloc(1, sizeof(struct mvbc_ctx));
+
+	if (ctx == NULL)
+	{
+		DEBUG_OUT( "ERROR no memory for context\n");
+		return NULL;
+	}
+
+	ctx_setup(ctx);
+
+	return ctx;
+}
+
+void mvbc_ctx_destroy(mvbc_ctx *ctx)
+{
+	if ((ctx == NULL) || (ctx == &gDefaultCtx))
+	{
+		return;
+	}
+
+	mvbc_ctx_srv_stop(ctx);
+
+	mvbc_ctx_metrics_stop(ctx);
+
+	mvbc_ctx_watchdog_stop(ctx);
+
+	mvbc_memtest_stop(ctx);
+
+	for (int i = 0; i < MAX_MVBC_DEVICES; i++)
+	{
+		mvbc_reader_close(ctx, i);
+		mvbc_uio_unmap(&ctx->dev[i].uio);
+		mvbc_port_image_free(ctx, i);
+		mvbc_port_seq_free(ctx, i);
+		pthread_mutex_destroy(&ctx->devLock[i]);
+	}
+	mvbc_cfg_free_all(ctx);
+	mvbc_metric_free(ctx);
+	mvbc_pool_free_all(ctx);
+	pthread_mutex_destroy(&ctx->ctxLock);
+
+	free(ctx);
+}
+
+/**
+ * Find a configured device by its path in the published configuration.
+ *
+ * @param ctx
+ * @param dev (e.g. /dev/mvbc1)
+ * @return index into ctx->dev[], -1 if not configured
+ */
+int mvbc_find_device(struct mvbc_ctx *ctx, const char *dev)
+{
+	int idx = -1;
+
+	if ((ctx != NULL) && (dev != NULL))
+	{
+		const struct sMvbcCfgSnapshot *cfg = mvbc_ctx_cfg_enter(ctx);
+
+		for (int i = 0; (cfg != NULL) && (i < cfg->project.mvbc_device_count) && (idx < 0); i++)
+		{
+			if (strncmp(cfg->project.mvbc[i].cDevPath, dev, MAX_STRING_LENGTH) == 0)
+			{
+				idx = i;
+			}
+		}
+		mvbc_ctx_cfg_leave(ctx);
+	}
+	return idx;
+}
+
+int mvbc_ctx_parse(mvbc_ctx *ctx, const char *config_file)
+{
+	struct sProject *project;
+	int rc;
+
+	if (ctx == NULL)
+	{
+		return ERROR_CONFIG_INVALID_PARAMETER;
+	}
+
+	project = parse_project(config_file, &rc);
+	if (project == NULL)
+	{
+		return rc;
+	}
+
+	if (rc == NO_ERROR)
+	{
+		pthread_mutex_lock(&ctx->ctxLock);
+		memcpy(&ctx->project, project, sizeof(struct sProject));
+		mvbc_cfg_publish(ctx);
+		pthread_mutex_unlock(&ctx->ctxLock);
+	}
+
+	free(project);
+	return rc;
+}
+
+int mvbc_ctx_shutdown(mvbc_ctx *ctx, const char *devPath)
+{
+	int idx = mvbc_find_device(ctx, devPath);
+	int rc;
+
+	if (idx < 0)
+	{
+		/* devices not (yet) configured in this context can be shut down as well */
+		return mvbc_send_cmd(devPath,EL_MVBC_SHUTDOWN_DEVICE,NULL);
+	}
+
+	pthread_mutex_lock(&ctx->devLock[idx]);
+	rc = mvbc_send_cmd(devPath,EL_MVBC_SHUTDOWN_DEVICE,NULL);
+	ctx->dev[idx].health.iStopped = 1;
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return rc;
+}
+
 int mvbc_shutdown(const char *devPath)
 {
-	return send_cmd(devPath,EL_MVBC_SHUTDOWN_DEVICE,NULL);
+	return mvbc_ctx_shutdown(mvbc_default_ctx(), devPath);
 }
 
-int mvbc_init(const char *config_file)
+/**
+ * Clear the runtime state of ctx->dev[idx] for a new configuration.
+ * Called with ctx->ctxLock and ctx->devLock[idx] held.
+ *
+ * @param ctx
+ * @param idx
+ * @param mvbc configuration of the device, NULL if the index is not configured any more
+ */
+static void mvbc_device_reset(struct mvbc_ctx *ctx, int idx, const struct sMvbcDevCfg *mvbc)
+{
+	struct sMvbcDevState *state = &ctx->dev[idx];
+	uint32_t generation;
+
+	mvbc_reader_close(ctx, idx);
+	mvbc_uio_unmap(&state->uio);
+	mvbc_port_image_free(ctx, idx);
+
+	/* pollers compare the generation, it must not start over */
+	generation = state->uiFdGeneration;
+	memset(state, 0, sizeof(struct sMvbcDevState));
+	state->uiFdGeneration = generation + 1;
+	state->iFd = -1;
+	state->uio.iFd = -1;
+
+	if (mvbc != NULL)
+	{
+		strncpy(state->cDevPath, mvbc->cDevPath, MAX_STRING_LENGTH - 1);
+		state->line.stats.iConfiguredLine = mvbc->iLine;
+		state->line.stats.iActiveLine = -1;
+		state->health.stats.llSilentMS = -1;
+		clock_gettime(CLOCK_MONOTONIC, &state->health.sLastRecord);
+	}
+}
+
+/**
+ * Bring up ctx->dev[idx]. Called with ctx->ctxLock and ctx->devLock[idx] held.
+ *
+ * @param ctx
+ * @param idx
+ * @param phaseNS gets the time of the init phases added
+ * @param mark time of the last phase end
+ * @return 0 in case of success, errorMask for error
+ */
+static int mvbc_device_start(struct mvbc_ctx *ctx, int idx, uint64_t *phaseNS, struct timespec *mark)
+{
+	struct sMvbcDevCfg *mvbc = &ctx->project.mvbc[idx];
+	int test;
+	int reset;
+	int rc;
+
+	mvbc_metric_lap_ns(mark);
+	rc = mvbc_send_cmd(mvbc->cDevPath,EL_MVBC_SHUTDOWN_DEVICE,NULL);
+	phaseNS[eMetricInitShutdown] += mvbc_metric_lap_ns(mark);
+	if (rc < 0)
+		return rc;
+
+	test = mvbc_memtest_prepare(ctx, idx);
+	reset = mvbc_reset_device(mvbc, test);
+	if (test)
+	{
+		mvbc_memtest_init_result(ctx, idx, reset == 0);
+	}
+	phaseNS[eMetricInitReset] += mvbc_metric_lap_ns(mark);
+	rc |= reset;
+	if (rc < 0)
+		return rc;
+
+	rc |= mvbc_set_device_configuration(mvbc);
+	phaseNS[eMetricInitDevice] += mvbc_metric_lap_ns(mark);
+	if (rc < 0)
+		return rc;
+
+	rc |= mvbc_set_port_configuration(mvbc, &ctx->dev[idx]);
+	phaseNS[eMetricInitPorts] += mvbc_metric_lap_ns(mark);
+	if (rc < 0)
+		return rc;
+
+	rc |= mvbc_run_device(mvbc);
+	phaseNS[eMetricInitRun] += mvbc_metric_lap_ns(mark);
+
+	mvbc_uio_attach(ctx, idx);
+
+	return rc;
+}
+
+/**
+ * Take over a configuration, publish it and bring up its devices. Called with ctx->ctxLock held.
+ * A configuration that failed to parse is published as well, its devices are the ones brought up.
+ *
+ * @param ctx
+ * @param project parsed configuration, copied
+ * @param rc result of parsing project
+ * @return 0 in case of success, errorMask for error
+ */
+int mvbc_ctx_start_locked(struct mvbc_ctx *ctx, const struct sProject *project, int rc)
+{
+	uint64_t phaseNS[eMetricInitCount] = { 0 };
+	struct timespec start;
+	struct timespec mark;
+	int failed = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	mark = start;
+
+	memcpy(&ctx->project, project, sizeof(struct sProject));
+	mvbc_line_apply_overrides(ctx);
+
+	mvbc_cfg_publish(ctx);
+	if (rc == NO_ERROR)
+	{
+		mvbc_pool_setup(ctx);
+	}
+
+	/* readers of a device wait on its lock until it is torn down and up again; after a failed device the others stay down */
+	for (int i = 0; i < MAX_MVBC_DEVICES; i++)
+	{
+		int configured = i < ctx->project.mvbc_device_count;
+
+		pthread_mutex_lock(&ctx->devLock[i]);
+
+		mvbc_device_reset(ctx, i, configured ? &ctx->project.mvbc[i] : NULL);
+		if (configured && !failed)
+		{
+			rc = mvbc_device_start(ctx, i, phaseNS, &mark);
+			failed = rc < 0;
+		}
+
+		pthread_mutex_unlock(&ctx->devLock[i]);
+	}
+
+	/* devices are up, a background memory test may begin */
+	mvbc_memtest_start(ctx);
+
+	mvbc_metric_describe(ctx);
+
+	phaseNS[eMetricInitStart] = mvbc_metric_lap_ns(&start);
+	for (int i = eMetricInitShutdown; i < eMetricInitCount; i++)
+	{
+		mvbc_metric_init_phase(i, phaseNS[i]);
+	}
+
+	return rc;
+}
+
+/**
+ * Bring up one device again from the configuration of the last init, e.g. after it hung.
+ * Skips the memory test and sends the cached port descriptors.
+ * Called with ctx->ctxLock and ctx->devLock[idx] held.
+ *
+ * @param ctx
+ * @param idx
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_device_restart(struct mvbc_ctx *ctx, int idx)
 {
-	int rc = 0;
+	struct sMvbcDevCfg *mvbc = &ctx->project.mvbc[idx];
+	struct sMvbcDevState *state = &ctx->dev[idx];
+	int rc;
 
-	rc |= mvbc_parse_project_configuration(config_file,&gProject);
+	/* records of the old run are gone, the reader opens the FIFO again */
+	mvbc_reader_close(ctx, idx);
 
-	/* if config valid -> init mvbc devices in the loop */
-	for (int i = 0; i < gProject.mvbc_device_count; i++)
+	/* a hung controller may refuse the shutdown, the reset below still brings it back */
+	if (mvbc_send_cmd(mvbc->cDevPath,EL_MVBC_SHUTDOWN_DEVICE,NULL) != 0)
 	{
-		rc = mvbc_shutdown(gProject.mvbc[i].cDevPath);
-		if (rc < 0)
-			return rc;
+		DEBUG_OUT( "WARNING shutdown of [%s] failed, resetting anyway\n", mvbc->cDevPath);
+	}
 
-		rc |= mvbc_reset_device(&gProject.mvbc[i]);
-		if (rc < 0)
-			return rc;
+	rc = mvbc_reset_device(mvbc, 0);
+	if (rc == 0)
+	{
+		rc = mvbc_set_device_configuration(mvbc) & ~ERROR_SET_DEVICE_CONFIG;
+	}
+	if (rc == 0)
+	{
+		if (state->iPortDescCount != mvbc->portSetup.mvbc_port_count)
+		{
+			/* descriptors were never built, e.g. the first init failed before */
+			rc = mvbc_set_port_configuration(mvbc, state) & ~ERROR_SET_PORT_CONFIG;
+		}
+		else
+		{
+			rc = mvbc_send_port_descriptors(mvbc->cDevPath, state->portDesc, state->iPortDescCount);
+		}
+	}
+	if (rc == 0)
+	{
+		rc = mvbc_run_device(mvbc) & ~ERROR_RUN_MVBC;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &state->health.sLastRecord);
+	state->health.iHadRecord = 0;
+	memset(state->health.ullFresh, 0, sizeof(state->health.ullFresh));
+	memset(state->health.llFreshMS, 0, sizeof(state->health.llFreshMS));
 
-		rc |= mvbc_set_device_configuration(&gProject.mvbc[i]);
-		if (rc < 0)
-			return rc;
+	return (rc == 0) ? 0 : -1;
+}
+
+int mvbc_ctx_init(mvbc_ctx *ctx, const char *config_file)
+{
+	struct sProject *project;
+	int rc;
 
-		rc |= mvbc_set_port_configuration(&gProject.mvbc[i]);
-		if (rc < 0)
-			return rc;
+	if (ctx == NULL)
+	{
+		return ERROR_PARSE_CONFIGURATION;
+	}
 
-		rc |= mvbc_run_device(&gProject.mvbc[i]);
+	/* parse before taking the lock, readers and the watchdog go on meanwhile */
+	project = parse_project(config_file, &rc);
+	if (project == NULL)
+	{
+		return rc;
 	}
 
+	pthread_mutex_lock(&ctx->ctxLock);
+
+	mvbc_memtest_stop(ctx);
+
+	rc = mvbc_ctx_start_locked(ctx, project, rc);
+
+	pthread_mutex_unlock(&ctx->ctxLock);
+
+	free(project);
+
 	DEBUG_OUT( "RC[%X]\n", rc);
 	return rc;
 }
+
+int mvbc_init(const char *config_file)
+{
+	return mvbc_ctx_init(mvbc_default_ctx(), config_file);
+}
@@ -0,0 +1,524 @@
+/**
+ * @file
+ *
+ * Publishing the parsed configuration as immutable snapshots with epoch based reclamation.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "mvbc_cfg.h"
+#include "mvbc_internal.h"
+
+/** contexts of the first reader slot table of a thread, it grows when the thread reads more */
+#define CFG_THREAD_SLOTS 4
+
+/**
+ * reader slot of the calling thread in one context.
+ */
+struct sCfgThreadSlot
+{
+	struct mvbc_ctx *ctx;
+	/** ctx->ullCfgId, a context created at the address of a destroyed one does not match */
+	uint64_t ullCtxId;
+	/** in ctx->cfgReader[] or a block of ctx->pCfgReaderMore */
+	struct sMvbcCfgReader *pReader;
+	int iNesting;
+};
+
+/**
+ * reader slots of a thread, one per context it reads.
+ */
+struct sCfgThreadSlots
+{
+	int iCount;
+	struct sCfgThreadSlot slot[];
+};
+
+static __thread struct sCfgThreadSlots *tCfgSlots;
+
+/** contexts not destroyed yet, a thread exit only releases slots of these */
+static pthread_mutex_t gCfgLiveLock = PTHREAD_MUTEX_INITIALIZER;
+static struct mvbc_ctx *gCfgLive;
+static uint64_t gCfgNextId;
+
+/** releases the reader slots of exiting threads */
+static pthread_key_t gCfgKey;
+static pthread_once_t gCfgKeyOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Release the reader slots of a thread. Called with gCfgLiveLock held.
+ *
+ * @param slots reader slots of the thread, may be NULL
+ * @param ctx only slots of this context, NULL for all
+ */
+static void cfg_release_locked(struct sCfgThreadSlots *slots, struct mvbc_ctx *ctx)
+{
+	for (int i = 0; (slots != NULL) && (i < slots->iCount); i++)
+	{
+		struct sCfgThreadSlot *slot = &slots->slot[i];
+		struct mvbc_ctx *live = gCfgLive;
+
+		if ((slot->ctx == NULL) || ((ctx != NULL) && (slot->ctx != ctx)))
+		{
+			continue;
+		}
+
+		while ((live != NULL) && ((live != slot->ctx) || (live->ullCfgId != slot->ullCtxId)))
+		{
+			live = live->pCfgNextLive;
+		}
+		if (live != NULL)
+		{
+			__atomic_store_n(&slot->pReader->ullEpoch, 0, __ATOMIC_RELEASE);
+			__atomic_store_n(&slot->pReader->uiUsed, 0, __ATOMIC_RELEASE);
+		}
+		memset(slot, 0, sizeof(struct sCfgThreadSlot));
+	}
+}
+
+/**
+ * Thread exit: give the reader slots of the thread back.
+ *
+ * @param arg reader slots of the thread
+ */
+static void cfg_thread_destructor(void *arg)
+{
+	pthread_mutex_lock(&gCfgLiveLock);
+	cfg_release_locked(arg, NULL);
+	pthread_mutex_unlock(&gCfgLiveLock);
+	free(arg);
+}
+
+static void cfg_key_setup(void)
+{
+	pthread_key_create(&gCfgKey, cfg_thread_destructor);
+}
+
+/**
+ * Register a new context, its reader slots are released by exiting threads from now on.
+ *
+ * @param ctx
+ */
+void mvbc_cfg_setup(struct mvbc_ctx *ctx)
+{
+	pthread_once(&gCfgKeyOnce, cfg_key_setup);
+
+	pthread_mutex_lock(&gCfgLiveLock);
+	ctx->ullCfgId = ++gCfgNextId;
+	ctx->pCfgNextLive = gCfgLive;
+	gCfgLive = ctx;
+	pthread_mutex_unlock(&gCfgLiveLock);
+}
+
+/**
+ * Claim a free reader slot of a context. A new block of slots is added when all are in use.
+ *
+ * @param ctx
+ * @return slot or NULL if there is no memory for a new block
+ */
+static struct sMvbcCfgReader *cfg_claim_reader(struct mvbc_ctx *ctx)
+{
+	struct sMvbcCfgReaderBlock *block = __atomic_load_n(&ctx->pCfgReaderMore, __ATOMIC_ACQUIRE);
+	struct sMvbcCfgReader *reader = ctx->cfgReader;
+
+	for (;;)
+	{
+		for (int i = 0; i < MVBC_CFG_READER_BLOCK; i++)
+		{
+			uint32_t unused = 0;
+
+			if (__atomic_compare_exchange_n(&reader[i].uiUsed, &unused, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			{
+				return &reader[i];
+			}
+		}
+		if (block == NULL)
+		{
+			break;
+		}
+		reader = block->reader;
+		block = block->pNext;
+	}
+
+	if (posix_memalign((void **)&block, 64, sizeof(struct sMvbcCfgReaderBlock)) != 0)
+	{
+		DEBUG_OUT( "ERROR no memory for configuration reader slots\n");
+		return NULL;
+	}
+	memset(block, 0, sizeof(struct sMvbcCfgReaderBlock));
+	block->reader[0].uiUsed = 1;
+
+	/* cfg_reclaim_locked() walks the blocks without a lock */
+	block->pNext = __atomic_load_n(&ctx->pCfgReaderMore, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&ctx->pCfgReaderMore, &block->pNext, block, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	{
+	}
+	DEBUG_OUT( "more configuration reader slots\n");
+
+	return &block->reader[0];
+}
+
+/**
+ * Get a free entry of the slot table of the calling thread, grow the table if it is full.
+ *
+ * @param ctx
+ * @return entry or NULL if there is no memory
+ */
+static struct sCfgThreadSlot *cfg_thread_entry(struct mvbc_ctx *ctx)
+{
+	struct sCfgThreadSlots *slots = tCfgSlots;
+	int count = (slots != NULL) ? slots->iCount : 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		/* a slot of a destroyed context at the same address is free again */
+		if ((slots->slot[i].ctx == NULL) || (slots->slot[i].ctx == ctx))
+		{
+			return &slots->slot[i];
+		}
+	}
+
+	slots = realloc(slots, sizeof(struct sCfgThreadSlots) + (count + CFG_THREAD_SLOTS) * sizeof(struct sCfgThreadSlot));
+	if (slots == NULL)
+	{
+		DEBUG_OUT( "ERROR no memory for the reader slots of a thread\n");
+		return NULL;
+	}
+	memset(&slots->slot[count], 0, CFG_THREAD_SLOTS * sizeof(struct sCfgThreadSlot));
+	slots->iCount = count + CFG_THREAD_SLOTS;
+
+	tCfgSlots = slots;
+	pthread_setspecific(gCfgKey, slots);
+
+	return &slots->slot[count];
+}
+
+/**
+ * Get the reader slot of the calling thread, claim one on first use.
+ *
+ * @param ctx
+ * @return slot or NULL if there is no memory for a slot
+ */
+static struct sCfgThreadSlot *cfg_thread_slot(struct mvbc_ctx *ctx)
+{
+	struct sCfgThreadSlots *slots = tCfgSlots;
+	struct sCfgThreadSlot *slot;
+
+	for (int i = 0; (slots != NULL) && (i < slots->iCount); i++)
+	{
+		if ((slots->slot[i].ctx == ctx) && (slots->slot[i].ullCtxId == ctx->ullCfgId))
+		{
+			return &slots->slot[i];
+		}
+	}
+
+	slot = cfg_thread_entry(ctx);
+	if (slot == NULL)
+	{
+		return NULL;
+	}
+
+	slot->pReader = cfg_claim_reader(ctx);
+	if (slot->pReader == NULL)
+	{
+		return NULL;
+	}
+	slot->ctx = ctx;
+	slot->ullCtxId = ctx->ullCfgId;
+	slot->iNesting = 0;
+
+	return slot;
+}
+
+/**
+ * Free retired snapshots no reader can still see. Called with ctx->ctxLock held.
+ *
+ * @param ctx
+ * @return number of snapshots still waiting
+ */
+static int cfg_reclaim_locked(struct mvbc_ctx *ctx)
+{
+	struct sMvbcCfgSnapshot **link = &ctx->pCfgRetired;
+	uint64_t oldest = UINT64_MAX;
+	int waiting = 0;
+
+	struct sMvbcCfgReaderBlock *block = __atomic_load_n(&ctx->pCfgReaderMore, __ATOMIC_ACQUIRE);
+	struct sMvbcCfgReader *reader = ctx->cfgReader;
+
+	for (;;)
+	{
+		for (int i = 0; i < MVBC_CFG_READER_BLOCK; i++)
+		{
+			uint64_t epoch = __atomic_load_n(&reader[i].ullEpoch, __ATOMIC_ACQUIRE);
+
+			if ((epoch != 0) && (epoch < oldest))
+			{
+				oldest = epoch;
+			}
+		}
+		if (block == NULL)
+		{
+			break;
+		}
+		reader = block->reader;
+		block = block->pNext;
+	}
+
+	while (*link != NULL)
+	{
+		struct sMvbcCfgSnapshot *snap = *link;
+
+		/* readers that started in the retire epoch or later already see the successor */
+		if ((oldest >= snap->ullRetireEpoch) && (__atomic_load_n(&snap->uiRefCount, __ATOMIC_ACQUIRE) == 0))
+		{
+			*link = snap->pNextRetired;
+			free(snap);
+		}
+		else
+		{
+			link = &snap->pNextRetired;
+			waiting++;
+		}
+	}
+
+	return waiting;
+}
+
+/**
+ * Publish ctx->project as new snapshot. Called with ctx->ctxLock held.
+ *
+ * @param ctx
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_cfg_publish(struct mvbc_ctx *ctx)
+{
+	struct sMvbcCfgSnapshot *snap = malloc(sizeof(struct sMvbcCfgSnapshot));
+	struct sMvbcCfgSnapshot *old;
+	uint64_t epoch;
+
+	if (snap == NULL)
+	{
+		DEBUG_OUT( "ERROR no memory for configuration snapshot\n");
+		return -1;
+	}
+
+	memset(snap, 0, offsetof(struct sMvbcCfgSnapshot, iPortIndex));
+	memset(snap->iPortIndex, 0xFF, sizeof(snap->iPortIndex));
+	memcpy(&snap->project, &ctx->project, sizeof(struct sProject));
+
+	for (int d = 0; d < snap->project.mvbc_device_count; d++)
+	{
+		const struct sMvbcPorts *ports = &snap->project.mvbc[d].portSetup;
+
+		for (int p = 0; p < ports->mvbc_port_count; p++)
+		{
+			int addr = ports->port[p].portCfg.iPortAddr;
+
+			if ((addr >= 0) && (addr <= MAX_PORT_COUNT))
+			{
+				snap->iPortIndex[d][addr] = p;
+			}
+		}
+	}
+
+	snap->ullVersion = ++ctx->ullCfgVersion;
+
+	old = __atomic_exchange_n(&ctx->pCfg, snap, __ATOMIC_SEQ_CST);
+	epoch = __atomic_add_fetch(&ctx->ullCfgEpoch, 1, __ATOMIC_SEQ_CST);
+
+	if (old != NULL)
+	{
+		old->ullRetireEpoch = epoch;
+		old->pNextRetired = ctx->pCfgRetired;
+		ctx->pCfgRetired = old;
+	}
+
+	cfg_reclaim_locked(ctx);
+
+	return 0;
+}
+
+/**
+ * Free the current and all retired snapshots of a context that is destroyed.
+ *
+ * @param ctx
+ */
+void mvbc_cfg_free_all(struct mvbc_ctx *ctx)
+{
+	struct mvbc_ctx **link = &gCfgLive;
+
+	pthread_mutex_lock(&gCfgLiveLock);
+	while ((*link != NULL) && (*link != ctx))
+	{
+		link = &(*link)->pCfgNextLive;
+	}
+	if (*link != NULL)
+	{
+		*link = ctx->pCfgNextLive;
+	}
+	pthread_mutex_unlock(&gCfgLiveLock);
+
+	while (ctx->pCfgRetired != NULL)
+	{
+		struct sMvbcCfgSnapshot *snap = ctx->pCfgRetired;
+
+		ctx->pCfgRetired = snap->pNextRetired;
+		free(snap);
+	}
+	free(ctx->pCfg);
+	ctx->pCfg = NULL;
+
+	while (ctx->pCfgReaderMore != NULL)
+	{
+		struct sMvbcCfgReaderBlock *block = ctx->pCfgReaderMore;
+
+		ctx->pCfgReaderMore = block->pNext;
+		free(block);
+	}
+}
+
+const struct sMvbcCfgSnapshot *mvbc_ctx_cfg_enter(mvbc_ctx *ctx)
+{
+	struct sCfgThreadSlot *slot;
+
+	if (ctx == NULL)
+	{
+		return NULL;
+	}
+
+	slot = cfg_thread_slot(ctx);
+	if (slot == NULL)
+	{
+		return NULL;
+	}
+
+	if (slot->iNesting++ == 0)
+	{
+		uint64_t epoch = __atomic_load_n(&ctx->ullCfgEpoch, __ATOMIC_ACQUIRE);
+
+		/* announce the epoch before the pointer is loaded */
+		__atomic_store_n(&slot->pReader->ullEpoch, epoch, __ATOMIC_SEQ_CST);
+	}
+
+	return __atomic_load_n(&ctx->pCfg, __ATOMIC_SEQ_CST);
+}
+
+void mvbc_ctx_cfg_leave(mvbc_ctx *ctx)
+{
+	struct sCfgThreadSlot *slot;
+
+	if (ctx == NULL)
+	{
+		return;
+	}
+
+	slot = cfg_thread_slot(ctx);
+	if ((slot == NULL) || (slot->iNesting == 0))
+	{
+		return;
+	}
+
+	if (--slot->iNesting == 0)
+	{
+		__atomic_store_n(&slot->pReader->ullEpoch, 0, __ATOMIC_RELEASE);
+	}
+}
+
+void mvbc_ctx_cfg_thread_exit(mvbc_ctx *ctx)
+{
+	if (ctx == NULL)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&gCfgLiveLock);
+	cfg_release_locked(tCfgSlots, ctx);
+	pthread_mutex_unlock(&gCfgLiveLock);
+}
+
+/**
+ * Copy the path of a device from the published configuration, e.g. for a trace.
+ *
+ * @param ctx
+ * @param idx
+ * @param path MAX_STRING_LENGTH bytes, empty if the device is not configured
+ * @return 0 in case of success, -1 if the device is not configured
+ */
+int mvbc_cfg_dev_path(struct mvbc_ctx *ctx, int idx, char *path)
+{
+	const struct sMvbcCfgSnapshot *cfg = mvbc_ctx_cfg_enter(ctx);
+	int rc = -1;
+
+	path[0] = 0;
+	if ((cfg != NULL) && (idx >= 0) && (idx < cfg->project.mvbc_device_count))
+	{
+		strncpy(path, cfg->project.mvbc[idx].cDevPath, MAX_STRING_LENGTH - 1);
+		path[MAX_STRING_LENGTH - 1] = 0;
+		rc = 0;
+	}
+	mvbc_ctx_cfg_leave(ctx);
+
+	return rc;
+}
+
+const struct sMvbcCfgSnapshot *mvbc_cfg_get(const struct sMvbcCfgSnapshot *cfg)
+{
+	if (cfg != NULL)
+	{
+		__atomic_add_fetch(&((struct sMvbcCfgSnapshot *)cfg)->uiRefCount, 1, __ATOMIC_ACQ_REL);
+	}
+	return cfg;
+}
+
+void mvbc_cfg_put(const struct sMvbcCfgSnapshot *cfg)
+{
+	if (cfg != NULL)
+	{
+		__atomic_sub_fetch(&((struct sMvbcCfgSnapshot *)cfg)->uiRefCount, 1, __ATOMIC_ACQ_REL);
+	}
+}
+
+int mvbc_ctx_cfg_reclaim(mvbc_ctx *ctx)
+{
+	int waiting;
+
+	if (ctx == NULL)
+	{
+		return 0;
+	}
+
+	pthread_mutex_lock(&ctx->ctxLock);
+	waiting = cfg_reclaim_locked(ctx);
+	pthread_mutex_unlock(&ctx->ctxLock);
+
+	return waiting;
+}
+
+const struct sMvbcCfgSnapshot *mvbc_cfg_enter(void)
+{
+	return mvbc_ctx_cfg_enter(mvbc_default_ctx());
+}
+
+void mvbc_cfg_leave(void)
+{
+	mvbc_ctx_cfg_leave(mvbc_default_ctx());
+}
@@ -0,0 +1,177 @@
+/**
+ * @file
+ *
+ * Consistency rules of a project configuration, the same for JSON files and linked in tables.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "mvbc_internal.h"
+#include "mvbc_static.h"
+
+/**
+ * Port type the library reports for a F-Code, see read_port_uio().
+ *
+ * @param fcode
+ * @return enum ePortType, -1 for the reserved F-Codes 5..7 and values out of range
+ */
+int mvbc_fcode_type(int fcode)
+{
+	if ((fcode >= 0) && (fcode <= 4))
+	{
+		return eLA;
+	}
+	if (fcode == 15)
+	{
+		return eDA;
+	}
+	if ((fcode >= 8) && (fcode <= 14))
+	{
+		return ePP;
+	}
+	return -1;
+}
+
+/**
+ * Check one port.
+ *
+ * @param path device, for the debug output
+ * @param cfg
+ * @return 0 if valid, -1 for error
+ */
+static int check_port(const char *path, const struct sMvbcPortCfg *cfg)
+{
+	const char *error = NULL;
+	int poll = cfg->iPollIntervalMS;
+
+	if ((cfg->iPortAddr <= 0) || (cfg->iPortAddr > MAX_PORT_COUNT))
+	{
+		error = "address";
+	}
+	else if (mvbc_fcode_type(cfg->iFunctionCode) < 0)
+	{
+		error = "F-Code";
+	}
+	else if (cfg->iPortType != mvbc_fcode_type(cfg->iFunctionCode))
+	{
+		error = "type for the F-Code";
+	}
+	else if ((cfg->iPortDirection != eSink) && (cfg->iPortDirection != eSource))
+	{
+		error = "direction";
+	}
+	else if ((poll <= 0) || (poll > 1024) || (poll & (poll - 1)))
+	{
+		error = "poll interval";
+	}
+	else if ((cfg->iIrqNumber < 0) || (cfg->iIrqNumber > 7))
+	{
+		error = "interrupt";
+	}
+	else if ((cfg->iNumData != 0) && (cfg->iNumData != 1))
+	{
+		error = "num_data";
+	}
+	else if ((cfg->iPCS_W0 != 0) &&
+			 (cfg->iPCS_W0 != MVBC_PCS_W0(cfg->iFunctionCode, cfg->iPortDirection, cfg->iIrqNumber, cfg->iNumData)))
+	{
+		error = "control word for the other fields";
+	}
+
+	if (error != NULL)
+	{
+		DEBUG_OUT( "ERROR [%s] port [%d] invalid %s\n", path, cfg->iPortAddr, error);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Check one device and its static ports: no port twice, bus load within
+ * MVBC_STATIC_MAX_BUS_LOAD_PERMILLE (same as mvbc::validate()).
+ *
+ * @param mvbc
+ * @return 0 if valid, -1 for error
+ */
+static int check_device(const struct sMvbcDevCfg *mvbc)
+{
+	const struct sMvbcPorts *ports = &mvbc->portSetup;
+	uint64_t seen[(MAX_PORT_COUNT + 64) / 64] = { 0 };
+	long bits = 0;
+
+	if ((mvbc->cDevPath[0] == 0) ||
+		(((int)mvbc->iInterface != eESD) && ((int)mvbc->iInterface != eEMD)) ||
+		(((int)mvbc->iMode != eStatic) && ((int)mvbc->iMode != eDynamic) && ((int)mvbc->iMode != eCombined)) ||
+		(((int)mvbc->iLine != eLineA) && ((int)mvbc->iLine != eLineB) && ((int)mvbc->iLine != eLineAB)) ||
+		(mvbc->iDeviceAddr <= 0) || (mvbc->iDeviceAddr > MAX_PORT_COUNT) ||
+		(ports->mvbc_port_count < 0) || (ports->mvbc_port_count > MAX_PORT_COUNT))
+	{
+		DEBUG_OUT( "ERROR invalid device [%s]\n", mvbc->cDevPath);
+		return -1;
+	}
+
+	for (int j = 0; j < ports->mvbc_port_count; j++)
+	{
+		const struct sMvbcPortCfg *cfg = &ports->port[j].portCfg;
+
+		if (check_port(mvbc->cDevPath, cfg) != 0)
+		{
+			return -1;
+		}
+		if (seen[cfg->iPortAddr / 64] & (1ULL << (cfg->iPortAddr % 64)))
+		{
+			DEBUG_OUT( "ERROR [%s] port [%d] configured twice\n", mvbc->cDevPath, cfg->iPortAddr);
+			return -1;
+		}
+		seen[cfg->iPortAddr / 64] |= 1ULL << (cfg->iPortAddr % 64);
+
+		bits += (long)MVBC_BUS_PORT_BITS(cfg->iFunctionCode) * (1024 / cfg->iPollIntervalMS);
+	}
+
+	if (bits * 1000 / (1024L * MVBC_BUS_BITS_PER_MS) > MVBC_STATIC_MAX_BUS_LOAD_PERMILLE)
+	{
+		DEBUG_OUT( "ERROR [%s] bus load %ld/1000 above %d/1000\n", mvbc->cDevPath,
+				   bits * 1000 / (1024L * MVBC_BUS_BITS_PER_MS), MVBC_STATIC_MAX_BUS_LOAD_PERMILLE);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Check a parsed or converted project before it is applied.
+ *
+ * @param project
+ * @return 0 if valid, -1 for error
+ */
+int mvbc_check_project(const struct sProject *project)
+{
+	if ((project->mvbc_device_count < 0) || (project->mvbc_device_count > MAX_MVBC_DEVICES))
+	{
+		DEBUG_OUT( "ERROR invalid device count [%d]\n", project->mvbc_device_count);
+		return -1;
+	}
+
+	for (int i = 0; i < project->mvbc_device_count; i++)
+	{
+		if (check_device(&project->mvbc[i]) != 0)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,21 @@
+/**
+ * @file
+ *
+ * Driver commands of the library. Not installed and not exported, the
+ * applications use the functions of mvbc_app_interface.h.
+ */
+
+#ifndef MVBC_CMD_INCLUDED
+#define MVBC_CMD_INCLUDED 1
+
+/**
+ * call driver IOCTL function, or the emulator for MVBC_EMU_PREFIX devices
+ *
+ * @param dev (e.g./dev/mvbc1)
+ * @param cmd (e.g. EL_MVBC_SET_DEVICE_CONFIGURATION)
+ * @param arg (e.g. (struct sMvbcDeviceConfig *)arg)
+ * @return 0 in case of success, -1 for error
+ */
+__attribute__((visibility("hidden"))) int mvbc_send_cmd(const char *dev, int cmd, void *arg);
+
+#endif
@@ -0,0 +1,146 @@
+/**
+ * @file
+ *
+ * Duplicate suppression for redundant MVBC devices.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "mvbc_dedup.h"
+
+/**
+ * FNV-1a hash over port address and payload.
+ *
+ * @param rec
+ * @return
+ */
+static uint32_t dedup_hash(const struct sPortData *rec)
+{
+	uint32_t hash = 2166136261u;
+	int words = rec->wNumOfWords;
+
+	if (words > MAX_PORT_DATA_LENGTH)
+	{
+		words = MAX_PORT_DATA_LENGTH;
+	}
+
+	hash = (hash ^ rec->wPortAddr) * 16777619u;
+	hash = (hash ^ words) * 16777619u;
+
+	for (int i = 0; i < words; i++)
+	{
+		hash = (hash ^ rec->wPortData[i]) * 16777619u;
+	}
+	return hash;
+}
+
+int mvbc_dedup_init(struct sMvbcDedup *d, int window_us)
+{
+	if ((d == NULL) || (window_us < 0))
+	{
+		return -1;
+	}
+
+	memset(d, 0, sizeof(struct sMvbcDedup));
+
+	d->llWindowUS = window_us ? window_us : MVBC_DEDUP_DEFAULT_WINDOW_US;
+
+	return 0;
+}
+
+int mvbc_dedup_check(struct sMvbcDedup *d, int dev, const struct sPortData *rec)
+{
+	struct sMvbcDedupBucket *bucket;
+	struct sMvbcDedupEntry *victim = NULL;
+	uint32_t hash;
+	int64_t now;
+
+	if ((d == NULL) || (rec == NULL) || (dev < 0) || (dev >= MAX_MVBC_DEVICES))
+	{
+		return -1;
+	}
+
+	d->stats.ullIn++;
+
+	hash = dedup_hash(rec);
+	now = (int64_t)rec->sTimeStamp.tv_sec * 1000000 + rec->sTimeStamp.tv_usec;
+	bucket = &d->bucket[hash & (MVBC_DEDUP_BUCKETS - 1)];
+
+	for (int i = 0; i < MVBC_DEDUP_WAYS; i++)
+	{
+		struct sMvbcDedupEntry *entry = &bucket->entry[i];
+
+		if (!entry->cValid)
+		{
+			if (victim == NULL)
+			{
+				victim = entry;
+			}
+			continue;
+		}
+
+		if ((entry->uiHash == hash) && (entry->wPortAddr == rec->wPortAddr))
+		{
+			int64_t lag = now - entry->llTimeUS;
+
+			if ((entry->cDev != dev) && (lag <= d->llWindowUS) && (lag >= -d->llWindowUS))
+			{
+				struct sMvbcDedupDevStats *slow = &d->stats.dev[dev];
+
+				/* time stamps of two devices may be slightly out of order */
+				if (lag < 0)
+				{
+					lag = 0;
+				}
+
+				slow->ullDuplicates++;
+				slow->ullLagSumUS += lag;
+				if (lag > slow->uiLagMaxUS)
+				{
+					slow->uiLagMaxUS = lag;
+				}
+				d->stats.ullSuppressed++;
+				return 0;
+			}
+
+			/* same value again from the same device or a later cycle -> reuse the entry */
+			victim = entry;
+			break;
+		}
+
+		if ((victim == NULL) || (victim->cValid && (entry->llTimeUS < victim->llTimeUS)))
+		{
+			victim = entry;
+		}
+	}
+
+	if (victim->cValid && (victim->uiHash != hash) && (now - victim->llTimeUS <= d->llWindowUS))
+	{
+		d->stats.ullEvictions++;
+	}
+
+	victim->llTimeUS = now;
+	victim->uiHash = hash;
+	victim->wPortAddr = rec->wPortAddr;
+	victim->cDev = dev;
+	victim->cValid = 1;
+
+	d->stats.dev[dev].ullFirst++;
+
+	return 1;
+}
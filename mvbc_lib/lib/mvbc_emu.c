@@ -0,0 +1,940 @@
+/**
+ * @file
+ *
+ * In-process MVBC02 emulator: register file, port index table, traffic memory and FIFO.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <limits.h>
+
+#include "mvbc_internal.h"
+#include "mvbc_emu.h"
+
+/** SCR: IL bits, initialisation level */
+#define EMU_SCR_IL_MASK 0x3
+
+/** IL: configuration mode */
+#define EMU_SCR_IL_CONFIG 1
+
+/** IL: full operation */
+#define EMU_SCR_IL_RUN 3
+
+/** MCR: MCM bits, memory configuration mode */
+#define EMU_MCR_MCM_MASK 0x7
+
+/** the library uses memory configuration mode 3 (4096 ports) */
+#define EMU_MCR_MCM_4K 3
+
+/** records written to the FIFO pipe at once */
+#define EMU_FIFO_CHUNK ((int)(PIPE_BUF / sizeof(struct sPortData)))
+
+/** poll interval classes 1, 2, 4 ... 1024 ms */
+#define EMU_POLL_CLASSES 11
+
+/**
+ * one port of the port index table with its two traffic memory pages.
+ */
+struct sEmuPort
+{
+	uint16_t wPortAddr;
+	uint16_t wFuncCode;
+	uint16_t wPortType;
+	uint16_t wPCS_W0;
+	uint16_t wPollInterval;
+	uint16_t wWords;
+
+	/** decoded from wPCS_W0 */
+	uint8_t cSource;
+	uint8_t cIrq;
+	uint8_t cNumData;
+
+	/** valid page, the other one is written */
+	uint8_t cVP;
+
+	/** page was flipped since the last record */
+	uint8_t cFresh;
+
+	/** next port of the same poll interval class, -1 = end */
+	int16_t iNextInClass;
+
+	uint16_t wPage[2][MAX_PORT_DATA_LENGTH];
+};
+
+/**
+ * one emulated board.
+ */
+struct sEmuDevice
+{
+	char cPath[MAX_STRING_LENGTH];
+	int iUsed;
+
+	pthread_mutex_t lock;
+
+	uint16_t wSCR;
+	uint16_t wMCR;
+	uint16_t wDR;
+	struct sMvbcDeviceConfig cfg;
+
+	/** port index table: port address -> index into pPort, -1 = not configured */
+	int16_t iPortIndex[MAX_PORT_COUNT + 1];
+
+	/** MAX_PORT_COUNT ports, allocated on first use */
+	struct sEmuPort *pPort;
+	int iPortCount;
+
+	/** first port of each poll interval class */
+	int16_t iClassHead[EMU_POLL_CLASSES];
+
+	/** FIFO: [0] read end handed to the readers, [1] write end */
+	int iFifo[2];
+
+	int iScale;
+	int iAutoTraffic;
+
+	/** frames come from mvbc_emu_bus_frame(), the emulated time does not produce records */
+	int iExternalBus;
+
+	/** line fault injected: [0] line A, [1] line B */
+	int iLineDown[2];
+
+	int iRunning;
+	pthread_t thread;
+
+	/** real time of RUN, base of the record time stamps */
+	struct timeval sRunTime;
+
+	struct sMvbcEmuStats stats;
+};
+
+static struct sEmuDevice gEmu[MVBC_EMU_MAX_DEVICES];
+static pthread_mutex_t gEmuLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Find an emulated device, create it on first use.
+ *
+ * @param dev path including MVBC_EMU_PREFIX
+ * @return device, NULL for error
+ */
+static struct sEmuDevice *emu_find(const char *dev)
+{
+	struct sEmuDevice *d = NULL;
+
+	if ((dev == NULL) || (strncmp(dev, MVBC_EMU_PREFIX, strlen(MVBC_EMU_PREFIX)) != 0))
+	{
+		return NULL;
+	}
+
+	pthread_mutex_lock(&gEmuLock);
+
+	for (int i = 0; i < MVBC_EMU_MAX_DEVICES; i++)
+	{
+		if (gEmu[i].iUsed && (strncmp(gEmu[i].cPath, dev, MAX_STRING_LENGTH) == 0))
+		{
+			d = &gEmu[i];
+			break;
+		}
+	}
+
+	for (int i = 0; (d == NULL) && (i < MVBC_EMU_MAX_DEVICES); i++)
+	{
+		if (!gEmu[i].iUsed)
+		{
+			struct sEmuDevice *n = &gEmu[i];
+
+			n->pPort = calloc(MAX_PORT_COUNT, sizeof(struct sEmuPort));
+			if (n->pPort == NULL)
+			{
+				break;
+			}
+			if (pipe2(n->iFifo, O_NONBLOCK | O_CLOEXEC) != 0)
+			{
+				free(n->pPort);
+				n->pPort = NULL;
+				break;
+			}
+			/* a larger pipe stands in for the FIFO, failure only limits its depth */
+			fcntl(n->iFifo[1], F_SETPIPE_SZ, MVBC_EMU_FIFO_BYTES);
+
+			strncpy(n->cPath, dev, MAX_STRING_LENGTH - 1);
+			pthread_mutex_init(&n->lock, NULL);
+			memset(n->iPortIndex, 0xFF, sizeof(n->iPortIndex));
+			memset(n->iClassHead, 0xFF, sizeof(n->iClassHead));
+			n->iScale = 1;
+			n->iAutoTraffic = 1;
+			n->iUsed = 1;
+			d = n;
+		}
+	}
+
+	pthread_mutex_unlock(&gEmuLock);
+
+	if (d == NULL)
+	{
+		DEBUG_OUT( "ERROR no emulated device left for [%s]\n", dev);
+	}
+	return d;
+}
+
+/**
+ * Set DR to the line(s) the decoder can trust: the configured ones without a fault. Called with d->lock held.
+ *
+ * @param d
+ */
+static void emu_update_dr(struct sEmuDevice *d)
+{
+	d->wDR = 0;
+
+	if ((d->cfg.uiLine != eLineB) && !d->iLineDown[eLineA])
+	{
+		d->wDR |= MVBC_DR_LAA;
+	}
+	if ((d->cfg.uiLine != eLineA) && !d->iLineDown[eLineB])
+	{
+		d->wDR |= MVBC_DR_LBA;
+	}
+}
+
+/**
+ * Write one record to the FIFO. Called with d->lock held.
+ *
+ * @param d
+ * @param rec
+ * @return 0 in case of success, -1 if the FIFO is full
+ */
+static int emu_fifo_push(struct sEmuDevice *d, const struct sPortData *rec)
+{
+	/* records are smaller than PIPE_BUF, so a write is never split */
+	if (write(d->iFifo[1], rec, sizeof(struct sPortData)) != sizeof(struct sPortData))
+	{
+		d->stats.ullOverflows++;
+		mvbc_metric_add(eMetricOverflowEmu, 1);
+		MVBC_TRACE3(queue__overflow, "emu", d->cPath, 1);
+		return -1;
+	}
+	d->stats.ullRecords++;
+	return 0;
+}
+
+/**
+ * Build the record of a sink port from its valid page. Called with d->lock held.
+ *
+ * @param d
+ * @param p
+ * @param vms emulated time in milliseconds
+ */
+static void emu_port_record(struct sEmuDevice *d, struct sEmuPort *p, uint64_t vms)
+{
+	struct sPortData rec;
+	uint64_t us = (uint64_t)d->sRunTime.tv_usec + vms * 1000;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.wPortAddr = p->wPortAddr;
+	rec.wPortType = p->wPortType;
+	rec.wNumOfWords = p->wWords;
+	/* sink time supervision: 0 = no new data since the last record */
+	rec.wTACK = p->cFresh;
+	rec.sTimeStamp.tv_sec = d->sRunTime.tv_sec + us / 1000000;
+	rec.sTimeStamp.tv_usec = us % 1000000;
+	memcpy(rec.wPortData, p->wPage[p->cVP], p->wWords * sizeof(uint16_t));
+
+	p->cFresh = 0;
+
+	emu_fifo_push(d, &rec);
+}
+
+/**
+ * Fill the invalid page and make it valid. Called with d->lock held.
+ *
+ * @param p
+ * @param data
+ * @param words
+ */
+static void emu_page_write(struct sEmuPort *p, const uint16_t *data, int words)
+{
+	int next = !p->cVP;
+
+	if (words > p->wWords)
+	{
+		words = p->wWords;
+	}
+	memcpy(p->wPage[next], data, words * sizeof(uint16_t));
+	p->cVP = next;
+	p->cFresh = 1;
+}
+
+/**
+ * Emulate one millisecond. Called with d->lock held.
+ *
+ * @param d
+ * @param vms emulated time in milliseconds
+ */
+static void emu_tick(struct sEmuDevice *d, uint64_t vms)
+{
+	if (d->iExternalBus)
+	{
+		return;
+	}
+
+	for (int c = 0; c < EMU_POLL_CLASSES; c++)
+	{
+		if (vms & ((1ULL << c) - 1))
+		{
+			/* classes of longer intervals are not due either */
+			break;
+		}
+
+		for (int i = d->iClassHead[c]; i >= 0; i = d->pPort[i].iNextInClass)
+		{
+			struct sEmuPort *p = &d->pPort[i];
+
+			if (d->iAutoTraffic)
+			{
+				uint16_t data[MAX_PORT_DATA_LENGTH];
+
+				/* counter in the first word, port address in the rest */
+				for (int w = 0; w < p->wWords; w++)
+				{
+					data[w] = (w == 0) ? (uint16_t)(p->wPage[p->cVP][0] + 1) : p->wPortAddr;
+				}
+				emu_page_write(p, data, p->wWords);
+			}
+			emu_port_record(d, p, vms);
+		}
+	}
+}
+
+static void *emu_thread(void *arg)
+{
+	struct sEmuDevice *d = arg;
+	struct timespec start;
+	struct timespec pause = { 0, 1000000 };
+	uint64_t base = 0;
+	int scale;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pthread_mutex_lock(&d->lock);
+	scale = d->iScale;
+
+	while (d->iRunning)
+	{
+		struct timespec now;
+		uint64_t target;
+		int ticks = 0;
+		int idle;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (d->iScale != scale)
+		{
+			/* a new speed applies from now on, the time already emulated stays */
+			start = now;
+			base = d->stats.ullVirtualMS;
+			scale = d->iScale;
+		}
+		target = base + ((uint64_t)(now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000) * scale / 1000;
+
+		while ((d->stats.ullVirtualMS < target) && (ticks++ < MVBC_EMU_TICKS_PER_ROUND))
+		{
+			emu_tick(d, d->stats.ullVirtualMS);
+			d->stats.ullVirtualMS++;
+		}
+
+		idle = (d->stats.ullVirtualMS >= target);
+
+		pthread_mutex_unlock(&d->lock);
+		if (idle)
+		{
+			nanosleep(&pause, NULL);
+		}
+		pthread_mutex_lock(&d->lock);
+	}
+
+	pthread_mutex_unlock(&d->lock);
+	return NULL;
+}
+
+/**
+ * Stop the emulated bus and forget all ports. Called with d->lock held, drops it while joining.
+ *
+ * @param d
+ */
+static void emu_stop(struct sEmuDevice *d)
+{
+	if (d->iRunning)
+	{
+		d->iRunning = 0;
+		pthread_mutex_unlock(&d->lock);
+		pthread_join(d->thread, NULL);
+		pthread_mutex_lock(&d->lock);
+	}
+
+	memset(d->iPortIndex, 0xFF, sizeof(d->iPortIndex));
+	memset(d->iClassHead, 0xFF, sizeof(d->iClassHead));
+	d->iPortCount = 0;
+	d->stats.uiPorts = 0;
+	d->wSCR &= ~EMU_SCR_IL_MASK;
+}
+
+/**
+ * EL_MVBC_RESET_DEVICE: program SCR/MCR, clear the traffic memory.
+ *
+ * @param d
+ * @param cfg
+ * @return 0 in case of success, -1 for error
+ */
+static int emu_reset(struct sEmuDevice *d, const struct sMvbcDeviceConfig *cfg)
+{
+	if ((cfg->regs.wSCR & EMU_SCR_IL_MASK) != EMU_SCR_IL_CONFIG)
+	{
+		DEBUG_OUT( "ERROR [%s] reset without configuration mode SCR[%X]\n", d->cPath, cfg->regs.wSCR);
+		return -1;
+	}
+	if ((cfg->regs.wMCR & EMU_MCR_MCM_MASK) != EMU_MCR_MCM_4K)
+	{
+		DEBUG_OUT( "ERROR [%s] memory configuration mode %d not emulated\n", d->cPath, cfg->regs.wMCR & EMU_MCR_MCM_MASK);
+		return -1;
+	}
+
+	emu_stop(d);
+
+	d->wSCR = cfg->regs.wSCR;
+	d->wMCR = cfg->regs.wMCR;
+	d->wDR = 0;
+	d->cfg = *cfg;
+
+	/* the memory test of the emulator always passes, the memory is cleared either way */
+	memset(d->pPort, 0, MAX_PORT_COUNT * sizeof(struct sEmuPort));
+
+	return 0;
+}
+
+/**
+ * EL_MVBC_SET_DEVICE_CONFIGURATION: line, device address and interface.
+ *
+ * @param d
+ * @param cfg
+ * @return 0 in case of success, -1 for error
+ */
+static int emu_set_device(struct sEmuDevice *d, const struct sMvbcDeviceConfig *cfg)
+{
+	if ((d->wSCR & EMU_SCR_IL_MASK) != EMU_SCR_IL_CONFIG)
+	{
+		return -1;
+	}
+
+	d->cfg.uiLine = cfg->uiLine;
+	d->cfg.uiDevAddr = cfg->uiDevAddr;
+	d->cfg.uiMode = cfg->uiMode;
+	d->cfg.uiSinkTimeInterval = cfg->uiSinkTimeInterval;
+	d->cfg.uiSinkTimeNumberOfDocks = cfg->uiSinkTimeNumberOfDocks;
+
+	emu_update_dr(d);
+
+	return 0;
+}
+
+/**
+ * Remove a port from the list of its poll interval class, e.g. before it is configured again.
+ *
+ * @param d
+ * @param idx index into pPort
+ */
+static void emu_class_unlink(struct sEmuDevice *d, int idx)
+{
+	for (int c = 0; c < EMU_POLL_CLASSES; c++)
+	{
+		int16_t *link = &d->iClassHead[c];
+
+		while (*link >= 0)
+		{
+			if (*link == idx)
+			{
+				*link = d->pPort[idx].iNextInClass;
+				return;
+			}
+			link = &d->pPort[*link].iNextInClass;
+		}
+	}
+}
+
+/**
+ * EL_MVBC_SET_PORT_CONFIGURATION: decode wPCS_W0 into the port index table.
+ *
+ * @param d
+ * @param cfg
+ * @return 0 in case of success, -1 for error
+ */
+static int emu_set_port(struct sEmuDevice *d, const struct sMvbcPortConfig *cfg)
+{
+	int sink = (cfg->wPCS_W0 >> 10) & 1;
+	int source = (cfg->wPCS_W0 >> 11) & 1;
+	int fcode = cfg->wPCS_W0 >> 12;
+	struct sEmuPort *p;
+	int idx;
+
+	if (((d->wSCR & EMU_SCR_IL_MASK) != EMU_SCR_IL_CONFIG) ||
+		(cfg->wPortAddr == 0) || (cfg->wPortAddr > MAX_PORT_COUNT) ||
+		(fcode != cfg->wFuncCode) || (sink == source) || ((fcode >= 5) && (fcode <= 7)))
+	{
+		DEBUG_OUT( "ERROR [%s] port [%d] PCS_W0[%X] rejected\n", d->cPath, cfg->wPortAddr, cfg->wPCS_W0);
+		return -1;
+	}
+
+	idx = d->iPortIndex[cfg->wPortAddr];
+	if (idx < 0)
+	{
+		if (d->iPortCount >= MAX_PORT_COUNT)
+		{
+			return -1;
+		}
+		idx = d->iPortCount++;
+		d->iPortIndex[cfg->wPortAddr] = idx;
+		d->stats.uiPorts = d->iPortCount;
+	}
+	else
+	{
+		/* configured again: the old settings may have put it into a class list */
+		emu_class_unlink(d, idx);
+	}
+
+	p = &d->pPort[idx];
+	memset(p, 0, sizeof(struct sEmuPort));
+	p->wPortAddr = cfg->wPortAddr;
+	p->wFuncCode = cfg->wFuncCode;
+	p->wPortType = cfg->wPortType;
+	p->wPCS_W0 = cfg->wPCS_W0;
+	p->wPollInterval = cfg->wPollInterval;
+	p->wWords = MVBC_FCODE_WORDS(fcode);
+	p->cSource = source;
+	p->cIrq = (cfg->wPCS_W0 >> 5) & 0x7;
+	p->cNumData = (cfg->wPCS_W0 >> 1) & 1;
+	p->iNextInClass = -1;
+
+	/* polled sink ports are put into the class of their interval, rounded down to a power of 2 */
+	if (sink && (p->cIrq == 0) && (p->wPollInterval > 0))
+	{
+		int c = 0;
+
+		while ((c < EMU_POLL_CLASSES - 1) && ((2 << c) <= p->wPollInterval))
+		{
+			c++;
+		}
+		p->iNextInClass = d->iClassHead[c];
+		d->iClassHead[c] = idx;
+	}
+
+	return 0;
+}
+
+/**
+ * EL_MVBC_GET_PORT_CONFIGURATION: look up a port by cfg->wPortAddr.
+ *
+ * @param d
+ * @param cfg
+ * @return 0 in case of success, -1 for error
+ */
+static int emu_get_port(struct sEmuDevice *d, struct sMvbcPortConfig *cfg)
+{
+	struct sEmuPort *p;
+	int idx;
+
+	if ((cfg->wPortAddr == 0) || (cfg->wPortAddr > MAX_PORT_COUNT) || ((idx = d->iPortIndex[cfg->wPortAddr]) < 0))
+	{
+		return -1;
+	}
+
+	p = &d->pPort[idx];
+	cfg->bStaticConf = 1;
+	cfg->wFuncCode = p->wFuncCode;
+	cfg->wPortType = p->wPortType;
+	cfg->wPCS_W0 = p->wPCS_W0;
+	cfg->wPollInterval = p->wPollInterval;
+	return 0;
+}
+
+/**
+ * Execute a driver command on an emulated device, see mvbc_send_cmd().
+ *
+ * @param dev
+ * @param cmd
+ * @param arg
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_emu_cmd(const char *dev, int cmd, void *arg)
+{
+	struct sEmuDevice *d = emu_find(dev);
+	int rc = -1;
+
+	if (d == NULL)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&d->lock);
+
+	d->stats.ullCommands++;
+
+	switch (cmd)
+	{
+	case EL_MVBC_RESET_DEVICE:
+		rc = (arg != NULL) ? emu_reset(d, arg) : -1;
+		break;
+
+	case EL_MVBC_SET_DEVICE_CONFIGURATION:
+		rc = (arg != NULL) ? emu_set_device(d, arg) : -1;
+		break;
+
+	case EL_MVBC_GET_DEVICE_CONFIGURATION:
+		if (arg != NULL)
+		{
+			struct sMvbcDeviceConfig *cfg = arg;
+
+			*cfg = d->cfg;
+			cfg->regs.wSCR = d->wSCR;
+			cfg->regs.wMCR = d->wMCR;
+			cfg->regs.wDR = d->wDR;
+			rc = 0;
+		}
+		break;
+
+	case EL_MVBC_SET_PORT_CONFIGURATION:
+		rc = (arg != NULL) ? emu_set_port(d, arg) : -1;
+		break;
+
+	case EL_MVBC_GET_PORT_CONFIGURATION:
+		rc = (arg != NULL) ? emu_get_port(d, arg) : -1;
+		break;
+
+	case EL_MVBC_RUN_DEVICE:
+		if ((d->wSCR & EMU_SCR_IL_MASK) != EMU_SCR_IL_CONFIG)
+		{
+			break;
+		}
+		d->wSCR = (d->wSCR & ~EMU_SCR_IL_MASK) | EMU_SCR_IL_RUN;
+		d->stats.ullVirtualMS = 0;
+		gettimeofday(&d->sRunTime, NULL);
+		d->iRunning = 1;
+		rc = pthread_create(&d->thread, NULL, emu_thread, d);
+		if (rc != 0)
+		{
+			d->iRunning = 0;
+			rc = -1;
+		}
+		break;
+
+	case EL_MVBC_SHUTDOWN_DEVICE:
+		emu_stop(d);
+		rc = 0;
+		break;
+
+	default:
+		break;
+	}
+
+	if (rc != 0)
+	{
+		d->stats.uiCommandErrors++;
+		errno = EINVAL;
+	}
+
+	pthread_mutex_unlock(&d->lock);
+
+	return rc;
+}
+
+/**
+ * Open the FIFO of an emulated device for reading.
+ *
+ * @param dev
+ * @return non blocking file descriptor, -1 for error
+ */
+int mvbc_emu_open(const char *dev)
+{
+	struct sEmuDevice *d = emu_find(dev);
+
+	if (d == NULL)
+	{
+		return -1;
+	}
+	return fcntl(d->iFifo[0], F_DUPFD_CLOEXEC, 1);
+}
+
+int mvbc_emu_set_speed(const char *dev, int scale)
+{
+	struct sEmuDevice *d = emu_find(dev);
+
+	if ((d == NULL) || (scale < 1))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&d->lock);
+	d->iScale = scale;
+	pthread_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+int mvbc_emu_set_auto_traffic(const char *dev, int on)
+{
+	struct sEmuDevice *d = emu_find(dev);
+
+	if (d == NULL)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&d->lock);
+	d->iAutoTraffic = (on != 0);
+	pthread_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+int mvbc_emu_write_port(const char *dev, int addr, const uint16_t *data, int words)
+{
+	struct sEmuDevice *d = emu_find(dev);
+	int rc = -1;
+
+	if ((d == NULL) || (data == NULL) || (words < 0) || (addr <= 0) || (addr > MAX_PORT_COUNT))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&d->lock);
+
+	if (d->iPortIndex[addr] >= 0)
+	{
+		struct sEmuPort *p = &d->pPort[d->iPortIndex[addr]];
+
+		emu_page_write(p, data, words);
+
+		/* interrupt driven sink ports report every update */
+		if (!p->cSource && (p->cIrq != 0) && d->iRunning)
+		{
+			emu_port_record(d, p, d->stats.ullVirtualMS);
+		}
+		rc = 0;
+	}
+
+	pthread_mutex_unlock(&d->lock);
+
+	return rc;
+}
+
+int mvbc_emu_read_port(const char *dev, int addr, uint16_t *data, int words)
+{
+	struct sEmuDevice *d = emu_find(dev);
+	int rc = -1;
+
+	if ((d == NULL) || (data == NULL) || (words < 0) || (addr <= 0) || (addr > MAX_PORT_COUNT))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&d->lock);
+
+	if (d->iPortIndex[addr] >= 0)
+	{
+		struct sEmuPort *p = &d->pPort[d->iPortIndex[addr]];
+
+		rc = p->wWords;
+		memcpy(data, p->wPage[p->cVP], ((words < rc) ? words : rc) * sizeof(uint16_t));
+	}
+
+	pthread_mutex_unlock(&d->lock);
+
+	return rc;
+}
+
+int mvbc_emu_get_stats(const char *dev, struct sMvbcEmuStats *stats)
+{
+	struct sEmuDevice *d = emu_find(dev);
+
+	if ((d == NULL) || (stats == NULL))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&d->lock);
+	*stats = d->stats;
+	stats->wSCR = d->wSCR;
+	stats->wMCR = d->wMCR;
+	stats->wDR = d->wDR;
+	pthread_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+int mvbc_emu_set_external_bus(const char *dev, int on)
+{
+	struct sEmuDevice *d = emu_find(dev);
+
+	if (d == NULL)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&d->lock);
+	d->iExternalBus = (on != 0);
+	pthread_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+int mvbc_emu_set_line_fault(const char *dev, int line, int down)
+{
+	struct sEmuDevice *d = emu_find(dev);
+
+	if ((d == NULL) || ((line != eLineA) && (line != eLineB)))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&d->lock);
+	d->iLineDown[line] = (down != 0);
+	emu_update_dr(d);
+	pthread_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+int mvbc_emu_bus_frames(const char *dev, struct sPortData *frames, int count)
+{
+	struct sEmuDevice *d = emu_find(dev);
+	int stored = 0;
+	int written = 0;
+
+	if ((d == NULL) || (frames == NULL) || (count < 0))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&d->lock);
+
+	if (((d->wSCR & EMU_SCR_IL_MASK) != EMU_SCR_IL_RUN) || (d->wDR == 0))
+	{
+		/* not running or no usable line: the frames never reach the traffic memory */
+		d->stats.ullLineLost += count;
+		pthread_mutex_unlock(&d->lock);
+		return 0;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		int addr = frames[i].wPortAddr;
+		struct sEmuPort *p;
+		struct sPortData *rec;
+		struct timeval ts;
+		uint16_t data[MAX_PORT_DATA_LENGTH];
+
+		/* the MVBC only stores frames of configured sink ports */
+		if ((addr <= 0) || (addr > MAX_PORT_COUNT) || (d->iPortIndex[addr] < 0) || d->pPort[d->iPortIndex[addr]].cSource)
+		{
+			continue;
+		}
+
+		p = &d->pPort[d->iPortIndex[addr]];
+		memcpy(data, frames[i].wPortData, sizeof(data));
+		emu_page_write(p, data, frames[i].wNumOfWords);
+		ts = frames[i].sTimeStamp;
+
+		/* stored records are compacted to the front */
+		rec = &frames[stored++];
+		rec->wPortAddr = p->wPortAddr;
+		rec->wPortType = p->wPortType;
+		rec->wNumOfWords = p->wWords;
+		rec->wTACK = 1;
+		rec->sTimeStamp = ts;
+		memcpy(rec->wPortData, p->wPage[p->cVP], p->wWords * sizeof(uint16_t));
+		p->cFresh = 0;
+	}
+
+	/* the bus waits for the reader instead of overflowing, so no frame of a simulation is lost */
+	while (written < stored)
+	{
+		int chunk = stored - written;
+		ssize_t n;
+
+		/* writes up to PIPE_BUF are atomic, so the reader never sees a split record */
+		if (chunk > EMU_FIFO_CHUNK)
+		{
+			chunk = EMU_FIFO_CHUNK;
+		}
+
+		n = write(d->iFifo[1], &frames[written], chunk * sizeof(struct sPortData));
+		if (n > 0)
+		{
+			written += n / sizeof(struct sPortData);
+			continue;
+		}
+		if (errno != EAGAIN)
+		{
+			d->stats.ullOverflows += stored - written;
+			mvbc_metric_add(eMetricOverflowEmu, stored - written);
+			MVBC_TRACE3(queue__overflow, "emu", d->cPath, stored - written);
+			break;
+		}
+
+		pthread_mutex_unlock(&d->lock);
+		{
+			struct pollfd pfd = { d->iFifo[1], POLLOUT, 0 };
+
+			poll(&pfd, 1, 100);
+		}
+		pthread_mutex_lock(&d->lock);
+
+		if ((d->wSCR & EMU_SCR_IL_MASK) != EMU_SCR_IL_RUN)
+		{
+			/* shut down while waiting */
+			break;
+		}
+	}
+	d->stats.ullRecords += written;
+
+	pthread_mutex_unlock(&d->lock);
+
+	return written;
+}
+
+int mvbc_emu_bus_frame(const char *dev, int addr, const uint16_t *data, int words, const struct timeval *ts)
+{
+	struct sPortData rec;
+
+	if ((data == NULL) || (ts == NULL) || (words < 0))
+	{
+		return -1;
+	}
+	if (words > MAX_PORT_DATA_LENGTH)
+	{
+		words = MAX_PORT_DATA_LENGTH;
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.wPortAddr = addr;
+	rec.wNumOfWords = words;
+	rec.sTimeStamp = *ts;
+	memcpy(rec.wPortData, data, words * sizeof(uint16_t));
+
+	return mvbc_emu_bus_frames(dev, &rec, 1);
+}
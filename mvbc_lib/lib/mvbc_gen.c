@@ -0,0 +1,279 @@
+/**
+ * @file
+ *
+ * Build time generator: project JSON -> linked in configuration tables (mvbc_static.h).
+ *
+ * 	mvbc_gen <config.json> <out.c> <out.h> <symbol>
+ *
+ * The configuration is read with the parser and validators of the library,
+ * so a file the library would reject fails the build instead of the boot.
+ * The generated file defines 'const struct sMvbcStaticProject <symbol>' with
+ * precomputed port control words and 'int <symbol>_init(mvbc_ctx *ctx)'.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "mvbc_internal.h"
+#include "mvbc_static.h"
+
+/**
+ * Write a string as C literal.
+ *
+ * @param out
+ * @param s
+ */
+static void gen_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (int i = 0; (i < MAX_STRING_LENGTH) && (s[i] != 0); i++)
+	{
+		unsigned char c = s[i];
+
+		if ((c == '"') || (c == '\\'))
+		{
+			fprintf(out, "\\%c", c);
+		}
+		else if (isprint(c))
+		{
+			fputc(c, out);
+		}
+		else
+		{
+			fprintf(out, "\\%03o", c);
+		}
+	}
+	fputc('"', out);
+}
+
+/**
+ * Reject what the parser accepts but the devices can not run: a port configured twice.
+ *
+ * @param project
+ * @return 0 if valid, -1 for error
+ */
+static int gen_check(const struct sProject *project)
+{
+	for (int d = 0; d < project->mvbc_device_count; d++)
+	{
+		const struct sMvbcPorts *ports = &project->mvbc[d].portSetup;
+		uint8_t seen[MAX_PORT_COUNT + 1];
+
+		memset(seen, 0, sizeof(seen));
+
+		for (int p = 0; p < ports->mvbc_port_count; p++)
+		{
+			int addr = ports->port[p].portCfg.iPortAddr;
+
+			if (seen[addr])
+			{
+				fprintf(stderr, "mvbc_gen: %s: port %d configured twice\n", project->mvbc[d].cDevPath, addr);
+				return -1;
+			}
+			seen[addr] = 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Write the tables and the init entry point.
+ *
+ * @param out
+ * @param project
+ * @param json source file name for the header comment
+ * @param header name of the generated header
+ * @param sym
+ */
+static void gen_source(FILE *out, const struct sProject *project, const char *json, const char *header, const char *sym)
+{
+	fprintf(out, "/* generated by mvbc_gen from %s, do not edit */\n\n", json);
+	fprintf(out, "#include \"%s\"\n\n", header);
+
+	for (int d = 0; d < project->mvbc_device_count; d++)
+	{
+		const struct sMvbcPorts *ports = &project->mvbc[d].portSetup;
+
+		if (ports->mvbc_port_count == 0)
+		{
+			continue;
+		}
+
+		fprintf(out, "static const struct sMvbcStaticPort %s_ports%d[%d] =\n{\n", sym, d, ports->mvbc_port_count);
+		for (int p = 0; p < ports->mvbc_port_count; p++)
+		{
+			const struct sMvbcPortCfg *cfg = &ports->port[p].portCfg;
+			int irq = cfg->iIrqNumber;
+
+			fprintf(out, "\t{ ");
+			gen_string(out, ports->port[p].cPortName);
+			fprintf(out, ", %d, %d, %d, %d, %d, %d, %d, 0x%04X },\n",
+				cfg->iPortAddr, cfg->iPortType, cfg->iPortDirection, cfg->iFunctionCode,
+				irq, cfg->iNumData, cfg->iPollIntervalMS,
+				MVBC_PCS_W0(cfg->iFunctionCode, cfg->iPortDirection, irq, cfg->iNumData));
+		}
+		fprintf(out, "};\n\n");
+	}
+
+	if (project->mvbc_device_count > 0)
+	{
+		fprintf(out, "static const struct sMvbcStaticDevice %s_devices[%d] =\n{\n", sym, project->mvbc_device_count);
+		for (int d = 0; d < project->mvbc_device_count; d++)
+		{
+			const struct sMvbcDevCfg *mvbc = &project->mvbc[d];
+
+			fprintf(out, "\t{\n\t\t");
+			gen_string(out, mvbc->cDescription);
+			fprintf(out, ",\n\t\t");
+			gen_string(out, mvbc->cDevPath);
+			fprintf(out, ",\n\t\t%d, %d, %d, %d, %d,\n", mvbc->iInterface, mvbc->iMode, mvbc->iTestTrafficMemory, mvbc->iLine, mvbc->iDeviceAddr);
+			fprintf(out, "\t\t%d, %d, %d, %d,\n", mvbc->portSetup.defaultPortCfg.wPortType, mvbc->portSetup.defaultPortCfg.wPollInterval,
+				mvbc->portSetup.defaultPortCfg.iIrqNumber, mvbc->portSetup.defaultPortCfg.iNumData);
+			if (mvbc->portSetup.mvbc_port_count > 0)
+			{
+				fprintf(out, "\t\t%d, %s_ports%d,\n\t\t", mvbc->portSetup.mvbc_port_count, sym, d);
+			}
+			else
+			{
+				fprintf(out, "\t\t0, 0,\n\t\t");
+			}
+			if (mvbc->cUioPath[0] != 0)
+			{
+				gen_string(out, mvbc->cUioPath);
+			}
+			else
+			{
+				fprintf(out, "0");
+			}
+			fprintf(out, "\n\t},\n");
+		}
+		fprintf(out, "};\n\n");
+	}
+
+	fprintf(out, "const struct sMvbcStaticProject %s =\n{\n\t", sym);
+	gen_string(out, project->cProjectName);
+	fprintf(out, ",\n\t");
+	gen_string(out, project->cProjectVersion);
+	if (project->mvbc_device_count > 0)
+	{
+		fprintf(out, ",\n\t%d, %s_devices\n};\n\n", project->mvbc_device_count, sym);
+	}
+	else
+	{
+		fprintf(out, ",\n\t0, 0\n};\n\n");
+	}
+
+	fprintf(out, "int %s_init(mvbc_ctx *ctx)\n{\n\treturn mvbc_ctx_init_static(ctx, &%s);\n}\n", sym, sym);
+}
+
+/**
+ * Write the declarations.
+ *
+ * @param out
+ * @param sym
+ */
+static void gen_header(FILE *out, const char *sym)
+{
+	fprintf(out, "/* generated by mvbc_gen, do not edit */\n\n");
+	fprintf(out, "#ifndef MVBC_GEN_%s_INCLUDED\n#define MVBC_GEN_%s_INCLUDED 1\n\n", sym, sym);
+	fprintf(out, "#include \"mvbc_static.h\"\n\n");
+	fprintf(out, "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n");
+	fprintf(out, "extern const struct sMvbcStaticProject %s;\n\n", sym);
+	fprintf(out, "/** mvbc_ctx_init_static() with the generated configuration */\n");
+	fprintf(out, "int %s_init(mvbc_ctx *ctx);\n\n", sym);
+	fprintf(out, "#ifdef __cplusplus\n}\n#endif\n\n#endif\n");
+}
+
+/**
+ * Check that the symbol is a C identifier.
+ *
+ * @param sym
+ * @return 1 if valid
+ */
+static int gen_valid_symbol(const char *sym)
+{
+	if (!isalpha((unsigned char)sym[0]) && (sym[0] != '_'))
+	{
+		return 0;
+	}
+	for (const char *c = sym; *c != 0; c++)
+	{
+		if (!isalnum((unsigned char)*c) && (*c != '_'))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sProject *project;
+	const char *header;
+	FILE *out;
+	int rc;
+
+	if ((argc != 5) || !gen_valid_symbol(argv[4]))
+	{
+		fprintf(stderr, "usage: %s <config.json> <out.c> <out.h> <symbol>\n", argv[0]);
+		return 2;
+	}
+
+	project = malloc(sizeof(struct sProject));
+	if (project == NULL)
+	{
+		return 1;
+	}
+
+	rc = mvbc_parse_project_configuration(argv[1], project);
+	if ((rc != NO_ERROR) || (gen_check(project) != 0))
+	{
+		fprintf(stderr, "mvbc_gen: %s rejected (%d)\n", argv[1], rc);
+		free(project);
+		return 1;
+	}
+
+	header = strrchr(argv[3], '/');
+	header = (header != NULL) ? header + 1 : argv[3];
+
+	out = fopen(argv[2], "w");
+	if (out == NULL)
+	{
+		perror(argv[2]);
+		free(project);
+		return 1;
+	}
+	gen_source(out, project, argv[1], header, argv[4]);
+	rc = fclose(out);
+
+	out = fopen(argv[3], "w");
+	if (out == NULL)
+	{
+		perror(argv[3]);
+		free(project);
+		return 1;
+	}
+	gen_header(out, argv[4]);
+	rc |= fclose(out);
+
+	free(project);
+
+	return (rc == 0) ? 0 : 1;
+}
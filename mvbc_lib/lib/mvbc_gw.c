@@ -0,0 +1,766 @@
+/**
+ * @file
+ *
+ * UDP multicast gateway publishing changed port data.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "mvbc_internal.h"
+#include "mvbc_gw.h"
+#include "mvbc_cfg.h"
+
+/**
+ * ports to send of one device, the payloads are taken from the image of the library.
+ */
+struct sMvbcGwDev
+{
+	/** per group: ports selected / to send */
+	uint64_t ullSelected[MVBC_GW_GROUPS];
+	uint64_t ullDirty[MVBC_GW_GROUPS];
+
+	/** groups with a dirty port */
+	uint64_t ullDirtyGroups;
+
+	uint32_t uiSeq[MVBC_GW_GROUPS];
+};
+
+struct sMvbcGw
+{
+	mvbc_ctx *ctx;
+	int iSocket;
+	struct sockaddr_in sDest;
+	int iMaxDatagram;
+	int iRefreshMS;
+	struct timespec sLastRefresh;
+
+	struct sMvbcGwDev dev[MAX_MVBC_DEVICES];
+
+	/** datagrams waiting for sendmmsg() */
+	int iPending;
+	struct mmsghdr msg[MVBC_GW_BATCH];
+	struct iovec iov[MVBC_GW_BATCH];
+	uint8_t cBuf[MVBC_GW_BATCH][MVBC_GW_MAX_DATAGRAM];
+
+	struct sMvbcGwStats stats;
+
+	/** records read by mvbc_gw_pump() and the group being packed, a block of MVBC_POOL_RECORD_BLOCK records of the record pool */
+	struct sPortData *batch;
+};
+
+#if MVBC_GW_GROUPS > 64
+#error "one bit per group in ullDirtyGroups"
+#endif
+
+#if (MVBC_GW_GROUP_PORTS != MVBC_POOL_RECORD_BLOCK) || (MVBC_GW_GROUPS < MVBC_IMAGE_GROUPS)
+#error "a gateway group is a group of the port image"
+#endif
+
+static int64_t gw_time_us(const struct sPortData *rec)
+{
+	return (int64_t)rec->sTimeStamp.tv_sec * 1000000 + rec->sTimeStamp.tv_usec;
+}
+
+/**
+ * Resolve group, port and interface of a configuration.
+ *
+ * @param cfg
+ * @param group
+ * @param iface
+ * @return 0 in case of success, -1 for error
+ */
+static int gw_addresses(const struct sMvbcGwCfg *cfg, struct sockaddr_in *group, struct in_addr *iface)
+{
+	memset(group, 0, sizeof(*group));
+	group->sin_family = AF_INET;
+	group->sin_port = htons(cfg->wPort);
+
+	if ((cfg->pGroup == NULL) || (inet_pton(AF_INET, cfg->pGroup, &group->sin_addr) != 1) || !IN_MULTICAST(ntohl(group->sin_addr.s_addr)))
+	{
+		DEBUG_OUT( "ERROR invalid multicast group [%s]\n", cfg->pGroup ? cfg->pGroup : "");
+		return -1;
+	}
+
+	iface->s_addr = htonl(INADDR_ANY);
+	if ((cfg->pInterface != NULL) && (inet_pton(AF_INET, cfg->pInterface, iface) != 1))
+	{
+		DEBUG_OUT( "ERROR invalid interface address [%s]\n", cfg->pInterface);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Let the images of all devices of a context record the changes for the gateway.
+ *
+ * @param ctx
+ * @param gw NULL to detach
+ * @return 0 in case of success, -1 if another gateway is attached
+ */
+static int gw_attach(struct mvbc_ctx *ctx, struct sMvbcGw *gw)
+{
+	pthread_mutex_lock(&ctx->ctxLock);
+
+	if ((gw != NULL) && (ctx->pGw != NULL))
+	{
+		pthread_mutex_unlock(&ctx->ctxLock);
+		DEBUG_OUT( "ERROR the context has a gateway already\n");
+		return -1;
+	}
+	ctx->pGw = gw;
+
+	for (int i = 0; i < MAX_MVBC_DEVICES; i++)
+	{
+		struct sMvbcPortImage *image = &ctx->portImage[i];
+
+		pthread_mutex_lock(&ctx->devLock[i]);
+		if (gw != NULL)
+		{
+			image->iEnabled = 1;
+		}
+		image->iTrackChanges = (gw != NULL);
+		memset(image->ullChanged, 0, sizeof(image->ullChanged));
+		pthread_mutex_unlock(&ctx->devLock[i]);
+	}
+
+	pthread_mutex_unlock(&ctx->ctxLock);
+
+	return 0;
+}
+
+struct sMvbcGw *mvbc_gw_create(mvbc_ctx *ctx, const struct sMvbcGwCfg *cfg)
+{
+	struct sMvbcGw *gw;
+	struct in_addr iface;
+	unsigned char ttl;
+	unsigned char loop;
+
+	if ((ctx == NULL) || (cfg == NULL))
+	{
+		return NULL;
+	}
+
+	gw = calloc(1, sizeof(struct sMvbcGw));
+	if (gw == NULL)
+	{
+		DEBUG_OUT( "ERROR no memory for the gateway\n");
+		return NULL;
+	}
+
+	if (gw_addresses(cfg, &gw->sDest, &iface) != 0)
+	{
+		free(gw);
+		return NULL;
+	}
+
+	gw->iSocket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (gw->iSocket < 0)
+	{
+		DEBUG_OUT( "ERROR socket errno[%d]\n", errno);
+		free(gw);
+		return NULL;
+	}
+
+	ttl = (cfg->iTTL > 0) ? (unsigned char)cfg->iTTL : 1;
+	loop = cfg->iLoop ? 1 : 0;
+	if ((setsockopt(gw->iSocket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) != 0) ||
+		(setsockopt(gw->iSocket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) != 0) ||
+		((cfg->pInterface != NULL) && (setsockopt(gw->iSocket, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface)) != 0)))
+	{
+		DEBUG_OUT( "ERROR multicast options errno[%d]\n", errno);
+		close(gw->iSocket);
+		free(gw);
+		return NULL;
+	}
+
+	gw->ctx = ctx;
+	gw->iMaxDatagram = MVBC_GW_MAX_DATAGRAM;
+	if ((cfg->iMaxDatagram > 0) && (cfg->iMaxDatagram < MVBC_GW_MAX_DATAGRAM))
+	{
+		/* at least one full port has to fit */
+		int min = sizeof(struct sMvbcGwHeader) + sizeof(struct sMvbcGwEntry) + MAX_PORT_DATA_LENGTH * sizeof(uint16_t);
+
+		gw->iMaxDatagram = (cfg->iMaxDatagram > min) ? cfg->iMaxDatagram : min;
+	}
+	gw->iRefreshMS = cfg->iRefreshMS;
+
+	gw->batch = mvbc_record_batch(ctx);
+	if ((gw->batch == NULL) || (gw_attach(ctx, gw) != 0))
+	{
+		mvbc_ctx_record_free(ctx, gw->batch);
+		close(gw->iSocket);
+		free(gw);
+		return NULL;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &gw->sLastRefresh);
+
+	for (int i = 0; i < MAX_MVBC_DEVICES; i++)
+	{
+		memset(gw->dev[i].ullSelected, 0xFF, sizeof(gw->dev[i].ullSelected));
+	}
+
+	for (int i = 0; i < MVBC_GW_BATCH; i++)
+	{
+		gw->iov[i].iov_base = gw->cBuf[i];
+		gw->msg[i].msg_hdr.msg_name = &gw->sDest;
+		gw->msg[i].msg_hdr.msg_namelen = sizeof(gw->sDest);
+		gw->msg[i].msg_hdr.msg_iov = &gw->iov[i];
+		gw->msg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return gw;
+}
+
+void mvbc_gw_destroy(struct sMvbcGw *gw)
+{
+	if (gw == NULL)
+	{
+		return;
+	}
+
+	gw_attach(gw->ctx, NULL);
+	close(gw->iSocket);
+	mvbc_ctx_record_free(gw->ctx, gw->batch);
+	free(gw);
+}
+
+int mvbc_gw_select(struct sMvbcGw *gw, const char *dev, int first, int last, int on)
+{
+	int idx;
+
+	if (gw == NULL)
+	{
+		return -1;
+	}
+
+	idx = mvbc_find_device(gw->ctx, dev);
+	if ((idx < 0) || (first < 0) || (last > MAX_PORT_COUNT) || (first > last))
+	{
+		return -1;
+	}
+
+	for (int addr = first; addr <= last; addr++)
+	{
+		uint64_t bit = 1ULL << (addr % MVBC_GW_GROUP_PORTS);
+
+		if (on)
+		{
+			gw->dev[idx].ullSelected[addr / MVBC_GW_GROUP_PORTS] |= bit;
+		}
+		else
+		{
+			gw->dev[idx].ullSelected[addr / MVBC_GW_GROUP_PORTS] &= ~bit;
+			gw->dev[idx].ullDirty[addr / MVBC_GW_GROUP_PORTS] &= ~bit;
+		}
+	}
+
+	return 0;
+}
+
+int mvbc_gw_submit(struct sMvbcGw *gw, int dev, const struct sPortData *recs, int count)
+{
+	struct sMvbcPortImage *image;
+	struct sMvbcGwDev *d;
+	int changed = 0;
+
+	if ((gw == NULL) || (dev < 0) || (dev >= MAX_MVBC_DEVICES) || ((recs == NULL) && (count > 0)))
+	{
+		return -1;
+	}
+
+	d = &gw->dev[dev];
+	image = &gw->ctx->portImage[dev];
+
+	gw->stats.ullRecords += count;
+
+	pthread_mutex_lock(&gw->ctx->devLock[dev]);
+
+	for (int i = 0; i < count; i++)
+	{
+		int group = recs[i].wPortAddr / MVBC_GW_GROUP_PORTS;
+		uint64_t bit = 1ULL << (recs[i].wPortAddr % MVBC_GW_GROUP_PORTS);
+
+		if ((recs[i].wPortAddr > MAX_PORT_COUNT) || !(d->ullSelected[group] & bit & image->ullChanged[group]))
+		{
+			continue;
+		}
+
+		image->ullChanged[group] &= ~bit;
+		d->ullDirty[group] |= bit;
+		d->ullDirtyGroups |= 1ULL << group;
+		changed++;
+	}
+
+	pthread_mutex_unlock(&gw->ctx->devLock[dev]);
+
+	gw->stats.ullChanged += changed;
+
+	return changed;
+}
+
+/**
+ * Send the pending datagrams.
+ *
+ * @param gw
+ */
+static void gw_send(struct sMvbcGw *gw)
+{
+	int done = 0;
+
+	while (done < gw->iPending)
+	{
+		int rc = sendmmsg(gw->iSocket, &gw->msg[done], gw->iPending - done, 0);
+
+		gw->stats.ullSendCalls++;
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			DEBUG_OUT( "ERROR sendmmsg errno[%d]\n", errno);
+			gw->stats.uiSendErrors += gw->iPending - done;
+			break;
+		}
+
+		for (int i = done; i < done + rc; i++)
+		{
+			gw->stats.ullBytes += gw->iov[i].iov_len;
+		}
+		gw->stats.ullDatagrams += rc;
+		done += rc;
+	}
+
+	gw->iPending = 0;
+}
+
+/**
+ * Finish the datagram being filled.
+ *
+ * @param gw
+ * @param dev
+ * @param group
+ * @param len bytes used
+ * @param count entries
+ * @param time_us time stamp of the first entry
+ */
+static void gw_close_datagram(struct sMvbcGw *gw, int dev, int group, int len, int count, int64_t time_us)
+{
+	struct sMvbcGwHeader *hdr = (struct sMvbcGwHeader *)gw->cBuf[gw->iPending];
+
+	hdr->uiMagic = htonl(MVBC_GW_MAGIC);
+	hdr->cVersion = MVBC_GW_VERSION;
+	hdr->cDev = dev;
+	hdr->cGroup = group;
+	hdr->cCount = count;
+	hdr->uiSeq = htonl(gw->dev[dev].uiSeq[group]++);
+	hdr->ullTimeUS = htobe64((uint64_t)time_us);
+
+	gw->iov[gw->iPending].iov_len = len;
+	gw->stats.ullEntries += count;
+
+	if (++gw->iPending == MVBC_GW_BATCH)
+	{
+		gw_send(gw);
+	}
+}
+
+/**
+ * Copy the dirty ports of a group from the image of the device to gw->batch.
+ *
+ * @param gw
+ * @param dev
+ * @param group
+ * @param mask dirty ports
+ * @return dirty ports with a record in the image
+ */
+static uint64_t gw_take_group(struct sMvbcGw *gw, int dev, int group, uint64_t mask)
+{
+	const struct sPortData *image;
+	uint64_t taken = 0;
+
+	pthread_mutex_lock(&gw->ctx->devLock[dev]);
+
+	image = gw->ctx->portImage[dev].pGroup[group];
+	while ((image != NULL) && (mask != 0))
+	{
+		int bit = __builtin_ctzll(mask);
+
+		mask &= mask - 1;
+		if (image[bit].wNumOfWords != 0)
+		{
+			gw->batch[bit] = image[bit];
+			taken |= 1ULL << bit;
+		}
+	}
+
+	pthread_mutex_unlock(&gw->ctx->devLock[dev]);
+
+	return taken;
+}
+
+/**
+ * Pack the ports of a group taken to gw->batch into datagrams.
+ *
+ * @param gw
+ * @param dev
+ * @param group
+ * @param mask ports taken
+ */
+static void gw_pack_group(struct sMvbcGw *gw, int dev, int group, uint64_t mask)
+{
+	const struct sPortData *ports = gw->batch;
+	int len = sizeof(struct sMvbcGwHeader);
+	int count = 0;
+	int64_t timeUS = 0;
+
+	while (mask != 0)
+	{
+		int bit = __builtin_ctzll(mask);
+		const struct sPortData *port = &ports[bit];
+		int words = (port->wNumOfWords < MAX_PORT_DATA_LENGTH) ? port->wNumOfWords : MAX_PORT_DATA_LENGTH;
+		int size = sizeof(struct sMvbcGwEntry) + words * sizeof(uint16_t);
+		int64_t timeRec = gw_time_us(port);
+		uint8_t *p;
+		struct sMvbcGwEntry entry;
+		int64_t delta;
+
+		mask &= mask - 1;
+
+		if (len + size > gw->iMaxDatagram)
+		{
+			gw_close_datagram(gw, dev, group, len, count, timeUS);
+			len = sizeof(struct sMvbcGwHeader);
+			count = 0;
+		}
+		if (count == 0)
+		{
+			timeUS = timeRec;
+		}
+
+		delta = timeRec - timeUS;
+		entry.wPortAddr = htons(group * MVBC_GW_GROUP_PORTS + bit);
+		entry.cWords = words;
+		entry.cType = port->wPortType;
+		entry.iTimeUS = (int32_t)htonl((uint32_t)(int32_t)((delta > INT32_MAX) ? INT32_MAX : (delta < INT32_MIN) ? INT32_MIN : delta));
+
+		p = gw->cBuf[gw->iPending] + len;
+		memcpy(p, &entry, sizeof(entry));
+		p += sizeof(entry);
+		for (int i = 0; i < words; i++)
+		{
+			uint16_t w = htons(port->wPortData[i]);
+
+			memcpy(p + i * sizeof(uint16_t), &w, sizeof(w));
+		}
+
+		len += size;
+		count++;
+	}
+
+	if (count > 0)
+	{
+		gw_close_datagram(gw, dev, group, len, count, timeUS);
+	}
+}
+
+int mvbc_gw_flush(struct sMvbcGw *gw)
+{
+	uint64_t before;
+
+	if (gw == NULL)
+	{
+		return -1;
+	}
+
+	before = gw->stats.ullDatagrams + gw->stats.uiSendErrors;
+
+	for (int dev = 0; dev < MAX_MVBC_DEVICES; dev++)
+	{
+		struct sMvbcGwDev *d = &gw->dev[dev];
+
+		while (d->ullDirtyGroups != 0)
+		{
+			int group = __builtin_ctzll(d->ullDirtyGroups);
+			uint64_t mask = d->ullDirty[group];
+
+			d->ullDirtyGroups &= d->ullDirtyGroups - 1;
+			d->ullDirty[group] = 0;
+			gw_pack_group(gw, dev, group, gw_take_group(gw, dev, group, mask & d->ullSelected[group]));
+		}
+	}
+
+	if (gw->iPending > 0)
+	{
+		gw_send(gw);
+	}
+
+	return (int)(gw->stats.ullDatagrams + gw->stats.uiSendErrors - before);
+}
+
+/**
+ * Mark all selected ports dirty once per refresh interval, the flush skips those without a record.
+ *
+ * @param gw
+ */
+static void gw_refresh(struct sMvbcGw *gw)
+{
+	struct timespec now;
+	int64_t elapsedMS;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsedMS = (int64_t)(now.tv_sec - gw->sLastRefresh.tv_sec) * 1000 + (now.tv_nsec - gw->sLastRefresh.tv_nsec) / 1000000;
+	if (elapsedMS < gw->iRefreshMS)
+	{
+		return;
+	}
+	gw->sLastRefresh = now;
+
+	for (int dev = 0; dev < MAX_MVBC_DEVICES; dev++)
+	{
+		struct sMvbcGwDev *d = &gw->dev[dev];
+
+		for (int group = 0; group < MVBC_GW_GROUPS; group++)
+		{
+			uint64_t mask = d->ullSelected[group];
+
+			if (mask != 0)
+			{
+				d->ullDirty[group] |= mask;
+				d->ullDirtyGroups |= 1ULL << group;
+			}
+		}
+	}
+}
+
+int mvbc_gw_pump(struct sMvbcGw *gw, int timeout_ms)
+{
+	struct pollfd pollDesc[MAX_MVBC_DEVICES];
+	const struct sMvbcCfgSnapshot *cfg;
+	int count;
+	int rc;
+
+	if (gw == NULL)
+	{
+		return -1;
+	}
+
+	cfg = mvbc_ctx_cfg_enter(gw->ctx);
+	count = (cfg != NULL) ? cfg->project.mvbc_device_count : 0;
+	mvbc_ctx_cfg_leave(gw->ctx);
+
+	for (int i = 0; i < count; i++)
+	{
+		pollDesc[i].fd = mvbc_reader_fd(gw->ctx, i);
+		pollDesc[i].events = POLLIN;
+		pollDesc[i].revents = 0;
+	}
+
+	rc = poll(pollDesc, count, timeout_ms);
+	if ((rc < 0) && (errno != EINTR))
+	{
+		return -1;
+	}
+
+	for (int i = 0; (i < count) && (rc > 0); i++)
+	{
+		if (!(pollDesc[i].revents & POLLIN))
+		{
+			continue;
+		}
+
+		for (;;)
+		{
+			int got = mvbc_read_index(gw->ctx, i, gw->batch, MVBC_POOL_RECORD_BLOCK);
+
+			if (got <= 0)
+			{
+				break;
+			}
+			mvbc_gw_submit(gw, i, gw->batch, got);
+			if (got < MVBC_POOL_RECORD_BLOCK)
+			{
+				break;
+			}
+		}
+	}
+
+	if (gw->iRefreshMS > 0)
+	{
+		gw_refresh(gw);
+	}
+
+	return mvbc_gw_flush(gw);
+}
+
+int mvbc_gw_get_stats(const struct sMvbcGw *gw, struct sMvbcGwStats *stats)
+{
+	if ((gw == NULL) || (stats == NULL))
+	{
+		return -1;
+	}
+
+	*stats = gw->stats;
+	return 0;
+}
+
+int mvbc_gw_rx_open(const struct sMvbcGwCfg *cfg)
+{
+	struct sockaddr_in group;
+	struct sockaddr_in local;
+	struct ip_mreq mreq;
+	int on = 1;
+	int fd;
+
+	if ((cfg == NULL) || (gw_addresses(cfg, &group, &mreq.imr_interface) != 0))
+	{
+		return -1;
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		DEBUG_OUT( "ERROR socket errno[%d]\n", errno);
+		return -1;
+	}
+
+	/* bound to the group, so that other groups on the same port are not received */
+	local = group;
+	mreq.imr_multiaddr = group.sin_addr;
+	if ((setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0) ||
+		(bind(fd, (struct sockaddr *)&local, sizeof(local)) != 0) ||
+		(setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0))
+	{
+		DEBUG_OUT( "ERROR join [%s:%u] errno[%d]\n", cfg->pGroup, cfg->wPort, errno);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int mvbc_gw_rx_parse(struct sMvbcGwRx *rx, const void *buf, int len, mvbc_gw_rx_fn fn, void *arg)
+{
+	const uint8_t *p = buf;
+	struct sMvbcGwHeader hdr;
+	uint32_t seq;
+	int64_t timeUS;
+	int pos;
+
+	if ((rx == NULL) || (buf == NULL))
+	{
+		return -1;
+	}
+
+	if (len < (int)sizeof(hdr))
+	{
+		rx->ullInvalid++;
+		return -1;
+	}
+
+	memcpy(&hdr, p, sizeof(hdr));
+	if ((ntohl(hdr.uiMagic) != MVBC_GW_MAGIC) || (hdr.cVersion != MVBC_GW_VERSION) ||
+		(hdr.cDev >= MAX_MVBC_DEVICES) || (hdr.cGroup >= MVBC_GW_GROUPS))
+	{
+		rx->ullInvalid++;
+		return -1;
+	}
+
+	/* check the whole datagram before any entry is passed on */
+	pos = sizeof(hdr);
+	for (int i = 0; i < hdr.cCount; i++)
+	{
+		struct sMvbcGwEntry entry;
+
+		if (pos + (int)sizeof(entry) > len)
+		{
+			rx->ullInvalid++;
+			return -1;
+		}
+		memcpy(&entry, p + pos, sizeof(entry));
+		pos += sizeof(entry) + entry.cWords * sizeof(uint16_t);
+		if ((entry.cWords > MAX_PORT_DATA_LENGTH) || (pos > len))
+		{
+			rx->ullInvalid++;
+			return -1;
+		}
+	}
+
+	seq = ntohl(hdr.uiSeq);
+	if (rx->cSeen[hdr.cDev][hdr.cGroup])
+	{
+		uint32_t gap = seq - rx->uiNextSeq[hdr.cDev][hdr.cGroup];
+
+		if (gap >= 0x80000000U)
+		{
+			rx->ullLate++;
+			return -1;
+		}
+		rx->ullLost += gap;
+	}
+	rx->cSeen[hdr.cDev][hdr.cGroup] = 1;
+	rx->uiNextSeq[hdr.cDev][hdr.cGroup] = seq + 1;
+	rx->ullDatagrams++;
+	rx->ullEntries += hdr.cCount;
+
+	timeUS = (int64_t)be64toh(hdr.ullTimeUS);
+	pos = sizeof(hdr);
+	for (int i = 0; i < hdr.cCount; i++)
+	{
+		struct sMvbcGwEntry entry;
+		struct sPortData rec;
+		int64_t recUS;
+
+		memcpy(&entry, p + pos, sizeof(entry));
+		pos += sizeof(entry);
+
+		memset(&rec, 0, sizeof(rec));
+		rec.wPortAddr = ntohs(entry.wPortAddr);
+		rec.wPortType = entry.cType;
+		rec.wNumOfWords = entry.cWords;
+		recUS = timeUS + (int32_t)ntohl((uint32_t)entry.iTimeUS);
+		rec.sTimeStamp.tv_sec = recUS / 1000000;
+		rec.sTimeStamp.tv_usec = recUS % 1000000;
+		for (int w = 0; w < entry.cWords; w++)
+		{
+			uint16_t v;
+
+			memcpy(&v, p + pos, sizeof(v));
+			rec.wPortData[w] = ntohs(v);
+			pos += sizeof(v);
+		}
+
+		if (fn != NULL)
+		{
+			fn(arg, hdr.cDev, &rec);
+		}
+	}
+
+	return hdr.cCount;
+}
@@ -0,0 +1,351 @@
+/**
+ * @file
+ *
+ * Runtime state of a library context and functions shared by the library
+ * sources. Not installed, the applications see mvbc_ctx as an opaque type.
+ */
+
+#ifndef MVBC_INTERNAL_INCLUDED
+#define MVBC_INTERNAL_INCLUDED 1
+
+#include <pthread.h>
+
+#include "mvbc_lib.h"
+
+/** DR: LAA - decoder trusts Line A (see MVBC02D spec.) */
+#define MVBC_DR_LAA (1 << 3)
+
+/** DR: LBA - decoder trusts Line B (see MVBC02D spec.) */
+#define MVBC_DR_LBA (1 << 2)
+
+/**
+ * line supervision state of one MVBC device.
+ */
+struct sMvbcLineState
+{
+	/** counters returned by mvbc_get_line_stats() */
+	struct sMvbcLineStats stats;
+
+	/** time of the last register read (CLOCK_MONOTONIC) */
+	struct timespec sLastPoll;
+};
+
+/**
+ * watchdog state of one MVBC device.
+ */
+struct sMvbcHealthState
+{
+	/** counters returned by mvbc_get_health() */
+	struct sMvbcHealthStats stats;
+
+	/** time of the last record read, or of the (re)start (CLOCK_MONOTONIC) */
+	struct timespec sLastRecord;
+
+	/** 1 once a record was read */
+	int iHadRecord;
+
+	/** stats.ullReads and stats.uiReadErrors at the last check */
+	uint64_t ullReadsSeen;
+	uint32_t uiReadErrorsSeen;
+
+	/** 1 after mvbc_shutdown(), the device is not supervised */
+	int iStopped;
+
+	/** checks that found the device stale */
+	uint32_t uiStale;
+
+	/** ports with a record with transfer acknowledge since the last check, set by the reader */
+	uint64_t ullFresh[(MAX_PORT_COUNT + 64) / 64];
+
+	/** per configured port: CLOCK_MONOTONIC milliseconds of the last acknowledged record, 0 = not supervised yet */
+	int64_t llFreshMS[MAX_PORT_COUNT];
+};
+
+/**
+ * runtime state of one MVBC device, same index as sProject.mvbc[].
+ */
+struct sMvbcDevState
+{
+	/** device path, copied from the configuration at init */
+	char cDevPath[MAX_STRING_LENGTH];
+
+	/** descriptor used for reading records, -1 = not open */
+	int iFd;
+
+	/** start of a record returned partially by the last read() */
+	uint8_t cPartial[sizeof(struct sPortData)];
+
+	/** bytes in cPartial */
+	uint32_t uiPartial;
+
+	/** incremented whenever iFd is closed (restart, init), kept over the reset of an init */
+	uint32_t uiFdGeneration;
+
+	/** receive counters */
+	struct sMvbcDevStats stats;
+
+	/** line A/B supervision */
+	struct sMvbcLineState line;
+
+	/** mapped traffic memory, pBase NULL if not configured */
+	struct sMvbcUio uio;
+
+	/** watchdog supervision */
+	struct sMvbcHealthState health;
+
+	/** traffic memory test */
+	struct sMvbcMemtestStatus memtest;
+
+	/** next port index of the background test, slices deferred in a row */
+	uint32_t uiMemtestIndex;
+	uint32_t uiMemtestDeferred;
+
+	/** port descriptors sent at init, sent again by a recovery */
+	int iPortDescCount;
+	struct sMvbcPortConfig portDesc[MAX_PORT_COUNT];
+};
+
+/**
+ * line mode requested by mvbc_set_line_mode() before mvbc_init()
+ */
+struct sMvbcLineOverride
+{
+	char cDevPath[MAX_STRING_LENGTH];
+	int iLine;
+};
+
+/** reader slots per block; a context starts with one block and adds more when threads need them */
+#define MVBC_CFG_READER_BLOCK 64
+
+/**
+ * configuration read section announcement of one thread, one cache line each.
+ */
+struct sMvbcCfgReader
+{
+	/** epoch at the start of the current read section, 0 = not reading */
+	uint64_t ullEpoch;
+
+	/** 1 if the slot belongs to a thread */
+	uint32_t uiUsed;
+} __attribute__((aligned(64)));
+
+/**
+ * reader slots added to a context, freed on destroy.
+ */
+struct sMvbcCfgReaderBlock
+{
+	struct sMvbcCfgReader reader[MVBC_CFG_READER_BLOCK];
+	struct sMvbcCfgReaderBlock *pNext;
+};
+
+struct sMvbcCfgSnapshot;
+struct sMvbcPortSeq;
+struct sMvbcMetricsShm;
+struct sMvbcMetricsExp;
+struct sMvbcGw;
+
+/** groups of MVBC_POOL_RECORD_BLOCK port addresses */
+#define MVBC_IMAGE_GROUPS ((MAX_PORT_COUNT + MVBC_POOL_RECORD_BLOCK) / MVBC_POOL_RECORD_BLOCK)
+
+#if MVBC_IMAGE_GROUPS > 64
+#error "one bit per group in a uint64_t"
+#endif
+
+/**
+ * latest-value image of a device (mvbc_read_ports()).
+ */
+struct sMvbcPortImage
+{
+	/** records are kept, set by mvbc_enable_port_image() or the first mvbc_read_ports() */
+	int iEnabled;
+
+	/** record blocks of the record pool, NULL until a record of the group arrived */
+	struct sPortData *pGroup[MVBC_IMAGE_GROUPS];
+
+	/** 1 while a gateway takes the changes (mvbc_gw.h) */
+	int iTrackChanges;
+
+	/** per group: ports whose payload changed since the gateway took them */
+	uint64_t ullChanged[MVBC_IMAGE_GROUPS];
+};
+
+/**
+ * library context: one parsed project and the runtime state of its devices.
+ *
+ * Locking: ctxLock serialises parse/init of the context, devLock[i] protects
+ * dev[i] so that different devices can be read in parallel. An init tears
+ * down and brings up dev[i] with devLock[i] held. Devices are looked up in
+ * the published snapshot (mvbc_cfg.h), never in project.
+ */
+struct mvbc_ctx
+{
+	/** configuration of the last parse/init, protected by ctxLock */
+	struct sProject project;
+
+	/** runtime state per configured device, same index as project.mvbc[] */
+	struct sMvbcDevState dev[MAX_MVBC_DEVICES];
+
+	/** line modes selected with mvbc_ctx_set_line_mode() */
+	struct sMvbcLineOverride lineOverride[MAX_MVBC_DEVICES];
+	int iLineOverrideCount;
+
+	pthread_mutex_t ctxLock;
+	pthread_mutex_t devLock[MAX_MVBC_DEVICES];
+
+	/** published configuration, replaced atomically (see mvbc_cfg.h) */
+	struct sMvbcCfgSnapshot *pCfg;
+
+	/** reclamation epoch, starts at 1 */
+	uint64_t ullCfgEpoch;
+
+	/** version of the last published snapshot */
+	uint64_t ullCfgVersion;
+
+	/** replaced snapshots waiting for their readers, protected by ctxLock */
+	struct sMvbcCfgSnapshot *pCfgRetired;
+
+	struct sMvbcCfgReader cfgReader[MVBC_CFG_READER_BLOCK];
+
+	/** blocks added when cfgReader[] was used up, prepended lock free */
+	struct sMvbcCfgReaderBlock *pCfgReaderMore;
+
+	/** unique id and link of the live context list (mvbc_cfg.c) */
+	uint64_t ullCfgId;
+	struct mvbc_ctx *pCfgNextLive;
+
+	/** message reassembly buffers (mvbc_pool.h), NULL until needed, replaced under ctxLock */
+	struct sMvbcPool *pMsgPool;
+
+	/** message pools replaced by bigger ones, protected by ctxLock, kept until destroy */
+	struct sMvbcPool *pMsgPoolRetired;
+
+	/** record blocks (mvbc_pool.h), NULL until needed, replaced under ctxLock */
+	struct sMvbcPool *pRecPool;
+
+	/** record pools replaced by bigger ones, protected by ctxLock, kept until destroy */
+	struct sMvbcPool *pRecPoolRetired;
+
+	/** latest record per port address of each device, protected by devLock[i] */
+	struct sMvbcPortImage portImage[MAX_MVBC_DEVICES];
+
+	/** update counters per port address of each device (mvbc_wait_port()), NULL until requested, kept until destroy */
+	struct sMvbcPortSeq *pPortSeq[MAX_MVBC_DEVICES];
+
+	/** watchdog thread (mvbc_ctx_watchdog_start()) */
+	pthread_t watchdogThread;
+	int iWatchdogRunning;
+	struct sMvbcWatchdogCfg watchdogCfg;
+
+	/** background traffic memory test (mvbc_memtest.h) */
+	pthread_t memtestThread;
+	int iMemtestRunning;
+
+	/** subscription server (mvbc_srv.h), NULL if not running, protected by ctxLock */
+	struct sMvbcSrv *pSrv;
+	pthread_t srvThread;
+
+	/** gateway taking the changes of the images, NULL if none, protected by ctxLock */
+	struct sMvbcGw *pGw;
+
+	/** device and port counters (mvbc_metrics.h), NULL until the first exporter start, kept until destroy */
+	struct sMvbcMetricsShm *pMetricsShm;
+
+	/** metrics exporter, NULL if not running, protected by ctxLock */
+	struct sMvbcMetricsExp *pMetrics;
+	pthread_t metricsThread;
+};
+
+int mvbc_find_device(struct mvbc_ctx *ctx, const char *dev);
+void mvbc_line_apply_overrides(struct mvbc_ctx *ctx);
+void mvbc_cfg_setup(struct mvbc_ctx *ctx);
+int mvbc_cfg_publish(struct mvbc_ctx *ctx);
+int mvbc_cfg_dev_path(struct mvbc_ctx *ctx, int idx, char *path);
+void mvbc_cfg_free_all(struct mvbc_ctx *ctx);
+int mvbc_pool_setup(struct mvbc_ctx *ctx);
+void mvbc_pool_free_all(struct mvbc_ctx *ctx);
+struct sPortData *mvbc_record_batch(struct mvbc_ctx *ctx);
+int mvbc_check_project(const struct sProject *project);
+int mvbc_fcode_type(int fcode);
+void mvbc_line_account_index(struct mvbc_ctx *ctx, int idx, int frames, int errors);
+int mvbc_reader_fd(struct mvbc_ctx *ctx, int idx);
+int mvbc_reader_fd_dup(struct mvbc_ctx *ctx, int idx, uint32_t *generation);
+int mvbc_read_index(struct mvbc_ctx *ctx, int idx, struct sPortData *recs, int max);
+void mvbc_reader_close(struct mvbc_ctx *ctx, int idx);
+void mvbc_port_image_free(struct mvbc_ctx *ctx, int idx);
+void mvbc_port_seq_update(struct sMvbcPortSeq *seq, const struct sPortData *recs, int count);
+void mvbc_port_seq_free(struct mvbc_ctx *ctx, int idx);
+int mvbc_ctx_start_locked(struct mvbc_ctx *ctx, const struct sProject *project, int rc);
+int mvbc_device_restart(struct mvbc_ctx *ctx, int idx);
+int mvbc_memtest_prepare(struct mvbc_ctx *ctx, int idx);
+void mvbc_memtest_init_result(struct mvbc_ctx *ctx, int idx, int ok);
+void mvbc_memtest_start(struct mvbc_ctx *ctx);
+void mvbc_memtest_stop(struct mvbc_ctx *ctx);
+int mvbc_emu_cmd(const char *dev, int cmd, void *arg);
+int mvbc_emu_open(const char *dev);
+void mvbc_uio_attach(struct mvbc_ctx *ctx, int idx);
+
+/**
+ * one run of a profiled phase (mvbc_prof.h).
+ */
+struct sMvbcProfSample
+{
+	int iActive;
+
+	/** time enabled and time running of the group at the start in ns */
+	uint64_t ullStartTime[2];
+
+	/** group values at the start, in the order of the thread's group */
+	uint64_t ullStart[eProfCounterCount];
+};
+
+extern int gMvbcProfEnabled;
+int mvbc_prof_sample_start(struct sMvbcProfSample *s);
+void mvbc_prof_sample_stop(struct sMvbcProfSample *s, int phase, int records);
+int mvbc_prof_cmd_phase(int cmd);
+
+static inline void mvbc_prof_begin(struct sMvbcProfSample *s)
+{
+	s->iActive = __atomic_load_n(&gMvbcProfEnabled, __ATOMIC_RELAXED) && (mvbc_prof_sample_start(s) == 0);
+}
+
+static inline void mvbc_prof_end(struct sMvbcProfSample *s, int phase, int records)
+{
+	if (s->iActive)
+	{
+		mvbc_prof_sample_stop(s, phase, records);
+	}
+}
+
+/** counters of the metrics registry (mvbc_metrics.c) */
+enum eMvbcMetricCounter
+{
+	eMetricOverflowMerge,
+	eMetricOverflowMsg,
+	eMetricOverflowEmu,
+	eMetricCounterCount
+};
+
+/** init phases timed for the metrics, summed over the devices */
+enum eMvbcMetricInit
+{
+	eMetricInitParse,
+	eMetricInitShutdown,
+	eMetricInitReset,
+	eMetricInitDevice,
+	eMetricInitPorts,
+	eMetricInitRun,
+
+	/** mvbc_ctx_start_locked() as a whole */
+	eMetricInitStart,
+	eMetricInitCount
+};
+
+void mvbc_metric_add(int counter, uint64_t n);
+uint64_t mvbc_metric_cmd(int cmd, int rc, const struct timespec *start);
+uint64_t mvbc_metric_lap_ns(struct timespec *mark);
+void mvbc_metric_init_phase(int phase, uint64_t ns);
+void mvbc_metric_read(struct mvbc_ctx *ctx, int idx, const struct sPortData *recs, int count, int max, const struct timespec *now);
+void mvbc_metric_describe(struct mvbc_ctx *ctx);
+void mvbc_metric_free(struct mvbc_ctx *ctx);
+
+#endif
@@ -0,0 +1,253 @@
+/**
+ * @file
+ *
+ * Line A/B redundancy supervision of MVBC devices.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "mvbc_internal.h"
+#include "mvbc_cmd.h"
+
+/**
+ * Milliseconds between two CLOCK_MONOTONIC time stamps.
+ *
+ * @param from
+ * @param to
+ * @return to - from in milliseconds
+ */
+static int64_t line_elapsed_ms(const struct timespec *from, const struct timespec *to)
+{
+	return (int64_t)(to->tv_sec - from->tv_sec) * 1000 + (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+/**
+ * Decode the trusted line(s) from the decoder register.
+ *
+ * @param wDR
+ * @return enum eLineMode, -1 if the decoder trusts none of the lines
+ */
+static int line_from_dr(uint16_t wDR)
+{
+	int rc = -1;
+
+	if ((wDR & MVBC_DR_LAA) && (wDR & MVBC_DR_LBA))
+	{
+		rc = eLineAB;
+	}
+	else if (wDR & MVBC_DR_LAA)
+	{
+		rc = eLineA;
+	}
+	else if (wDR & MVBC_DR_LBA)
+	{
+		rc = eLineB;
+	}
+	return rc;
+}
+
+int mvbc_ctx_set_line_mode(mvbc_ctx *ctx, const char *dev, int line)
+{
+	int rc = 0;
+
+	if ((ctx == NULL) || (dev == NULL) || (line < eLineA) || (line > eLineAB))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->ctxLock);
+
+	for (int i = 0; i < ctx->iLineOverrideCount; i++)
+	{
+		if (strncmp(ctx->lineOverride[i].cDevPath, dev, MAX_STRING_LENGTH) == 0)
+		{
+			ctx->lineOverride[i].iLine = line;
+			pthread_mutex_unlock(&ctx->ctxLock);
+			return 0;
+		}
+	}
+
+	if (ctx->iLineOverrideCount >= MAX_MVBC_DEVICES)
+	{
+		DEBUG_OUT( "ERROR too many line overrides\n");
+		rc = -1;
+	}
+	else
+	{
+		struct sMvbcLineOverride *entry = &ctx->lineOverride[ctx->iLineOverrideCount++];
+
+		strncpy(entry->cDevPath, dev, MAX_STRING_LENGTH - 1);
+		entry->iLine = line;
+	}
+
+	pthread_mutex_unlock(&ctx->ctxLock);
+
+	return rc;
+}
+
+int mvbc_set_line_mode(const char *dev, int line)
+{
+	return mvbc_ctx_set_line_mode(mvbc_default_ctx(), dev, line);
+}
+
+/**
+ * Replace the parsed line mode by the one selected with mvbc_ctx_set_line_mode().
+ * Called with ctx->ctxLock held.
+ *
+ * @param ctx
+ */
+void mvbc_line_apply_overrides(struct mvbc_ctx *ctx)
+{
+	struct sProject *pProject = &ctx->project;
+
+	for (int i = 0; i < ctx->iLineOverrideCount; i++)
+	{
+		for (int j = 0; j < pProject->mvbc_device_count; j++)
+		{
+			if (strncmp(pProject->mvbc[j].cDevPath, ctx->lineOverride[i].cDevPath, MAX_STRING_LENGTH) == 0)
+			{
+				DEBUG_OUT( "DEVICE[%d]\tline[%d] -> [%d]\n", j, pProject->mvbc[j].iLine, ctx->lineOverride[i].iLine);
+				pProject->mvbc[j].iLine = ctx->lineOverride[i].iLine;
+			}
+		}
+	}
+}
+
+int mvbc_ctx_line_update(mvbc_ctx *ctx, const char *dev)
+{
+	int idx = mvbc_find_device(ctx, dev);
+	struct sMvbcLineState *line;
+	struct sMvbcDeviceConfig deviceCfg;
+	struct timespec now;
+	int active;
+	int rc = 1;
+
+	if (idx < 0)
+	{
+		return -1;
+	}
+
+	line = &ctx->dev[idx].line;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&ctx->devLock[idx]);
+
+	if ((line->stats.uiPolls != 0) && (line_elapsed_ms(&line->sLastPoll, &now) < MVBC_LINE_POLL_INTERVAL_MS))
+	{
+		rc = 0;
+	}
+	/* one ioctl returns MCR, DR and SCR together */
+	else if (mvbc_send_cmd(dev, EL_MVBC_GET_DEVICE_CONFIGURATION, &deviceCfg) < 0)
+	{
+		line->stats.uiPollErrors++;
+		rc = -1;
+	}
+	else
+	{
+		active = line_from_dr(deviceCfg.regs.wDR);
+
+		if (line->stats.uiPolls != 0)
+		{
+			if (line->stats.iActiveLine >= 0)
+			{
+				line->stats.ullTimeOnLineMS[line->stats.iActiveLine] += line_elapsed_ms(&line->sLastPoll, &now);
+			}
+			if (active != line->stats.iActiveLine)
+			{
+				DEBUG_OUT( "%s: line switch [%d] -> [%d]\n", dev, line->stats.iActiveLine, active);
+				line->stats.uiSwitchovers++;
+			}
+		}
+
+		line->stats.iActiveLine = active;
+		line->stats.uiPolls++;
+		line->sLastPoll = now;
+	}
+
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return rc;
+}
+
+int mvbc_line_update(const char *dev)
+{
+	return mvbc_ctx_line_update(mvbc_default_ctx(), dev);
+}
+
+/**
+ * Account records and errors to the trusted line of ctx->dev[idx].
+ * Called with ctx->devLock[idx] held.
+ *
+ * @param ctx
+ * @param idx
+ * @param frames
+ * @param errors
+ */
+void mvbc_line_account_index(struct mvbc_ctx *ctx, int idx, int frames, int errors)
+{
+	struct sMvbcLineStats *stats = &ctx->dev[idx].line.stats;
+
+	/* before the first register read assume the configured line */
+	int active = (stats->iActiveLine >= 0) ? stats->iActiveLine : stats->iConfiguredLine;
+
+	stats->ullFrames[active] += frames;
+	stats->ullErrors[active] += errors;
+}
+
+int mvbc_ctx_line_account(mvbc_ctx *ctx, const char *dev, int frames, int errors)
+{
+	int idx = mvbc_find_device(ctx, dev);
+
+	if (idx < 0)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->devLock[idx]);
+	mvbc_line_account_index(ctx, idx, frames, errors);
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return 0;
+}
+
+int mvbc_line_account(const char *dev, int frames, int errors)
+{
+	return mvbc_ctx_line_account(mvbc_default_ctx(), dev, frames, errors);
+}
+
+int mvbc_ctx_get_line_stats(mvbc_ctx *ctx, const char *dev, struct sMvbcLineStats *stats)
+{
+	int idx = mvbc_find_device(ctx, dev);
+
+	if ((idx < 0) || (stats == NULL))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->devLock[idx]);
+	*stats = ctx->dev[idx].line.stats;
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return 0;
+}
+
+int mvbc_get_line_stats(const char *dev, struct sMvbcLineStats *stats)
+{
+	return mvbc_ctx_get_line_stats(mvbc_default_ctx(), dev, stats);
+}
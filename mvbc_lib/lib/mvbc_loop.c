@@ -0,0 +1,510 @@
+/**
+ * @file
+ *
+ * Single threaded event loop dispatching records and timers to waiters.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+
+#include "mvbc_internal.h"
+#include "mvbc_loop.h"
+
+/**
+ * a device of the loop and its waiters.
+ */
+struct sMvbcLoopDev
+{
+	/** index into ctx->dev[] */
+	int iIdx;
+
+	/** device path for the traces, the configuration may be replaced meanwhile */
+	char cDevPath[MAX_STRING_LENGTH];
+
+	/** port waiters by address, created on the first port wait */
+	struct sMvbcLoopWait **pPort;
+
+	/** batch waiters */
+	struct sMvbcLoopWait *pBatch;
+
+	/** waiters of this device, it is only read while > 0 */
+	int iWaiters;
+
+	/** CLOCK_MONOTONIC in microseconds until the device is polled again after an error, 0 = polled */
+	uint64_t ullRetryUS;
+};
+
+struct sMvbcLoop
+{
+	mvbc_ctx *ctx;
+
+	struct sMvbcLoopDev dev[MAX_MVBC_DEVICES];
+	int iDevCount;
+
+	/** timer waiters, min heap on ullDeadlineUS */
+	struct sMvbcLoopWait **pTimer;
+	int iTimerCount;
+	int iTimerSize;
+
+	/** port, batch and timer waiters */
+	int iWaiters;
+
+	int iStop;
+
+	/** records of the device being dispatched, a block of the record pool */
+	struct sPortData *batch;
+};
+
+#if MVBC_LOOP_BATCH > MVBC_POOL_RECORD_BLOCK
+#error "a batch is one block of the record pool"
+#endif
+
+uint64_t mvbc_loop_now_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+struct sMvbcLoop *mvbc_loop_create(mvbc_ctx *ctx)
+{
+	struct sMvbcLoop *loop;
+
+	if (ctx == NULL)
+	{
+		return NULL;
+	}
+
+	loop = calloc(1, sizeof(struct sMvbcLoop));
+	if (loop == NULL)
+	{
+		DEBUG_OUT( "ERROR no memory for the event loop\n");
+		return NULL;
+	}
+	loop->ctx = ctx;
+
+	loop->batch = mvbc_record_batch(ctx);
+	if (loop->batch == NULL)
+	{
+		free(loop);
+		return NULL;
+	}
+
+	return loop;
+}
+
+void mvbc_loop_destroy(struct sMvbcLoop *loop)
+{
+	if (loop == NULL)
+	{
+		return;
+	}
+
+	for (int i = 0; i < loop->iDevCount; i++)
+	{
+		free(loop->dev[i].pPort);
+	}
+	free(loop->pTimer);
+	mvbc_ctx_record_free(loop->ctx, loop->batch);
+	free(loop);
+}
+
+int mvbc_loop_device(struct sMvbcLoop *loop, const char *dev)
+{
+	int idx;
+
+	if (loop == NULL)
+	{
+		return -1;
+	}
+
+	idx = mvbc_find_device(loop->ctx, dev);
+	if (idx < 0)
+	{
+		DEBUG_OUT( "ERROR device [%s] not configured\n", dev ? dev : "");
+		return -1;
+	}
+
+	for (int i = 0; i < loop->iDevCount; i++)
+	{
+		if (loop->dev[i].iIdx == idx)
+		{
+			return i;
+		}
+	}
+
+	if (loop->iDevCount == MAX_MVBC_DEVICES)
+	{
+		return -1;
+	}
+
+	loop->dev[loop->iDevCount].iIdx = idx;
+	snprintf(loop->dev[loop->iDevCount].cDevPath, MAX_STRING_LENGTH, "%s", dev);
+	return loop->iDevCount++;
+}
+
+int mvbc_loop_wait_port(struct sMvbcLoop *loop, int dev, int addr, struct sMvbcLoopWait *w)
+{
+	struct sMvbcLoopDev *d;
+
+	if ((loop == NULL) || (dev < 0) || (dev >= loop->iDevCount) || (addr <= 0) || (addr > MAX_PORT_COUNT) || (w == NULL) || (w->fn == NULL))
+	{
+		return -1;
+	}
+
+	d = &loop->dev[dev];
+	if (d->pPort == NULL)
+	{
+		d->pPort = calloc(MAX_PORT_COUNT + 1, sizeof(struct sMvbcLoopWait *));
+		if (d->pPort == NULL)
+		{
+			DEBUG_OUT( "ERROR no memory for the port waiters\n");
+			return -1;
+		}
+	}
+
+	w->pNext = d->pPort[addr];
+	d->pPort[addr] = w;
+	d->iWaiters++;
+	loop->iWaiters++;
+
+	return 0;
+}
+
+int mvbc_loop_wait_batch(struct sMvbcLoop *loop, int dev, struct sMvbcLoopWait *w)
+{
+	struct sMvbcLoopDev *d;
+
+	if ((loop == NULL) || (dev < 0) || (dev >= loop->iDevCount) || (w == NULL) || (w->fn == NULL))
+	{
+		return -1;
+	}
+
+	d = &loop->dev[dev];
+	w->pNext = d->pBatch;
+	d->pBatch = w;
+	d->iWaiters++;
+	loop->iWaiters++;
+
+	return 0;
+}
+
+int mvbc_loop_wait_until(struct sMvbcLoop *loop, struct sMvbcLoopWait *w)
+{
+	int pos;
+
+	if ((loop == NULL) || (w == NULL) || (w->fn == NULL))
+	{
+		return -1;
+	}
+
+	if (loop->iTimerCount == loop->iTimerSize)
+	{
+		int size = loop->iTimerSize ? loop->iTimerSize * 2 : 64;
+		struct sMvbcLoopWait **timer = realloc(loop->pTimer, size * sizeof(struct sMvbcLoopWait *));
+
+		if (timer == NULL)
+		{
+			DEBUG_OUT( "ERROR no memory for the loop timers\n");
+			return -1;
+		}
+		loop->pTimer = timer;
+		loop->iTimerSize = size;
+	}
+
+	/* sift up */
+	pos = loop->iTimerCount++;
+	while (pos > 0)
+	{
+		int parent = (pos - 1) / 2;
+
+		if (loop->pTimer[parent]->ullDeadlineUS <= w->ullDeadlineUS)
+		{
+			break;
+		}
+		loop->pTimer[pos] = loop->pTimer[parent];
+		pos = parent;
+	}
+	loop->pTimer[pos] = w;
+	loop->iWaiters++;
+
+	return 0;
+}
+
+/**
+ * Remove the earliest timer.
+ *
+ * @param loop
+ * @return timer waiter
+ */
+static struct sMvbcLoopWait *loop_timer_pop(struct sMvbcLoop *loop)
+{
+	struct sMvbcLoopWait *top = loop->pTimer[0];
+	struct sMvbcLoopWait *last = loop->pTimer[--loop->iTimerCount];
+	int count = loop->iTimerCount;
+	int pos = 0;
+
+	/* sift down */
+	for (;;)
+	{
+		int child = pos * 2 + 1;
+
+		if (child >= count)
+		{
+			break;
+		}
+		if ((child + 1 < count) && (loop->pTimer[child + 1]->ullDeadlineUS < loop->pTimer[child]->ullDeadlineUS))
+		{
+			child++;
+		}
+		if (last->ullDeadlineUS <= loop->pTimer[child]->ullDeadlineUS)
+		{
+			break;
+		}
+		loop->pTimer[pos] = loop->pTimer[child];
+		pos = child;
+	}
+	if (count > 0)
+	{
+		loop->pTimer[pos] = last;
+	}
+	loop->iWaiters--;
+
+	return top;
+}
+
+/**
+ * Call the waiters of the records in loop->batch. A list is taken off before its
+ * waiters are called, so that a waiter registering again gets the next record.
+ *
+ * @param loop
+ * @param d
+ * @param count records in loop->batch
+ * @return number of waiters called
+ */
+static int loop_dispatch(struct sMvbcLoop *loop, struct sMvbcLoopDev *d, int count)
+{
+	struct sMvbcProfSample prof;
+	struct sMvbcLoopWait *w;
+	int called = 0;
+	int woken = 0;
+
+	mvbc_prof_begin(&prof);
+
+	for (int i = 0; (i < count) && (d->pPort != NULL); i++)
+	{
+		const struct sPortData *rec = &loop->batch[i];
+
+		if (rec->wPortAddr > MAX_PORT_COUNT)
+		{
+			continue;
+		}
+
+		w = d->pPort[rec->wPortAddr];
+		d->pPort[rec->wPortAddr] = NULL;
+		if (w == NULL)
+		{
+			continue;
+		}
+		woken = called;
+		while (w != NULL)
+		{
+			struct sMvbcLoopWait *next = w->pNext;
+
+			d->iWaiters--;
+			loop->iWaiters--;
+			w->pNext = NULL;
+			w->pRec = rec;
+			w->iCount = 1;
+			w->fn(w);
+			called++;
+			w = next;
+		}
+		MVBC_TRACE3(dispatch, d->cDevPath, rec->wPortAddr, called - woken);
+	}
+
+	w = d->pBatch;
+	d->pBatch = NULL;
+	woken = called;
+	while (w != NULL)
+	{
+		struct sMvbcLoopWait *next = w->pNext;
+
+		d->iWaiters--;
+		loop->iWaiters--;
+		w->pNext = NULL;
+		w->pRec = loop->batch;
+		w->iCount = count;
+		w->fn(w);
+		called++;
+		w = next;
+	}
+
+	if (called > woken)
+	{
+		MVBC_TRACE3(dispatch, d->cDevPath, -1, called - woken);
+	}
+
+	mvbc_prof_end(&prof, eProfDispatch, count);
+	return called;
+}
+
+int mvbc_loop_run_once(struct sMvbcLoop *loop, int timeout_ms)
+{
+	struct pollfd pollDesc[MAX_MVBC_DEVICES];
+	struct timespec ts;
+	int64_t waitUS = (timeout_ms < 0) ? -1 : (int64_t)timeout_ms * 1000;
+	int polled = 0;
+	int called = 0;
+	uint64_t now;
+	int rc;
+
+	if (loop == NULL)
+	{
+		return -1;
+	}
+
+	now = mvbc_loop_now_us();
+	if (loop->iTimerCount > 0)
+	{
+		uint64_t due = loop->pTimer[0]->ullDeadlineUS;
+
+		if ((waitUS < 0) || (due < now + waitUS))
+		{
+			waitUS = (due > now) ? (int64_t)(due - now) : 0;
+		}
+	}
+
+	/* only devices with waiters are read, records nobody waits for stay in the FIFO */
+	for (int i = 0; i < loop->iDevCount; i++)
+	{
+		struct sMvbcLoopDev *d = &loop->dev[i];
+
+		pollDesc[i].fd = -1;
+		pollDesc[i].events = POLLIN;
+		pollDesc[i].revents = 0;
+
+		if (d->iWaiters == 0)
+		{
+			continue;
+		}
+		if (d->ullRetryUS > now)
+		{
+			/* backing off after an error, the wait ends with the back off */
+			if ((waitUS < 0) || (d->ullRetryUS < now + waitUS))
+			{
+				waitUS = d->ullRetryUS - now;
+			}
+			continue;
+		}
+
+		/* fetched again every time, the watchdog or an init may have replaced it */
+		d->ullRetryUS = 0;
+		pollDesc[i].fd = mvbc_reader_fd(loop->ctx, d->iIdx);
+		polled += (pollDesc[i].fd >= 0);
+	}
+
+	if ((polled == 0) && (waitUS < 0))
+	{
+		/* nothing could ever end the wait */
+		return -1;
+	}
+
+	ts.tv_sec = waitUS / 1000000;
+	ts.tv_nsec = (waitUS % 1000000) * 1000;
+	rc = ppoll(pollDesc, loop->iDevCount, (waitUS < 0) ? NULL : &ts, NULL);
+	if (rc < 0)
+	{
+		return (errno == EINTR) ? 0 : -1;
+	}
+
+	for (int i = 0; (i < loop->iDevCount) && (rc > 0); i++)
+	{
+		struct sMvbcLoopDev *d = &loop->dev[i];
+
+		/* waiters of this device may have registered again for the next batch */
+		while ((pollDesc[i].revents & POLLIN) && (d->iWaiters > 0))
+		{
+			int got = mvbc_read_index(loop->ctx, d->iIdx, loop->batch, MVBC_LOOP_BATCH);
+
+			if (got <= 0)
+			{
+				break;
+			}
+
+			called += loop_dispatch(loop, d, got);
+			if (got < MVBC_LOOP_BATCH)
+			{
+				break;
+			}
+		}
+
+		/* without the back off an error would be reported by every poll at once */
+		if (pollDesc[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+		{
+			DEBUG_OUT( "ERROR [%s] poll events [%X], retry in %d ms\n", d->cDevPath, pollDesc[i].revents, MVBC_LOOP_RETRY_MS);
+			d->ullRetryUS = mvbc_loop_now_us() + MVBC_LOOP_RETRY_MS * 1000;
+		}
+	}
+
+	if (loop->iTimerCount > 0)
+	{
+		now = mvbc_loop_now_us();
+		while ((loop->iTimerCount > 0) && (loop->pTimer[0]->ullDeadlineUS <= now))
+		{
+			struct sMvbcLoopWait *w = loop_timer_pop(loop);
+
+			w->fn(w);
+			called++;
+		}
+	}
+
+	return called;
+}
+
+int mvbc_loop_run(struct sMvbcLoop *loop)
+{
+	if (loop == NULL)
+	{
+		return -1;
+	}
+
+	loop->iStop = 0;
+	while (!loop->iStop && (loop->iWaiters > 0))
+	{
+		if (mvbc_loop_run_once(loop, -1) < 0)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void mvbc_loop_stop(struct sMvbcLoop *loop)
+{
+	if (loop != NULL)
+	{
+		loop->iStop = 1;
+	}
+}
@@ -0,0 +1,434 @@
+/**
+ * @file
+ *
+ * Traffic memory test in the background and per boot test markers.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "mvbc_internal.h"
+#include "mvbc_memtest.h"
+
+/** words of the two pages of one port index */
+#define MEMTEST_INDEX_WORDS 32
+
+/**
+ * Get the id of the running boot.
+ *
+ * @param id
+ * @param len
+ * @return 0 in case of success, -1 for error
+ */
+static int memtest_boot_id(char *id, int len)
+{
+	FILE *f = fopen("/proc/sys/kernel/random/boot_id", "r");
+	int rc = -1;
+
+	if (f != NULL)
+	{
+		if (fgets(id, len, f) != NULL)
+		{
+			id[strcspn(id, "\n")] = 0;
+			rc = 0;
+		}
+		fclose(f);
+	}
+	return rc;
+}
+
+/**
+ * Marker file of a device, e.g. /run/mvbc/_dev_mvbc1.memtest
+ *
+ * @param dev
+ * @param path
+ * @param len
+ */
+static void memtest_marker_path(const char *dev, char *path, size_t len)
+{
+	char name[MAX_STRING_LENGTH];
+
+	strncpy(name, dev, MAX_STRING_LENGTH - 1);
+	name[MAX_STRING_LENGTH - 1] = 0;
+	for (char *c = name; *c != 0; c++)
+	{
+		if ((*c == '/') || (*c == ':'))
+		{
+			*c = '_';
+		}
+	}
+	snprintf(path, len, "%s/%s.memtest", MVBC_MEMTEST_MARKER_DIR, name);
+}
+
+/**
+ * Check whether the memory of a device passed a test during this boot.
+ *
+ * @param dev
+ * @return 1 if marked, 0 if not
+ */
+static int memtest_marked(const char *dev)
+{
+	char path[MAX_STRING_LENGTH + sizeof(MVBC_MEMTEST_MARKER_DIR) + 16];
+	char boot[64];
+	char mark[64] = "";
+	FILE *f;
+
+	if (memtest_boot_id(boot, sizeof(boot)) != 0)
+	{
+		return 0;
+	}
+
+	memtest_marker_path(dev, path, sizeof(path));
+	f = fopen(path, "r");
+	if (f == NULL)
+	{
+		return 0;
+	}
+	if (fgets(mark, sizeof(mark), f) != NULL)
+	{
+		mark[strcspn(mark, "\n")] = 0;
+	}
+	fclose(f);
+
+	return strcmp(mark, boot) == 0;
+}
+
+/**
+ * Leave the marker of a passed test.
+ *
+ * @param dev
+ */
+static void memtest_mark(const char *dev)
+{
+	char path[MAX_STRING_LENGTH + sizeof(MVBC_MEMTEST_MARKER_DIR) + 16];
+	char boot[64];
+	FILE *f;
+
+	if (memtest_boot_id(boot, sizeof(boot)) != 0)
+	{
+		return;
+	}
+
+	if ((mkdir(MVBC_MEMTEST_MARKER_DIR, 0755) != 0) && (errno != EEXIST))
+	{
+		DEBUG_OUT( "WARNING no marker directory [%s] %s\n", MVBC_MEMTEST_MARKER_DIR, strerror(errno));
+		return;
+	}
+
+	memtest_marker_path(dev, path, sizeof(path));
+	f = fopen(path, "w");
+	if (f != NULL)
+	{
+		fprintf(f, "%s\n", boot);
+		fclose(f);
+	}
+}
+
+/**
+ * Select the test of ctx->dev[idx] before its reset. Called with ctx->ctxLock held.
+ *
+ * @param ctx
+ * @param idx
+ * @return 1 if the reset ioctl has to run the memory test, 0 if not
+ */
+int mvbc_memtest_prepare(struct mvbc_ctx *ctx, int idx)
+{
+	struct sMvbcDevCfg *mvbc = &ctx->project.mvbc[idx];
+	struct sMvbcMemtestStatus *st = &ctx->dev[idx].memtest;
+
+	memset(st, 0, sizeof(struct sMvbcMemtestStatus));
+	ctx->dev[idx].uiMemtestIndex = 0;
+
+	if ((mvbc->iTestTrafficMemory != MVBC_MEMTEST_INIT) && (mvbc->iTestTrafficMemory != MVBC_MEMTEST_BACKGROUND))
+	{
+		st->iState = eMemtestOff;
+		return 0;
+	}
+
+	if (mvbc->iTestTrafficMemory == MVBC_MEMTEST_BACKGROUND)
+	{
+#ifndef MVBC_UIO_BOARD_LAYOUT
+		/* the patterns would go wherever the built-in offsets point to in the running controller */
+		DEBUG_OUT( "WARNING [%s] background memory test needs the board layout (MVBC_UIO_BOARD_LAYOUT)\n", mvbc->cDevPath);
+		st->iState = eMemtestUnavailable;
+		return 0;
+#endif
+		if ((int)mvbc->iMode != eStatic)
+		{
+			/* the sniffer may claim an index while its pages are under test */
+			DEBUG_OUT( "WARNING [%s] background memory test only in static mode\n", mvbc->cDevPath);
+			st->iState = eMemtestUnavailable;
+			return 0;
+		}
+	}
+
+	if (memtest_marked(mvbc->cDevPath))
+	{
+		DEBUG_OUT( "DEVICE[%d]\ttraffic memory tested during this boot\n", idx);
+		st->iState = eMemtestCached;
+		return 0;
+	}
+
+	st->iState = eMemtestPending;
+
+	return mvbc->iTestTrafficMemory == MVBC_MEMTEST_INIT;
+}
+
+/**
+ * Record the result of a memory test run by the reset ioctl. Called with ctx->ctxLock held.
+ *
+ * @param ctx
+ * @param idx
+ * @param ok 1 if the reset passed
+ */
+void mvbc_memtest_init_result(struct mvbc_ctx *ctx, int idx, int ok)
+{
+	struct sMvbcMemtestStatus *st = &ctx->dev[idx].memtest;
+
+	st->iState = ok ? eMemtestPassed : eMemtestFailed;
+	if (ok)
+	{
+		memtest_mark(ctx->project.mvbc[idx].cDevPath);
+	}
+}
+
+/**
+ * Test one word with three patterns and restore it.
+ *
+ * @param w
+ * @return 1 if the word kept all patterns, 0 if not
+ */
+static int memtest_word(volatile uint16_t *w)
+{
+	uint16_t saved = *w;
+	uint16_t pattern[3] = { 0x5555, 0xAAAA, (uint16_t)~saved };
+	int ok = 1;
+
+	for (int p = 0; p < 3; p++)
+	{
+		*w = pattern[p];
+		if (*w != pattern[p])
+		{
+			ok = 0;
+		}
+	}
+	*w = saved;
+
+	return ok;
+}
+
+/**
+ * Test the next slice of ctx->dev[idx]. Called with ctx->devLock[idx] held.
+ *
+ * @param ctx
+ * @param idx
+ */
+static void memtest_slice(struct mvbc_ctx *ctx, int idx)
+{
+	struct sMvbcDevState *state = &ctx->dev[idx];
+	struct sMvbcMemtestStatus *st = &state->memtest;
+	volatile uint16_t *pit = (volatile uint16_t *)(state->uio.pBase + MVBC_UIO_PIT_OFFSET);
+	volatile uint16_t *data = (volatile uint16_t *)(state->uio.pBase + MVBC_UIO_DATA_OFFSET);
+	uint8_t used[MVBC_UIO_PORT_INDICES];
+	uint32_t words = 0;
+
+	/* ports may be added by the sniffer at any time, so the port index table is read for every slice */
+	memset(used, 0, sizeof(used));
+	used[0] = 1;
+	for (int addr = 1; addr <= MAX_PORT_COUNT; addr++)
+	{
+		uint16_t index = pit[addr];
+
+		if (index < MVBC_UIO_PORT_INDICES)
+		{
+			used[index] = 1;
+		}
+	}
+
+	if (st->iState == eMemtestPending)
+	{
+		for (int i = 0; i < MVBC_UIO_PORT_INDICES; i++)
+		{
+			st->uiWordsTotal += used[i] ? 0 : MEMTEST_INDEX_WORDS;
+		}
+		state->uiMemtestIndex = 1;
+		st->iState = eMemtestRunning;
+	}
+
+	while ((words < MVBC_MEMTEST_SLICE_WORDS) && (state->uiMemtestIndex < MVBC_UIO_PORT_INDICES))
+	{
+		uint32_t index = state->uiMemtestIndex++;
+
+		if (used[index])
+		{
+			continue;
+		}
+
+		for (int w = 0; w < MEMTEST_INDEX_WORDS; w++)
+		{
+			volatile uint16_t *word = &data[index * MEMTEST_INDEX_WORDS + w];
+
+			if (!memtest_word(word))
+			{
+				if (st->uiErrors++ == 0)
+				{
+					st->uiFirstErrorOffset = (const volatile uint8_t *)word - state->uio.pBase;
+				}
+			}
+		}
+		words += MEMTEST_INDEX_WORDS;
+	}
+
+	st->uiWordsTested += words;
+	st->uiSlices++;
+
+	if (state->uiMemtestIndex >= MVBC_UIO_PORT_INDICES)
+	{
+		st->iState = (st->uiErrors == 0) ? eMemtestPassed : eMemtestFailed;
+		DEBUG_OUT( "DEVICE[%d]\ttraffic memory test done, errors [%u]\n", idx, st->uiErrors);
+		if (st->uiErrors == 0)
+		{
+			memtest_mark(state->cDevPath);
+		}
+	}
+}
+
+/**
+ * Background test thread: one slice per device and period until all tests are done.
+ *
+ * @param arg context
+ * @return NULL
+ */
+static void *memtest_thread(void *arg)
+{
+	struct mvbc_ctx *ctx = arg;
+	struct timespec pause = { MVBC_MEMTEST_PERIOD_MS / 1000, (MVBC_MEMTEST_PERIOD_MS % 1000) * 1000000 };
+	int pending = 1;
+
+	while (pending && __atomic_load_n(&ctx->iMemtestRunning, __ATOMIC_ACQUIRE))
+	{
+		pending = 0;
+
+		/* a parse may replace ctx->project meanwhile, devices not tested are eMemtestOff */
+		for (int i = 0; i < MAX_MVBC_DEVICES; i++)
+		{
+			struct sMvbcDevState *state = &ctx->dev[i];
+			struct sMvbcMemtestStatus *st = &state->memtest;
+
+			pthread_mutex_lock(&ctx->devLock[i]);
+
+			if ((st->iState == eMemtestPending) || (st->iState == eMemtestRunning))
+			{
+				struct timespec now;
+				int64_t silent;
+
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				silent = (int64_t)(now.tv_sec - state->health.sLastRecord.tv_sec) * 1000 +
+					(now.tv_nsec - state->health.sLastRecord.tv_nsec) / 1000000;
+
+				if (state->uio.pBase == NULL)
+				{
+					DEBUG_OUT( "WARNING [%s] background memory test needs the traffic memory (uio)\n", state->cDevPath);
+					st->iState = eMemtestUnavailable;
+				}
+				else if ((silent < MVBC_MEMTEST_IDLE_MS) && (state->uiMemtestDeferred < MVBC_MEMTEST_MAX_DEFER))
+				{
+					state->uiMemtestDeferred++;
+					st->uiDeferred++;
+					pending = 1;
+				}
+				else
+				{
+					state->uiMemtestDeferred = 0;
+					memtest_slice(ctx, i);
+					pending |= (st->iState == eMemtestRunning);
+				}
+			}
+
+			pthread_mutex_unlock(&ctx->devLock[i]);
+		}
+
+		if (pending)
+		{
+			nanosleep(&pause, NULL);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Start the background test if a device waits for it. Called with ctx->ctxLock held.
+ *
+ * @param ctx
+ */
+void mvbc_memtest_start(struct mvbc_ctx *ctx)
+{
+	int pending = 0;
+
+	for (int i = 0; i < ctx->project.mvbc_device_count; i++)
+	{
+		pending |= ((ctx->project.mvbc[i].iTestTrafficMemory == MVBC_MEMTEST_BACKGROUND) && (ctx->dev[i].memtest.iState == eMemtestPending));
+	}
+
+	if (pending && !ctx->iMemtestRunning)
+	{
+		ctx->iMemtestRunning = 1;
+		if (pthread_create(&ctx->memtestThread, NULL, memtest_thread, ctx) != 0)
+		{
+			DEBUG_OUT( "ERROR starting the memory test %s\n", strerror(errno));
+			ctx->iMemtestRunning = 0;
+		}
+	}
+}
+
+/**
+ * Stop the background test, e.g. before the traffic memory is unmapped. Called with ctx->ctxLock held.
+ *
+ * @param ctx
+ */
+void mvbc_memtest_stop(struct mvbc_ctx *ctx)
+{
+	if (ctx->iMemtestRunning)
+	{
+		__atomic_store_n(&ctx->iMemtestRunning, 0, __ATOMIC_RELEASE);
+		pthread_join(ctx->memtestThread, NULL);
+	}
+}
+
+int mvbc_ctx_get_memtest_status(mvbc_ctx *ctx, const char *dev, struct sMvbcMemtestStatus *status)
+{
+	int idx = mvbc_find_device(ctx, dev);
+
+	if ((idx < 0) || (status == NULL))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->devLock[idx]);
+	*status = ctx->dev[idx].memtest;
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return 0;
+}
+
+int mvbc_get_memtest_status(const char *dev, struct sMvbcMemtestStatus *status)
+{
+	return mvbc_ctx_get_memtest_status(mvbc_default_ctx(), dev, status);
+}
@@ -0,0 +1,334 @@
+/**
+ * @file
+ *
+ * Time ordered k-way merge of the records of several MVBC devices.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <poll.h>
+
+#include "mvbc_merge.h"
+#include "mvbc_cfg.h"
+#include "mvbc_internal.h"
+
+#define RING_MASK (MVBC_MERGE_RING_SIZE - 1)
+
+/**
+ * Time stamp of a record in microseconds.
+ *
+ * @param rec
+ * @return
+ */
+static int64_t merge_time_us(const struct sPortData *rec)
+{
+	return (int64_t)rec->sTimeStamp.tv_sec * 1000000 + rec->sTimeStamp.tv_usec;
+}
+
+/**
+ * Time stamp of the oldest buffered record of a device.
+ *
+ * @param m
+ * @param dev
+ * @return
+ */
+static int64_t merge_key(const struct sMvbcMerge *m, int dev)
+{
+	const struct sMvbcMergeRing *ring = &m->ring[dev];
+
+	return merge_time_us(&ring->rec[ring->uiHead & RING_MASK]);
+}
+
+static uint32_t merge_ring_count(const struct sMvbcMergeRing *ring)
+{
+	return ring->uiTail - ring->uiHead;
+}
+
+/**
+ * Restore the heap order upwards from position pos.
+ *
+ * @param m
+ * @param pos
+ */
+static void merge_sift_up(struct sMvbcMerge *m, int pos)
+{
+	int dev = m->iHeap[pos];
+	int64_t key = merge_key(m, dev);
+
+	while (pos > 0)
+	{
+		int parent = (pos - 1) / 2;
+
+		if (merge_key(m, m->iHeap[parent]) <= key)
+		{
+			break;
+		}
+		m->iHeap[pos] = m->iHeap[parent];
+		pos = parent;
+	}
+	m->iHeap[pos] = dev;
+}
+
+/**
+ * Restore the heap order downwards from position pos.
+ *
+ * @param m
+ * @param pos
+ */
+static void merge_sift_down(struct sMvbcMerge *m, int pos)
+{
+	int dev = m->iHeap[pos];
+	int64_t key = merge_key(m, dev);
+
+	for (;;)
+	{
+		int child = 2 * pos + 1;
+
+		if (child >= m->iHeapSize)
+		{
+			break;
+		}
+		if ((child + 1 < m->iHeapSize) && (merge_key(m, m->iHeap[child + 1]) < merge_key(m, m->iHeap[child])))
+		{
+			child++;
+		}
+		if (key <= merge_key(m, m->iHeap[child]))
+		{
+			break;
+		}
+		m->iHeap[pos] = m->iHeap[child];
+		pos = child;
+	}
+	m->iHeap[pos] = dev;
+}
+
+/**
+ * Account records added to the ring of a device, insert the device into the heap if it was empty.
+ *
+ * @param m
+ * @param dev
+ * @param count
+ */
+static void merge_commit(struct sMvbcMerge *m, int dev, uint32_t count)
+{
+	struct sMvbcMergeRing *ring = &m->ring[dev];
+	int wasEmpty = (merge_ring_count(ring) == 0);
+
+	ring->uiTail += count;
+	m->stats.ullIn += count;
+
+	if (wasEmpty && count)
+	{
+		m->iHeap[m->iHeapSize] = dev;
+		merge_sift_up(m, m->iHeapSize++);
+	}
+}
+
+int mvbc_ctx_merge_init(mvbc_ctx *ctx, struct sMvbcMerge *m, int window_us)
+{
+	const struct sMvbcCfgSnapshot *cfg;
+
+	if ((ctx == NULL) || (m == NULL))
+	{
+		return -1;
+	}
+
+	memset(m, 0, sizeof(struct sMvbcMerge));
+
+	m->ctx = ctx;
+	cfg = mvbc_ctx_cfg_enter(ctx);
+	m->iDevCount = (cfg != NULL) ? cfg->project.mvbc_device_count : 0;
+	mvbc_ctx_cfg_leave(ctx);
+	m->llWindowUS = (window_us < 0) ? MVBC_MERGE_DEFAULT_WINDOW_US : window_us;
+
+	return 0;
+}
+
+int mvbc_merge_init(struct sMvbcMerge *m, int window_us)
+{
+	return mvbc_ctx_merge_init(mvbc_default_ctx(), m, window_us);
+}
+
+int mvbc_merge_set_window(struct sMvbcMerge *m, int window_us)
+{
+	if ((m == NULL) || (window_us < 0))
+	{
+		return -1;
+	}
+
+	m->llWindowUS = window_us;
+
+	return 0;
+}
+
+int mvbc_merge_push(struct sMvbcMerge *m, int dev, const struct sPortData *rec)
+{
+	struct sMvbcMergeRing *ring;
+
+	if ((m == NULL) || (rec == NULL) || (dev < 0) || (dev >= m->iDevCount))
+	{
+		return -1;
+	}
+
+	ring = &m->ring[dev];
+
+	if (merge_ring_count(ring) == MVBC_MERGE_RING_SIZE)
+	{
+		m->stats.uiDropped++;
+		mvbc_metric_add(eMetricOverflowMerge, 1);
+		if (MVBC_TRACE_ENABLED(queue__overflow))
+		{
+			char path[MAX_STRING_LENGTH];
+
+			mvbc_cfg_dev_path(m->ctx, dev, path);
+			MVBC_TRACE3(queue__overflow, "merge", path, 1);
+		}
+		return -1;
+	}
+
+	ring->rec[ring->uiTail & RING_MASK] = *rec;
+	merge_commit(m, dev, 1);
+
+	return 0;
+}
+
+int mvbc_merge_fill(struct sMvbcMerge *m, int timeout_ms)
+{
+	struct pollfd pollDesc[MAX_MVBC_DEVICES];
+	int total = 0;
+	int rc;
+
+	if (m == NULL)
+	{
+		return -1;
+	}
+
+	for (int i = 0; i < m->iDevCount; i++)
+	{
+		pollDesc[i].fd = mvbc_reader_fd(m->ctx, i);
+		pollDesc[i].events = POLLIN;
+		pollDesc[i].revents = 0;
+
+		/* a full buffer leaves the records in the driver FIFO */
+		if (merge_ring_count(&m->ring[i]) == MVBC_MERGE_RING_SIZE)
+		{
+			pollDesc[i].fd = -1;
+		}
+	}
+
+	rc = poll(pollDesc, m->iDevCount, timeout_ms);
+	if (rc <= 0)
+	{
+		return rc;
+	}
+
+	for (int i = 0; i < m->iDevCount; i++)
+	{
+		struct sMvbcMergeRing *ring = &m->ring[i];
+
+		if (!(pollDesc[i].revents & POLLIN))
+		{
+			continue;
+		}
+
+		/* read straight into the ring, at most two chunks because of the wrap around */
+		for (int chunk = 0; chunk < 2; chunk++)
+		{
+			uint32_t pos = ring->uiTail & RING_MASK;
+			uint32_t space = MVBC_MERGE_RING_SIZE - merge_ring_count(ring);
+			uint32_t contiguous = MVBC_MERGE_RING_SIZE - pos;
+			int got;
+
+			if (space == 0)
+			{
+				break;
+			}
+
+			got = mvbc_read_index(m->ctx, i, &ring->rec[pos], space < contiguous ? space : contiguous);
+			if (got <= 0)
+			{
+				break;
+			}
+
+			merge_commit(m, i, got);
+			total += got;
+		}
+	}
+
+	return total;
+}
+
+int mvbc_merge_pop(struct sMvbcMerge *m, struct sPortData *out, int *dev, const struct timeval *now)
+{
+	struct sMvbcMergeRing *ring;
+	int64_t key;
+	int top;
+
+	if ((m == NULL) || (out == NULL) || (m->iHeapSize == 0))
+	{
+		return 0;
+	}
+
+	top = m->iHeap[0];
+	ring = &m->ring[top];
+	key = merge_key(m, top);
+
+	if (now != NULL)
+	{
+		int64_t nowUS = (int64_t)now->tv_sec * 1000000 + now->tv_usec;
+
+		if (key > nowUS - m->llWindowUS)
+		{
+			/* still inside the window, only a full buffer forces it out */
+			if (merge_ring_count(ring) < MVBC_MERGE_RING_SIZE)
+			{
+				return 0;
+			}
+			m->stats.uiForced++;
+		}
+	}
+
+	*out = ring->rec[ring->uiHead & RING_MASK];
+	ring->uiHead++;
+
+	if (dev != NULL)
+	{
+		*dev = top;
+	}
+
+	if (key < m->llLastOutUS)
+	{
+		m->stats.uiLate++;
+	}
+	else
+	{
+		m->llLastOutUS = key;
+	}
+	m->stats.ullOut++;
+
+	if (merge_ring_count(ring) == 0)
+	{
+		m->iHeap[0] = m->iHeap[--m->iHeapSize];
+	}
+	if (m->iHeapSize > 0)
+	{
+		merge_sift_down(m, 0);
+	}
+
+	return 1;
+}
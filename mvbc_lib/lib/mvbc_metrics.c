@@ -0,0 +1,1068 @@
+/**
+ * @file
+ *
+ * Metrics registry and Prometheus text exporter.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mvbc_internal.h"
+#include "mvbc_cfg.h"
+#include "mvbc_metrics.h"
+
+#if MVBC_METRICS_PORTS != MAX_PORT_COUNT + 1
+#error "the shared counters cover all port addresses"
+#endif
+
+/** counter slots, CPUs above share slots */
+#define METRICS_CPUS 64
+
+/** ioctl commands told apart, as mvbc_prof_cmd_phase() */
+#define METRICS_CMDS (eProfCmdOther - eProfCmdReset + 1)
+
+/** latency histogram buckets without +Inf */
+#define METRICS_BUCKETS 10
+
+#define METRICS_DEFAULT_PERIOD_MS 1000
+
+/** a stalled client does not hold up the exporter longer */
+#define METRICS_SEND_TIMEOUT_MS 1000
+
+/**
+ * counters of one CPU, only uint64_t so that a scrape can sum the slots as arrays.
+ */
+struct sMetricSlot
+{
+	uint64_t ullCounter[eMetricCounterCount];
+
+	uint64_t ullCmdCalls[METRICS_CMDS];
+	uint64_t ullCmdErrors[METRICS_CMDS];
+	uint64_t ullCmdSumNS[METRICS_CMDS];
+
+	/** per bucket, not cumulative, the last one is +Inf */
+	uint64_t ullCmdBucket[METRICS_CMDS][METRICS_BUCKETS + 1];
+} __attribute__((aligned(64)));
+
+/**
+ * text being formatted, with the snprintf() semantics of mvbc_ctx_metrics_format().
+ */
+struct sMetricsText
+{
+	char *pBuf;
+	size_t size;
+	size_t len;
+};
+
+struct sMvbcMetricsExp
+{
+	struct mvbc_ctx *ctx;
+
+	char cFile[PATH_MAX];
+	char cTemp[PATH_MAX + 8];
+	char cSocket[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	int iPeriodMS;
+
+	int iListen;
+	int iWake;
+
+	/** text buffer, grown as needed */
+	char *pText;
+	size_t textSize;
+};
+
+static struct sMetricSlot gSlot[METRICS_CPUS];
+
+/** last init, written under ctxLock */
+static uint64_t gInitNS[eMetricInitCount];
+
+/** upper bounds of the latency buckets */
+static const uint32_t gBucketUS[METRICS_BUCKETS] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 50000, 100000 };
+
+static const char *gCmdNames[METRICS_CMDS] =
+{
+	"reset",
+	"set_device",
+	"get_device",
+	"set_port",
+	"get_port",
+	"run",
+	"shutdown",
+	"other"
+};
+
+static const char *gInitNames[eMetricInitCount] =
+{
+	"parse",
+	"shutdown",
+	"reset",
+	"device",
+	"ports",
+	"run",
+	"start"
+};
+
+static const char *gOverflowNames[eMetricCounterCount] =
+{
+	"merge",
+	"msg_sessions",
+	"emu_fifo"
+};
+
+static struct sMetricSlot *metric_slot(void)
+{
+	int cpu = sched_getcpu();
+
+	return &gSlot[(cpu < 0) ? 0 : (cpu % METRICS_CPUS)];
+}
+
+void mvbc_metric_add(int counter, uint64_t n)
+{
+	if ((counter >= 0) && (counter < eMetricCounterCount))
+	{
+		__atomic_add_fetch(&metric_slot()->ullCounter[counter], n, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Time since a mark, the mark moves on to now.
+ *
+ * @param mark CLOCK_MONOTONIC
+ * @return nanoseconds
+ */
+uint64_t mvbc_metric_lap_ns(struct timespec *mark)
+{
+	struct timespec now;
+	int64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (int64_t)(now.tv_sec - mark->tv_sec) * 1000000000 + (now.tv_nsec - mark->tv_nsec);
+	*mark = now;
+
+	return (ns > 0) ? (uint64_t)ns : 0;
+}
+
+/**
+ * Count an ioctl.
+ *
+ * @param cmd
+ * @param rc result of the call
+ * @param start CLOCK_MONOTONIC before the call
+ * @return latency in nanoseconds
+ */
+uint64_t mvbc_metric_cmd(int cmd, int rc, const struct timespec *start)
+{
+	struct timespec mark = *start;
+	uint64_t ns = mvbc_metric_lap_ns(&mark);
+	struct sMetricSlot *slot = metric_slot();
+	int c = mvbc_prof_cmd_phase(cmd) - eProfCmdReset;
+	int b = 0;
+
+	while ((b < METRICS_BUCKETS) && (ns > (uint64_t)gBucketUS[b] * 1000))
+	{
+		b++;
+	}
+
+	__atomic_add_fetch(&slot->ullCmdCalls[c], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&slot->ullCmdSumNS[c], ns, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&slot->ullCmdBucket[c][b], 1, __ATOMIC_RELAXED);
+	if (rc < 0)
+	{
+		__atomic_add_fetch(&slot->ullCmdErrors[c], 1, __ATOMIC_RELAXED);
+	}
+
+	return ns;
+}
+
+void mvbc_metric_init_phase(int phase, uint64_t ns)
+{
+	if ((phase >= 0) && (phase < eMetricInitCount))
+	{
+		__atomic_store_n(&gInitNS[phase], ns, __ATOMIC_RELAXED);
+	}
+}
+
+static int64_t metric_now_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Count the records of a read per device and port.
+ * Called with ctx->devLock[idx] held, so every counter has a single writer.
+ *
+ * @param ctx
+ * @param idx
+ * @param recs
+ * @param count
+ * @param max buffer size of the read
+ * @param now CLOCK_MONOTONIC of the read
+ */
+void mvbc_metric_read(struct mvbc_ctx *ctx, int idx, const struct sPortData *recs, int count, int max, const struct timespec *now)
+{
+	struct sMvbcMetricsShm *block = __atomic_load_n(&ctx->pMetricsShm, __ATOMIC_ACQUIRE);
+	struct sMvbcDevMetric *d;
+	struct timeval wall;
+	int64_t us = (int64_t)now->tv_sec * 1000000 + now->tv_nsec / 1000;
+
+	if (block == NULL)
+	{
+		return;
+	}
+
+	d = &block->dev[idx];
+	__atomic_store_n(&d->ullReads, d->ullReads + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&d->ullRecords, d->ullRecords + count, __ATOMIC_RELAXED);
+	if (count == max)
+	{
+		__atomic_store_n(&d->ullFullReads, d->ullFullReads + 1, __ATOMIC_RELAXED);
+	}
+
+	/* the driver stamps the records with the wall clock */
+	gettimeofday(&wall, NULL);
+
+	for (int i = 0; i < count; i++)
+	{
+		struct sMvbcPortMetric *port;
+		int64_t age;
+		int b = 0;
+
+		if (recs[i].wPortAddr > MAX_PORT_COUNT)
+		{
+			continue;
+		}
+		port = &d->port[recs[i].wPortAddr];
+		__atomic_store_n(&port->ullRecords, port->ullRecords + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&port->llLastUS, us, __ATOMIC_RELAXED);
+
+		age = (int64_t)(wall.tv_sec - recs[i].sTimeStamp.tv_sec) * 1000000 + (wall.tv_usec - recs[i].sTimeStamp.tv_usec);
+		if (age > 0)
+		{
+			b = 64 - __builtin_clzll((uint64_t)age);
+			b = (b < MVBC_METRICS_LAT_BUCKETS) ? b : MVBC_METRICS_LAT_BUCKETS - 1;
+		}
+		__atomic_store_n(&port->uiLatency[b], port->uiLatency[b] + 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Write the device paths, port names and poll intervals of the configuration.
+ * Readers retry while uiDescSeq is odd or changed.
+ *
+ * @param ctx
+ * @param block
+ */
+static void metric_describe_block(struct mvbc_ctx *ctx, struct sMvbcMetricsShm *block)
+{
+	const struct sProject *project = &ctx->project;
+
+	__atomic_add_fetch(&block->uiDescSeq, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memset(block->cDevPath, 0, sizeof(block->cDevPath));
+	memset(block->wPollMS, 0, sizeof(block->wPollMS));
+	memset(block->cPortName, 0, sizeof(block->cPortName));
+
+	block->iDevCount = project->mvbc_device_count;
+	for (int i = 0; i < project->mvbc_device_count; i++)
+	{
+		const struct sMvbcDevCfg *mvbc = &project->mvbc[i];
+
+		snprintf(block->cDevPath[i], MAX_STRING_LENGTH, "%s", mvbc->cDevPath);
+		for (int j = 0; j < mvbc->portSetup.mvbc_port_count; j++)
+		{
+			const struct sMvbcPortCfg *port = &mvbc->portSetup.port[j].portCfg;
+
+			if ((port->iPortAddr < 0) || (port->iPortAddr > MAX_PORT_COUNT))
+			{
+				continue;
+			}
+			snprintf(block->cPortName[i][port->iPortAddr], MVBC_METRICS_NAME_LENGTH, "%.*s", MVBC_METRICS_NAME_LENGTH - 1, mvbc->portSetup.port[j].cPortName);
+			if ((port->iPortDirection == eSink) && (port->iPollIntervalMS > 0))
+			{
+				block->wPollMS[i][port->iPortAddr] = (port->iPollIntervalMS < 0xFFFF) ? port->iPollIntervalMS : 0xFFFF;
+			}
+		}
+	}
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_add_fetch(&block->uiDescSeq, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Describe the configuration of the last init. Called with ctx->ctxLock held.
+ *
+ * @param ctx
+ */
+void mvbc_metric_describe(struct mvbc_ctx *ctx)
+{
+	if (ctx->pMetricsShm != NULL)
+	{
+		metric_describe_block(ctx, ctx->pMetricsShm);
+	}
+}
+
+/**
+ * Create the device and port counters, the last read of every port starts now.
+ * Called with ctx->ctxLock held.
+ *
+ * @param ctx
+ * @param file shared memory file, NULL for process memory
+ * @return 0 in case of success, -1 for error
+ */
+static int metric_block_create(struct mvbc_ctx *ctx, const char *file)
+{
+	struct sMvbcMetricsShm *block;
+	size_t size = sizeof(struct sMvbcMetricsShm);
+	int64_t us;
+
+	if (ctx->pMetricsShm != NULL)
+	{
+		/* kept from an earlier start, it cannot move into shared memory any more */
+		return ((file == NULL) || (strcmp(ctx->pMetricsShm->cFile, file) == 0)) ? 0 : -1;
+	}
+
+	if (file == NULL)
+	{
+		block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	else
+	{
+		int fd;
+
+		if (strlen(file) >= sizeof(block->cFile))
+		{
+			return -1;
+		}
+
+		/* a new file, a monitor still mapping the old one keeps it */
+		unlink(file);
+		fd = open(file, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+		if ((fd < 0) || (ftruncate(fd, size) != 0))
+		{
+			DEBUG_OUT( "ERROR metrics file [%s] %s\n", file, strerror(errno));
+			if (fd >= 0)
+			{
+				close(fd);
+				unlink(file);
+			}
+			return -1;
+		}
+		block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+	}
+
+	if (block == MAP_FAILED)
+	{
+		DEBUG_OUT( "ERROR no memory for the metrics %s\n", strerror(errno));
+		return -1;
+	}
+
+	us = metric_now_us();
+	for (int i = 0; i < MAX_MVBC_DEVICES; i++)
+	{
+		for (int j = 0; j < MVBC_METRICS_PORTS; j++)
+		{
+			block->dev[i].port[j].llLastUS = us;
+		}
+	}
+	block->uiVersion = MVBC_METRICS_SHM_VERSION;
+	block->iPid = getpid();
+	if (file != NULL)
+	{
+		strcpy(block->cFile, file);
+	}
+	metric_describe_block(ctx, block);
+
+	/* a monitor takes the block as valid from here on */
+	__atomic_store_n(&block->uiMagic, MVBC_METRICS_SHM_MAGIC, __ATOMIC_RELEASE);
+	__atomic_store_n(&ctx->pMetricsShm, block, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+void mvbc_metric_free(struct mvbc_ctx *ctx)
+{
+	struct sMvbcMetricsShm *block = ctx->pMetricsShm;
+
+	if (block == NULL)
+	{
+		return;
+	}
+
+	ctx->pMetricsShm = NULL;
+	if (block->cFile[0] != '\0')
+	{
+		unlink(block->cFile);
+	}
+	munmap(block, sizeof(struct sMvbcMetricsShm));
+}
+
+/**
+ * Sum the counter slots of all CPUs.
+ *
+ * @param sum
+ */
+static void metric_sum(struct sMetricSlot *sum)
+{
+	uint64_t *dst = (uint64_t *)sum;
+	size_t n = sizeof(struct sMetricSlot) / sizeof(uint64_t);
+
+	memset(sum, 0, sizeof(struct sMetricSlot));
+
+	for (int cpu = 0; cpu < METRICS_CPUS; cpu++)
+	{
+		uint64_t *src = (uint64_t *)&gSlot[cpu];
+
+		for (size_t i = 0; i < n; i++)
+		{
+			dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static void text_add(struct sMetricsText *t, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void text_add(struct sMetricsText *t, const char *fmt, ...)
+{
+	size_t room = (t->len < t->size) ? t->size - t->len : 0;
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf((room > 0) ? t->pBuf + t->len : NULL, room, fmt, ap);
+	va_end(ap);
+
+	if (n > 0)
+	{
+		t->len += n;
+	}
+}
+
+/**
+ * Add a label value, escaped as the exposition format demands.
+ *
+ * @param t
+ * @param value
+ */
+static void text_label(struct sMetricsText *t, const char *value)
+{
+	for (; *value != '\0'; value++)
+	{
+		char c = *value;
+		int esc = (c == '\\') || (c == '"') || (c == '\n');
+
+		if (esc)
+		{
+			if (t->len + 1 < t->size)
+			{
+				t->pBuf[t->len] = '\\';
+			}
+			t->len++;
+			c = (c == '\n') ? 'n' : c;
+		}
+		if (t->len + 1 < t->size)
+		{
+			t->pBuf[t->len] = c;
+		}
+		t->len++;
+	}
+}
+
+static void text_family(struct sMetricsText *t, const char *name, const char *type, const char *help)
+{
+	text_add(t, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * Add one sample with the device label.
+ *
+ * @param t
+ * @param name
+ * @param dev
+ * @param value
+ */
+static void text_dev(struct sMetricsText *t, const char *name, const char *dev, uint64_t value)
+{
+	text_add(t, "%s{dev=\"", name);
+	text_label(t, dev);
+	text_add(t, "\"} %llu\n", (unsigned long long)value);
+}
+
+static void format_cmds(struct sMetricsText *t, const struct sMetricSlot *sum)
+{
+	text_family(t, "mvbc_ioctl_calls_total", "counter", "Driver commands sent.");
+	for (int c = 0; c < METRICS_CMDS; c++)
+	{
+		text_add(t, "mvbc_ioctl_calls_total{cmd=\"%s\"} %llu\n", gCmdNames[c], (unsigned long long)sum->ullCmdCalls[c]);
+	}
+
+	text_family(t, "mvbc_ioctl_errors_total", "counter", "Driver commands that failed.");
+	for (int c = 0; c < METRICS_CMDS; c++)
+	{
+		text_add(t, "mvbc_ioctl_errors_total{cmd=\"%s\"} %llu\n", gCmdNames[c], (unsigned long long)sum->ullCmdErrors[c]);
+	}
+
+	text_family(t, "mvbc_ioctl_duration_seconds", "histogram", "Latency of the driver commands.");
+	for (int c = 0; c < METRICS_CMDS; c++)
+	{
+		uint64_t count = 0;
+
+		for (int b = 0; b <= METRICS_BUCKETS; b++)
+		{
+			count += sum->ullCmdBucket[c][b];
+			if (b < METRICS_BUCKETS)
+			{
+				text_add(t, "mvbc_ioctl_duration_seconds_bucket{cmd=\"%s\",le=\"%g\"} %llu\n",
+						 gCmdNames[c], gBucketUS[b] / 1e6, (unsigned long long)count);
+			}
+			else
+			{
+				text_add(t, "mvbc_ioctl_duration_seconds_bucket{cmd=\"%s\",le=\"+Inf\"} %llu\n", gCmdNames[c], (unsigned long long)count);
+			}
+		}
+		text_add(t, "mvbc_ioctl_duration_seconds_sum{cmd=\"%s\"} %.9f\n", gCmdNames[c], sum->ullCmdSumNS[c] / 1e9);
+		text_add(t, "mvbc_ioctl_duration_seconds_count{cmd=\"%s\"} %llu\n", gCmdNames[c], (unsigned long long)count);
+	}
+}
+
+static void format_queues(struct sMetricsText *t, struct mvbc_ctx *ctx, const struct sMetricSlot *sum)
+{
+	static const char *names[] = { "msg_pool", "rec_pool" };
+	struct sMvbcPoolStats pool[2];
+
+	memset(pool, 0, sizeof(pool));
+	mvbc_ctx_get_pool_stats(ctx, eMessagePool, &pool[0]);
+	mvbc_ctx_get_pool_stats(ctx, eRecordPool, &pool[1]);
+
+	text_family(t, "mvbc_queue_overflows_total", "counter", "Records or messages dropped because a queue was full.");
+	for (int i = 0; i < eMetricCounterCount; i++)
+	{
+		text_add(t, "mvbc_queue_overflows_total{queue=\"%s\"} %llu\n", gOverflowNames[i], (unsigned long long)sum->ullCounter[i]);
+	}
+	for (int i = 0; i < 2; i++)
+	{
+		text_add(t, "mvbc_queue_overflows_total{queue=\"%s\"} %llu\n", names[i], (unsigned long long)pool[i].ullExhausted);
+	}
+
+	text_family(t, "mvbc_queue_depth", "gauge", "Objects in use.");
+	for (int i = 0; i < 2; i++)
+	{
+		text_add(t, "mvbc_queue_depth{queue=\"%s\"} %u\n", names[i], pool[i].uiInUse);
+	}
+
+	text_family(t, "mvbc_queue_high_water", "gauge", "Most objects in use at once.");
+	for (int i = 0; i < 2; i++)
+	{
+		text_add(t, "mvbc_queue_high_water{queue=\"%s\"} %u\n", names[i], pool[i].uiHighWater);
+	}
+
+	text_family(t, "mvbc_queue_capacity", "gauge", "Objects of the queue.");
+	for (int i = 0; i < 2; i++)
+	{
+		text_add(t, "mvbc_queue_capacity{queue=\"%s\"} %u\n", names[i], pool[i].uiCapacity);
+	}
+}
+
+/**
+ * Count the configured sink ports of a device without a record for MVBC_METRICS_STALE_FACTOR poll intervals.
+ *
+ * @param block
+ * @param idx
+ * @param nowUS
+ * @return number of stale ports
+ */
+static uint64_t metric_stale_ports(const struct sMvbcMetricsShm *block, int idx, int64_t nowUS)
+{
+	uint64_t stale = 0;
+
+	for (int addr = 0; addr < MVBC_METRICS_PORTS; addr++)
+	{
+		int64_t poll = block->wPollMS[idx][addr];
+
+		if ((poll > 0) &&
+			(nowUS - __atomic_load_n(&block->dev[idx].port[addr].llLastUS, __ATOMIC_RELAXED) > poll * 1000 * MVBC_METRICS_STALE_FACTOR))
+		{
+			stale++;
+		}
+	}
+
+	return stale;
+}
+
+static void format_devices(struct sMetricsText *t, struct mvbc_ctx *ctx, const struct sMvbcCfgSnapshot *cfg)
+{
+	const struct sMvbcMetricsShm *block = __atomic_load_n(&ctx->pMetricsShm, __ATOMIC_ACQUIRE);
+	int count = cfg->project.mvbc_device_count;
+	int64_t nowUS = metric_now_us();
+
+	text_family(t, "mvbc_device_records_total", "counter", "Records read from the device FIFO.");
+	for (int i = 0; i < count; i++)
+	{
+		text_dev(t, "mvbc_device_records_total", cfg->project.mvbc[i].cDevPath, __atomic_load_n(&ctx->dev[i].stats.ullRecords, __ATOMIC_RELAXED));
+	}
+
+	text_family(t, "mvbc_device_reads_total", "counter", "read() calls on the device.");
+	for (int i = 0; i < count; i++)
+	{
+		text_dev(t, "mvbc_device_reads_total", cfg->project.mvbc[i].cDevPath, __atomic_load_n(&ctx->dev[i].stats.ullReads, __ATOMIC_RELAXED));
+	}
+
+	text_family(t, "mvbc_device_read_errors_total", "counter", "read() calls that failed.");
+	for (int i = 0; i < count; i++)
+	{
+		text_dev(t, "mvbc_device_read_errors_total", cfg->project.mvbc[i].cDevPath, __atomic_load_n(&ctx->dev[i].stats.uiReadErrors, __ATOMIC_RELAXED));
+	}
+
+	text_family(t, "mvbc_device_short_reads_total", "counter", "read() calls that ended in a partial record, completed by the next read.");
+	for (int i = 0; i < count; i++)
+	{
+		text_dev(t, "mvbc_device_short_reads_total", cfg->project.mvbc[i].cDevPath, __atomic_load_n(&ctx->dev[i].stats.uiShortReads, __ATOMIC_RELAXED));
+	}
+
+	text_family(t, "mvbc_device_full_reads_total", "counter", "Reads that filled the buffer of the caller, the FIFO may have held more.");
+	for (int i = 0; (i < count) && (block != NULL); i++)
+	{
+		text_dev(t, "mvbc_device_full_reads_total", cfg->project.mvbc[i].cDevPath, __atomic_load_n(&block->dev[i].ullFullReads, __ATOMIC_RELAXED));
+	}
+
+	text_family(t, "mvbc_device_recoveries_total", "counter", "Devices restarted by the watchdog.");
+	for (int i = 0; i < count; i++)
+	{
+		text_dev(t, "mvbc_device_recoveries_total", cfg->project.mvbc[i].cDevPath, __atomic_load_n(&ctx->dev[i].health.stats.uiRecoveries, __ATOMIC_RELAXED));
+	}
+
+	text_family(t, "mvbc_device_stale_total", "counter", "Watchdog checks that found the device read but silent.");
+	for (int i = 0; i < count; i++)
+	{
+		text_dev(t, "mvbc_device_stale_total", cfg->project.mvbc[i].cDevPath, __atomic_load_n(&ctx->dev[i].health.uiStale, __ATOMIC_RELAXED));
+	}
+
+	text_add(t, "# HELP mvbc_device_stale_ports Configured sink ports without a record for %d poll intervals.\n"
+			 "# TYPE mvbc_device_stale_ports gauge\n", MVBC_METRICS_STALE_FACTOR);
+	for (int i = 0; (i < count) && (block != NULL); i++)
+	{
+		text_dev(t, "mvbc_device_stale_ports", cfg->project.mvbc[i].cDevPath, metric_stale_ports(block, i, nowUS));
+	}
+
+	text_family(t, "mvbc_port_records_total", "counter", "Records read per port, ports without records are left out.");
+	for (int i = 0; (i < count) && (block != NULL); i++)
+	{
+		for (int addr = 0; addr <= MAX_PORT_COUNT; addr++)
+		{
+			uint64_t records = __atomic_load_n(&block->dev[i].port[addr].ullRecords, __ATOMIC_RELAXED);
+			int port = cfg->iPortIndex[i][addr];
+
+			if (records == 0)
+			{
+				continue;
+			}
+			text_add(t, "mvbc_port_records_total{dev=\"");
+			text_label(t, cfg->project.mvbc[i].cDevPath);
+			text_add(t, "\",port=\"0x%03X\",name=\"", addr);
+			text_label(t, (port != MVBC_CFG_NO_PORT) ? cfg->project.mvbc[i].portSetup.port[port].cPortName : "");
+			text_add(t, "\"} %llu\n", (unsigned long long)records);
+		}
+	}
+}
+
+int mvbc_ctx_metrics_format(mvbc_ctx *ctx, char *buf, size_t size)
+{
+	struct sMetricsText t = { buf, (buf != NULL) ? size : 0, 0 };
+	struct sMetricSlot sum;
+	const struct sMvbcCfgSnapshot *cfg;
+
+	if (ctx == NULL)
+	{
+		return -1;
+	}
+
+	metric_sum(&sum);
+
+	format_cmds(&t, &sum);
+	format_queues(&t, ctx, &sum);
+
+	text_family(&t, "mvbc_init_phase_seconds", "gauge", "Duration of the phases of the last init, summed over the devices.");
+	for (int i = 0; i < eMetricInitCount; i++)
+	{
+		text_add(&t, "mvbc_init_phase_seconds{phase=\"%s\"} %.6f\n", gInitNames[i], __atomic_load_n(&gInitNS[i], __ATOMIC_RELAXED) / 1e9);
+	}
+
+	cfg = mvbc_ctx_cfg_enter(ctx);
+	if (cfg != NULL)
+	{
+		format_devices(&t, ctx, cfg);
+	}
+	mvbc_ctx_cfg_leave(ctx);
+
+	if (t.size > 0)
+	{
+		t.pBuf[(t.len < t.size) ? t.len : t.size - 1] = '\0';
+	}
+
+	return (t.len > INT_MAX) ? -1 : (int)t.len;
+}
+
+int mvbc_metrics_format(char *buf, size_t size)
+{
+	return mvbc_ctx_metrics_format(mvbc_default_ctx(), buf, size);
+}
+
+/**
+ * Format the text into the buffer of the exporter, growing it as needed.
+ *
+ * @param e
+ * @return length, -1 for error
+ */
+static int exp_render(struct sMvbcMetricsExp *e)
+{
+	for (;;)
+	{
+		int len = mvbc_ctx_metrics_format(e->ctx, e->pText, e->textSize);
+		char *p;
+
+		if ((len < 0) || ((size_t)len < e->textSize))
+		{
+			return len;
+		}
+
+		/* some head room for ports that start sending */
+		p = realloc(e->pText, len + len / 4 + 1);
+		if (p == NULL)
+		{
+			DEBUG_OUT( "ERROR no memory for the metrics text\n");
+			return -1;
+		}
+		e->pText = p;
+		e->textSize = len + len / 4 + 1;
+	}
+}
+
+static int exp_write_all(int fd, const char *p, int len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * Rewrite the file. Readers see the old or the new text, never a part.
+ *
+ * @param e
+ */
+static void exp_write_file(struct sMvbcMetricsExp *e)
+{
+	int len = exp_render(e);
+	int fd;
+	int rc;
+
+	if (len < 0)
+	{
+		return;
+	}
+
+	fd = open(e->cTemp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		DEBUG_OUT( "ERROR open [%s] %s\n", e->cTemp, strerror(errno));
+		return;
+	}
+	rc = exp_write_all(fd, e->pText, len);
+	if (close(fd) != 0)
+	{
+		rc = -1;
+	}
+	if (rc != 0)
+	{
+		DEBUG_OUT( "ERROR write [%s] %s\n", e->cTemp, strerror(errno));
+		unlink(e->cTemp);
+		return;
+	}
+	if (rename(e->cTemp, e->cFile) != 0)
+	{
+		DEBUG_OUT( "ERROR rename [%s] %s\n", e->cFile, strerror(errno));
+		unlink(e->cTemp);
+	}
+}
+
+/**
+ * Answer the pending connections with the current text.
+ *
+ * @param e
+ */
+static void exp_serve(struct sMvbcMetricsExp *e)
+{
+	struct timeval timeout = { METRICS_SEND_TIMEOUT_MS / 1000, (METRICS_SEND_TIMEOUT_MS % 1000) * 1000 };
+
+	for (;;)
+	{
+		int fd = accept4(e->iListen, NULL, NULL, SOCK_CLOEXEC);
+		int len;
+
+		if (fd < 0)
+		{
+			return;
+		}
+
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		len = exp_render(e);
+		if ((len >= 0) && (exp_write_all(fd, e->pText, len) != 0))
+		{
+			DEBUG_OUT( "ERROR metrics client %s\n", strerror(errno));
+		}
+		close(fd);
+	}
+}
+
+static void *exp_thread(void *arg)
+{
+	struct sMvbcMetricsExp *e = arg;
+	struct pollfd pollDesc[2];
+	struct timespec next;
+	int running = 1;
+
+	pollDesc[0].fd = e->iWake;
+	pollDesc[0].events = POLLIN;
+	pollDesc[1].fd = e->iListen;
+	pollDesc[1].events = POLLIN;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (running)
+	{
+		int timeout = -1;
+
+		if (e->cFile[0] != '\0')
+		{
+			struct timespec now;
+			int64_t dueMS;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			dueMS = (next.tv_sec - now.tv_sec) * 1000 + (next.tv_nsec - now.tv_nsec) / 1000000;
+			if (dueMS <= 0)
+			{
+				exp_write_file(e);
+				next = now;
+				next.tv_sec += e->iPeriodMS / 1000;
+				next.tv_nsec += (e->iPeriodMS % 1000) * 1000000;
+				if (next.tv_nsec >= 1000000000)
+				{
+					next.tv_sec++;
+					next.tv_nsec -= 1000000000;
+				}
+				dueMS = e->iPeriodMS;
+			}
+			timeout = (int)dueMS;
+		}
+
+		pollDesc[0].revents = 0;
+		pollDesc[1].revents = 0;
+		if (poll(pollDesc, 2, timeout) < 0)
+		{
+			continue;
+		}
+		if (pollDesc[0].revents & POLLIN)
+		{
+			running = 0;
+		}
+		else if (pollDesc[1].revents & POLLIN)
+		{
+			exp_serve(e);
+		}
+	}
+
+	mvbc_ctx_cfg_thread_exit(e->ctx);
+	return NULL;
+}
+
+static void exp_free(struct sMvbcMetricsExp *e)
+{
+	if (e->iListen >= 0)
+	{
+		close(e->iListen);
+		unlink(e->cSocket);
+	}
+	if (e->iWake >= 0)
+	{
+		close(e->iWake);
+	}
+	free(e->pText);
+	free(e);
+}
+
+/**
+ * Open the wakeup descriptor and the socket of an exporter.
+ *
+ * @param e
+ * @return 0 in case of success, -1 for error
+ */
+static int exp_open(struct sMvbcMetricsExp *e)
+{
+	struct sockaddr_un addr;
+
+	e->iWake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (e->iWake < 0)
+	{
+		return -1;
+	}
+
+	if (e->cSocket[0] == '\0')
+	{
+		return 0;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, e->cSocket);
+	unlink(e->cSocket);
+
+	e->iListen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if ((e->iListen < 0) || (bind(e->iListen, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(e->iListen, 8) != 0))
+	{
+		DEBUG_OUT( "ERROR metrics socket [%s] %s\n", e->cSocket, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int mvbc_ctx_metrics_start(mvbc_ctx *ctx, const struct sMvbcMetricsCfg *cfg)
+{
+	struct sMvbcMetricsExp *e;
+
+	if ((ctx == NULL) || (cfg == NULL) || ((cfg->pFile == NULL) && (cfg->pSocket == NULL) && (cfg->pShm == NULL)) || (cfg->iPeriodMS < 0))
+	{
+		return -1;
+	}
+
+	e = calloc(1, sizeof(struct sMvbcMetricsExp));
+	if (e == NULL)
+	{
+		DEBUG_OUT( "ERROR no memory for the metrics exporter\n");
+		return -1;
+	}
+
+	e->ctx = ctx;
+	e->iListen = -1;
+	e->iWake = -1;
+	e->iPeriodMS = (cfg->iPeriodMS != 0) ? cfg->iPeriodMS : METRICS_DEFAULT_PERIOD_MS;
+
+	if (((cfg->pFile != NULL) && (strlen(cfg->pFile) >= sizeof(e->cFile))) ||
+		((cfg->pSocket != NULL) && (strlen(cfg->pSocket) >= sizeof(e->cSocket))))
+	{
+		exp_free(e);
+		return -1;
+	}
+	if (cfg->pFile != NULL)
+	{
+		strcpy(e->cFile, cfg->pFile);
+		snprintf(e->cTemp, sizeof(e->cTemp), "%s.tmp", cfg->pFile);
+	}
+	if (cfg->pSocket != NULL)
+	{
+		strcpy(e->cSocket, cfg->pSocket);
+	}
+
+	pthread_mutex_lock(&ctx->ctxLock);
+
+	if ((ctx->pMetrics != NULL) || (metric_block_create(ctx, cfg->pShm) != 0) || (exp_open(e) != 0))
+	{
+		pthread_mutex_unlock(&ctx->ctxLock);
+		exp_free(e);
+		return -1;
+	}
+
+	if (pthread_create(&ctx->metricsThread, NULL, exp_thread, e) != 0)
+	{
+		DEBUG_OUT( "ERROR starting the metrics exporter %s\n", strerror(errno));
+		pthread_mutex_unlock(&ctx->ctxLock);
+		exp_free(e);
+		return -1;
+	}
+
+	ctx->pMetrics = e;
+	pthread_mutex_unlock(&ctx->ctxLock);
+	return 0;
+}
+
+int mvbc_metrics_start(const struct sMvbcMetricsCfg *cfg)
+{
+	return mvbc_ctx_metrics_start(mvbc_default_ctx(), cfg);
+}
+
+int mvbc_ctx_metrics_stop(mvbc_ctx *ctx)
+{
+	struct sMvbcMetricsExp *e;
+	uint64_t one = 1;
+
+	if (ctx == NULL)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->ctxLock);
+	e = ctx->pMetrics;
+	ctx->pMetrics = NULL;
+	pthread_mutex_unlock(&ctx->ctxLock);
+
+	if (e == NULL)
+	{
+		return -1;
+	}
+
+	if (write(e->iWake, &one, sizeof(one)) != sizeof(one))
+	{
+		DEBUG_OUT( "ERROR waking the metrics exporter %s\n", strerror(errno));
+	}
+	pthread_join(ctx->metricsThread, NULL);
+	exp_free(e);
+
+	return 0;
+}
+
+int mvbc_metrics_stop(void)
+{
+	return mvbc_ctx_metrics_stop(mvbc_default_ctx());
+}
@@ -0,0 +1,305 @@
+/**
+ * @file
+ *
+ * Reassembly of message data received on PP ports.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "mvbc_internal.h"
+#include "mvbc_msg.h"
+
+/**
+ * Milliseconds between two time stamps.
+ *
+ * @param from
+ * @param to
+ * @return to - from in milliseconds
+ */
+static long msg_elapsed_ms(const struct timeval *from, const struct timeval *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000L + (to->tv_usec - from->tv_usec) / 1000L;
+}
+
+/**
+ * Stop collecting a message and return its buffer to the pool.
+ *
+ * @param r
+ * @param slot
+ */
+static void msg_release(struct sMvbcMsgReassembler *r, struct sMvbcMsgSlot *slot)
+{
+	mvbc_pool_free(r->pPool, slot->pData);
+	slot->pData = NULL;
+	slot->iInUse = 0;
+}
+
+/**
+ * Find the slot collecting a message for the given device pair.
+ *
+ * @param r
+ * @param src
+ * @param dst
+ * @return slot or NULL
+ */
+static struct sMvbcMsgSlot *msg_find_slot(struct sMvbcMsgReassembler *r, uint16_t src, uint16_t dst)
+{
+	for (int i = 0; i < MVBC_MSG_MAX_SESSIONS; i++)
+	{
+		struct sMvbcMsgSlot *slot = &r->slot[i];
+
+		if (slot->iInUse && (slot->wSrcDevice == src) && (slot->wDstDevice == dst))
+		{
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Get a free slot. If all slots are in use the one with the oldest frame is dropped.
+ *
+ * @param r
+ * @return slot
+ */
+static struct sMvbcMsgSlot *msg_claim_slot(struct sMvbcMsgReassembler *r)
+{
+	struct sMvbcMsgSlot *oldest = &r->slot[0];
+
+	for (int i = 0; i < MVBC_MSG_MAX_SESSIONS; i++)
+	{
+		struct sMvbcMsgSlot *slot = &r->slot[i];
+
+		if (!slot->iInUse)
+		{
+			return slot;
+		}
+		if (msg_elapsed_ms(&slot->sLastFrame, &oldest->sLastFrame) > 0)
+		{
+			oldest = slot;
+		}
+	}
+
+	DEBUG_OUT( "no free buffer, drop message %X->%X\n", oldest->wSrcDevice, oldest->wDstDevice);
+	r->stats.uiEvictions++;
+	mvbc_metric_add(eMetricOverflowMsg, 1);
+	MVBC_TRACE3(queue__overflow, "msg", "", 1);
+	msg_release(r, oldest);
+	return oldest;
+}
+
+int mvbc_ctx_msg_init(mvbc_ctx *ctx, struct sMvbcMsgReassembler *r, int timeout_ms, mvbc_msg_callback callback, void *arg)
+{
+	if ((ctx == NULL) || (r == NULL) || (callback == NULL) || (timeout_ms < 0))
+	{
+		return -1;
+	}
+
+	memset(r, 0, sizeof(struct sMvbcMsgReassembler));
+
+	/* a context not initialised yet gets its pool now */
+	pthread_mutex_lock(&ctx->ctxLock);
+	if (ctx->pMsgPool == NULL)
+	{
+		mvbc_pool_setup(ctx);
+	}
+	r->pPool = ctx->pMsgPool;
+	pthread_mutex_unlock(&ctx->ctxLock);
+
+	if (r->pPool == NULL)
+	{
+		return -1;
+	}
+
+	r->iTimeoutMS = timeout_ms ? timeout_ms : MVBC_MSG_DEFAULT_TIMEOUT_MS;
+	r->callback = callback;
+	r->pCallbackArg = arg;
+
+	return 0;
+}
+
+int mvbc_msg_init(struct sMvbcMsgReassembler *r, int timeout_ms, mvbc_msg_callback callback, void *arg)
+{
+	return mvbc_ctx_msg_init(mvbc_default_ctx(), r, timeout_ms, callback, arg);
+}
+
+/**
+ * Feed one record, see mvbc_msg_feed().
+ *
+ * @param r
+ * @param rec
+ * @return 1 if a message was delivered, 0 if not, -1 for error
+ */
+static int msg_feed(struct sMvbcMsgReassembler *r, const struct sPortData *rec)
+{
+	struct sMvbcMsgSlot *slot;
+	struct timeval ts;
+	uint16_t dst, src, mtc, len, seq, words;
+
+	if ((r == NULL) || (rec == NULL))
+	{
+		return -1;
+	}
+
+	if ((rec->wPortType != ePP) || (rec->wNumOfWords < 3))
+	{
+		return 0;
+	}
+
+	r->stats.uiFrames++;
+
+	/* copy out of the packed record before taking its address */
+	ts = rec->sTimeStamp;
+	dst = rec->wPortData[0] & 0xFFF;
+	src = rec->wPortData[1] & 0xFFF;
+	mtc = rec->wPortData[2] >> 8;
+	len = rec->wPortData[2] & 0xFF;
+	seq = mtc & MVBC_MSG_MTC_SEQ_MASK;
+
+	/* never trust the length byte beyond the words actually received, nor those beyond the record */
+	words = (rec->wNumOfWords > MAX_PORT_DATA_LENGTH) ? MAX_PORT_DATA_LENGTH : rec->wNumOfWords;
+	if (len > (words - 3) * 2)
+	{
+		len = (words - 3) * 2;
+	}
+
+	slot = msg_find_slot(r, src, dst);
+
+	if (mtc & MVBC_MSG_MTC_FIRST)
+	{
+		if (slot != NULL)
+		{
+			/* new message started before the previous one was complete */
+			r->stats.uiSequenceErrors++;
+		}
+		else
+		{
+			slot = msg_claim_slot(r);
+
+			slot->pData = mvbc_pool_alloc(r->pPool);
+			if (slot->pData == NULL)
+			{
+				r->stats.uiNoBuffer++;
+				return 0;
+			}
+		}
+
+		slot->iInUse = 1;
+		slot->wSrcDevice = src;
+		slot->wDstDevice = dst;
+		slot->wFrameCount = 0;
+		slot->uiLength = 0;
+		slot->sFirstFrame = ts;
+	}
+	else if (slot == NULL)
+	{
+		/* middle or last frame without a first one */
+		r->stats.uiSequenceErrors++;
+		return 0;
+	}
+	else if ((seq != slot->wNextSeq) || (msg_elapsed_ms(&slot->sLastFrame, &ts) > r->iTimeoutMS))
+	{
+		if (seq != slot->wNextSeq)
+		{
+			r->stats.uiSequenceErrors++;
+		}
+		else
+		{
+			r->stats.uiTimeouts++;
+		}
+		msg_release(r, slot);
+		return 0;
+	}
+
+	if (slot->uiLength + len > MVBC_MSG_MAX_LENGTH)
+	{
+		r->stats.uiOverflows++;
+		msg_release(r, slot);
+		return 0;
+	}
+
+	for (int i = 0; i < len; i++)
+	{
+		uint16_t word = rec->wPortData[3 + i / 2];
+
+		slot->pData[slot->uiLength + i] = (i & 1) ? (word & 0xFF) : (word >> 8);
+	}
+
+	slot->uiLength += len;
+	slot->wFrameCount++;
+	slot->wNextSeq = (seq + 1) & MVBC_MSG_MTC_SEQ_MASK;
+	slot->sLastFrame = ts;
+
+	if (mtc & MVBC_MSG_MTC_LAST)
+	{
+		struct sMvbcMessage msg;
+
+		msg.wSrcDevice = slot->wSrcDevice;
+		msg.wDstDevice = slot->wDstDevice;
+		msg.wPortAddr = rec->wPortAddr;
+		msg.wFrameCount = slot->wFrameCount;
+		msg.uiLength = slot->uiLength;
+		msg.pData = slot->pData;
+		msg.sFirstFrame = slot->sFirstFrame;
+		msg.sLastFrame = slot->sLastFrame;
+
+		r->stats.uiMessages++;
+		r->callback(&msg, r->pCallbackArg);
+
+		msg_release(r, slot);
+		return 1;
+	}
+
+	return 0;
+}
+
+int mvbc_msg_feed(struct sMvbcMsgReassembler *r, const struct sPortData *rec)
+{
+	struct sMvbcProfSample prof;
+	int rc;
+
+	mvbc_prof_begin(&prof);
+	rc = msg_feed(r, rec);
+	mvbc_prof_end(&prof, eProfDecode, 1);
+
+	return rc;
+}
+
+int mvbc_msg_expire(struct sMvbcMsgReassembler *r, const struct timeval *now)
+{
+	int dropped = 0;
+
+	if ((r == NULL) || (now == NULL))
+	{
+		return 0;
+	}
+
+	for (int i = 0; i < MVBC_MSG_MAX_SESSIONS; i++)
+	{
+		struct sMvbcMsgSlot *slot = &r->slot[i];
+
+		if (slot->iInUse && (msg_elapsed_ms(&slot->sLastFrame, now) > r->iTimeoutMS))
+		{
+			msg_release(r, slot);
+			r->stats.uiTimeouts++;
+			dropped++;
+		}
+	}
+
+	return dropped;
+}
@@ -0,0 +1,655 @@
+/**
+ * @file
+ *
+ * Fixed size object pools with per-thread caches and a lock free global free list.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "mvbc_internal.h"
+#include "mvbc_msg.h"
+
+/** end of the free list */
+#define POOL_NIL 0xFFFFFFFFu
+
+/**
+ * objects of one pool cached by the calling thread.
+ */
+struct sPoolCache
+{
+	struct sMvbcPool *pool;
+	uint32_t uiPoolId;
+	uint32_t uiCount;
+	uint32_t uiIndex[MVBC_POOL_CACHE_SIZE];
+};
+
+static __thread struct sPoolCache tPoolCache[MVBC_POOL_THREAD_POOLS];
+
+static uint32_t gPoolId;
+
+/** pools not destroyed yet, cached objects only go back to these */
+static pthread_mutex_t gPoolLiveLock = PTHREAD_MUTEX_INITIALIZER;
+static struct sMvbcPool *gPoolLive;
+
+/** flushes the caches of exiting threads */
+static pthread_key_t gPoolKey;
+static pthread_once_t gPoolKeyOnce = PTHREAD_ONCE_INIT;
+
+static uint64_t pool_head(uint32_t tag, uint32_t idx)
+{
+	return ((uint64_t)tag << 32) | idx;
+}
+
+/**
+ * Take up to max objects from the global free list.
+ *
+ * @param pool
+ * @param out object indices
+ * @param max
+ * @return number of objects taken
+ */
+static uint32_t pool_pop(struct sMvbcPool *pool, uint32_t *out, uint32_t max)
+{
+	uint32_t got = 0;
+
+	while (got < max)
+	{
+		uint64_t head = __atomic_load_n(&pool->ullHead, __ATOMIC_ACQUIRE);
+		uint32_t idx;
+
+		do
+		{
+			idx = (uint32_t)head;
+			if (idx == POOL_NIL)
+			{
+				return got;
+			}
+		} while (!__atomic_compare_exchange_n(&pool->ullHead, &head,
+					pool_head((uint32_t)(head >> 32) + 1, __atomic_load_n(&pool->pNext[idx], __ATOMIC_RELAXED)),
+					1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+		out[got++] = idx;
+	}
+	return got;
+}
+
+/**
+ * Return a number of objects to the global free list with one atomic operation.
+ *
+ * @param pool
+ * @param idx object indices
+ * @param count
+ */
+static void pool_push(struct sMvbcPool *pool, const uint32_t *idx, uint32_t count)
+{
+	uint64_t head;
+
+	if (count == 0)
+	{
+		return;
+	}
+
+	/* chain the objects first, then link the chain in */
+	for (uint32_t i = 0; i + 1 < count; i++)
+	{
+		__atomic_store_n(&pool->pNext[idx[i]], idx[i + 1], __ATOMIC_RELAXED);
+	}
+
+	head = __atomic_load_n(&pool->ullHead, __ATOMIC_ACQUIRE);
+	do
+	{
+		__atomic_store_n(&pool->pNext[idx[count - 1]], (uint32_t)head, __ATOMIC_RELAXED);
+	} while (!__atomic_compare_exchange_n(&pool->ullHead, &head,
+				pool_head((uint32_t)(head >> 32) + 1, idx[0]),
+				1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * Get the cache of the calling thread for a pool.
+ *
+ * @param pool
+ * @return cache or NULL if the thread already caches MVBC_POOL_THREAD_POOLS other pools
+ */
+static struct sPoolCache *pool_cache(struct sMvbcPool *pool)
+{
+	struct sPoolCache *freeCache = NULL;
+
+	for (int i = 0; i < MVBC_POOL_THREAD_POOLS; i++)
+	{
+		struct sPoolCache *cache = &tPoolCache[i];
+
+		if ((cache->pool == pool) && (cache->uiPoolId == pool->uiId))
+		{
+			return cache;
+		}
+		/* objects of a destroyed pool at the same address are dropped */
+		if (((cache->pool == NULL) || (cache->pool == pool)) && (freeCache == NULL))
+		{
+			freeCache = cache;
+		}
+	}
+
+	if (freeCache != NULL)
+	{
+		freeCache->pool = pool;
+		freeCache->uiPoolId = pool->uiId;
+		freeCache->uiCount = 0;
+		pthread_setspecific(gPoolKey, tPoolCache);
+	}
+	return freeCache;
+}
+
+/**
+ * Give cached objects back to their pools. Called with gPoolLiveLock held.
+ *
+ * @param caches caches of a thread
+ */
+static void pool_flush_locked(struct sPoolCache *caches)
+{
+	for (int i = 0; i < MVBC_POOL_THREAD_POOLS; i++)
+	{
+		struct sPoolCache *cache = &caches[i];
+		struct sMvbcPool *live = gPoolLive;
+
+		while ((live != NULL) && ((live != cache->pool) || (live->uiId != cache->uiPoolId)))
+		{
+			live = live->pNextLive;
+		}
+		if (live != NULL)
+		{
+			pool_push(live, cache->uiIndex, cache->uiCount);
+		}
+		memset(cache, 0, sizeof(struct sPoolCache));
+	}
+}
+
+/**
+ * Thread exit: give the cached objects back.
+ *
+ * @param arg caches of the thread
+ */
+static void pool_thread_destructor(void *arg)
+{
+	pthread_mutex_lock(&gPoolLiveLock);
+	pool_flush_locked(arg);
+	pthread_mutex_unlock(&gPoolLiveLock);
+}
+
+static void pool_key_setup(void)
+{
+	pthread_key_create(&gPoolKey, pool_thread_destructor);
+}
+
+static void pool_account_alloc(struct sMvbcPool *pool)
+{
+	uint32_t inUse = __atomic_add_fetch(&pool->uiInUse, 1, __ATOMIC_RELAXED);
+	uint32_t high = __atomic_load_n(&pool->uiHighWater, __ATOMIC_RELAXED);
+
+	while ((inUse > high) &&
+		   !__atomic_compare_exchange_n(&pool->uiHighWater, &high, inUse, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	{
+	}
+	__atomic_add_fetch(&pool->ullAllocs, 1, __ATOMIC_RELAXED);
+}
+
+int mvbc_pool_create(struct sMvbcPool *pool, size_t objSize, uint32_t count)
+{
+	if ((pool == NULL) || (objSize == 0) || (count == 0) || (count >= POOL_NIL))
+	{
+		return -1;
+	}
+
+	memset(pool, 0, sizeof(struct sMvbcPool));
+
+	/* keep every object 8 byte aligned */
+	pool->objSize = (objSize + 7) & ~(size_t)7;
+	pool->uiCount = count;
+	pool->uiId = __atomic_add_fetch(&gPoolId, 1, __ATOMIC_RELAXED);
+
+	/* a thread must not sit on a large part of a small pool */
+	pool->uiCacheMax = count / MVBC_POOL_CACHE_SHARE;
+	if (pool->uiCacheMax > MVBC_POOL_CACHE_SIZE)
+	{
+		pool->uiCacheMax = MVBC_POOL_CACHE_SIZE;
+	}
+	if (pool->uiCacheMax < 2)
+	{
+		pool->uiCacheMax = 0;
+	}
+
+	if (posix_memalign((void **)&pool->pMem, 64, pool->objSize * count) != 0)
+	{
+		DEBUG_OUT( "ERROR no memory for %u objects of %zu bytes\n", count, objSize);
+		pool->pMem = NULL;
+		return -1;
+	}
+
+	pool->pNext = malloc(count * sizeof(uint32_t));
+	if (pool->pNext == NULL)
+	{
+		DEBUG_OUT( "ERROR no memory for free list\n");
+		free(pool->pMem);
+		pool->pMem = NULL;
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pool->pNext[i] = (i + 1 < count) ? i + 1 : POOL_NIL;
+	}
+	pool->ullHead = pool_head(0, 0);
+
+	pthread_once(&gPoolKeyOnce, pool_key_setup);
+
+	pthread_mutex_lock(&gPoolLiveLock);
+	pool->pNextLive = gPoolLive;
+	gPoolLive = pool;
+	pthread_mutex_unlock(&gPoolLiveLock);
+
+	return 0;
+}
+
+void mvbc_pool_destroy(struct sMvbcPool *pool)
+{
+	if ((pool != NULL) && (pool->pMem != NULL))
+	{
+		struct sMvbcPool **link = &gPoolLive;
+
+		pthread_mutex_lock(&gPoolLiveLock);
+		while ((*link != NULL) && (*link != pool))
+		{
+			link = &(*link)->pNextLive;
+		}
+		if (*link != NULL)
+		{
+			*link = pool->pNextLive;
+		}
+		pthread_mutex_unlock(&gPoolLiveLock);
+
+		free(pool->pMem);
+		free(pool->pNext);
+		memset(pool, 0, sizeof(struct sMvbcPool));
+	}
+}
+
+void *mvbc_pool_alloc(struct sMvbcPool *pool)
+{
+	struct sPoolCache *cache;
+	uint32_t idx;
+
+	if ((pool == NULL) || (pool->pMem == NULL))
+	{
+		return NULL;
+	}
+
+	cache = (pool->uiCacheMax != 0) ? pool_cache(pool) : NULL;
+
+	if (cache == NULL)
+	{
+		if (pool_pop(pool, &idx, 1) == 0)
+		{
+			__atomic_add_fetch(&pool->ullExhausted, 1, __ATOMIC_RELAXED);
+			MVBC_TRACE3(queue__overflow, "pool", "", 1);
+			return NULL;
+		}
+	}
+	else
+	{
+		if (cache->uiCount == 0)
+		{
+			cache->uiCount = pool_pop(pool, cache->uiIndex, pool->uiCacheMax / 2);
+			if (cache->uiCount == 0)
+			{
+				__atomic_add_fetch(&pool->ullExhausted, 1, __ATOMIC_RELAXED);
+				MVBC_TRACE3(queue__overflow, "pool", "", 1);
+				return NULL;
+			}
+		}
+		idx = cache->uiIndex[--cache->uiCount];
+	}
+
+	pool_account_alloc(pool);
+
+	return pool->pMem + (size_t)idx * pool->objSize;
+}
+
+void mvbc_pool_free(struct sMvbcPool *pool, void *obj)
+{
+	struct sPoolCache *cache;
+	uint32_t idx;
+
+	if ((pool == NULL) || (obj == NULL))
+	{
+		return;
+	}
+
+	idx = ((uint8_t *)obj - pool->pMem) / pool->objSize;
+
+	__atomic_sub_fetch(&pool->uiInUse, 1, __ATOMIC_RELAXED);
+
+	cache = (pool->uiCacheMax != 0) ? pool_cache(pool) : NULL;
+
+	if (cache == NULL)
+	{
+		pool_push(pool, &idx, 1);
+		return;
+	}
+
+	if (cache->uiCount >= pool->uiCacheMax)
+	{
+		uint32_t half = pool->uiCacheMax / 2;
+
+		/* give the older half back */
+		pool_push(pool, cache->uiIndex, half);
+		memmove(cache->uiIndex, &cache->uiIndex[half], (cache->uiCount - half) * sizeof(uint32_t));
+		cache->uiCount -= half;
+	}
+	cache->uiIndex[cache->uiCount++] = idx;
+}
+
+void mvbc_pool_thread_flush(void)
+{
+	pthread_mutex_lock(&gPoolLiveLock);
+	pool_flush_locked(tPoolCache);
+	pthread_mutex_unlock(&gPoolLiveLock);
+}
+
+int mvbc_pool_get_stats(struct sMvbcPool *pool, struct sMvbcPoolStats *stats)
+{
+	if ((pool == NULL) || (stats == NULL))
+	{
+		return -1;
+	}
+
+	stats->uiCapacity = pool->uiCount;
+	stats->uiInUse = __atomic_load_n(&pool->uiInUse, __ATOMIC_RELAXED);
+	stats->uiHighWater = __atomic_load_n(&pool->uiHighWater, __ATOMIC_RELAXED);
+	stats->ullAllocs = __atomic_load_n(&pool->ullAllocs, __ATOMIC_RELAXED);
+	stats->ullExhausted = __atomic_load_n(&pool->ullExhausted, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/**
+ * Make a pool of a context hold at least count objects. Called with ctx->ctxLock held.
+ * A pool too small is replaced, never freed: its objects may still be in use.
+ *
+ * @param cur current pool of the context
+ * @param retired replaced pools of the context
+ * @param objSize
+ * @param count
+ * @return 0 in case of success, -1 for error
+ */
+static int pool_grow(struct sMvbcPool **cur, struct sMvbcPool **retired, size_t objSize, uint32_t count)
+{
+	struct sMvbcPool *old = *cur;
+	struct sMvbcPool *pool;
+
+	if ((old != NULL) && (old->uiCount >= count))
+	{
+		return 0;
+	}
+
+	pool = malloc(sizeof(struct sMvbcPool));
+	if ((pool == NULL) || (mvbc_pool_create(pool, objSize, count) != 0))
+	{
+		DEBUG_OUT( "ERROR no pool of [%u] objects of %zu bytes\n", count, objSize);
+		free(pool);
+		return -1;
+	}
+
+	if (old != NULL)
+	{
+		/* mvbc_ctx_record_free() walks the retired list without the lock */
+		old->pNextRetired = *retired;
+		__atomic_store_n(retired, old, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(cur, pool, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/**
+ * Number of record blocks for the port setup of a context: the read batches
+ * and two images per group of 64 port addresses in use. Dynamic devices may
+ * see any address.
+ *
+ * @param ctx
+ * @return number of blocks
+ */
+static uint32_t pool_record_blocks(struct mvbc_ctx *ctx)
+{
+	uint32_t blocks = MVBC_POOL_BATCH_BLOCKS;
+
+	for (int i = 0; i < ctx->project.mvbc_device_count; i++)
+	{
+		struct sMvbcDevCfg *mvbc = &ctx->project.mvbc[i];
+		uint32_t groups = MVBC_IMAGE_GROUPS;
+
+		if ((int)mvbc->iMode == eStatic)
+		{
+			uint64_t used = 0;
+
+			for (int j = 0; j < mvbc->portSetup.mvbc_port_count; j++)
+			{
+				int addr = mvbc->portSetup.port[j].portCfg.iPortAddr;
+
+				if ((addr >= 0) && (addr <= MAX_PORT_COUNT))
+				{
+					used |= 1ull << (addr / MVBC_POOL_RECORD_BLOCK);
+				}
+			}
+			groups = __builtin_popcountll(used);
+		}
+		blocks += groups * MVBC_POOL_IMAGES;
+	}
+
+	return blocks;
+}
+
+/**
+ * Number of message buffers for the port setup of a context: one session per
+ * configured process-to-process sink port, all sessions on dynamic devices.
+ *
+ * @param ctx
+ * @return number of buffers
+ */
+static uint32_t pool_message_buffers(struct mvbc_ctx *ctx)
+{
+	uint32_t messages = 0;
+
+	for (int i = 0; i < ctx->project.mvbc_device_count; i++)
+	{
+		struct sMvbcDevCfg *mvbc = &ctx->project.mvbc[i];
+		uint32_t sessions = MVBC_MSG_MAX_SESSIONS;
+
+		if ((int)mvbc->iMode == eStatic)
+		{
+			sessions = 0;
+			for (int j = 0; j < mvbc->portSetup.mvbc_port_count; j++)
+			{
+				struct sMvbcPortCfg *cfg = &mvbc->portSetup.port[j].portCfg;
+
+				if ((cfg->iPortType == ePP) && (cfg->iPortDirection == eSink) && (sessions < MVBC_MSG_MAX_SESSIONS))
+				{
+					sessions++;
+				}
+			}
+		}
+		messages += sessions;
+	}
+
+	/* mvbc_ctx_msg_init() may come before any configuration */
+	if (messages < MVBC_MSG_MAX_SESSIONS)
+	{
+		messages = MVBC_MSG_MAX_SESSIONS;
+	}
+
+	return messages;
+}
+
+/**
+ * Size the record and message pools of a context from its port setup. Called with ctx->ctxLock held.
+ *
+ * @param ctx
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_pool_setup(struct mvbc_ctx *ctx)
+{
+	uint32_t blocks = pool_record_blocks(ctx);
+	uint32_t messages = pool_message_buffers(ctx);
+
+	if ((pool_grow(&ctx->pRecPool, &ctx->pRecPoolRetired, sizeof(struct sPortData) * MVBC_POOL_RECORD_BLOCK, blocks) != 0) ||
+		(pool_grow(&ctx->pMsgPool, &ctx->pMsgPoolRetired, MVBC_MSG_MAX_LENGTH, messages) != 0))
+	{
+		return -1;
+	}
+
+	DEBUG_OUT( "record blocks[%u] messages[%u]\n", ctx->pRecPool->uiCount, ctx->pMsgPool->uiCount);
+
+	return 0;
+}
+
+/**
+ * Free a pool of a context and the ones it replaced.
+ *
+ * @param cur
+ * @param retired
+ */
+static void pool_free_list(struct sMvbcPool **cur, struct sMvbcPool **retired)
+{
+	while (*retired != NULL)
+	{
+		struct sMvbcPool *pool = *retired;
+
+		*retired = pool->pNextRetired;
+		mvbc_pool_destroy(pool);
+		free(pool);
+	}
+	mvbc_pool_destroy(*cur);
+	free(*cur);
+	*cur = NULL;
+}
+
+/**
+ * Free the pools of a context that is destroyed.
+ *
+ * @param ctx
+ */
+void mvbc_pool_free_all(struct mvbc_ctx *ctx)
+{
+	pool_free_list(&ctx->pRecPool, &ctx->pRecPoolRetired);
+	pool_free_list(&ctx->pMsgPool, &ctx->pMsgPoolRetired);
+}
+
+struct sPortData *mvbc_ctx_record_alloc(mvbc_ctx *ctx)
+{
+	return mvbc_pool_alloc(__atomic_load_n(&ctx->pRecPool, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * Get a read batch of MVBC_POOL_RECORD_BLOCK records, the pools of a context
+ * not initialised yet are created now. Takes ctx->ctxLock.
+ *
+ * @param ctx
+ * @return block, NULL for error
+ */
+struct sPortData *mvbc_record_batch(struct mvbc_ctx *ctx)
+{
+	struct sPortData *batch;
+
+	pthread_mutex_lock(&ctx->ctxLock);
+	if (ctx->pRecPool == NULL)
+	{
+		mvbc_pool_setup(ctx);
+	}
+	pthread_mutex_unlock(&ctx->ctxLock);
+
+	batch = mvbc_ctx_record_alloc(ctx);
+	if (batch == NULL)
+	{
+		DEBUG_OUT( "ERROR no record block for a read batch\n");
+	}
+	return batch;
+}
+
+/**
+ * Check if an object belongs to a pool.
+ *
+ * @param pool
+ * @param obj
+ * @return true if obj lies in the memory of pool
+ */
+static bool pool_owns(struct sMvbcPool *pool, const void *obj)
+{
+	const uint8_t *p = obj;
+
+	return (pool != NULL) && (p >= pool->pMem) && (p < pool->pMem + pool->objSize * pool->uiCount);
+}
+
+void mvbc_ctx_record_free(mvbc_ctx *ctx, struct sPortData *block)
+{
+	struct sMvbcPool *pool = __atomic_load_n(&ctx->pRecPool, __ATOMIC_ACQUIRE);
+
+	if (block == NULL)
+	{
+		return;
+	}
+
+	if (!pool_owns(pool, block))
+	{
+		pool = __atomic_load_n(&ctx->pRecPoolRetired, __ATOMIC_ACQUIRE);
+		while ((pool != NULL) && !pool_owns(pool, block))
+		{
+			pool = pool->pNextRetired;
+		}
+	}
+
+	if (pool == NULL)
+	{
+		DEBUG_OUT( "ERROR record block %p of no pool\n", (void *)block);
+		return;
+	}
+	mvbc_pool_free(pool, block);
+}
+
+int mvbc_ctx_get_pool_stats(mvbc_ctx *ctx, int which, struct sMvbcPoolStats *stats)
+{
+	if (ctx == NULL)
+	{
+		return -1;
+	}
+
+	switch (which)
+	{
+		case eMessagePool:
+			return mvbc_pool_get_stats(__atomic_load_n(&ctx->pMsgPool, __ATOMIC_ACQUIRE), stats);
+
+		case eRecordPool:
+			return mvbc_pool_get_stats(__atomic_load_n(&ctx->pRecPool, __ATOMIC_ACQUIRE), stats);
+	}
+	return -1;
+}
+
+int mvbc_get_pool_stats(int which, struct sMvbcPoolStats *stats)
+{
+	return mvbc_ctx_get_pool_stats(mvbc_default_ctx(), which, stats);
+}
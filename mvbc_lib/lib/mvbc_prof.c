@@ -0,0 +1,349 @@
+/**
+ * @file
+ *
+ * Self profiling of the library phases with perf_event_open() counters.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#include "mvbc_internal.h"
+#include "mvbc_prof.h"
+
+int gMvbcProfEnabled;
+
+/**
+ * totals of one phase, added to by all threads.
+ */
+struct sProfTotals
+{
+	uint64_t ullCalls;
+	uint64_t ullRecords;
+	uint64_t ullCount[eProfCounterCount];
+};
+
+/**
+ * counter group of one thread.
+ */
+struct sProfThread
+{
+	/** 0 = not tried, 1 = open, -1 = failed */
+	int iState;
+
+	/** group leader */
+	int iFd;
+
+	/** counters in the group and the counter of each group slot */
+	int iCount;
+	int iCounter[eProfCounterCount];
+
+	/** all descriptors, closed when the thread exits */
+	int iFds[eProfCounterCount];
+};
+
+static struct sProfTotals gTotals[eProfPhaseCount];
+static uint32_t gAvailable;
+
+static __thread struct sProfThread tThread;
+static pthread_key_t gThreadKey;
+static pthread_once_t gThreadKeyOnce = PTHREAD_ONCE_INIT;
+
+static const char *gPhaseNames[eProfPhaseCount] =
+{
+	"parse",
+	"cmd_reset",
+	"cmd_set_device",
+	"cmd_get_device",
+	"cmd_set_port",
+	"cmd_get_port",
+	"cmd_run",
+	"cmd_shutdown",
+	"cmd_other",
+	"read",
+	"decode",
+	"dispatch"
+};
+
+/** type and config of each enum eMvbcProfCounter */
+static const struct
+{
+	uint32_t uiType;
+	uint64_t ullConfig;
+} gCounters[eProfCounterCount] =
+{
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES }
+};
+
+static void prof_thread_exit(void *arg)
+{
+	struct sProfThread *t = arg;
+
+	for (int i = 0; i < t->iCount; i++)
+	{
+		close(t->iFds[i]);
+	}
+	t->iCount = 0;
+}
+
+static void prof_key_create(void)
+{
+	pthread_key_create(&gThreadKey, prof_thread_exit);
+}
+
+static int prof_open(int counter, int group, int exclude_kernel)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = gCounters[counter].uiType;
+	attr.config = gCounters[counter].ullConfig;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.exclude_kernel = exclude_kernel;
+	attr.exclude_hv = 1;
+
+	/* this thread on any CPU */
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+/**
+ * Open the counter group of the calling thread. The context switch counter leads the
+ * group because it exists on every kernel, hardware counters join as far as present.
+ *
+ * @param t
+ * @return 0 in case of success, -1 for error
+ */
+static int prof_thread_open(struct sProfThread *t)
+{
+	int excludeKernel = 0;
+	int fd;
+
+	t->iState = -1;
+	t->iCount = 0;
+
+	fd = prof_open(eProfContextSwitches, -1, excludeKernel);
+	if ((fd < 0) && ((errno == EACCES) || (errno == EPERM)))
+	{
+		/* perf_event_paranoid >= 2 only allows user space counting */
+		excludeKernel = 1;
+		fd = prof_open(eProfContextSwitches, -1, excludeKernel);
+	}
+	if (fd < 0)
+	{
+		DEBUG_OUT( "ERROR perf_event_open %s\n", strerror(errno));
+		return -1;
+	}
+
+	t->iFd = fd;
+	t->iFds[t->iCount] = fd;
+	t->iCounter[t->iCount++] = eProfContextSwitches;
+
+	for (int c = 0; c < eProfContextSwitches; c++)
+	{
+		fd = prof_open(c, t->iFd, excludeKernel);
+		if (fd >= 0)
+		{
+			t->iFds[t->iCount] = fd;
+			t->iCounter[t->iCount++] = c;
+		}
+	}
+
+	for (int i = 0; i < t->iCount; i++)
+	{
+		__atomic_or_fetch(&gAvailable, 1U << t->iCounter[i], __ATOMIC_RELAXED);
+	}
+
+	pthread_once(&gThreadKeyOnce, prof_key_create);
+	pthread_setspecific(gThreadKey, t);
+
+	ioctl(t->iFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(t->iFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+	t->iState = 1;
+	return 0;
+}
+
+/**
+ * Read the group of the calling thread: number of counters, time enabled,
+ * time running, then the values.
+ *
+ * @param t
+ * @param times gets the time enabled and the time running in ns
+ * @param values gets the value of each group slot
+ * @return 0 in case of success, -1 for error
+ */
+static int prof_read(const struct sProfThread *t, uint64_t *times, uint64_t *values)
+{
+	uint64_t buf[3 + eProfCounterCount];
+	ssize_t len = (3 + t->iCount) * sizeof(uint64_t);
+
+	if ((read(t->iFd, buf, len) != len) || (buf[0] != (uint64_t)t->iCount))
+	{
+		return -1;
+	}
+	times[0] = buf[1];
+	times[1] = buf[2];
+	memcpy(values, &buf[3], t->iCount * sizeof(uint64_t));
+	return 0;
+}
+
+int mvbc_prof_sample_start(struct sMvbcProfSample *s)
+{
+	struct sProfThread *t = &tThread;
+
+	if ((t->iState == 0) && (prof_thread_open(t) != 0))
+	{
+		return -1;
+	}
+	if (t->iState < 0)
+	{
+		return -1;
+	}
+	return prof_read(t, s->ullStartTime, s->ullStart);
+}
+
+void mvbc_prof_sample_stop(struct sMvbcProfSample *s, int phase, int records)
+{
+	struct sProfThread *t = &tThread;
+	struct sProfTotals *totals;
+	uint64_t endTime[2];
+	uint64_t end[eProfCounterCount];
+	uint64_t enabled;
+	uint64_t running;
+
+	if ((phase < 0) || (phase >= eProfPhaseCount) || (prof_read(t, endTime, end) != 0))
+	{
+		return;
+	}
+	totals = &gTotals[phase];
+	enabled = endTime[0] - s->ullStartTime[0];
+	running = endTime[1] - s->ullStartTime[1];
+
+	for (int i = 0; i < t->iCount; i++)
+	{
+		uint64_t count = end[i] - s->ullStart[i];
+
+		/* the group shared the PMU with other events, extrapolate to the whole sample */
+		if ((running > 0) && (running < enabled))
+		{
+			count = (uint64_t)((double)count * enabled / running);
+		}
+		__atomic_add_fetch(&totals->ullCount[t->iCounter[i]], count, __ATOMIC_RELAXED);
+	}
+	__atomic_add_fetch(&totals->ullCalls, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&totals->ullRecords, (records > 0) ? records : 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * Phase of a mvbc_send_cmd() command.
+ *
+ * @param cmd
+ * @return enum eMvbcProfPhase
+ */
+int mvbc_prof_cmd_phase(int cmd)
+{
+	switch (cmd)
+	{
+		case EL_MVBC_RESET_DEVICE:
+			return eProfCmdReset;
+		case EL_MVBC_SET_DEVICE_CONFIGURATION:
+			return eProfCmdSetDevice;
+		case EL_MVBC_GET_DEVICE_CONFIGURATION:
+			return eProfCmdGetDevice;
+		case EL_MVBC_SET_PORT_CONFIGURATION:
+			return eProfCmdSetPort;
+		case EL_MVBC_GET_PORT_CONFIGURATION:
+			return eProfCmdGetPort;
+		case EL_MVBC_RUN_DEVICE:
+			return eProfCmdRun;
+		case EL_MVBC_SHUTDOWN_DEVICE:
+			return eProfCmdShutdown;
+		default:
+			return eProfCmdOther;
+	}
+}
+
+int mvbc_prof_enable(int on)
+{
+	if (on)
+	{
+		struct sMvbcProfSample s;
+
+		/* try on the calling thread, so that a missing permission shows up here */
+		if (mvbc_prof_sample_start(&s) != 0)
+		{
+			return -1;
+		}
+	}
+
+	__atomic_store_n(&gMvbcProfEnabled, on ? 1 : 0, __ATOMIC_RELAXED);
+	return 0;
+}
+
+void mvbc_prof_reset(void)
+{
+	for (int p = 0; p < eProfPhaseCount; p++)
+	{
+		__atomic_store_n(&gTotals[p].ullCalls, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&gTotals[p].ullRecords, 0, __ATOMIC_RELAXED);
+		for (int c = 0; c < eProfCounterCount; c++)
+		{
+			__atomic_store_n(&gTotals[p].ullCount[c], 0, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+int mvbc_prof_get(int phase, struct sMvbcProfStats *stats)
+{
+	if ((phase < 0) || (phase >= eProfPhaseCount) || (stats == NULL))
+	{
+		return -1;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+	stats->ullCalls = __atomic_load_n(&gTotals[phase].ullCalls, __ATOMIC_RELAXED);
+	stats->ullRecords = __atomic_load_n(&gTotals[phase].ullRecords, __ATOMIC_RELAXED);
+	stats->uiAvailable = __atomic_load_n(&gAvailable, __ATOMIC_RELAXED);
+
+	for (int c = 0; c < eProfCounterCount; c++)
+	{
+		stats->ullCount[c] = __atomic_load_n(&gTotals[phase].ullCount[c], __ATOMIC_RELAXED);
+		if (stats->ullCalls)
+		{
+			stats->dPerCall[c] = (double)stats->ullCount[c] / stats->ullCalls;
+		}
+		if (stats->ullRecords)
+		{
+			stats->dPerRecord[c] = (double)stats->ullCount[c] / stats->ullRecords;
+		}
+	}
+
+	return 0;
+}
+
+const char *mvbc_prof_phase_name(int phase)
+{
+	return ((phase >= 0) && (phase < eProfPhaseCount)) ? gPhaseNames[phase] : "?";
+}
@@ -0,0 +1,489 @@
+/**
+ * @file
+ *
+ * Reading port data records from the driver FIFO of the configured MVBC devices.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "mvbc_internal.h"
+
+/**
+ * Open the FIFO of ctx->dev[idx] for non blocking reads if not done yet.
+ * Called with ctx->devLock[idx] held.
+ *
+ * @param ctx
+ * @param idx
+ * @return file descriptor, -1 for error
+ */
+static int reader_open(struct mvbc_ctx *ctx, int idx)
+{
+	struct sMvbcDevState *state = &ctx->dev[idx];
+
+	if (state->iFd < 0)
+	{
+		const char *path = state->cDevPath;
+		int fd;
+
+		if (path[0] == 0)
+		{
+			/* index not configured by the last init */
+			fd = -1;
+		}
+		else if (strncmp(path, MVBC_EMU_PREFIX, strlen(MVBC_EMU_PREFIX)) == 0)
+		{
+			fd = mvbc_emu_open(path);
+		}
+		else
+		{
+			fd = open(path, O_RDWR | O_NONBLOCK);
+		}
+
+		if (fd < 0)
+		{
+			DEBUG_OUT( "ERROR open device [%s] RC[%X]\n", path, fd);
+			return -1;
+		}
+		state->iFd = fd;
+	}
+	return state->iFd;
+}
+
+/**
+ * Get the (opened) FIFO descriptor of ctx->dev[idx], e.g. to poll() on it.
+ *
+ * @param ctx
+ * @param idx
+ * @return file descriptor, -1 for error
+ */
+int mvbc_reader_fd(struct mvbc_ctx *ctx, int idx)
+{
+	int fd;
+
+	pthread_mutex_lock(&ctx->devLock[idx]);
+	fd = reader_open(ctx, idx);
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return fd;
+}
+
+/**
+ * Duplicate the FIFO descriptor of ctx->dev[idx] for a poller that owns its registration.
+ * The generation tells when the descriptor of the device was replaced.
+ *
+ * @param ctx
+ * @param idx
+ * @param generation gets ctx->dev[idx].uiFdGeneration
+ * @return new file descriptor, -1 for error
+ */
+int mvbc_reader_fd_dup(struct mvbc_ctx *ctx, int idx, uint32_t *generation)
+{
+	int fd;
+
+	pthread_mutex_lock(&ctx->devLock[idx]);
+	fd = reader_open(ctx, idx);
+	if (fd >= 0)
+	{
+		fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	}
+	*generation = ctx->dev[idx].uiFdGeneration;
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return fd;
+}
+
+/**
+ * Close the FIFO of ctx->dev[idx]. Called with ctx->devLock[idx] held.
+ *
+ * @param ctx
+ * @param idx
+ */
+void mvbc_reader_close(struct mvbc_ctx *ctx, int idx)
+{
+	if (ctx->dev[idx].iFd >= 0)
+	{
+		close(ctx->dev[idx].iFd);
+		ctx->dev[idx].iFd = -1;
+		ctx->dev[idx].uiFdGeneration++;
+	}
+	ctx->dev[idx].uiPartial = 0;
+}
+
+/**
+ * Return the record groups of the latest-value image of ctx->dev[idx] to the record pool.
+ * The image stays enabled. Called with ctx->devLock[idx] held or on destroy.
+ *
+ * @param ctx
+ * @param idx
+ */
+void mvbc_port_image_free(struct mvbc_ctx *ctx, int idx)
+{
+	struct sMvbcPortImage *image = &ctx->portImage[idx];
+
+	for (int g = 0; g < MVBC_IMAGE_GROUPS; g++)
+	{
+		mvbc_ctx_record_free(ctx, image->pGroup[g]);
+		image->pGroup[g] = NULL;
+		image->ullChanged[g] = 0;
+	}
+}
+
+/**
+ * Store records in the latest-value image of ctx->dev[idx]. The group of an address
+ * takes a block of the record pool with its first record; without one the record is
+ * skipped and counted as pool exhaustion. For a gateway a port is marked changed
+ * when its payload differs from the image. Called with ctx->devLock[idx] held.
+ *
+ * @param ctx
+ * @param idx
+ * @param recs
+ * @param count
+ */
+static void port_image_update(struct mvbc_ctx *ctx, int idx, const struct sPortData *recs, int count)
+{
+	struct sMvbcPortImage *image = &ctx->portImage[idx];
+
+	for (int i = 0; i < count; i++)
+	{
+		uint16_t addr = recs[i].wPortAddr;
+		struct sPortData *group;
+
+		if (addr > MAX_PORT_COUNT)
+		{
+			continue;
+		}
+
+		group = image->pGroup[addr / MVBC_POOL_RECORD_BLOCK];
+		if (group == NULL)
+		{
+			group = mvbc_ctx_record_alloc(ctx);
+			if (group == NULL)
+			{
+				continue;
+			}
+			memset(group, 0, sizeof(struct sPortData) * MVBC_POOL_RECORD_BLOCK);
+			image->pGroup[addr / MVBC_POOL_RECORD_BLOCK] = group;
+		}
+		if (image->iTrackChanges)
+		{
+			const struct sPortData *last = &group[addr % MVBC_POOL_RECORD_BLOCK];
+			uint16_t words = (recs[i].wNumOfWords < MAX_PORT_DATA_LENGTH) ? recs[i].wNumOfWords : MAX_PORT_DATA_LENGTH;
+
+			if ((last->wNumOfWords != recs[i].wNumOfWords) || (memcmp(last->wPortData, recs[i].wPortData, words * sizeof(uint16_t)) != 0))
+			{
+				image->ullChanged[addr / MVBC_POOL_RECORD_BLOCK] |= 1ULL << (addr % MVBC_POOL_RECORD_BLOCK);
+			}
+		}
+		group[addr % MVBC_POOL_RECORD_BLOCK] = recs[i];
+	}
+}
+
+/**
+ * Fire the record__read probe for every record read.
+ *
+ * @param dev
+ * @param recs
+ * @param count
+ */
+static void reader_trace(const char *dev, const struct sPortData *recs, int count)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	for (int i = 0; i < count; i++)
+	{
+		int64_t age = (int64_t)(now.tv_sec - recs[i].sTimeStamp.tv_sec) * 1000000 + (now.tv_usec - recs[i].sTimeStamp.tv_usec);
+
+		MVBC_TRACE5(record__read, dev, recs[i].wPortAddr, recs[i].wPortType, recs[i].wNumOfWords, age);
+	}
+}
+
+/**
+ * Read records of ctx->dev[idx] without blocking.
+ *
+ * @param ctx
+ * @param idx
+ * @param recs
+ * @param max
+ * @return number of records, -1 for error
+ */
+int mvbc_read_index(struct mvbc_ctx *ctx, int idx, struct sPortData *recs, int max)
+{
+	struct sMvbcDevState *state = &ctx->dev[idx];
+	struct sMvbcProfSample prof;
+	int got = 0;
+	int errors = 0;
+	int fd;
+
+	pthread_mutex_lock(&ctx->devLock[idx]);
+
+	fd = reader_open(ctx, idx);
+	if (fd < 0)
+	{
+		pthread_mutex_unlock(&ctx->devLock[idx]);
+		return -1;
+	}
+
+	mvbc_prof_begin(&prof);
+
+	/* the driver may return less than requested, continue until the FIFO is empty */
+	while (got < max)
+	{
+		uint8_t *dst = (uint8_t *)&recs[got];
+		ssize_t count;
+
+		/* a partial record of the last read is completed by this one */
+		memcpy(dst, state->cPartial, state->uiPartial);
+		count = read(fd, dst + state->uiPartial, (max - got) * sizeof(struct sPortData) - state->uiPartial);
+
+		/* scrapes read the counters without the lock (mvbc_metrics.c) */
+		__atomic_store_n(&state->stats.ullReads, state->stats.ullReads + 1, __ATOMIC_RELAXED);
+
+		if (count < 0)
+		{
+			if ((errno != EAGAIN) && (errno != EINTR))
+			{
+				__atomic_store_n(&state->stats.uiReadErrors, state->stats.uiReadErrors + 1, __ATOMIC_RELAXED);
+				errors++;
+			}
+			break;
+		}
+		if (count == 0)
+		{
+			break;
+		}
+		count += state->uiPartial;
+		state->uiPartial = count % sizeof(struct sPortData);
+		if (state->uiPartial)
+		{
+			/* keep the partial record for the next read */
+			memcpy(state->cPartial, dst + count - state->uiPartial, state->uiPartial);
+			__atomic_store_n(&state->stats.uiShortReads, state->stats.uiShortReads + 1, __ATOMIC_RELAXED);
+		}
+		got += count / sizeof(struct sPortData);
+	}
+
+	__atomic_store_n(&state->stats.ullRecords, state->stats.ullRecords + got, __ATOMIC_RELAXED);
+
+	mvbc_prof_end(&prof, eProfRead, got);
+	mvbc_prof_begin(&prof);
+
+	if (got > 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &state->health.sLastRecord);
+		state->health.iHadRecord = 1;
+
+		for (int i = 0; i < got; i++)
+		{
+			if (recs[i].wTACK && (recs[i].wPortAddr <= MAX_PORT_COUNT))
+			{
+				state->health.ullFresh[recs[i].wPortAddr / 64] |= 1ULL << (recs[i].wPortAddr % 64);
+			}
+		}
+
+		mvbc_metric_read(ctx, idx, recs, got, max, &state->health.sLastRecord);
+	}
+
+	if ((got > 0) && MVBC_TRACE_ENABLED(record__read))
+	{
+		reader_trace(state->cDevPath, recs, got);
+	}
+
+	if ((got > 0) && (ctx->pPortSeq[idx] != NULL))
+	{
+		mvbc_port_seq_update(ctx->pPortSeq[idx], recs, got);
+	}
+
+	if ((got > 0) && ctx->portImage[idx].iEnabled)
+	{
+		port_image_update(ctx, idx, recs, got);
+	}
+
+	if (got || errors)
+	{
+		mvbc_line_account_index(ctx, idx, got, errors);
+	}
+
+	mvbc_prof_end(&prof, eProfDispatch, got);
+
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return ((got == 0) && (errors != 0)) ? -1 : got;
+}
+
+int mvbc_ctx_read(mvbc_ctx *ctx, const char *dev, struct sPortData *recs, int max)
+{
+	int idx = mvbc_find_device(ctx, dev);
+
+	if ((idx < 0) || (recs == NULL) || (max <= 0))
+	{
+		return -1;
+	}
+
+	return mvbc_read_index(ctx, idx, recs, max);
+}
+
+int mvbc_read(const char *dev, struct sPortData *recs, int max)
+{
+	return mvbc_ctx_read(mvbc_default_ctx(), dev, recs, max);
+}
+
+/**
+ * Fill a record from the mapped traffic memory of ctx->dev[idx].
+ * Called with ctx->devLock[idx] held.
+ *
+ * @param ctx
+ * @param idx
+ * @param addr
+ * @param rec
+ * @return 1 if the port has data, 0 if not
+ */
+static int read_port_uio(struct mvbc_ctx *ctx, int idx, uint16_t addr, struct sPortData *rec)
+{
+	struct sMvbcUioPort port;
+	uint16_t data[MAX_PORT_DATA_LENGTH];
+	struct timeval now;
+	int fcode;
+	int fresh = 0;
+	int words;
+
+	if (mvbc_uio_port(&ctx->dev[idx].uio, addr, &port) != 0)
+	{
+		return 0;
+	}
+
+	words = mvbc_uio_port_read(&port, data, MAX_PORT_DATA_LENGTH, &fresh);
+	if (words < 0)
+	{
+		return 0;
+	}
+
+	fcode = port.pPCS[0] >> 12;
+	rec->wPortType = (fcode <= 4) ? eLA : ((fcode == 15) ? eDA : ePP);
+	rec->wNumOfWords = words;
+	rec->wTACK = fresh;
+	gettimeofday(&now, NULL);
+	rec->sTimeStamp = now;
+	memcpy(rec->wPortData, data, words * sizeof(uint16_t));
+
+	return 1;
+}
+
+int mvbc_ctx_read_ports(mvbc_ctx *ctx, const char *dev, const uint16_t *addrs, int n, struct sPortData *out)
+{
+	int idx = mvbc_find_device(ctx, dev);
+	struct sMvbcPortImage *image = NULL;
+	int found = 0;
+
+	if ((idx < 0) || (addrs == NULL) || (out == NULL) || (n < 0))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->devLock[idx]);
+
+	if (ctx->dev[idx].uio.pBase == NULL)
+	{
+		image = &ctx->portImage[idx];
+		image->iEnabled = 1;
+	}
+
+	for (int i = 0; i < n; i++)
+	{
+		uint16_t addr = addrs[i];
+		int has = 0;
+
+		memset(&out[i], 0, sizeof(struct sPortData));
+
+		if ((addr > 0) && (addr <= MAX_PORT_COUNT))
+		{
+			if (image == NULL)
+			{
+				has = read_port_uio(ctx, idx, addr, &out[i]);
+			}
+			else
+			{
+				const struct sPortData *group = image->pGroup[addr / MVBC_POOL_RECORD_BLOCK];
+
+				if ((group != NULL) && (group[addr % MVBC_POOL_RECORD_BLOCK].wNumOfWords != 0))
+				{
+					out[i] = group[addr % MVBC_POOL_RECORD_BLOCK];
+					has = 1;
+				}
+			}
+		}
+
+		out[i].wPortAddr = addr;
+		found += has;
+	}
+
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return found;
+}
+
+int mvbc_read_ports(const char *dev, const uint16_t *addrs, int n, struct sPortData *out)
+{
+	return mvbc_ctx_read_ports(mvbc_default_ctx(), dev, addrs, n, out);
+}
+
+int mvbc_ctx_enable_port_image(mvbc_ctx *ctx, const char *dev)
+{
+	int idx = mvbc_find_device(ctx, dev);
+
+	if (idx < 0)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->devLock[idx]);
+	ctx->portImage[idx].iEnabled = 1;
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return 0;
+}
+
+int mvbc_enable_port_image(const char *dev)
+{
+	return mvbc_ctx_enable_port_image(mvbc_default_ctx(), dev);
+}
+
+int mvbc_ctx_get_device_stats(mvbc_ctx *ctx, const char *dev, struct sMvbcDevStats *stats)
+{
+	int idx = mvbc_find_device(ctx, dev);
+
+	if ((idx < 0) || (stats == NULL))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->devLock[idx]);
+	*stats = ctx->dev[idx].stats;
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return 0;
+}
+
+int mvbc_get_device_stats(const char *dev, struct sMvbcDevStats *stats)
+{
+	return mvbc_ctx_get_device_stats(mvbc_default_ctx(), dev, stats);
+}
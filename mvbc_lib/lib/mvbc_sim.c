@@ -0,0 +1,396 @@
+/**
+ * @file
+ *
+ * Emulated bus master: deterministic periodic traffic on a virtual clock.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stddef.h>
+
+#include "mvbc_internal.h"
+#include "mvbc_sim.h"
+#include "mvbc_cfg.h"
+
+/**
+ * xorshift32
+ *
+ * @param sim
+ * @return next pseudo random number
+ */
+static uint32_t sim_random(struct sMvbcSim *sim)
+{
+	uint32_t x = sim->uiRandom;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	sim->uiRandom = x;
+
+	return x;
+}
+
+static void sim_swap(struct sMvbcSim *sim, int a, int b)
+{
+	struct sMvbcSimSlot tmp = sim->slot[a];
+
+	sim->slot[a] = sim->slot[b];
+	sim->slot[b] = tmp;
+}
+
+/**
+ * Restore the heap order below slot i.
+ *
+ * @param sim
+ * @param i
+ */
+static void sim_sift_down(struct sMvbcSim *sim, int i)
+{
+	for (;;)
+	{
+		int l = 2 * i + 1;
+		int r = l + 1;
+		int min = i;
+
+		if ((l < sim->iCount) && (sim->slot[l].ullDueUS < sim->slot[min].ullDueUS))
+		{
+			min = l;
+		}
+		if ((r < sim->iCount) && (sim->slot[r].ullDueUS < sim->slot[min].ullDueUS))
+		{
+			min = r;
+		}
+		if (min == i)
+		{
+			return;
+		}
+		sim_swap(sim, i, min);
+		i = min;
+	}
+}
+
+/**
+ * Add a port to the schedule.
+ *
+ * @param sim
+ * @param addr
+ * @param fcode
+ * @param period_ms
+ * @param phase_ms
+ * @return 0 in case of success, -1 for error
+ */
+static int sim_add(struct sMvbcSim *sim, int addr, int fcode, int period_ms, int phase_ms)
+{
+	struct sMvbcSimSlot *s;
+	int i;
+
+	if ((sim->iCount >= MVBC_SIM_MAX_ENTRIES) || (addr <= 0) || (addr > MAX_PORT_COUNT) ||
+		(fcode < 0) || (fcode > 15) || (period_ms <= 0))
+	{
+		DEBUG_OUT( "ERROR invalid schedule entry port [%d] period [%d]\n", addr, period_ms);
+		return -1;
+	}
+
+	i = sim->iCount++;
+	s = &sim->slot[i];
+	memset(s, 0, sizeof(struct sMvbcSimSlot));
+	s->wPortAddr = addr;
+	s->wWords = MVBC_FCODE_WORDS(fcode);
+	s->uiPeriodUS = period_ms * 1000;
+	s->ullDueUS = (uint64_t)phase_ms * 1000;
+
+	/* sift up */
+	while ((i > 0) && (sim->slot[(i - 1) / 2].ullDueUS > sim->slot[i].ullDueUS))
+	{
+		sim_swap(sim, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+	return 0;
+}
+
+/**
+ * Common part of the init functions.
+ *
+ * @param sim
+ * @param dev
+ * @param faults
+ * @return 0 in case of success, -1 for error
+ */
+static int sim_setup(struct sMvbcSim *sim, const char *dev, const struct sMvbcSimFaults *faults)
+{
+	if ((sim == NULL) || (dev == NULL))
+	{
+		return -1;
+	}
+
+	memset(sim, 0, offsetof(struct sMvbcSim, slot));
+	strncpy(sim->cDevPath, dev, MAX_STRING_LENGTH - 1);
+
+	if (faults != NULL)
+	{
+		sim->faults = *faults;
+	}
+	sim->uiRandom = (sim->faults.uiSeed != 0) ? sim->faults.uiSeed : 1;
+	sim->ullNextFaultUS = (uint64_t)sim->faults.iLineFaultEveryMS * 1000;
+	gettimeofday(&sim->sStart, NULL);
+
+	if (mvbc_emu_set_external_bus(dev, 1) != 0)
+	{
+		DEBUG_OUT( "ERROR [%s] is no emulated device\n", dev);
+		return -1;
+	}
+	return 0;
+}
+
+int mvbc_sim_init(struct sMvbcSim *sim, const char *dev, const struct sMvbcSimEntry *schedule, int count, const struct sMvbcSimFaults *faults)
+{
+	if ((sim_setup(sim, dev, faults) != 0) || ((count > 0) && (schedule == NULL)))
+	{
+		return -1;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		if (sim_add(sim, schedule[i].wPortAddr, schedule[i].wFunctionCode, schedule[i].wPeriodMS, schedule[i].wPhaseMS) != 0)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int mvbc_ctx_sim_init(mvbc_ctx *ctx, struct sMvbcSim *sim, const char *dev, const struct sMvbcSimFaults *faults)
+{
+	const struct sMvbcCfgSnapshot *snap;
+	int idx = mvbc_find_device(ctx, dev);
+	int rc = 0;
+
+	if ((idx < 0) || (sim_setup(sim, dev, faults) != 0))
+	{
+		return -1;
+	}
+
+	snap = mvbc_ctx_cfg_enter(ctx);
+
+	/* the index is only valid in the snapshot if it was not replaced since the lookup */
+	rc = ((snap != NULL) && (idx < snap->project.mvbc_device_count)) ? 0 : -1;
+	for (int j = 0; (rc == 0) && (j < snap->project.mvbc[idx].portSetup.mvbc_port_count); j++)
+	{
+		const struct sMvbcPortCfg *cfg = &snap->project.mvbc[idx].portSetup.port[j].portCfg;
+
+		if ((cfg->iPortDirection == eSink) && (cfg->iPollIntervalMS > 0))
+		{
+			/* spread the ports over their period like a bus master does */
+			rc = sim_add(sim, cfg->iPortAddr, cfg->iFunctionCode, cfg->iPollIntervalMS, cfg->iPortAddr % cfg->iPollIntervalMS);
+		}
+	}
+
+	mvbc_ctx_cfg_leave(ctx);
+
+	return rc;
+}
+
+void mvbc_sim_set_fill(struct sMvbcSim *sim, mvbc_sim_fill fill, void *arg)
+{
+	sim->fill = fill;
+	sim->pFillArg = arg;
+}
+
+/**
+ * Start and end line faults due at virtual time now.
+ *
+ * @param sim
+ * @param now virtual time in microseconds
+ */
+static void sim_line_faults(struct sMvbcSim *sim, uint64_t now)
+{
+	if ((sim->ullFaultEndUS != 0) && (now >= sim->ullFaultEndUS))
+	{
+		mvbc_emu_set_line_fault(sim->cDevPath, sim->iFaultLine, 0);
+		sim->ullFaultEndUS = 0;
+	}
+
+	if ((sim->faults.iLineFaultEveryMS > 0) && (now >= sim->ullNextFaultUS) && (sim->ullFaultEndUS == 0))
+	{
+		if (sim->faults.iLineFaultLine == eLineAB)
+		{
+			sim->iFaultLine = (sim->stats.uiLineFaults & 1) ? eLineB : eLineA;
+		}
+		else
+		{
+			sim->iFaultLine = sim->faults.iLineFaultLine;
+		}
+
+		mvbc_emu_set_line_fault(sim->cDevPath, sim->iFaultLine, 1);
+		sim->stats.uiLineFaults++;
+		sim->ullFaultEndUS = now + (uint64_t)sim->faults.iLineFaultMS * 1000 + 1;
+		sim->ullNextFaultUS += (uint64_t)sim->faults.iLineFaultEveryMS * 1000;
+	}
+}
+
+/**
+ * Wait until real time caught up with the virtual time.
+ *
+ * @param start real time (CLOCK_MONOTONIC) of the run
+ * @param elapsed virtual microseconds since the start of the run
+ * @param scale
+ */
+static void sim_pace(const struct timespec *start, uint64_t elapsed, int scale)
+{
+	struct timespec now;
+	int64_t ahead;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ahead = (int64_t)(elapsed / scale) - ((int64_t)(now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000);
+
+	if (ahead > 0)
+	{
+		struct timespec pause = { ahead / 1000000, (ahead % 1000000) * 1000 };
+
+		nanosleep(&pause, NULL);
+	}
+}
+
+/**
+ * Hand the collected frames to the device.
+ *
+ * @param sim
+ * @return number of records stored, -1 for error
+ */
+static int sim_flush(struct sMvbcSim *sim)
+{
+	int rc = 0;
+
+	if (sim->iBatch > 0)
+	{
+		rc = mvbc_emu_bus_frames(sim->cDevPath, sim->batch, sim->iBatch);
+		sim->iBatch = 0;
+		if (rc > 0)
+		{
+			sim->stats.ullDelivered += rc;
+		}
+	}
+	return rc;
+}
+
+int64_t mvbc_sim_run(struct sMvbcSim *sim, uint64_t duration_ms, int scale)
+{
+	uint64_t begin;
+	uint64_t end;
+	uint64_t delivered;
+	struct timespec start;
+
+	if ((sim == NULL) || (scale < 0))
+	{
+		return -1;
+	}
+
+	begin = sim->stats.ullNowUS;
+	end = begin + duration_ms * 1000;
+	delivered = sim->stats.ullDelivered;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while ((sim->iCount > 0) && (sim->slot[0].ullDueUS < end))
+	{
+		struct sMvbcSimSlot *s = &sim->slot[0];
+		uint64_t now = s->ullDueUS;
+
+		if (scale > 0)
+		{
+			/* paced runs deliver every frame at its time */
+			if (sim_flush(sim) < 0)
+			{
+				return -1;
+			}
+			sim_pace(&start, now - begin, scale);
+		}
+
+		if ((sim->ullFaultEndUS != 0) ? (now >= sim->ullFaultEndUS) : ((sim->faults.iLineFaultEveryMS > 0) && (now >= sim->ullNextFaultUS)))
+		{
+			/* frames before the line change see the old line state */
+			if (sim_flush(sim) < 0)
+			{
+				return -1;
+			}
+			sim_line_faults(sim, now);
+		}
+
+		sim->stats.ullNowUS = now;
+		sim->stats.ullFrames++;
+		s->wCounter++;
+
+		if ((sim->faults.iDropPPM > 0) && ((int)(sim_random(sim) % 1000000) < sim->faults.iDropPPM))
+		{
+			sim->stats.ullDropped++;
+		}
+		else
+		{
+			struct sPortData *f = &sim->batch[sim->iBatch++];
+			int64_t us = now;
+
+			memset(f, 0, sizeof(struct sPortData));
+			f->wPortAddr = s->wPortAddr;
+			f->wNumOfWords = s->wWords;
+
+			if (sim->fill != NULL)
+			{
+				uint16_t data[MAX_PORT_DATA_LENGTH] = { 0 };
+
+				sim->fill(sim->pFillArg, s->wPortAddr, data, s->wWords, now);
+				memcpy(f->wPortData, data, sizeof(data));
+			}
+			else
+			{
+				for (int w = 0; w < s->wWords; w++)
+				{
+					f->wPortData[w] = (w == 0) ? s->wCounter : s->wPortAddr;
+				}
+			}
+
+			if (sim->faults.iJitterUS > 0)
+			{
+				us += (int64_t)(sim_random(sim) % (2 * sim->faults.iJitterUS + 1)) - sim->faults.iJitterUS;
+				if (us < 0)
+				{
+					us = 0;
+				}
+			}
+			us += sim->sStart.tv_usec;
+			f->sTimeStamp.tv_sec = sim->sStart.tv_sec + us / 1000000;
+			f->sTimeStamp.tv_usec = us % 1000000;
+
+			if ((sim->iBatch == MVBC_SIM_BATCH) && (sim_flush(sim) < 0))
+			{
+				return -1;
+			}
+		}
+
+		s->ullDueUS += s->uiPeriodUS;
+		sim_sift_down(sim, 0);
+	}
+
+	if (sim_flush(sim) < 0)
+	{
+		return -1;
+	}
+
+	sim->stats.ullNowUS = end;
+	sim_line_faults(sim, end);
+
+	return sim->stats.ullDelivered - delivered;
+}
@@ -0,0 +1,853 @@
+/**
+ * @file
+ *
+ * Subscription server for local processes on a Unix domain socket.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mvbc_internal.h"
+#include "mvbc_cfg.h"
+#include "mvbc_srv.h"
+
+/** 64 ports per mask word */
+#define SRV_GROUPS ((MAX_PORT_COUNT + 1) / 64)
+
+/** epoll tags besides the client slots */
+#define SRV_TAG_DEV 0x100
+#define SRV_TAG_LISTEN 0x200
+#define SRV_TAG_WAKE 0x201
+
+/** device descriptors are registered again after this time, they change when the watchdog restarts a device */
+#define SRV_REARM_MS 100
+
+/**
+ * one client slot.
+ */
+struct sMvbcSrvClient
+{
+	/** -1 = free */
+	int iFd;
+
+	int iCredit;
+
+	/** waiting for EPOLLOUT */
+	int iBlocked;
+
+	uint32_t uiSeq;
+
+	/** per device and group of 64 ports: subscribed / to send */
+	uint64_t ullSub[MAX_MVBC_DEVICES][SRV_GROUPS];
+	uint64_t ullDirty[MAX_MVBC_DEVICES][SRV_GROUPS];
+
+	/** groups with a port to send */
+	uint64_t ullDirtyGroups[MAX_MVBC_DEVICES];
+};
+
+struct sMvbcSrv
+{
+	struct mvbc_ctx *ctx;
+	char cPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+	int iEpoll;
+	int iListen;
+	int iWake;
+	int iDevCount;
+
+	/** duplicates of the FIFO descriptors registered in iEpoll, -1 = none */
+	int iDevFd[MAX_MVBC_DEVICES];
+
+	/** uiFdGeneration of the device when iDevFd was duplicated */
+	uint32_t uiDevGeneration[MAX_MVBC_DEVICES];
+	struct timespec sArmed;
+
+	/** latest record per port in record pool blocks, taken with the first record of a group, and ports with a record */
+	struct sPortData *pImage[MAX_MVBC_DEVICES][SRV_GROUPS];
+	uint64_t ullKnown[MAX_MVBC_DEVICES][SRV_GROUPS];
+
+	struct sMvbcSrvClient client[MVBC_SRV_MAX_CLIENTS];
+
+	/** a block of the record pool */
+	struct sPortData *batch;
+	uint8_t cRequest[MVBC_SRV_MAX_REQUEST];
+
+	/** counters of the server thread, copied to published under statsLock */
+	struct sMvbcSrvStats stats;
+	struct sMvbcSrvStats published;
+	pthread_mutex_t statsLock;
+};
+
+#if SRV_GROUPS > 64
+#error "one bit per group in ullDirtyGroups"
+#endif
+
+#if (MVBC_POOL_RECORD_BLOCK != 64) || (MVBC_SRV_BATCH > MVBC_POOL_RECORD_BLOCK)
+#error "an image group and a batch are one block of the record pool"
+#endif
+
+static void srv_client_close(struct sMvbcSrv *srv, struct sMvbcSrvClient *c)
+{
+	epoll_ctl(srv->iEpoll, EPOLL_CTL_DEL, c->iFd, NULL);
+	close(c->iFd);
+	c->iFd = -1;
+	srv->stats.uiClients--;
+}
+
+/**
+ * Send update frames while the client has credit and dirty ports.
+ *
+ * @param srv
+ * @param c
+ */
+static void srv_client_flush(struct sMvbcSrv *srv, struct sMvbcSrvClient *c)
+{
+	struct iovec iov[MVBC_SRV_BATCH + 1];
+	uint16_t addrs[MVBC_SRV_BATCH];
+	struct sMvbcSrvFrame frame;
+	struct msghdr msg;
+
+	for (int dev = 0; (dev < srv->iDevCount) && !c->iBlocked; dev++)
+	{
+		while ((c->ullDirtyGroups[dev] != 0) && (c->iCredit > 0))
+		{
+			uint64_t groups = c->ullDirtyGroups[dev];
+			int count = 0;
+			ssize_t rc;
+
+			/* collect up to a batch of dirty ports, in address order */
+			while ((groups != 0) && (count < MVBC_SRV_BATCH))
+			{
+				int group = __builtin_ctzll(groups);
+				uint64_t mask = c->ullDirty[dev][group];
+
+				while ((mask != 0) && (count < MVBC_SRV_BATCH))
+				{
+					int addr = group * 64 + __builtin_ctzll(mask);
+
+					mask &= mask - 1;
+					addrs[count] = addr;
+					iov[count + 1].iov_base = &srv->pImage[dev][group][addr % 64];
+					iov[count + 1].iov_len = sizeof(struct sPortData);
+					count++;
+				}
+				groups &= groups - 1;
+			}
+
+			frame.wType = MVBC_SRV_UPDATE;
+			frame.wDev = dev;
+			frame.uiLen = count * sizeof(struct sPortData);
+			frame.uiSeq = c->uiSeq;
+			frame.uiCount = count;
+			iov[0].iov_base = &frame;
+			iov[0].iov_len = sizeof(frame);
+
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = count + 1;
+
+			rc = sendmsg(c->iFd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (rc < 0)
+			{
+				if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				{
+					struct epoll_event ev = { EPOLLIN | EPOLLOUT, { .u64 = c - srv->client } };
+
+					srv->stats.ullBlocked++;
+					c->iBlocked = 1;
+					epoll_ctl(srv->iEpoll, EPOLL_CTL_MOD, c->iFd, &ev);
+				}
+				else
+				{
+					srv_client_close(srv, c);
+				}
+				return;
+			}
+
+			for (int i = 0; i < count; i++)
+			{
+				int group = addrs[i] / 64;
+
+				c->ullDirty[dev][group] &= ~(1ULL << (addrs[i] % 64));
+				if (c->ullDirty[dev][group] == 0)
+				{
+					c->ullDirtyGroups[dev] &= ~(1ULL << group);
+				}
+			}
+
+			c->uiSeq++;
+			c->iCredit--;
+			srv->stats.ullFrames++;
+			srv->stats.ullUpdates += count;
+		}
+	}
+}
+
+/**
+ * Mark a port (un)subscribed; a newly subscribed port with data is sent at once.
+ *
+ * @param srv
+ * @param c
+ * @param dev
+ * @param addr
+ * @param on
+ */
+static void srv_subscribe(struct sMvbcSrv *srv, struct sMvbcSrvClient *c, int dev, int addr, int on)
+{
+	int group = addr / 64;
+	uint64_t bit = 1ULL << (addr % 64);
+
+	if (on)
+	{
+		c->ullSub[dev][group] |= bit;
+		if (srv->ullKnown[dev][group] & bit)
+		{
+			c->ullDirty[dev][group] |= bit;
+			c->ullDirtyGroups[dev] |= 1ULL << group;
+		}
+	}
+	else
+	{
+		c->ullSub[dev][group] &= ~bit;
+		c->ullDirty[dev][group] &= ~bit;
+		if (c->ullDirty[dev][group] == 0)
+		{
+			c->ullDirtyGroups[dev] &= ~(1ULL << group);
+		}
+	}
+}
+
+/**
+ * (Un)subscribe the ports of a device with the given names.
+ *
+ * @param srv
+ * @param c
+ * @param dev
+ * @param names uiCount zero terminated names
+ * @param len
+ * @param count
+ * @param on
+ * @return ports matched, -1 for a malformed list
+ */
+static int srv_subscribe_names(struct sMvbcSrv *srv, struct sMvbcSrvClient *c, int dev, const char *names, int len, uint32_t count, int on)
+{
+	const struct sMvbcCfgSnapshot *cfg;
+	int matched = 0;
+	int pos = 0;
+
+	if ((len == 0) || (names[len - 1] != '\0'))
+	{
+		return -1;
+	}
+
+	cfg = mvbc_ctx_cfg_enter(srv->ctx);
+	if ((cfg == NULL) || (dev >= cfg->project.mvbc_device_count))
+	{
+		mvbc_ctx_cfg_leave(srv->ctx);
+		return 0;
+	}
+
+	for (uint32_t n = 0; n < count; n++)
+	{
+		const struct sMvbcPorts *ports = &cfg->project.mvbc[dev].portSetup;
+		const char *name = names + pos;
+
+		if (pos >= len)
+		{
+			matched = -1;
+			break;
+		}
+		pos += strlen(name) + 1;
+
+		/* names need not be unique, every port of that name is taken */
+		for (int i = 0; i < ports->mvbc_port_count; i++)
+		{
+			int addr = ports->port[i].portCfg.iPortAddr;
+
+			if ((addr >= 0) && (addr <= MAX_PORT_COUNT) && (strncmp(ports->port[i].cPortName, name, MAX_STRING_LENGTH) == 0))
+			{
+				srv_subscribe(srv, c, dev, addr, on);
+				matched++;
+			}
+		}
+	}
+
+	mvbc_ctx_cfg_leave(srv->ctx);
+	return matched;
+}
+
+/**
+ * Handle one request of a client.
+ *
+ * @param srv
+ * @param c
+ */
+static void srv_client_request(struct sMvbcSrv *srv, struct sMvbcSrvClient *c)
+{
+	struct sMvbcSrvFrame frame;
+	const uint8_t *payload = srv->cRequest + sizeof(frame);
+	ssize_t n = recv(c->iFd, srv->cRequest, sizeof(srv->cRequest), MSG_DONTWAIT | MSG_TRUNC);
+	int matched = 0;
+	int32_t status;
+	struct sMvbcSrvFrame reply;
+	struct iovec iov[2];
+	struct msghdr msg;
+
+	if (n < 0)
+	{
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+		{
+			srv_client_close(srv, c);
+		}
+		return;
+	}
+	if (n == 0)
+	{
+		srv_client_close(srv, c);
+		return;
+	}
+
+	srv->stats.ullRequests++;
+
+	memcpy(&frame, srv->cRequest, (n < (ssize_t)sizeof(frame)) ? (size_t)n : sizeof(frame));
+	if ((n < (ssize_t)sizeof(frame)) || (n > (ssize_t)sizeof(srv->cRequest)) || ((ssize_t)frame.uiLen != n - (ssize_t)sizeof(frame)) ||
+		((frame.wType != MVBC_SRV_CREDIT) && (frame.wDev >= srv->iDevCount)))
+	{
+		srv->stats.uiBadRequests++;
+		srv_client_close(srv, c);
+		return;
+	}
+
+	switch (frame.wType)
+	{
+	case MVBC_SRV_CREDIT:
+		c->iCredit = (frame.uiCount > (uint32_t)(INT32_MAX - c->iCredit)) ? INT32_MAX : c->iCredit + (int)frame.uiCount;
+		srv_client_flush(srv, c);
+		return;
+
+	case MVBC_SRV_SUBSCRIBE:
+	case MVBC_SRV_UNSUBSCRIBE:
+		if (frame.uiLen != frame.uiCount * sizeof(uint16_t))
+		{
+			matched = -1;
+			break;
+		}
+		for (uint32_t i = 0; i < frame.uiCount; i++)
+		{
+			uint16_t addr;
+
+			memcpy(&addr, payload + i * sizeof(addr), sizeof(addr));
+			if (addr <= MAX_PORT_COUNT)
+			{
+				srv_subscribe(srv, c, frame.wDev, addr, frame.wType == MVBC_SRV_SUBSCRIBE);
+				matched++;
+			}
+		}
+		break;
+
+	case MVBC_SRV_SUBSCRIBE_NAME:
+	case MVBC_SRV_UNSUBSCRIBE_NAME:
+		matched = srv_subscribe_names(srv, c, frame.wDev, (const char *)payload, frame.uiLen, frame.uiCount, frame.wType == MVBC_SRV_SUBSCRIBE_NAME);
+		break;
+
+	default:
+		matched = -1;
+		break;
+	}
+
+	status = (matched < 0) ? -1 : 0;
+	reply.wType = MVBC_SRV_REPLY;
+	reply.wDev = frame.wDev;
+	reply.uiLen = sizeof(status);
+	reply.uiSeq = frame.uiSeq;
+	reply.uiCount = (matched < 0) ? 0 : matched;
+	iov[0].iov_base = &reply;
+	iov[0].iov_len = sizeof(reply);
+	iov[1].iov_base = &status;
+	iov[1].iov_len = sizeof(status);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	/* a reply that does not fit is dropped, the client sees the result in its updates */
+	sendmsg(c->iFd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+	srv_client_flush(srv, c);
+}
+
+static void srv_accept(struct sMvbcSrv *srv)
+{
+	for (;;)
+	{
+		int fd = accept4(srv->iListen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		struct sMvbcSrvClient *c = NULL;
+		struct epoll_event ev;
+
+		if (fd < 0)
+		{
+			return;
+		}
+
+		for (int i = 0; i < MVBC_SRV_MAX_CLIENTS; i++)
+		{
+			if (srv->client[i].iFd < 0)
+			{
+				c = &srv->client[i];
+				break;
+			}
+		}
+
+		if (c == NULL)
+		{
+			srv->stats.uiRejected++;
+			close(fd);
+			continue;
+		}
+
+		memset(c, 0, sizeof(*c));
+		c->iFd = fd;
+		c->iCredit = MVBC_SRV_INITIAL_CREDIT;
+
+		ev.events = EPOLLIN;
+		ev.data.u64 = c - srv->client;
+		if (epoll_ctl(srv->iEpoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+		{
+			close(fd);
+			c->iFd = -1;
+			continue;
+		}
+		srv->stats.uiClients++;
+	}
+}
+
+/**
+ * Read a device and mark the records for the subscribed clients.
+ *
+ * @param srv
+ * @param dev
+ */
+static void srv_read_device(struct sMvbcSrv *srv, int dev)
+{
+	for (;;)
+	{
+		int got = mvbc_read_index(srv->ctx, dev, srv->batch, MVBC_SRV_BATCH);
+
+		if (got <= 0)
+		{
+			return;
+		}
+
+		srv->stats.ullRecords += got;
+
+		for (int i = 0; i < got; i++)
+		{
+			uint16_t addr = srv->batch[i].wPortAddr;
+			int group = addr / 64;
+			uint64_t bit = 1ULL << (addr % 64);
+
+			if (addr > MAX_PORT_COUNT)
+			{
+				continue;
+			}
+
+			if (srv->pImage[dev][group] == NULL)
+			{
+				/* without a block the group stays unknown, the pool counts it */
+				srv->pImage[dev][group] = mvbc_ctx_record_alloc(srv->ctx);
+				if (srv->pImage[dev][group] == NULL)
+				{
+					continue;
+				}
+			}
+
+			srv->pImage[dev][group][addr % 64] = srv->batch[i];
+			srv->ullKnown[dev][group] |= bit;
+
+			for (int n = 0; n < MVBC_SRV_MAX_CLIENTS; n++)
+			{
+				struct sMvbcSrvClient *c = &srv->client[n];
+
+				if ((c->iFd < 0) || !(c->ullSub[dev][group] & bit))
+				{
+					continue;
+				}
+				if (c->ullDirty[dev][group] & bit)
+				{
+					srv->stats.ullCoalesced++;
+				}
+				c->ullDirty[dev][group] |= bit;
+				c->ullDirtyGroups[dev] |= 1ULL << group;
+			}
+		}
+
+		if (got < MVBC_SRV_BATCH)
+		{
+			return;
+		}
+	}
+}
+
+/**
+ * Register the FIFO descriptors of the devices with epoll again. A device restarted
+ * by the watchdog or an init gets a new descriptor, possibly with the same number,
+ * so a change is told by the generation of the device and not by the number.
+ *
+ * @param srv
+ */
+static void srv_arm_devices(struct sMvbcSrv *srv)
+{
+	clock_gettime(CLOCK_MONOTONIC, &srv->sArmed);
+
+	for (int i = 0; i < srv->iDevCount; i++)
+	{
+		struct epoll_event ev = { EPOLLIN, { .u64 = SRV_TAG_DEV + i } };
+		uint32_t generation;
+		int fd = mvbc_reader_fd_dup(srv->ctx, i, &generation);
+
+		if ((srv->iDevFd[i] >= 0) && (generation == srv->uiDevGeneration[i]))
+		{
+			/* still the registered descriptor */
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+			continue;
+		}
+
+		/* the duplicate is still open, so it names the registered file and no other */
+		if (srv->iDevFd[i] >= 0)
+		{
+			epoll_ctl(srv->iEpoll, EPOLL_CTL_DEL, srv->iDevFd[i], NULL);
+			close(srv->iDevFd[i]);
+			srv->iDevFd[i] = -1;
+			srv->stats.uiReopened++;
+		}
+		if ((fd >= 0) && (epoll_ctl(srv->iEpoll, EPOLL_CTL_ADD, fd, &ev) != 0))
+		{
+			close(fd);
+			fd = -1;
+		}
+		srv->iDevFd[i] = fd;
+		srv->uiDevGeneration[i] = generation;
+	}
+}
+
+static void *srv_thread(void *arg)
+{
+	struct sMvbcSrv *srv = arg;
+	struct epoll_event events[MVBC_SRV_MAX_CLIENTS + MAX_MVBC_DEVICES + 2];
+	int running = 1;
+
+	srv_arm_devices(srv);
+
+	while (running)
+	{
+		int n = epoll_wait(srv->iEpoll, events, sizeof(events) / sizeof(events[0]), SRV_REARM_MS);
+		int readDevice = 0;
+		struct timespec now;
+
+		for (int i = 0; i < n; i++)
+		{
+			uint64_t tag = events[i].data.u64;
+
+			if (tag == SRV_TAG_WAKE)
+			{
+				running = 0;
+			}
+			else if (tag == SRV_TAG_LISTEN)
+			{
+				srv_accept(srv);
+			}
+			else if (tag >= SRV_TAG_DEV)
+			{
+				srv_read_device(srv, tag - SRV_TAG_DEV);
+				readDevice = 1;
+			}
+			else
+			{
+				struct sMvbcSrvClient *c = &srv->client[tag];
+
+				if (c->iFd < 0)
+				{
+					continue;
+				}
+				if (events[i].events & (EPOLLERR | EPOLLHUP))
+				{
+					srv_client_close(srv, c);
+					continue;
+				}
+				if ((events[i].events & EPOLLOUT) && c->iBlocked)
+				{
+					struct epoll_event ev = { EPOLLIN, { .u64 = tag } };
+
+					c->iBlocked = 0;
+					epoll_ctl(srv->iEpoll, EPOLL_CTL_MOD, c->iFd, &ev);
+					srv_client_flush(srv, c);
+				}
+				if ((c->iFd >= 0) && (events[i].events & EPOLLIN))
+				{
+					srv_client_request(srv, c);
+				}
+			}
+		}
+
+		if (readDevice)
+		{
+			for (int i = 0; i < MVBC_SRV_MAX_CLIENTS; i++)
+			{
+				if ((srv->client[i].iFd >= 0) && !srv->client[i].iBlocked)
+				{
+					srv_client_flush(srv, &srv->client[i]);
+				}
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ((now.tv_sec - srv->sArmed.tv_sec) * 1000 + (now.tv_nsec - srv->sArmed.tv_nsec) / 1000000 >= SRV_REARM_MS)
+		{
+			srv_arm_devices(srv);
+		}
+
+		pthread_mutex_lock(&srv->statsLock);
+		srv->published = srv->stats;
+		pthread_mutex_unlock(&srv->statsLock);
+	}
+
+	mvbc_ctx_cfg_thread_exit(srv->ctx);
+	return NULL;
+}
+
+static void srv_free(struct sMvbcSrv *srv)
+{
+	for (int i = 0; i < MVBC_SRV_MAX_CLIENTS; i++)
+	{
+		if (srv->client[i].iFd >= 0)
+		{
+			close(srv->client[i].iFd);
+		}
+	}
+	for (int i = 0; i < MAX_MVBC_DEVICES; i++)
+	{
+		for (int g = 0; g < SRV_GROUPS; g++)
+		{
+			mvbc_ctx_record_free(srv->ctx, srv->pImage[i][g]);
+		}
+		if (srv->iDevFd[i] >= 0)
+		{
+			close(srv->iDevFd[i]);
+		}
+	}
+	if (srv->iListen >= 0)
+	{
+		close(srv->iListen);
+		unlink(srv->cPath);
+	}
+	if (srv->iWake >= 0)
+	{
+		close(srv->iWake);
+	}
+	if (srv->iEpoll >= 0)
+	{
+		close(srv->iEpoll);
+	}
+	mvbc_ctx_record_free(srv->ctx, srv->batch);
+	pthread_mutex_destroy(&srv->statsLock);
+	free(srv);
+}
+
+/**
+ * Take the read batch and open the sockets of a server. Called with ctx->ctxLock held.
+ *
+ * @param srv
+ * @param path
+ * @return 0 in case of success, -1 for error
+ */
+static int srv_open(struct sMvbcSrv *srv, const char *path)
+{
+	struct sockaddr_un addr;
+	struct epoll_event ev;
+
+	/* a context not initialised yet gets its pools now */
+	if (srv->ctx->pRecPool == NULL)
+	{
+		mvbc_pool_setup(srv->ctx);
+	}
+	srv->batch = mvbc_ctx_record_alloc(srv->ctx);
+	if (srv->batch == NULL)
+	{
+		DEBUG_OUT( "ERROR no record block for the server\n");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	strcpy(srv->cPath, path);
+	unlink(path);
+
+	srv->iEpoll = epoll_create1(EPOLL_CLOEXEC);
+	srv->iWake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	srv->iListen = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if ((srv->iEpoll < 0) || (srv->iWake < 0) || (srv->iListen < 0) ||
+		(bind(srv->iListen, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(srv->iListen, MVBC_SRV_MAX_CLIENTS) != 0))
+	{
+		DEBUG_OUT( "ERROR server socket [%s] %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.u64 = SRV_TAG_LISTEN;
+	if (epoll_ctl(srv->iEpoll, EPOLL_CTL_ADD, srv->iListen, &ev) != 0)
+	{
+		return -1;
+	}
+	ev.data.u64 = SRV_TAG_WAKE;
+	if (epoll_ctl(srv->iEpoll, EPOLL_CTL_ADD, srv->iWake, &ev) != 0)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+int mvbc_ctx_srv_start(mvbc_ctx *ctx, const char *path)
+{
+	struct sMvbcSrv *srv;
+
+	if ((ctx == NULL) || (path == NULL) || (strlen(path) >= sizeof(srv->cPath)))
+	{
+		return -1;
+	}
+
+	srv = calloc(1, sizeof(struct sMvbcSrv));
+	if (srv == NULL)
+	{
+		DEBUG_OUT( "ERROR no memory for the server\n");
+		return -1;
+	}
+
+	srv->ctx = ctx;
+	srv->iListen = -1;
+	srv->iWake = -1;
+	srv->iEpoll = -1;
+	pthread_mutex_init(&srv->statsLock, NULL);
+	for (int i = 0; i < MVBC_SRV_MAX_CLIENTS; i++)
+	{
+		srv->client[i].iFd = -1;
+	}
+	for (int i = 0; i < MAX_MVBC_DEVICES; i++)
+	{
+		srv->iDevFd[i] = -1;
+	}
+
+	pthread_mutex_lock(&ctx->ctxLock);
+
+	srv->iDevCount = ctx->project.mvbc_device_count;
+	if ((ctx->pSrv != NULL) || (srv_open(srv, path) != 0))
+	{
+		pthread_mutex_unlock(&ctx->ctxLock);
+		srv_free(srv);
+		return -1;
+	}
+
+	if (pthread_create(&ctx->srvThread, NULL, srv_thread, srv) != 0)
+	{
+		DEBUG_OUT( "ERROR starting the server %s\n", strerror(errno));
+		pthread_mutex_unlock(&ctx->ctxLock);
+		srv_free(srv);
+		return -1;
+	}
+
+	ctx->pSrv = srv;
+	pthread_mutex_unlock(&ctx->ctxLock);
+	return 0;
+}
+
+int mvbc_srv_start(const char *path)
+{
+	return mvbc_ctx_srv_start(mvbc_default_ctx(), path);
+}
+
+int mvbc_ctx_srv_stop(mvbc_ctx *ctx)
+{
+	struct sMvbcSrv *srv;
+	uint64_t one = 1;
+
+	if (ctx == NULL)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->ctxLock);
+	srv = ctx->pSrv;
+	ctx->pSrv = NULL;
+	pthread_mutex_unlock(&ctx->ctxLock);
+
+	if (srv == NULL)
+	{
+		return -1;
+	}
+
+	if (write(srv->iWake, &one, sizeof(one)) != sizeof(one))
+	{
+		DEBUG_OUT( "ERROR waking the server %s\n", strerror(errno));
+	}
+	pthread_join(ctx->srvThread, NULL);
+	srv_free(srv);
+
+	return 0;
+}
+
+int mvbc_srv_stop(void)
+{
+	return mvbc_ctx_srv_stop(mvbc_default_ctx());
+}
+
+int mvbc_ctx_srv_get_stats(mvbc_ctx *ctx, struct sMvbcSrvStats *stats)
+{
+	int rc = -1;
+
+	if ((ctx == NULL) || (stats == NULL))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->ctxLock);
+	if (ctx->pSrv != NULL)
+	{
+		pthread_mutex_lock(&ctx->pSrv->statsLock);
+		*stats = ctx->pSrv->published;
+		pthread_mutex_unlock(&ctx->pSrv->statsLock);
+		rc = 0;
+	}
+	pthread_mutex_unlock(&ctx->ctxLock);
+
+	return rc;
+}
+
+int mvbc_srv_get_stats(struct sMvbcSrvStats *stats)
+{
+	return mvbc_ctx_srv_get_stats(mvbc_default_ctx(), stats);
+}
@@ -0,0 +1,158 @@
+/**
+ * @file
+ *
+ * Initialisation from a project configuration linked into the application.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdlib.h>
+
+#include "mvbc_internal.h"
+#include "mvbc_static.h"
+
+/**
+ * Copy a string of the tables, NULL selects the default.
+ *
+ * @param dst MAX_STRING_LENGTH bytes
+ * @param src
+ * @param def
+ */
+static void static_copy_string(char *dst, const char *src, const char *def)
+{
+	strncpy(dst, (src != NULL) ? src : def, MAX_STRING_LENGTH - 1);
+}
+
+/**
+ * Fill a project configuration from linked in tables.
+ *
+ * @param src
+ * @param project
+ * @return 0 in case of success, error_code (enum configErrors) in case of error
+ */
+static int static_to_project(const struct sMvbcStaticProject *src, struct sProject *project)
+{
+	memset(project, 0, sizeof(struct sProject));
+
+	if ((src->iDeviceCount < 0) || (src->iDeviceCount > MAX_MVBC_DEVICES) || ((src->iDeviceCount > 0) && (src->pDevices == NULL)))
+	{
+		DEBUG_OUT( "ERROR invalid static device count [%d]\n", src->iDeviceCount);
+		return ERROR_CONFIG_INVALID_PARAMETER;
+	}
+
+	static_copy_string(project->cProjectName, src->pName, MVBC_JSON_CONF_DEFAULT_PROJECT_NAME);
+	static_copy_string(project->cProjectVersion, src->pVersion, MVBC_JSON_CONF_DEFAULT_PROJECT_VERSION);
+	project->mvbc_device_count = src->iDeviceCount;
+
+	for (int i = 0; i < src->iDeviceCount; i++)
+	{
+		const struct sMvbcStaticDevice *d = &src->pDevices[i];
+		struct sMvbcDevCfg *mvbc = &project->mvbc[i];
+
+		if ((d->pDevPath == NULL) || (d->iPortCount < 0) || (d->iPortCount > MAX_PORT_COUNT) ||
+			((d->iPortCount > 0) && (d->pPorts == NULL)))
+		{
+			DEBUG_OUT( "ERROR invalid static device [%d]\n", i);
+			return ERROR_CONFIG_INVALID_PARAMETER;
+		}
+
+		static_copy_string(mvbc->cDevPath, d->pDevPath, "");
+		static_copy_string(mvbc->cUioPath, d->pUioPath, "");
+		static_copy_string(mvbc->cDescription, d->pDescription, MVBC_JSON_CONF_DEFAULT_DEVICE_DESCRIPTION);
+		mvbc->iInterface = d->iInterface;
+		mvbc->iMode = d->iMode;
+		mvbc->iTestTrafficMemory = d->iTestTrafficMemory;
+		mvbc->iLine = d->iLine;
+		mvbc->iDeviceAddr = d->iDeviceAddr;
+
+		mvbc->portSetup.defaultPortCfg.wPortType = d->wDefaultPortType;
+		mvbc->portSetup.defaultPortCfg.wPollInterval = d->wDefaultPollInterval;
+		mvbc->portSetup.defaultPortCfg.iIrqNumber = d->iDefaultIrqNumber;
+		mvbc->portSetup.defaultPortCfg.iNumData = d->iDefaultNumData;
+
+		mvbc->portSetup.mvbc_port_count = d->iPortCount;
+
+		for (int j = 0; j < d->iPortCount; j++)
+		{
+			const struct sMvbcStaticPort *p = &d->pPorts[j];
+			struct sMvbcPort *port = &mvbc->portSetup.port[j];
+
+			static_copy_string(port->cPortName, p->pName, MVBC_JSON_CONF_DEFAULT_PORT_NAME);
+			port->portCfg.iPortAddr = p->wPortAddr;
+			port->portCfg.iPortType = p->cPortType;
+			port->portCfg.iPortDirection = p->cPortDirection;
+			port->portCfg.iFunctionCode = p->cFunctionCode;
+			port->portCfg.iPollIntervalMS = p->wPollIntervalMS;
+			port->portCfg.iIrqNumber = p->cIrqNumber;
+			port->portCfg.iNumData = p->cNumData;
+			port->portCfg.iPCS_W0 = p->wPCS_W0;
+		}
+	}
+
+	/* the rules of the JSON parser; tables declared in C++ passed them at compile time already (mvbc.hpp) */
+	if (mvbc_check_project(project) != 0)
+	{
+		return ERROR_CONFIG_INVALID_PARAMETER;
+	}
+
+	return NO_ERROR;
+}
+
+int mvbc_ctx_init_static(mvbc_ctx *ctx, const struct sMvbcStaticProject *project)
+{
+	struct sProject *parsed;
+	int rc;
+
+	if ((ctx == NULL) || (project == NULL))
+	{
+		return ERROR_PARSE_CONFIGURATION;
+	}
+
+	parsed = malloc(sizeof(struct sProject));
+	if (parsed == NULL)
+	{
+		DEBUG_OUT( "ERROR no memory for the configuration\n");
+		return ERROR_PARSE_CONFIGURATION;
+	}
+
+	if (static_to_project(project, parsed) != NO_ERROR)
+	{
+		/* nothing of a broken table reaches the devices, the last configuration stays */
+		free(parsed);
+		DEBUG_OUT( "RC[%X]\n", ERROR_PARSE_CONFIGURATION);
+		return ERROR_PARSE_CONFIGURATION;
+	}
+
+	pthread_mutex_lock(&ctx->ctxLock);
+
+	mvbc_memtest_stop(ctx);
+
+	rc = mvbc_ctx_start_locked(ctx, parsed, NO_ERROR);
+
+	pthread_mutex_unlock(&ctx->ctxLock);
+
+	free(parsed);
+
+	DEBUG_OUT( "RC[%X]\n", rc);
+	return rc;
+}
+
+int mvbc_init_static(const struct sMvbcStaticProject *project)
+{
+	return mvbc_ctx_init_static(mvbc_default_ctx(), project);
+}
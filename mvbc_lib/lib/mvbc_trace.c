@@ -0,0 +1,39 @@
+/**
+ * @file
+ *
+ * Semaphores of the static probe points.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "mvbc_trace.h"
+
+#ifdef MVBC_TRACE
+
+/* a tracer increments the semaphore of a probe while it is attached */
+#define MVBC_TRACE_SEMAPHORE(name) unsigned short mvbc_##name##_semaphore __attribute__((unused, section(".probes")))
+
+MVBC_TRACE_SEMAPHORE(cmd__entry);
+MVBC_TRACE_SEMAPHORE(cmd__return);
+MVBC_TRACE_SEMAPHORE(port__config);
+MVBC_TRACE_SEMAPHORE(record__read);
+MVBC_TRACE_SEMAPHORE(dispatch);
+MVBC_TRACE_SEMAPHORE(queue__overflow);
+MVBC_TRACE_SEMAPHORE(stale);
+
+#endif
@@ -0,0 +1,357 @@
+/**
+ * @file
+ *
+ * Traffic memory mapped into user space.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mvbc_internal.h"
+#include "mvbc_uio.h"
+
+int mvbc_uio_map(struct sMvbcUio *uio, const char *path, size_t size)
+{
+	struct stat st;
+	void *base;
+
+	if ((uio == NULL) || (path == NULL))
+	{
+		return -1;
+	}
+
+	memset(uio, 0, sizeof(struct sMvbcUio));
+	uio->iFd = -1;
+
+#ifndef MVBC_UIO_BOARD_LAYOUT
+	if ((stat(path, &st) != 0) || !S_ISREG(st.st_mode))
+	{
+		/* the built-in offsets only describe files programmed with mvbc_uio_set_port() */
+		DEBUG_OUT( "ERROR [%s] is no regular file and no board layout is built in (MVBC_UIO_BOARD_LAYOUT)\n", path);
+		return -1;
+	}
+#endif
+
+	uio->iFd = open(path, O_RDWR | O_SYNC);
+	if (uio->iFd < 0)
+	{
+		DEBUG_OUT( "ERROR open [%s] %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (size == 0)
+	{
+		/* UIO devices report no size, regular files do */
+		size = ((fstat(uio->iFd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0)) ? (size_t)st.st_size : MVBC_UIO_MAP_SIZE;
+	}
+	if (size < MVBC_UIO_DATA_OFFSET + MVBC_UIO_PORT_INDICES * 2 * 16 * sizeof(uint16_t))
+	{
+		DEBUG_OUT( "ERROR [%s] too small for the traffic memory [%zu]\n", path, size);
+		close(uio->iFd);
+		uio->iFd = -1;
+		return -1;
+	}
+
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, uio->iFd, 0);
+	if (base == MAP_FAILED)
+	{
+		DEBUG_OUT( "ERROR mmap [%s] %s\n", path, strerror(errno));
+		close(uio->iFd);
+		uio->iFd = -1;
+		return -1;
+	}
+
+	uio->pBase = base;
+	uio->ulSize = size;
+
+	return 0;
+}
+
+void mvbc_uio_unmap(struct sMvbcUio *uio)
+{
+	if ((uio != NULL) && (uio->pBase != NULL))
+	{
+		munmap((void *)uio->pBase, uio->ulSize);
+		close(uio->iFd);
+		uio->pBase = NULL;
+		uio->iFd = -1;
+	}
+}
+
+/**
+ * PCS words of a port index.
+ *
+ * @param uio
+ * @param index
+ * @return first of the 4 words
+ */
+static volatile uint16_t *uio_pcs(const struct sMvbcUio *uio, int index)
+{
+	return (volatile uint16_t *)(uio->pBase + MVBC_UIO_PCS_OFFSET) + index * 4;
+}
+
+/**
+ * Data page of a port index.
+ *
+ * @param uio
+ * @param index
+ * @param page 0 or 1
+ * @return first data word
+ */
+static volatile uint16_t *uio_page(const struct sMvbcUio *uio, int index, int page)
+{
+	return (volatile uint16_t *)(uio->pBase + MVBC_UIO_DATA_OFFSET) + (index * 2 + page) * 16;
+}
+
+int mvbc_uio_port(const struct sMvbcUio *uio, int addr, struct sMvbcUioPort *port)
+{
+	int index;
+	uint16_t w0;
+
+	if ((uio == NULL) || (uio->pBase == NULL) || (port == NULL) || (addr <= 0) || (addr > MAX_PORT_COUNT))
+	{
+		return -1;
+	}
+
+	index = ((volatile uint16_t *)(uio->pBase + MVBC_UIO_PIT_OFFSET))[addr];
+	if ((index <= 0) || (index >= MVBC_UIO_PORT_INDICES))
+	{
+		return -1;
+	}
+
+	port->pPCS = uio_pcs(uio, index);
+	port->pPage[0] = uio_page(uio, index, 0);
+	port->pPage[1] = uio_page(uio, index, 1);
+
+	w0 = port->pPCS[0];
+	port->wWords = MVBC_FCODE_WORDS(w0 >> 12);
+	port->wSource = (w0 & MVBC_PCS_W0(0, eSource, 0, 0)) ? 1 : 0;
+
+	return 0;
+}
+
+int mvbc_uio_port_read(const struct sMvbcUioPort *port, uint16_t *data, int words, int *fresh)
+{
+	if ((port == NULL) || (port->pPCS == NULL) || (data == NULL) || (words < 0))
+	{
+		return -1;
+	}
+	if (words > port->wWords)
+	{
+		words = port->wWords;
+	}
+
+	/*
+	 * The MVBC only writes the invalid page and flips VP when the frame is
+	 * complete. A flip takes at least one frame time, far longer than this
+	 * copy, so an unchanged VP means the copy is consistent.
+	 */
+	for (int retry = 0; retry < MVBC_UIO_READ_RETRIES; retry++)
+	{
+		uint16_t w1 = __atomic_load_n(&port->pPCS[1], __ATOMIC_ACQUIRE);
+		const volatile uint16_t *page = port->pPage[w1 & MVBC_UIO_PCS1_VP];
+
+		for (int i = 0; i < words; i++)
+		{
+			data[i] = page[i];
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (((__atomic_load_n(&port->pPCS[1], __ATOMIC_RELAXED) ^ w1) & MVBC_UIO_PCS1_VP) == 0)
+		{
+			if (fresh != NULL)
+			{
+				*fresh = ((w1 & MVBC_UIO_PCS1_TACK) && !port->wSource) ? 1 : 0;
+				if (*fresh)
+				{
+					/* VP did not change since w1, one store acknowledges without a read-modify-write */
+					__atomic_store_n(&port->pPCS[1], (uint16_t)(w1 & ~MVBC_UIO_PCS1_TACK), __ATOMIC_RELAXED);
+				}
+			}
+			return words;
+		}
+	}
+
+	return -1;
+}
+
+int mvbc_uio_port_write(const struct sMvbcUioPort *port, const uint16_t *data, int words)
+{
+	volatile uint16_t *page;
+	uint16_t w1;
+
+	if ((port == NULL) || (port->pPCS == NULL) || (data == NULL) || (words < 0) || !port->wSource)
+	{
+		return -1;
+	}
+
+	w1 = __atomic_load_n(&port->pPCS[1], __ATOMIC_RELAXED);
+	page = port->pPage[(w1 & MVBC_UIO_PCS1_VP) ^ 1];
+
+	for (int i = 0; i < port->wWords; i++)
+	{
+		page[i] = (i < words) ? data[i] : 0;
+	}
+
+	/* the page has to be complete before the MVBC may send it */
+	__atomic_store_n(&port->pPCS[1], (uint16_t)((w1 ^ MVBC_UIO_PCS1_VP) & ~MVBC_UIO_PCS1_TACK), __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+int mvbc_uio_get_regs(const struct sMvbcUio *uio, uint16_t *scr, uint16_t *mcr, uint16_t *dr)
+{
+	volatile uint16_t *reg;
+
+	if ((uio == NULL) || (uio->pBase == NULL))
+	{
+		return -1;
+	}
+
+	reg = (volatile uint16_t *)(uio->pBase + MVBC_UIO_REG_OFFSET);
+	if (scr != NULL)
+	{
+		*scr = reg[0];
+	}
+	if (mcr != NULL)
+	{
+		*mcr = reg[2];
+	}
+	if (dr != NULL)
+	{
+		*dr = reg[4];
+	}
+	return 0;
+}
+
+int mvbc_uio_set_port(struct sMvbcUio *uio, int index, int addr, uint16_t pcs_w0)
+{
+	volatile uint16_t *pcs;
+
+	if ((uio == NULL) || (uio->pBase == NULL) || (index <= 0) || (index >= MVBC_UIO_PORT_INDICES) ||
+		(addr <= 0) || (addr > MAX_PORT_COUNT))
+	{
+		return -1;
+	}
+
+	pcs = uio_pcs(uio, index);
+	pcs[0] = pcs_w0;
+	pcs[1] = 0;
+	pcs[2] = 0;
+	pcs[3] = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		uio_page(uio, index, 0)[i] = 0;
+		uio_page(uio, index, 1)[i] = 0;
+	}
+
+	__atomic_store_n(&((volatile uint16_t *)(uio->pBase + MVBC_UIO_PIT_OFFSET))[addr], (uint16_t)index, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/**
+ * Map the traffic memory of ctx->dev[idx] if its configuration names one.
+ * Called with ctx->ctxLock and ctx->devLock[idx] held.
+ *
+ * @param ctx
+ * @param idx
+ */
+void mvbc_uio_attach(struct mvbc_ctx *ctx, int idx)
+{
+	const char *path = ctx->project.mvbc[idx].cUioPath;
+
+	if ((path[0] != 0) && (mvbc_uio_map(&ctx->dev[idx].uio, path, 0) != 0))
+	{
+		/* the ioctl/FIFO path keeps working without it */
+		DEBUG_OUT( "WARNING no traffic memory for [%s]\n", ctx->project.mvbc[idx].cDevPath);
+	}
+}
+
+int mvbc_ctx_uio_port(mvbc_ctx *ctx, const char *dev, int addr, struct sMvbcUioPort *port)
+{
+	int idx = mvbc_find_device(ctx, dev);
+	int rc;
+
+	if (idx < 0)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->devLock[idx]);
+	rc = mvbc_uio_port(&ctx->dev[idx].uio, addr, port);
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return rc;
+}
+
+int mvbc_ctx_port_read(mvbc_ctx *ctx, const char *dev, int addr, uint16_t *data, int words, int *fresh)
+{
+	struct sMvbcUioPort port;
+	int idx = mvbc_find_device(ctx, dev);
+	int rc = -1;
+
+	if (idx < 0)
+	{
+		return -1;
+	}
+
+	/* an init may unmap the memory as soon as the lock is dropped */
+	pthread_mutex_lock(&ctx->devLock[idx]);
+	if (mvbc_uio_port(&ctx->dev[idx].uio, addr, &port) == 0)
+	{
+		rc = mvbc_uio_port_read(&port, data, words, fresh);
+	}
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return rc;
+}
+
+int mvbc_port_read(const char *dev, int addr, uint16_t *data, int words, int *fresh)
+{
+	return mvbc_ctx_port_read(mvbc_default_ctx(), dev, addr, data, words, fresh);
+}
+
+int mvbc_ctx_port_write(mvbc_ctx *ctx, const char *dev, int addr, const uint16_t *data, int words)
+{
+	struct sMvbcUioPort port;
+	int idx = mvbc_find_device(ctx, dev);
+	int rc = -1;
+
+	if (idx < 0)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->devLock[idx]);
+	if (mvbc_uio_port(&ctx->dev[idx].uio, addr, &port) == 0)
+	{
+		rc = mvbc_uio_port_write(&port, data, words);
+	}
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return rc;
+}
+
+int mvbc_port_write(const char *dev, int addr, const uint16_t *data, int words)
+{
+	return mvbc_ctx_port_write(mvbc_default_ctx(), dev, addr, data, words);
+}
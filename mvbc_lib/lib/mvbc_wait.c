@@ -0,0 +1,205 @@
+/**
+ * @file
+ *
+ * Blocking wait for updates of single ports (per port sequence counters and futexes).
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "mvbc_internal.h"
+
+/**
+ * update counters and waiters of the ports of one device.
+ */
+struct sMvbcPortSeq
+{
+	/** incremented for every record of the port, futex word of its waiters */
+	uint32_t uiSeq[MAX_PORT_COUNT + 1];
+
+	/** threads in mvbc_wait_port() per port */
+	uint32_t uiWaiters[MAX_PORT_COUNT + 1];
+};
+
+static long futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout, uint32_t val3)
+{
+	return syscall(SYS_futex, uaddr, op, val, timeout, NULL, val3);
+}
+
+/**
+ * Count the records read from a device and wake the waiters of their ports.
+ * Called with ctx->devLock[idx] held.
+ *
+ * @param seq
+ * @param recs
+ * @param count
+ */
+void mvbc_port_seq_update(struct sMvbcPortSeq *seq, const struct sPortData *recs, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		uint16_t addr = recs[i].wPortAddr;
+
+		if (addr > MAX_PORT_COUNT)
+		{
+			continue;
+		}
+
+		/* pairs with the waiter announcing itself before it checks the counter */
+		__atomic_add_fetch(&seq->uiSeq[addr], 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&seq->uiWaiters[addr], __ATOMIC_SEQ_CST) != 0)
+		{
+			futex(&seq->uiSeq[addr], FUTEX_WAKE_PRIVATE, INT_MAX, NULL, 0);
+		}
+	}
+}
+
+/**
+ * Free the counters of ctx->dev[idx].
+ *
+ * @param ctx
+ * @param idx
+ */
+void mvbc_port_seq_free(struct mvbc_ctx *ctx, int idx)
+{
+	free(ctx->pPortSeq[idx]);
+	ctx->pPortSeq[idx] = NULL;
+}
+
+/**
+ * Get the counters of a device, created on first use. They live as long as the context,
+ * so waiters never see them disappear.
+ *
+ * @param ctx
+ * @param idx
+ * @return counters, NULL for error
+ */
+static struct sMvbcPortSeq *port_seq(struct mvbc_ctx *ctx, int idx)
+{
+	struct sMvbcPortSeq *seq = __atomic_load_n(&ctx->pPortSeq[idx], __ATOMIC_ACQUIRE);
+
+	if (seq == NULL)
+	{
+		pthread_mutex_lock(&ctx->devLock[idx]);
+		seq = ctx->pPortSeq[idx];
+		if (seq == NULL)
+		{
+			seq = calloc(1, sizeof(struct sMvbcPortSeq));
+			if (seq == NULL)
+			{
+				DEBUG_OUT( "ERROR no memory for the port counters of [%s]\n", ctx->dev[idx].cDevPath);
+			}
+			__atomic_store_n(&ctx->pPortSeq[idx], seq, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(&ctx->devLock[idx]);
+	}
+	return seq;
+}
+
+int mvbc_ctx_port_seq(mvbc_ctx *ctx, const char *dev, int addr, uint32_t *seq)
+{
+	int idx = mvbc_find_device(ctx, dev);
+	struct sMvbcPortSeq *counters;
+
+	if ((idx < 0) || (addr <= 0) || (addr > MAX_PORT_COUNT) || (seq == NULL))
+	{
+		return -1;
+	}
+
+	counters = port_seq(ctx, idx);
+	if (counters == NULL)
+	{
+		return -1;
+	}
+
+	*seq = __atomic_load_n(&counters->uiSeq[addr], __ATOMIC_ACQUIRE);
+	return 0;
+}
+
+int mvbc_port_seq(const char *dev, int addr, uint32_t *seq)
+{
+	return mvbc_ctx_port_seq(mvbc_default_ctx(), dev, addr, seq);
+}
+
+int mvbc_ctx_wait_port(mvbc_ctx *ctx, const char *dev, int addr, uint32_t last_seq, int timeout_ms, uint32_t *seq)
+{
+	int idx = mvbc_find_device(ctx, dev);
+	struct sMvbcPortSeq *counters;
+	struct timespec deadline;
+	uint32_t cur;
+
+	if ((idx < 0) || (addr <= 0) || (addr > MAX_PORT_COUNT))
+	{
+		return -1;
+	}
+
+	counters = port_seq(ctx, idx);
+	if (counters == NULL)
+	{
+		return -1;
+	}
+
+	if (timeout_ms >= 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	__atomic_add_fetch(&counters->uiWaiters[addr], 1, __ATOMIC_SEQ_CST);
+
+	for (;;)
+	{
+		cur = __atomic_load_n(&counters->uiSeq[addr], __ATOMIC_SEQ_CST);
+		if ((cur != last_seq) || (timeout_ms == 0))
+		{
+			break;
+		}
+
+		/* sleeps only while the counter still is last_seq, so no update is missed */
+		if ((futex(&counters->uiSeq[addr], FUTEX_WAIT_BITSET_PRIVATE, last_seq,
+				(timeout_ms > 0) ? &deadline : NULL, FUTEX_BITSET_MATCH_ANY) != 0) && (errno == ETIMEDOUT))
+		{
+			cur = __atomic_load_n(&counters->uiSeq[addr], __ATOMIC_SEQ_CST);
+			break;
+		}
+	}
+
+	__atomic_sub_fetch(&counters->uiWaiters[addr], 1, __ATOMIC_SEQ_CST);
+
+	if (seq != NULL)
+	{
+		*seq = cur;
+	}
+	return cur != last_seq;
+}
+
+int mvbc_wait_port(const char *dev, int addr, uint32_t last_seq, int timeout_ms, uint32_t *seq)
+{
+	return mvbc_ctx_wait_port(mvbc_default_ctx(), dev, addr, last_seq, timeout_ms, seq);
+}
@@ -0,0 +1,373 @@
+/**
+ * @file
+ *
+ * Health watchdog and single device recovery.
+ *
+ * Copyright (C) ELTEC Elektronik AG 2019
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <errno.h>
+
+#include "mvbc_internal.h"
+#include "mvbc_cmd.h"
+#include "mvbc_watchdog.h"
+
+/** SCR: IL field, 3 = run */
+#define WATCHDOG_SCR_IL_MASK 0x3
+#define WATCHDOG_SCR_IL_RUN 3
+
+/**
+ * Milliseconds between two CLOCK_MONOTONIC time stamps.
+ *
+ * @param from
+ * @param to
+ * @return to - from in milliseconds
+ */
+static int64_t watchdog_elapsed_ms(const struct timespec *from, const struct timespec *to)
+{
+	return (int64_t)(to->tv_sec - from->tv_sec) * 1000 + (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+/**
+ * Silence after which a device being read counts as stale.
+ *
+ * @param mvbc
+ * @param cfg
+ * @return milliseconds, -1 = no supervision
+ */
+static int64_t watchdog_stale_ms(const struct sMvbcDevCfg *mvbc, const struct sMvbcWatchdogCfg *cfg)
+{
+	int64_t poll = 0;
+
+	if (cfg->iStaleMS != 0)
+	{
+		return cfg->iStaleMS;
+	}
+
+	for (int j = 0; j < mvbc->portSetup.mvbc_port_count; j++)
+	{
+		const struct sMvbcPortCfg *port = &mvbc->portSetup.port[j].portCfg;
+
+		if ((port->iPortDirection == eSink) && (port->iPollIntervalMS > poll))
+		{
+			poll = port->iPollIntervalMS;
+		}
+	}
+	if ((poll == 0) && ((int)mvbc->iMode != eStatic))
+	{
+		/* the sniffer creates ports with the default interval */
+		poll = mvbc->portSetup.defaultPortCfg.wPollInterval;
+	}
+	if (poll == 0)
+	{
+		/* nothing is expected to arrive */
+		return -1;
+	}
+
+	poll *= MVBC_WATCHDOG_STALE_FACTOR;
+	return (poll < MVBC_WATCHDOG_STALE_MIN_MS) ? MVBC_WATCHDOG_STALE_MIN_MS : poll;
+}
+
+/**
+ * Count the configured sink ports of ctx->dev[idx] whose records came without
+ * transfer acknowledge for their stale time. Only a device being read tells.
+ * Called with ctx->devLock[idx] held.
+ *
+ * @param ctx
+ * @param idx
+ * @param cfg
+ * @param now
+ * @param reads 1 if the device was read since the last check
+ */
+static void watchdog_check_ports(struct mvbc_ctx *ctx, int idx, const struct sMvbcWatchdogCfg *cfg, const struct timespec *now, int reads)
+{
+	struct sMvbcDevCfg *mvbc = &ctx->project.mvbc[idx];
+	struct sMvbcHealthState *health = &ctx->dev[idx].health;
+	int64_t nowMS = (int64_t)now->tv_sec * 1000 + now->tv_nsec / 1000000;
+	uint32_t stalePorts = 0;
+
+	for (int j = 0; j < mvbc->portSetup.mvbc_port_count; j++)
+	{
+		const struct sMvbcPortCfg *port = &mvbc->portSetup.port[j].portCfg;
+		int addr = port->iPortAddr;
+		int64_t stale = (cfg->iStaleMS != 0) ? cfg->iStaleMS : (int64_t)port->iPollIntervalMS * MVBC_WATCHDOG_STALE_FACTOR;
+
+		if ((port->iPortDirection != eSink) || (addr < 0) || (addr > MAX_PORT_COUNT) || (stale <= 0))
+		{
+			continue;
+		}
+		if (stale < MVBC_WATCHDOG_STALE_MIN_MS)
+		{
+			stale = MVBC_WATCHDOG_STALE_MIN_MS;
+		}
+
+		/* without readers nothing can be acknowledged, start over when they come back */
+		if (!reads || (health->llFreshMS[j] == 0) || (health->ullFresh[addr / 64] & (1ULL << (addr % 64))))
+		{
+			health->llFreshMS[j] = nowMS;
+		}
+		else if (nowMS - health->llFreshMS[j] > stale)
+		{
+			stalePorts++;
+		}
+	}
+	memset(health->ullFresh, 0, sizeof(health->ullFresh));
+
+	if (stalePorts != health->stats.uiStalePorts)
+	{
+		DEBUG_OUT( "WARNING [%s] %u sink ports without acknowledged records\n", mvbc->cDevPath, stalePorts);
+		health->stats.uiStalePorts = stalePorts;
+	}
+}
+
+/**
+ * Decide whether ctx->dev[idx] needs a recovery. Called with ctx->devLock[idx] held.
+ *
+ * @param ctx
+ * @param idx
+ * @param cfg
+ * @param now
+ * @return enum eMvbcWatchdogReason
+ */
+static int watchdog_diagnose(struct mvbc_ctx *ctx, int idx, const struct sMvbcWatchdogCfg *cfg, const struct timespec *now)
+{
+	struct sMvbcDevCfg *mvbc = &ctx->project.mvbc[idx];
+	struct sMvbcDevState *state = &ctx->dev[idx];
+	struct sMvbcHealthState *health = &state->health;
+	struct sMvbcDeviceConfig deviceCfg;
+	int64_t silent = watchdog_elapsed_ms(&health->sLastRecord, now);
+	int64_t stale;
+	int reads = state->stats.ullReads != health->ullReadsSeen;
+	int readErrors = state->stats.uiReadErrors - health->uiReadErrorsSeen;
+
+	health->ullReadsSeen = state->stats.ullReads;
+	health->uiReadErrorsSeen = state->stats.uiReadErrors;
+	health->stats.llSilentMS = health->iHadRecord ? silent : -1;
+
+	watchdog_check_ports(ctx, idx, cfg, now, reads);
+
+	memset(&deviceCfg, 0, sizeof(struct sMvbcDeviceConfig));
+	if (mvbc_send_cmd(mvbc->cDevPath, EL_MVBC_GET_DEVICE_CONFIGURATION, &deviceCfg) < 0)
+	{
+		health->stats.uiErrorsInRow++;
+	}
+	else if ((deviceCfg.regs.wSCR & WATCHDOG_SCR_IL_MASK) != WATCHDOG_SCR_IL_RUN)
+	{
+		return eWatchdogNotRunning;
+	}
+	else if (readErrors > 0)
+	{
+		health->stats.uiErrorsInRow += readErrors;
+	}
+	else
+	{
+		health->stats.uiErrorsInRow = 0;
+	}
+
+	if (health->stats.uiErrorsInRow >= (uint32_t)cfg->iErrors)
+	{
+		return eWatchdogErrors;
+	}
+
+	/* only a device somebody reads can tell that records stopped, a dead bus (no trusted line) is no controller fault */
+	stale = watchdog_stale_ms(mvbc, cfg);
+	if (reads && (stale > 0) && (silent > stale) && (deviceCfg.regs.wDR & (MVBC_DR_LAA | MVBC_DR_LBA)))
+	{
+		health->uiStale++;
+		MVBC_TRACE3(stale, mvbc->cDevPath, silent, stale);
+		return eWatchdogStale;
+	}
+
+	return eWatchdogNone;
+}
+
+/**
+ * Fill in the defaults of a watchdog configuration.
+ *
+ * @param dst
+ * @param src NULL for all defaults
+ */
+static void watchdog_cfg(struct sMvbcWatchdogCfg *dst, const struct sMvbcWatchdogCfg *src)
+{
+	if (src != NULL)
+	{
+		*dst = *src;
+	}
+	else
+	{
+		memset(dst, 0, sizeof(struct sMvbcWatchdogCfg));
+	}
+
+	if (dst->iPeriodMS <= 0)
+	{
+		dst->iPeriodMS = MVBC_WATCHDOG_DEFAULT_PERIOD_MS;
+	}
+	if (dst->iErrors <= 0)
+	{
+		dst->iErrors = MVBC_WATCHDOG_DEFAULT_ERRORS;
+	}
+}
+
+int mvbc_ctx_watchdog_check(mvbc_ctx *ctx, const struct sMvbcWatchdogCfg *cfg)
+{
+	struct sMvbcWatchdogCfg wd;
+	int recovered = 0;
+
+	if (ctx == NULL)
+	{
+		return -1;
+	}
+	watchdog_cfg(&wd, cfg);
+
+	/* an init in progress owns all devices, check again next time */
+	if (pthread_mutex_trylock(&ctx->ctxLock) != 0)
+	{
+		return 0;
+	}
+
+	for (int i = 0; i < ctx->project.mvbc_device_count; i++)
+	{
+		struct sMvbcHealthState *health = &ctx->dev[i].health;
+		struct timespec now;
+		int reason;
+
+		pthread_mutex_lock(&ctx->devLock[i]);
+
+		if (health->iStopped)
+		{
+			pthread_mutex_unlock(&ctx->devLock[i]);
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		reason = watchdog_diagnose(ctx, i, &wd, &now);
+
+		if (reason != eWatchdogNone)
+		{
+			struct timespec done;
+
+			DEBUG_OUT( "WARNING [%s] failed [%d], recovering\n", ctx->project.mvbc[i].cDevPath, reason);
+
+			health->stats.iLastReason = reason;
+			if (mvbc_device_restart(ctx, i) == 0)
+			{
+				health->stats.uiRecoveries++;
+				health->stats.uiErrorsInRow = 0;
+				recovered++;
+			}
+			else
+			{
+				health->stats.uiRecoveryErrors++;
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &done);
+			health->stats.uiLastRecoveryUS = (done.tv_sec - now.tv_sec) * 1000000 + (done.tv_nsec - now.tv_nsec) / 1000;
+		}
+
+		pthread_mutex_unlock(&ctx->devLock[i]);
+	}
+
+	pthread_mutex_unlock(&ctx->ctxLock);
+
+	return recovered;
+}
+
+int mvbc_watchdog_check(const struct sMvbcWatchdogCfg *cfg)
+{
+	return mvbc_ctx_watchdog_check(mvbc_default_ctx(), cfg);
+}
+
+/**
+ * Watchdog thread: check every iPeriodMS until stopped.
+ *
+ * @param arg context
+ * @return NULL
+ */
+static void *watchdog_thread(void *arg)
+{
+	struct mvbc_ctx *ctx = arg;
+	struct timespec pause = { ctx->watchdogCfg.iPeriodMS / 1000, (ctx->watchdogCfg.iPeriodMS % 1000) * 1000000 };
+
+	while (__atomic_load_n(&ctx->iWatchdogRunning, __ATOMIC_ACQUIRE))
+	{
+		mvbc_ctx_watchdog_check(ctx, &ctx->watchdogCfg);
+		nanosleep(&pause, NULL);
+	}
+	return NULL;
+}
+
+int mvbc_ctx_watchdog_start(mvbc_ctx *ctx, const struct sMvbcWatchdogCfg *cfg)
+{
+	if ((ctx == NULL) || __atomic_load_n(&ctx->iWatchdogRunning, __ATOMIC_ACQUIRE))
+	{
+		return -1;
+	}
+
+	watchdog_cfg(&ctx->watchdogCfg, cfg);
+	__atomic_store_n(&ctx->iWatchdogRunning, 1, __ATOMIC_RELEASE);
+
+	if (pthread_create(&ctx->watchdogThread, NULL, watchdog_thread, ctx) != 0)
+	{
+		DEBUG_OUT( "ERROR starting the watchdog %s\n", strerror(errno));
+		__atomic_store_n(&ctx->iWatchdogRunning, 0, __ATOMIC_RELEASE);
+		return -1;
+	}
+	return 0;
+}
+
+int mvbc_watchdog_start(const struct sMvbcWatchdogCfg *cfg)
+{
+	return mvbc_ctx_watchdog_start(mvbc_default_ctx(), cfg);
+}
+
+int mvbc_ctx_watchdog_stop(mvbc_ctx *ctx)
+{
+	if ((ctx == NULL) || !__atomic_exchange_n(&ctx->iWatchdogRunning, 0, __ATOMIC_ACQ_REL))
+	{
+		return -1;
+	}
+
+	pthread_join(ctx->watchdogThread, NULL);
+	return 0;
+}
+
+int mvbc_watchdog_stop(void)
+{
+	return mvbc_ctx_watchdog_stop(mvbc_default_ctx());
+}
+
+int mvbc_ctx_get_health(mvbc_ctx *ctx, const char *dev, struct sMvbcHealthStats *stats)
+{
+	int idx = mvbc_find_device(ctx, dev);
+
+	if ((idx < 0) || (stats == NULL))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->devLock[idx]);
+	*stats = ctx->dev[idx].health.stats;
+	pthread_mutex_unlock(&ctx->devLock[idx]);
+
+	return 0;
+}
+
+int mvbc_get_health(const char *dev, struct sMvbcHealthStats *stats)
+{
+	return mvbc_ctx_get_health(mvbc_default_ctx(), dev, stats);
+}
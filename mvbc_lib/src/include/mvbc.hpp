@@ -0,0 +1,676 @@
+/**
+ * @file
+ *
+ * Header only C++20 layer over the C interface. CMake targets get the
+ * language level by linking mvbc_cpp instead of mvbc_lib.
+ *
+ * Ports are described as types, e.g.
+ *
+ * 	using Speed  = mvbc::Signal<0, 0, 16, uint16_t>;
+ * 	using Doors  = mvbc::Signal<1, 4, 4, uint8_t>;
+ * 	using Status = mvbc::Port<0x123, 2, mvbc::Layout<Speed, Doors>>;
+ *
+ * so payload size, direction and signal position are checked at compile time
+ * and the accessors reduce to a few shifts on the record in place. Context,
+ * Device and Reader own the C handles and release them on destruction.
+ *
+ * Linked in configurations (mvbc_static.h) can be declared constexpr and
+ * checked with the rules of the JSON parser plus duplicate port and bus load
+ * checks:
+ *
+ * 	constexpr sMvbcStaticPort ports[] = { mvbc::sink(0x123, 2, 32, "Status") };
+ * 	constexpr sMvbcStaticDevice devices[] = { mvbc::device("/dev/mvbc0", 0x10, ports) };
+ * 	constexpr sMvbcStaticProject project = mvbc::project("train", "1.0", devices);
+ * 	static_assert(mvbc::validate(project) == mvbc::CfgError::None);
+ */
+
+#ifndef MVBC_HPP_INCLUDED
+#define MVBC_HPP_INCLUDED 1
+
+static_assert(__cplusplus >= 202002L, "mvbc.hpp needs C++20 (std::span, std::type_identity), link mvbc_cpp or build with -std=c++20");
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "mvbc_app_interface.h"
+#include "mvbc_static.h"
+
+namespace mvbc
+{
+
+/** same values as enum ePortDirection */
+enum class Direction : int
+{
+	Sink = 0,
+	Source = 1
+};
+
+/** same values as enum ePortType */
+enum class PortType : int
+{
+	LA = 0,
+	DA = 1,
+	PP = 2
+};
+
+/** same values as enum eLineMode */
+enum class Line : int
+{
+	A = 0,
+	B = 1,
+	AB = 2
+};
+
+/** F-Codes 5..7 are reserved */
+constexpr bool fcode_valid(int fcode)
+{
+	return ((fcode >= 0) && (fcode <= 4)) || ((fcode >= 8) && (fcode <= 15));
+}
+
+/** number of data words a port of this F-Code carries */
+constexpr int fcode_words(int fcode)
+{
+	if ((fcode >= 0) && (fcode <= 4))
+	{
+		return 1 << fcode;
+	}
+	if ((fcode >= 8) && (fcode <= 14))
+	{
+		return MAX_PORT_DATA_LENGTH;
+	}
+	return 1;
+}
+
+/** port type the library uses for an F-Code */
+constexpr PortType fcode_type(int fcode)
+{
+	if (fcode <= 4)
+	{
+		return PortType::LA;
+	}
+	if (fcode == 15)
+	{
+		return PortType::DA;
+	}
+	return PortType::PP;
+}
+
+/**
+ * Bit field inside the port data.
+ *
+ * Bits are counted from the most significant bit of word WordOffset, as on
+ * the bus; a field may continue into the following words.
+ */
+template <int WordOffset, int BitOffset, int Bits, typename T = uint16_t>
+struct Signal
+{
+	static_assert(WordOffset >= 0, "negative word offset");
+	static_assert((BitOffset >= 0) && (BitOffset < 16), "bit offset has to be 0..15");
+	static_assert((Bits >= 1) && (Bits <= 32), "signal width has to be 1..32 bits");
+	static_assert(std::is_integral_v<T> || std::is_enum_v<T>, "signal type has to be integral or enum");
+
+	using type = T;
+
+	/** words touched by the signal */
+	static constexpr int words = (BitOffset + Bits + 15) / 16;
+
+	/** first word after the signal */
+	static constexpr int end = WordOffset + words;
+
+	static constexpr uint64_t mask = (1ULL << Bits) - 1;
+	static constexpr int shift = words * 16 - BitOffset - Bits;
+
+	using raw_type = std::conditional_t<std::is_enum_v<T>, std::underlying_type<T>, std::type_identity<T>>::type;
+
+	static constexpr T decode(std::span<const uint16_t> data)
+	{
+		uint64_t v = 0;
+
+		for (int i = 0; i < words; i++)
+		{
+			v = (v << 16) | data[WordOffset + i];
+		}
+		v = (v >> shift) & mask;
+
+		if constexpr (std::is_signed_v<raw_type> && !std::is_same_v<raw_type, bool>)
+		{
+			if (v & (1ULL << (Bits - 1)))
+			{
+				v |= ~mask;
+			}
+		}
+		return static_cast<T>(static_cast<raw_type>(v));
+	}
+
+	static constexpr void encode(std::span<uint16_t> data, T value)
+	{
+		uint64_t v = 0;
+
+		for (int i = 0; i < words; i++)
+		{
+			v = (v << 16) | data[WordOffset + i];
+		}
+		v &= ~(mask << shift);
+		v |= (static_cast<uint64_t>(static_cast<raw_type>(value)) & mask) << shift;
+
+		for (int i = words - 1; i >= 0; i--)
+		{
+			data[WordOffset + i] = static_cast<uint16_t>(v);
+			v >>= 16;
+		}
+	}
+};
+
+/**
+ * set of signals of one port.
+ */
+template <typename... Signals>
+struct Layout
+{
+	/** words the signals need */
+	static constexpr int words = [] {
+		int n = 0;
+		((n = (Signals::end > n) ? Signals::end : n), ...);
+		return n;
+	}();
+
+	template <typename S>
+	static constexpr bool contains = (std::is_same_v<S, Signals> || ...);
+};
+
+/**
+ * port description.
+ *
+ * @tparam Addr port address
+ * @tparam FCode F-Code, selects the payload size
+ * @tparam L Layout of the payload
+ * @tparam Dir direction the port is configured for
+ * @tparam Type defaults to the type the library uses for FCode
+ */
+template <int Addr, int FCode, typename L = Layout<>, Direction Dir = Direction::Sink, PortType Type = fcode_type(FCode)>
+struct Port
+{
+	static_assert((Addr > 0) && (Addr <= 4095), "port address has to be 1..4095");
+	static_assert(fcode_valid(FCode), "F-Code 5..7 is reserved");
+	static_assert((Type != PortType::LA) || (FCode <= 4), "process data needs F-Code 0..4");
+	static_assert((Type != PortType::DA) || (FCode == 15), "device status needs F-Code 15");
+	static_assert((Type != PortType::PP) || ((FCode >= 8) && (FCode <= 14)), "message data needs F-Code 8..14");
+	static_assert(L::words <= fcode_words(FCode), "layout exceeds the port size");
+
+	static constexpr uint16_t address = Addr;
+	static constexpr int fcode = FCode;
+	static constexpr int words = fcode_words(FCode);
+	static constexpr Direction direction = Dir;
+	static constexpr PortType type = Type;
+
+	using layout = L;
+
+	static constexpr bool matches(const sPortData &rec)
+	{
+		return rec.wPortAddr == Addr;
+	}
+
+	/** payload in place; sPortData is packed, so the array is reached through its offset */
+	static std::span<const uint16_t, words> payload(const sPortData &rec)
+	{
+		auto p = reinterpret_cast<const unsigned char *>(&rec) + offsetof(sPortData, wPortData);
+
+		return std::span<const uint16_t, words>(reinterpret_cast<const uint16_t *>(p), words);
+	}
+
+	static std::span<uint16_t, words> payload(sPortData &rec)
+	{
+		auto p = reinterpret_cast<unsigned char *>(&rec) + offsetof(sPortData, wPortData);
+
+		return std::span<uint16_t, words>(reinterpret_cast<uint16_t *>(p), words);
+	}
+
+	template <typename S>
+	static typename S::type get(const sPortData &rec)
+	{
+		static_assert(L::template contains<S>, "signal is not part of the port layout");
+		return S::decode(payload(rec));
+	}
+
+	template <typename S>
+	static void set(sPortData &rec, typename S::type value)
+	{
+		static_assert(Dir == Direction::Source, "only source ports can be written");
+		static_assert(L::template contains<S>, "signal is not part of the port layout");
+		S::encode(payload(rec), value);
+	}
+
+	/** prepare an empty record for this port */
+	static void prepare(sPortData &rec)
+	{
+		static_assert(Dir == Direction::Source, "only source ports can be written");
+		rec = sPortData{};
+		rec.wPortAddr = Addr;
+		rec.wPortType = static_cast<uint16_t>(Type);
+		rec.wNumOfWords = words;
+	}
+};
+
+/**
+ * owning handle of a library context.
+ */
+class Context
+{
+public:
+	Context() : pCtx(mvbc_ctx_create()), bOwned(true)
+	{
+	}
+
+	~Context()
+	{
+		if (bOwned && (pCtx != nullptr))
+		{
+			mvbc_ctx_destroy(pCtx);
+		}
+	}
+
+	Context(const Context &) = delete;
+	Context &operator=(const Context &) = delete;
+
+	Context(Context &&other) noexcept : pCtx(std::exchange(other.pCtx, nullptr)), bOwned(other.bOwned)
+	{
+	}
+
+	Context &operator=(Context &&other) noexcept
+	{
+		std::swap(pCtx, other.pCtx);
+		std::swap(bOwned, other.bOwned);
+		return *this;
+	}
+
+	/** non owning handle of the context used by the C functions without context parameter */
+	static Context global()
+	{
+		return Context(mvbc_default_ctx(), false);
+	}
+
+	explicit operator bool() const
+	{
+		return pCtx != nullptr;
+	}
+
+	mvbc_ctx *get() const
+	{
+		return pCtx;
+	}
+
+	/** @return 0 in case of success, errorMask for error */
+	int init(const char *config_file = nullptr)
+	{
+		return mvbc_ctx_init(pCtx, config_file);
+	}
+
+	/** @return 0 in case of success, errorMask for error */
+	int init(const sMvbcStaticProject &project)
+	{
+		return mvbc_ctx_init_static(pCtx, &project);
+	}
+
+	/** @return 0 in case of success, error_code for error */
+	int parse(const char *config_file = nullptr)
+	{
+		return mvbc_ctx_parse(pCtx, config_file);
+	}
+
+private:
+	Context(mvbc_ctx *ctx, bool owned) : pCtx(ctx), bOwned(owned)
+	{
+	}
+
+	mvbc_ctx *pCtx;
+	bool bOwned;
+};
+
+/**
+ * handle of one configured device, shuts the device down on destruction unless released.
+ */
+class Device
+{
+public:
+	Device(const Context &ctx, std::string path) : pCtx(ctx.get()), sPath(std::move(path))
+	{
+	}
+
+	~Device()
+	{
+		if (pCtx != nullptr)
+		{
+			mvbc_ctx_shutdown(pCtx, sPath.c_str());
+		}
+	}
+
+	Device(const Device &) = delete;
+	Device &operator=(const Device &) = delete;
+
+	Device(Device &&other) noexcept : pCtx(std::exchange(other.pCtx, nullptr)), sPath(std::move(other.sPath))
+	{
+	}
+
+	Device &operator=(Device &&other) noexcept
+	{
+		std::swap(pCtx, other.pCtx);
+		std::swap(sPath, other.sPath);
+		return *this;
+	}
+
+	/** keep the device running when the handle is destroyed */
+	void release()
+	{
+		pCtx = nullptr;
+	}
+
+	const std::string &path() const
+	{
+		return sPath;
+	}
+
+	/**
+	 * Read available records without blocking.
+	 *
+	 * @return the filled part of buf, empty if the FIFO is empty or on error
+	 */
+	std::span<sPortData> read(std::span<sPortData> buf)
+	{
+		int n = mvbc_ctx_read(pCtx, sPath.c_str(), buf.data(), static_cast<int>(buf.size()));
+
+		return buf.first((n > 0) ? static_cast<std::size_t>(n) : 0);
+	}
+
+	/** current content of some ports, out[i] belongs to addrs[i] (mvbc_read_ports()) */
+	int read_ports(std::span<const uint16_t> addrs, std::span<sPortData> out)
+	{
+		if (out.size() < addrs.size())
+		{
+			return -1;
+		}
+		return mvbc_ctx_read_ports(pCtx, sPath.c_str(), addrs.data(), static_cast<int>(addrs.size()), out.data());
+	}
+
+	/** block until port addr changed from seq, seq gets the new counter (mvbc_wait_port()) */
+	int wait_port(uint16_t addr, uint32_t &seq, int timeout_ms = -1)
+	{
+		return mvbc_ctx_wait_port(pCtx, sPath.c_str(), addr, seq, timeout_ms, &seq);
+	}
+
+	int stats(sMvbcDevStats &stats) const
+	{
+		return mvbc_ctx_get_device_stats(pCtx, sPath.c_str(), &stats);
+	}
+
+	int line_stats(sMvbcLineStats &stats) const
+	{
+		return mvbc_ctx_get_line_stats(pCtx, sPath.c_str(), &stats);
+	}
+
+	int line_update()
+	{
+		return mvbc_ctx_line_update(pCtx, sPath.c_str());
+	}
+
+	int set_line_mode(Line line)
+	{
+		return mvbc_ctx_set_line_mode(pCtx, sPath.c_str(), static_cast<int>(line));
+	}
+
+private:
+	mvbc_ctx *pCtx;
+	std::string sPath;
+};
+
+/**
+ * batch reader with an inline buffer of N records.
+ */
+template <std::size_t N = 64>
+class Reader
+{
+public:
+	explicit Reader(Device &dev) : rDev(dev)
+	{
+	}
+
+	/** read the next batch, valid until the next call */
+	std::span<const sPortData> next()
+	{
+		return rDev.read(std::span<sPortData>(aBuf, N));
+	}
+
+	/**
+	 * Read the next batch and call fn(rec) for every record of port P.
+	 *
+	 * @return number of records read
+	 */
+	template <typename P, typename F>
+	std::size_t dispatch(F &&fn)
+	{
+		static_assert(P::direction == Direction::Sink, "only sink ports are received");
+
+		auto batch = next();
+
+		for (const sPortData &rec : batch)
+		{
+			if (P::matches(rec))
+			{
+				fn(rec);
+			}
+		}
+		return batch.size();
+	}
+
+private:
+	Device &rDev;
+	sPortData aBuf[N];
+};
+
+/** reason a linked in configuration is rejected */
+enum class CfgError
+{
+	None,
+	DevicePath,
+	Interface,
+	Mode,
+	DeviceAddr,
+	Line,
+	PortCount,
+	PortAddr,
+	FunctionCode,
+	PortType,
+	PortDirection,
+	PollInterval,
+	Irq,
+	NumData,
+	PortControl,
+	DuplicatePort,
+	BusLoad
+};
+
+/** MVB bit rate in bits per millisecond */
+constexpr int bus_bits_per_ms = MVBC_BUS_BITS_PER_MS;
+
+/** bit times of a master frame: start delimiter, 16 bits, check sequence */
+constexpr int bus_master_frame_bits = MVBC_BUS_MASTER_FRAME_BITS;
+
+/** bit times between two frames */
+constexpr int bus_gap_bits = MVBC_BUS_GAP_BITS;
+
+/** bit times one exchange of a port of this F-Code occupies, the formula mvbc_init_static() checks with */
+constexpr int bus_port_bits(int fcode)
+{
+	return MVBC_BUS_PORT_BITS(fcode);
+}
+
+/** part of the bus capacity in 1/1000 the ports of a device use, each exchanged once per poll interval */
+constexpr long bus_load_permille(const sMvbcStaticDevice &dev)
+{
+	long bits = 0;
+
+	for (int i = 0; i < dev.iPortCount; i++)
+	{
+		const sMvbcStaticPort &p = dev.pPorts[i];
+
+		if ((p.wPollIntervalMS > 0) && (p.wPollIntervalMS <= 1024))
+		{
+			bits += static_cast<long>(bus_port_bits(p.cFunctionCode)) * (1024 / p.wPollIntervalMS);
+		}
+	}
+	return bits * 1000 / (1024L * bus_bits_per_ms);
+}
+
+/** static port, type and control word are derived from the F-Code */
+constexpr sMvbcStaticPort port(uint16_t addr, int fcode, Direction dir, uint16_t poll_ms = 16, const char *name = nullptr, int irq = 0, int num_data = 0)
+{
+	return sMvbcStaticPort{name, addr, static_cast<uint8_t>(fcode_type(fcode)), static_cast<uint8_t>(dir), static_cast<uint8_t>(fcode),
+		static_cast<uint8_t>(irq), static_cast<uint8_t>(num_data), poll_ms,
+		MVBC_PCS_W0(fcode, static_cast<int>(dir), irq, num_data)};
+}
+
+constexpr sMvbcStaticPort sink(uint16_t addr, int fcode, uint16_t poll_ms = 16, const char *name = nullptr, int irq = 0, int num_data = 0)
+{
+	return port(addr, fcode, Direction::Sink, poll_ms, name, irq, num_data);
+}
+
+constexpr sMvbcStaticPort source(uint16_t addr, int fcode, uint16_t poll_ms = 16, const char *name = nullptr, int irq = 0, int num_data = 0)
+{
+	return port(addr, fcode, Direction::Source, poll_ms, name, irq, num_data);
+}
+
+/** static port of a typed Port<> description */
+template <typename P>
+constexpr sMvbcStaticPort port(uint16_t poll_ms = 16, const char *name = nullptr, int irq = 0, int num_data = 0)
+{
+	sMvbcStaticPort p = port(P::address, P::fcode, P::direction, poll_ms, name, irq, num_data);
+
+	p.cPortType = static_cast<uint8_t>(P::type);
+	return p;
+}
+
+/** static device in static mode on both lines with ESD+ interface */
+template <std::size_t N>
+constexpr sMvbcStaticDevice device(const char *path, int device_addr, const sMvbcStaticPort (&ports)[N], Line line = Line::AB, const char *description = nullptr)
+{
+	return sMvbcStaticDevice{description, path, 1, 0, 0, static_cast<int>(line), device_addr,
+		0, 16, 0, 0, static_cast<int>(N), ports, nullptr};
+}
+
+template <std::size_t N>
+constexpr sMvbcStaticProject project(const char *name, const char *version, const sMvbcStaticDevice (&devices)[N])
+{
+	return sMvbcStaticProject{name, version, static_cast<int>(N), devices};
+}
+
+/** rules of the JSON parser for one port */
+constexpr CfgError validate(const sMvbcStaticPort &p)
+{
+	if ((p.wPortAddr == 0) || (p.wPortAddr > 4095))
+	{
+		return CfgError::PortAddr;
+	}
+	if (!fcode_valid(p.cFunctionCode))
+	{
+		return CfgError::FunctionCode;
+	}
+	if (p.cPortType != static_cast<int>(fcode_type(p.cFunctionCode)))
+	{
+		return CfgError::PortType;
+	}
+	if (p.cPortDirection > static_cast<int>(Direction::Source))
+	{
+		return CfgError::PortDirection;
+	}
+	if ((p.wPollIntervalMS == 0) || (p.wPollIntervalMS > 1024) || (p.wPollIntervalMS & (p.wPollIntervalMS - 1)))
+	{
+		return CfgError::PollInterval;
+	}
+	if (p.cIrqNumber > 7)
+	{
+		return CfgError::Irq;
+	}
+	if (p.cNumData > 1)
+	{
+		return CfgError::NumData;
+	}
+	if ((p.wPCS_W0 != 0) && (p.wPCS_W0 != MVBC_PCS_W0(p.cFunctionCode, p.cPortDirection, p.cIrqNumber, p.cNumData)))
+	{
+		return CfgError::PortControl;
+	}
+	return CfgError::None;
+}
+
+/** rules of the JSON parser for one device, no port twice, bus load below MVBC_STATIC_MAX_BUS_LOAD_PERMILLE */
+constexpr CfgError validate(const sMvbcStaticDevice &d)
+{
+	uint64_t seen[4096 / 64] = {};
+
+	if ((d.pDevPath == nullptr) || (d.pDevPath[0] == 0))
+	{
+		return CfgError::DevicePath;
+	}
+	if ((d.iInterface != 1) && (d.iInterface != 2))
+	{
+		return CfgError::Interface;
+	}
+	if ((d.iMode < 0) || (d.iMode > 2))
+	{
+		return CfgError::Mode;
+	}
+	if ((d.iDeviceAddr <= 0) || (d.iDeviceAddr > 4095))
+	{
+		return CfgError::DeviceAddr;
+	}
+	if ((d.iLine < static_cast<int>(Line::A)) || (d.iLine > static_cast<int>(Line::AB)))
+	{
+		return CfgError::Line;
+	}
+	if ((d.iPortCount < 0) || (d.iPortCount > 4095) || ((d.iPortCount > 0) && (d.pPorts == nullptr)))
+	{
+		return CfgError::PortCount;
+	}
+
+	for (int i = 0; i < d.iPortCount; i++)
+	{
+		const sMvbcStaticPort &p = d.pPorts[i];
+		CfgError err = validate(p);
+
+		if (err != CfgError::None)
+		{
+			return err;
+		}
+		if (seen[p.wPortAddr / 64] & (1ULL << (p.wPortAddr % 64)))
+		{
+			return CfgError::DuplicatePort;
+		}
+		seen[p.wPortAddr / 64] |= 1ULL << (p.wPortAddr % 64);
+	}
+
+	if (bus_load_permille(d) > MVBC_STATIC_MAX_BUS_LOAD_PERMILLE)
+	{
+		return CfgError::BusLoad;
+	}
+	return CfgError::None;
+}
+
+constexpr CfgError validate(const sMvbcStaticProject &p)
+{
+	for (int i = 0; i < p.iDeviceCount; i++)
+	{
+		CfgError err = validate(p.pDevices[i]);
+
+		if (err != CfgError::None)
+		{
+			return err;
+		}
+	}
+	return CfgError::None;
+}
+
+}
+
+#endif
@@ -8,6 +8,86 @@
 #ifndef PACKAGE_SYSTEM_MVBC_LIB_SRC_INCLUDE_MVBC_APP_INTERFACE_H_
 #define PACKAGE_SYSTEM_MVBC_LIB_SRC_INCLUDE_MVBC_APP_INTERFACE_H_
 
+#include <stdint.h>
+#include <sys/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** maximal number of data words carried by one port record */
+#define MAX_PORT_DATA_LENGTH 16
+
+/**
+ * One record as delivered by the driver FIFO (read() on /dev/mvbcX).
+ */
+struct sPortData
+{
+	uint16_t wPortAddr;		///< MVB Port Address
+	uint16_t wPortType;		///< LA, DA, PP type
+	uint16_t wNumOfWords;	///< number of valid words in wPortData
+	uint16_t wTACK;			///< transfer acknowledge
+	struct timeval sTimeStamp;
+	uint16_t wPortData[MAX_PORT_DATA_LENGTH];
+}__attribute__((packed));
+
+/**
+ * line A/B quality counters of one MVBC device.
+ *
+ * Arrays are indexed by enum eLineMode: [eLineA], [eLineB], [eLineAB] (both lines trusted).
+ */
+struct sMvbcLineStats
+{
+	/** line mode programmed at init (enum eLineMode) */
+	int iConfiguredLine;
+
+	/** line(s) the decoder trusted at the last register read, -1 = unknown */
+	int iActiveLine;
+
+	/** records received while the decoder trusted the line */
+	uint64_t ullFrames[3];
+
+	/** errors reported while the decoder trusted the line */
+	uint64_t ullErrors[3];
+
+	/** milliseconds the decoder trusted the line */
+	uint64_t ullTimeOnLineMS[3];
+
+	/** number of changes of the trusted line */
+	uint32_t uiSwitchovers;
+
+	/** number of register reads */
+	uint32_t uiPolls;
+
+	/** failed register reads */
+	uint32_t uiPollErrors;
+};
+
+/**
+ * receive counters of one MVBC device.
+ */
+struct sMvbcDevStats
+{
+	/** records read from the device FIFO */
+	uint64_t ullRecords;
+
+	/** read() calls */
+	uint64_t ullReads;
+
+	/** read() calls returning an error other than EAGAIN */
+	uint32_t uiReadErrors;
+
+	/** read() calls ending in a partial record, completed by the next read */
+	uint32_t uiShortReads;
+};
+
+/**
+ * Library context. Holds one parsed project configuration and the runtime
+ * state of its devices. All functions without context parameter work on the
+ * default context returned by mvbc_default_ctx().
+ */
+typedef struct mvbc_ctx mvbc_ctx;
+
 /** Get revision information */
 int mvbc_get_library_version(int *major, int *minor, int* patch);
 int mvbc_get_pld_firmware_version(int *version);
@@ -36,5 +116,188 @@ int mvbc_init(const char *config_file);
  */
 int mvbc_shutdown(const char *dev);
 
+/**
+ * Select LineA/LineB/both for a device. Has to be called before mvbc_init(),
+ * overrides the 'line' entry of the project configuration.
+ *
+ * @param dev (e.g. /dev/mvbc1)
+ * @param line enum eLineMode
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_set_line_mode(const char *dev, int line);
+
+/**
+ * Read the decoder register of the device with one ioctl and update the line statistics.
+ * Calls within MVBC_LINE_POLL_INTERVAL_MS of the last read return without device access,
+ * so it can be called from the receive loop.
+ *
+ * @param dev
+ * @return 1 if the registers were read, 0 if skipped, -1 for error
+ */
+int mvbc_line_update(const char *dev);
+
+/**
+ * Account received records and errors to the currently trusted line.
+ *
+ * @param dev
+ * @param frames
+ * @param errors
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_line_account(const char *dev, int frames, int errors);
+
+/**
+ * Get the line statistics of a device.
+ *
+ * @param dev
+ * @param stats
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_get_line_stats(const char *dev, struct sMvbcLineStats *stats);
+
+/**
+ * Read records from the FIFO of a configured device without blocking.
+ * The device stays open between calls.
+ *
+ * @param dev (e.g. /dev/mvbc1)
+ * @param recs buffer for max records
+ * @param max
+ * @return number of records read (0 if the FIFO is empty), -1 for error
+ */
+int mvbc_read(const char *dev, struct sPortData *recs, int max);
+
+/**
+ * Get the current content of some ports without draining the FIFO.
+ *
+ * Ports are read from the mapped traffic memory if the device has one
+ * (mvbc_port_read()), otherwise from the latest-value image the library
+ * keeps of the records read through mvbc_read(). The image is started by
+ * mvbc_enable_port_image() or the first call and kept over a restart of the
+ * device; it holds the ports of each group of 64 addresses in a block of the
+ * record pool (mvbc_pool.h). Ports without data, or of a group the pool had
+ * no block for, have wNumOfWords 0. The cost depends on n only.
+ *
+ * @param dev
+ * @param addrs port addresses
+ * @param n
+ * @param out n records, same order as addrs
+ * @return number of ports with data, -1 for error
+ */
+int mvbc_read_ports(const char *dev, const uint16_t *addrs, int n, struct sPortData *out);
+
+/**
+ * Get the update counter of a port, the start value for mvbc_wait_port().
+ *
+ * @param dev
+ * @param addr
+ * @param seq
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_port_seq(const char *dev, int addr, uint32_t *seq);
+
+/**
+ * Block until a port got a record since its counter was last_seq.
+ *
+ * Every record read from the device (mvbc_read(), merge reader) counts for its
+ * port and wakes only the threads waiting for that port, so some thread has to
+ * drain the FIFO.
+ *
+ * @param dev
+ * @param addr
+ * @param last_seq counter seen last (mvbc_port_seq() or a previous wait)
+ * @param timeout_ms -1 = forever, 0 = do not block
+ * @param seq NULL or gets the current counter
+ * @return 1 if updated, 0 on timeout, -1 for error
+ */
+int mvbc_wait_port(const char *dev, int addr, uint32_t last_seq, int timeout_ms, uint32_t *seq);
+
+/**
+ * Start the latest-value image of a device before the first mvbc_read_ports().
+ *
+ * @param dev
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_enable_port_image(const char *dev);
+
+/**
+ * Get the receive counters of a device.
+ *
+ * @param dev
+ * @param stats
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_get_device_stats(const char *dev, struct sMvbcDevStats *stats);
+
+/**
+ * Create an independent library context, e.g. for a second project or a replay
+ * running next to the live devices.
+ *
+ * @return context, NULL for error
+ */
+mvbc_ctx *mvbc_ctx_create(void);
+
+/**
+ * Close all devices of a context and free it. The default context can not be destroyed.
+ *
+ * @param ctx
+ */
+void mvbc_ctx_destroy(mvbc_ctx *ctx);
+
+/**
+ * Get the context used by the functions without context parameter.
+ *
+ * @return default context
+ */
+mvbc_ctx *mvbc_default_ctx(void);
+
+/**
+ * Parse a project configuration into a context without touching the devices.
+ *
+ * @param ctx
+ * @param config_file NULL selects DEFAULT_PROJECT_CONFIG_FILE
+ * @return 0 in case of success, error_code (enum configErrors) in case of error
+ */
+int mvbc_ctx_parse(mvbc_ctx *ctx, const char *config_file);
+
+/** mvbc_init() on a context */
+int mvbc_ctx_init(mvbc_ctx *ctx, const char *config_file);
+
+/** mvbc_shutdown() on a context */
+int mvbc_ctx_shutdown(mvbc_ctx *ctx, const char *dev);
+
+/** mvbc_set_line_mode() on a context */
+int mvbc_ctx_set_line_mode(mvbc_ctx *ctx, const char *dev, int line);
+
+/** mvbc_line_update() on a context */
+int mvbc_ctx_line_update(mvbc_ctx *ctx, const char *dev);
+
+/** mvbc_line_account() on a context */
+int mvbc_ctx_line_account(mvbc_ctx *ctx, const char *dev, int frames, int errors);
+
+/** mvbc_get_line_stats() on a context */
+int mvbc_ctx_get_line_stats(mvbc_ctx *ctx, const char *dev, struct sMvbcLineStats *stats);
+
+/** mvbc_read() on a context */
+int mvbc_ctx_read(mvbc_ctx *ctx, const char *dev, struct sPortData *recs, int max);
+
+/** mvbc_read_ports() on a context */
+int mvbc_ctx_read_ports(mvbc_ctx *ctx, const char *dev, const uint16_t *addrs, int n, struct sPortData *out);
+
+/** mvbc_port_seq() on a context */
+int mvbc_ctx_port_seq(mvbc_ctx *ctx, const char *dev, int addr, uint32_t *seq);
+
+/** mvbc_wait_port() on a context */
+int mvbc_ctx_wait_port(mvbc_ctx *ctx, const char *dev, int addr, uint32_t last_seq, int timeout_ms, uint32_t *seq);
+
+/** mvbc_enable_port_image() on a context */
+int mvbc_ctx_enable_port_image(mvbc_ctx *ctx, const char *dev);
+
+/** mvbc_get_device_stats() on a context */
+int mvbc_ctx_get_device_stats(mvbc_ctx *ctx, const char *dev, struct sMvbcDevStats *stats);
+
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* PACKAGE_SYSTEM_MVBC_LIB_SRC_INCLUDE_MVBC_APP_INTERFACE_H_ */
@@ -0,0 +1,137 @@
+/**
+ * @file
+ *
+ * Lock free access to the parsed configuration.
+ *
+ * Every parse/init of a context publishes the configuration as an immutable
+ * snapshot. Readers enter a read section, get the current snapshot with one
+ * atomic load and never block the writer or each other:
+ *
+ * 	const struct sMvbcCfgSnapshot *cfg = mvbc_ctx_cfg_enter(ctx);
+ * 	const struct sMvbcPortCfg *port = mvbc_cfg_find_port(cfg, 0, 0x101);
+ * 	...
+ * 	mvbc_ctx_cfg_leave(ctx);
+ *
+ * A replaced snapshot is freed once no thread is inside a read section that
+ * started before the replacement (epoch based reclamation) and no reference
+ * taken with mvbc_cfg_get() is left.
+ */
+
+#ifndef MVBC_CFG_INCLUDED
+#define MVBC_CFG_INCLUDED 1
+
+#include "mvbc_lib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** lookup value for ports not configured */
+#define MVBC_CFG_NO_PORT (-1)
+
+/**
+ * immutable configuration snapshot.
+ */
+struct sMvbcCfgSnapshot
+{
+	/** incremented with every published snapshot, starting at 1 */
+	uint64_t ullVersion;
+
+	/** references taken with mvbc_cfg_get() */
+	uint32_t uiRefCount;
+
+	/** epoch the snapshot was replaced in, 0 while current */
+	uint64_t ullRetireEpoch;
+
+	/** next replaced snapshot waiting to be freed */
+	struct sMvbcCfgSnapshot *pNextRetired;
+
+	/** port address -> index into project.mvbc[dev].portSetup.port[] */
+	int16_t iPortIndex[MAX_MVBC_DEVICES][MAX_PORT_COUNT + 1];
+
+	/** copy of the parsed configuration */
+	struct sProject project;
+};
+
+/**
+ * Enter a read section and get the current configuration. Never blocks; the
+ * first section of a thread claims a reader slot, more are allocated when the
+ * slots are used up. Read sections can be nested.
+ *
+ * @param ctx
+ * @return current snapshot, NULL if no configuration was published or no memory for a reader slot
+ */
+const struct sMvbcCfgSnapshot *mvbc_ctx_cfg_enter(mvbc_ctx *ctx);
+
+/**
+ * Leave a read section. Snapshots obtained inside must not be used afterwards
+ * unless a reference was taken with mvbc_cfg_get().
+ *
+ * @param ctx
+ */
+void mvbc_ctx_cfg_leave(mvbc_ctx *ctx);
+
+/**
+ * Release the reader slot of the calling thread early. Exiting threads release
+ * their slots on their own.
+ *
+ * @param ctx
+ */
+void mvbc_ctx_cfg_thread_exit(mvbc_ctx *ctx);
+
+/**
+ * Keep a snapshot beyond the read section. Has to be called inside the read section.
+ *
+ * @param cfg
+ * @return cfg
+ */
+const struct sMvbcCfgSnapshot *mvbc_cfg_get(const struct sMvbcCfgSnapshot *cfg);
+
+/**
+ * Drop a reference taken with mvbc_cfg_get().
+ *
+ * @param cfg
+ */
+void mvbc_cfg_put(const struct sMvbcCfgSnapshot *cfg);
+
+/**
+ * Free replaced snapshots that are no longer in use. Done automatically on every publish.
+ *
+ * @param ctx
+ * @return number of snapshots still waiting
+ */
+int mvbc_ctx_cfg_reclaim(mvbc_ctx *ctx);
+
+/** mvbc_ctx_cfg_enter() on the default context */
+const struct sMvbcCfgSnapshot *mvbc_cfg_enter(void);
+
+/** mvbc_ctx_cfg_leave() on the default context */
+void mvbc_cfg_leave(void);
+
+/**
+ * Look up the configuration of a port.
+ *
+ * @param cfg snapshot
+ * @param dev device index
+ * @param addr port address
+ * @return port configuration or NULL if the port is not configured
+ */
+static inline const struct sMvbcPortCfg *mvbc_cfg_find_port(const struct sMvbcCfgSnapshot *cfg, int dev, int addr)
+{
+	int idx;
+
+	if ((cfg == NULL) || (dev < 0) || (dev >= cfg->project.mvbc_device_count) || (addr < 0) || (addr > MAX_PORT_COUNT))
+	{
+		return NULL;
+	}
+
+	idx = cfg->iPortIndex[dev][addr];
+
+	return (idx == MVBC_CFG_NO_PORT) ? NULL : &cfg->project.mvbc[dev].portSetup.port[idx].portCfg;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
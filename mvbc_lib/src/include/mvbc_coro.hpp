@@ -0,0 +1,415 @@
+/**
+ * @file
+ *
+ * C++20 coroutines on the event loop of mvbc_loop.h.
+ *
+ * A coroutine returning mvbc::Task runs until its first co_await and is
+ * resumed by the loop when the awaited record, batch or cycle is due, so
+ * any number of them share the thread calling Loop::run():
+ *
+ * 	mvbc::Task speed(mvbc::LoopDevice dev)
+ * 	{
+ * 		auto port = dev.port<Status>();
+ * 		for (;;)
+ * 		{
+ * 			const sPortData &rec = co_await port.next();
+ * 			use(Status::get<Speed>(rec));
+ * 		}
+ * 	}
+ *
+ * 	mvbc::Task control(mvbc::Loop &loop)
+ * 	{
+ * 		for (;;)
+ * 		{
+ * 			co_await loop.cycle(std::chrono::milliseconds(32));
+ * 			...
+ * 		}
+ * 	}
+ *
+ * Records are references into the batch buffer of the loop, valid until the
+ * next co_await. Frames come from per thread free lists, the waits live in
+ * the frames, so steady state resumption allocates nothing.
+ */
+
+#ifndef MVBC_CORO_HPP_INCLUDED
+#define MVBC_CORO_HPP_INCLUDED 1
+
+static_assert(__cplusplus >= 202002L, "mvbc_coro.hpp needs C++20 coroutines, link mvbc_cpp or build with -std=c++20");
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <span>
+
+#include "mvbc.hpp"
+#include "mvbc_loop.h"
+
+namespace mvbc
+{
+
+namespace detail
+{
+
+/**
+ * free lists of coroutine frames by size class, larger frames use operator new.
+ */
+class FramePool
+{
+public:
+	static constexpr std::size_t granule = 64;
+	static constexpr std::size_t classes = 16;
+
+	static FramePool &local()
+	{
+		thread_local FramePool pool;
+		return pool;
+	}
+
+	void *alloc(std::size_t size)
+	{
+		std::size_t c = (size + granule - 1) / granule;
+
+		if (c > classes)
+		{
+			return ::operator new(size);
+		}
+		if (Node *n = aFree[c - 1])
+		{
+			aFree[c - 1] = n->pNext;
+			return n;
+		}
+		return ::operator new(c * granule);
+	}
+
+	void free(void *p, std::size_t size) noexcept
+	{
+		std::size_t c = (size + granule - 1) / granule;
+
+		if (c > classes)
+		{
+			::operator delete(p);
+			return;
+		}
+		Node *n = static_cast<Node *>(p);
+		n->pNext = aFree[c - 1];
+		aFree[c - 1] = n;
+	}
+
+	~FramePool()
+	{
+		for (Node *n : aFree)
+		{
+			while (n != nullptr)
+			{
+				::operator delete(std::exchange(n, n->pNext));
+			}
+		}
+	}
+
+private:
+	struct Node
+	{
+		Node *pNext;
+	};
+
+	Node *aFree[classes] = {};
+};
+
+/** returned by a port wait that could not be registered */
+inline const sPortData empty_record{};
+
+/**
+ * one loop wait inside the frame of the awaiting coroutine.
+ */
+class Awaiter
+{
+public:
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+protected:
+	/** prepare the wait, false resumes at once */
+	bool prepare(std::coroutine_handle<> h) noexcept
+	{
+		hCoro = h;
+		sWait.fn = &Awaiter::resume;
+		sWait.pArg = this;
+		sWait.pRec = nullptr;
+		sWait.iCount = 0;
+		return true;
+	}
+
+	sMvbcLoopWait sWait{};
+
+private:
+	static void resume(sMvbcLoopWait *w)
+	{
+		static_cast<Awaiter *>(w->pArg)->hCoro.resume();
+	}
+
+	std::coroutine_handle<> hCoro;
+};
+
+}
+
+/**
+ * fire and forget coroutine, started at once, frame freed when it returns.
+ */
+class Task
+{
+public:
+	struct promise_type
+	{
+		Task get_return_object() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void return_void() noexcept
+		{
+		}
+
+		void unhandled_exception() noexcept
+		{
+			std::terminate();
+		}
+
+		static void *operator new(std::size_t size)
+		{
+			return detail::FramePool::local().alloc(size);
+		}
+
+		static void operator delete(void *p, std::size_t size) noexcept
+		{
+			detail::FramePool::local().free(p, size);
+		}
+	};
+};
+
+/** co_await port.next(): the next record of a port */
+class PortAwaiter : public detail::Awaiter
+{
+public:
+	PortAwaiter(sMvbcLoop *loop, int dev, uint16_t addr) : pLoop(loop), iDev(dev), wAddr(addr)
+	{
+	}
+
+	bool await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		return prepare(h) && (mvbc_loop_wait_port(pLoop, iDev, wAddr, &sWait) == 0);
+	}
+
+	/** the record in the loop buffer, empty_record if the wait failed */
+	const sPortData &await_resume() const noexcept
+	{
+		return (sWait.pRec != nullptr) ? *sWait.pRec : detail::empty_record;
+	}
+
+private:
+	sMvbcLoop *pLoop;
+	int iDev;
+	uint16_t wAddr;
+};
+
+/** co_await device.batch(): the next batch of a device */
+class BatchAwaiter : public detail::Awaiter
+{
+public:
+	BatchAwaiter(sMvbcLoop *loop, int dev) : pLoop(loop), iDev(dev)
+	{
+	}
+
+	bool await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		return prepare(h) && (mvbc_loop_wait_batch(pLoop, iDev, &sWait) == 0);
+	}
+
+	/** the records in the loop buffer, empty if the wait failed */
+	std::span<const sPortData> await_resume() const noexcept
+	{
+		return std::span<const sPortData>(sWait.pRec, (sWait.pRec != nullptr) ? static_cast<std::size_t>(sWait.iCount) : 0);
+	}
+
+private:
+	sMvbcLoop *pLoop;
+	int iDev;
+};
+
+/** co_await loop.cycle(period) */
+class TimerAwaiter : public detail::Awaiter
+{
+public:
+	TimerAwaiter(sMvbcLoop *loop, uint64_t deadline_us) : pLoop(loop)
+	{
+		sWait.ullDeadlineUS = deadline_us;
+	}
+
+	bool await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		return prepare(h) && (mvbc_loop_wait_until(pLoop, &sWait) == 0);
+	}
+
+	void await_resume() const noexcept
+	{
+	}
+
+private:
+	sMvbcLoop *pLoop;
+};
+
+/**
+ * one port of a loop device.
+ */
+class PortSource
+{
+public:
+	PortSource(sMvbcLoop *loop, int dev, uint16_t addr) : pLoop(loop), iDev(dev), wAddr(addr)
+	{
+	}
+
+	PortAwaiter next() const
+	{
+		return PortAwaiter(pLoop, iDev, wAddr);
+	}
+
+	uint16_t address() const
+	{
+		return wAddr;
+	}
+
+private:
+	sMvbcLoop *pLoop;
+	int iDev;
+	uint16_t wAddr;
+};
+
+/**
+ * a device added to a loop, cheap to copy into coroutines.
+ */
+class LoopDevice
+{
+public:
+	LoopDevice(sMvbcLoop *loop, int dev) : pLoop(loop), iDev(dev)
+	{
+	}
+
+	explicit operator bool() const
+	{
+		return iDev >= 0;
+	}
+
+	PortSource port(uint16_t addr) const
+	{
+		return PortSource(pLoop, iDev, addr);
+	}
+
+	template <typename P>
+	PortSource port() const
+	{
+		static_assert(P::direction == Direction::Sink, "only sink ports are received");
+		return PortSource(pLoop, iDev, P::address);
+	}
+
+	BatchAwaiter batch() const
+	{
+		return BatchAwaiter(pLoop, iDev);
+	}
+
+private:
+	sMvbcLoop *pLoop;
+	int iDev;
+};
+
+/**
+ * owning handle of an event loop (mvbc_loop.h).
+ */
+class Loop
+{
+public:
+	explicit Loop(const Context &ctx) : pLoop(mvbc_loop_create(ctx.get()))
+	{
+	}
+
+	~Loop()
+	{
+		if (pLoop != nullptr)
+		{
+			mvbc_loop_destroy(pLoop);
+		}
+	}
+
+	Loop(const Loop &) = delete;
+	Loop &operator=(const Loop &) = delete;
+
+	explicit operator bool() const
+	{
+		return pLoop != nullptr;
+	}
+
+	sMvbcLoop *get() const
+	{
+		return pLoop;
+	}
+
+	LoopDevice device(const Device &dev)
+	{
+		return LoopDevice(pLoop, mvbc_loop_device(pLoop, dev.path().c_str()));
+	}
+
+	LoopDevice device(const char *path)
+	{
+		return LoopDevice(pLoop, mvbc_loop_device(pLoop, path));
+	}
+
+	/** resume at the next multiple of period on CLOCK_MONOTONIC, so cycles do not drift */
+	TimerAwaiter cycle(std::chrono::microseconds period) const
+	{
+		uint64_t us = (period.count() > 0) ? static_cast<uint64_t>(period.count()) : 1;
+
+		return TimerAwaiter(pLoop, (mvbc_loop_now_us() / us + 1) * us);
+	}
+
+	/** resume after d */
+	TimerAwaiter sleep(std::chrono::microseconds d) const
+	{
+		return TimerAwaiter(pLoop, mvbc_loop_now_us() + ((d.count() > 0) ? static_cast<uint64_t>(d.count()) : 0));
+	}
+
+	/** @return 0 in case of success, -1 for error */
+	int run()
+	{
+		return mvbc_loop_run(pLoop);
+	}
+
+	/** @return number of coroutines resumed, -1 for error */
+	int run_once(int timeout_ms = -1)
+	{
+		return mvbc_loop_run_once(pLoop, timeout_ms);
+	}
+
+	void stop()
+	{
+		mvbc_loop_stop(pLoop);
+	}
+
+private:
+	sMvbcLoop *pLoop;
+};
+
+}
+
+#endif
@@ -0,0 +1,135 @@
+/**
+ * @file
+ *
+ * Duplicate suppression for redundant MVBC devices attached to the same bus.
+ *
+ * A record is a duplicate if another device delivered the same port with the
+ * same payload within the window. The first arrival is passed on, later ones
+ * are suppressed and their delay behind the first arrival is accounted to the
+ * slower device. Feed the records in time stamp order (e.g. from mvbc_merge)
+ * to get meaningful delays.
+ *
+ * The table is a fixed array of cache line sized buckets holding the most
+ * recent (port, payload hash) keys; nothing is allocated per record. The
+ * window has to be shorter than the poll interval of the ports, otherwise an
+ * unchanged value of the next poll cycle is taken for a duplicate.
+ */
+
+#ifndef MVBC_DEDUP_INCLUDED
+#define MVBC_DEDUP_INCLUDED 1
+
+#include "mvbc_lib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** number of buckets, power of 2 */
+#define MVBC_DEDUP_BUCKETS 1024
+
+/** entries per bucket, 4 x 16 bytes = one cache line */
+#define MVBC_DEDUP_WAYS 4
+
+/** default time two copies of one record may be apart */
+#define MVBC_DEDUP_DEFAULT_WINDOW_US 4000
+
+/**
+ * recently seen record.
+ */
+struct sMvbcDedupEntry
+{
+	/** time stamp of the first arrival in microseconds */
+	int64_t llTimeUS;
+
+	/** payload hash */
+	uint32_t uiHash;
+
+	uint16_t wPortAddr;
+
+	/** device of the first arrival */
+	uint8_t cDev;
+
+	/** 1 if the entry is in use */
+	uint8_t cValid;
+};
+
+/**
+ * one cache line of entries.
+ */
+struct sMvbcDedupBucket
+{
+	struct sMvbcDedupEntry entry[MVBC_DEDUP_WAYS];
+} __attribute__((aligned(64)));
+
+/**
+ * per device counters.
+ */
+struct sMvbcDedupDevStats
+{
+	/** records of this device that arrived first */
+	uint64_t ullFirst;
+
+	/** records of this device suppressed as duplicate */
+	uint64_t ullDuplicates;
+
+	/** sum of the delays of the suppressed records behind the first arrival */
+	uint64_t ullLagSumUS;
+
+	/** maximal delay of a suppressed record */
+	uint32_t uiLagMaxUS;
+};
+
+/**
+ * deduplication counters.
+ */
+struct sMvbcDedupStats
+{
+	/** records checked */
+	uint64_t ullIn;
+
+	/** records suppressed */
+	uint64_t ullSuppressed;
+
+	/** entries overwritten before their window passed */
+	uint64_t ullEvictions;
+
+	struct sMvbcDedupDevStats dev[MAX_MVBC_DEVICES];
+};
+
+/**
+ * deduplication state, fully preallocated.
+ */
+struct sMvbcDedup
+{
+	struct sMvbcDedupBucket bucket[MVBC_DEDUP_BUCKETS];
+
+	/** maximal distance of two copies in microseconds */
+	int64_t llWindowUS;
+
+	struct sMvbcDedupStats stats;
+};
+
+/**
+ * Prepare a deduplication table.
+ *
+ * @param d
+ * @param window_us maximal distance of two copies, 0 selects MVBC_DEDUP_DEFAULT_WINDOW_US
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_dedup_init(struct sMvbcDedup *d, int window_us);
+
+/**
+ * Check a record.
+ *
+ * @param d
+ * @param dev index of the device the record was read from
+ * @param rec
+ * @return 1 if the record has to be processed, 0 if it is a duplicate, -1 for error
+ */
+int mvbc_dedup_check(struct sMvbcDedup *d, int dev, const struct sPortData *rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,169 @@
+/**
+ * @file
+ *
+ * In-process emulation of a MVBC02 board.
+ *
+ * Device paths starting with MVBC_EMU_PREFIX (e.g. "emu:mvbc0") are served by
+ * the emulator instead of the driver: mvbc_send_cmd() programs its register file,
+ * port index table and traffic memory, and the reader gets a pipe the
+ * emulator writes FIFO records into. The JSON configuration and the
+ * complete init/read stack work unchanged, without a board.
+ *
+ * While running, every sink port produces one record per configured poll
+ * interval from the valid page of its traffic memory; ports using an
+ * interrupt produce a record on every write. Time runs iScale times faster
+ * than real time, record time stamps follow the emulated time.
+ */
+
+#ifndef MVBC_EMU_INCLUDED
+#define MVBC_EMU_INCLUDED 1
+
+#include "mvbc_app_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** path prefix selecting the emulator */
+#define MVBC_EMU_PREFIX "emu:"
+
+/** maximal number of emulated devices */
+#define MVBC_EMU_MAX_DEVICES 8
+
+/** size of the emulated FIFO in bytes */
+#define MVBC_EMU_FIFO_BYTES (1 << 20)
+
+/** emulated time processed per lock hold, bounds the latency of commands at high speed */
+#define MVBC_EMU_TICKS_PER_ROUND 256
+
+/**
+ * emulator counters and registers.
+ */
+struct sMvbcEmuStats
+{
+	/** records written to the FIFO */
+	uint64_t ullRecords;
+
+	/** records lost because the FIFO was full */
+	uint64_t ullOverflows;
+
+	/** bus frames lost because no trusted line was left */
+	uint64_t ullLineLost;
+
+	/** commands received through mvbc_send_cmd() */
+	uint64_t ullCommands;
+
+	/** commands rejected */
+	uint32_t uiCommandErrors;
+
+	/** configured ports */
+	uint32_t uiPorts;
+
+	/** emulated milliseconds since run */
+	uint64_t ullVirtualMS;
+
+	uint16_t wSCR;
+	uint16_t wMCR;
+	uint16_t wDR;
+};
+
+/**
+ * Set the speed of the emulated time.
+ *
+ * @param dev (e.g. emu:mvbc0)
+ * @param scale 1 = real time, 10 = ten times faster
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_emu_set_speed(const char *dev, int scale);
+
+/**
+ * Select whether the emulator changes the sink port data by itself (default on).
+ * When off, sink ports only change through mvbc_emu_write_port().
+ *
+ * @param dev
+ * @param on
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_emu_set_auto_traffic(const char *dev, int on);
+
+/**
+ * Write port data as received from the bus: fill the invalid page and flip.
+ *
+ * @param dev
+ * @param addr port address
+ * @param data
+ * @param words
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_emu_write_port(const char *dev, int addr, const uint16_t *data, int words);
+
+/**
+ * Read the valid page of a port, e.g. the data of a source port.
+ *
+ * @param dev
+ * @param addr port address
+ * @param data
+ * @param words
+ * @return number of words of the port, -1 for error
+ */
+int mvbc_emu_read_port(const char *dev, int addr, uint16_t *data, int words);
+
+/**
+ * Let an external bus (e.g. mvbc_sim.h) drive the device: the emulated time
+ * stops producing records, every mvbc_emu_bus_frame() produces one instead.
+ *
+ * @param dev
+ * @param on
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_emu_set_external_bus(const char *dev, int on);
+
+/**
+ * Inject a line fault. DR follows, frames are lost while no configured line is left.
+ *
+ * @param dev
+ * @param line eLineA or eLineB
+ * @param down 1 = line broken, 0 = repaired
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_emu_set_line_fault(const char *dev, int line, int down);
+
+/**
+ * Deliver a frame received from the bus: update the port page and write a
+ * record with the given time stamp. Waits while the FIFO is full.
+ *
+ * @param dev
+ * @param addr port address
+ * @param data
+ * @param words
+ * @param ts time stamp of the record
+ * @return 1 if a record was written, 0 if the frame was not stored (port not configured as sink, line fault), -1 for error
+ */
+int mvbc_emu_bus_frame(const char *dev, int addr, const uint16_t *data, int words, const struct timeval *ts);
+
+/**
+ * mvbc_emu_bus_frame() for a batch: wPortAddr, wNumOfWords, sTimeStamp and
+ * wPortData of each frame are used. The array is overwritten with the
+ * records that were stored, so the FIFO is written with few calls.
+ *
+ * @param dev
+ * @param frames
+ * @param count
+ * @return number of records written, -1 for error
+ */
+int mvbc_emu_bus_frames(const char *dev, struct sPortData *frames, int count);
+
+/**
+ * Get the counters of an emulated device.
+ *
+ * @param dev
+ * @param stats
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_emu_get_stats(const char *dev, struct sMvbcEmuStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,258 @@
+/**
+ * @file
+ *
+ * Gateway publishing changed port data as UDP multicast datagrams.
+ *
+ * The gateway works on the latest-value image of the library (mvbc_read_ports()):
+ * the reader marks a port whose payload differs from the image, a record of a
+ * marked port makes it dirty. The flush sends the image, so a fast port costs
+ * one entry per flush. A context has at most one gateway. A flush
+ * packs the dirty ports of each port group (MVBC_GW_GROUP_PORTS consecutive
+ * addresses) into datagrams of at most the configured size and hands up to
+ * MVBC_GW_BATCH of them to one sendmmsg(). Every datagram carries the
+ * sequence number of its (device, group), so receivers see lost datagrams
+ * per group (mvbc_gw_rx_parse()). With a refresh interval unchanged ports
+ * are sent again, so that late receivers get the whole image.
+ *
+ * Datagram layout, big endian: struct sMvbcGwHeader followed by cCount
+ * entries of struct sMvbcGwEntry, each followed by cWords data words.
+ */
+
+#ifndef MVBC_GW_INCLUDED
+#define MVBC_GW_INCLUDED 1
+
+#include <stdint.h>
+
+#include "mvbc_ioctl_interface.h"
+#include "mvbc_app_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** "MVBG" */
+#define MVBC_GW_MAGIC 0x4D564247
+#define MVBC_GW_VERSION 1
+
+/** ports per group, one dirty mask word each */
+#define MVBC_GW_GROUP_PORTS 64
+
+/** groups per device */
+#define MVBC_GW_GROUPS (4096 / MVBC_GW_GROUP_PORTS)
+
+/** largest datagram, Ethernet MTU without IP and UDP header */
+#define MVBC_GW_MAX_DATAGRAM 1472
+
+/** datagrams per sendmmsg() */
+#define MVBC_GW_BATCH 32
+
+/**
+ * datagram header.
+ */
+struct sMvbcGwHeader
+{
+	uint32_t uiMagic;
+	uint8_t cVersion;
+
+	/** index of the device in the project */
+	uint8_t cDev;
+
+	/** port address / MVBC_GW_GROUP_PORTS */
+	uint8_t cGroup;
+
+	/** number of entries */
+	uint8_t cCount;
+
+	/** per (device, group), incremented with every datagram */
+	uint32_t uiSeq;
+
+	/** time stamp of the first entry in microseconds */
+	uint64_t ullTimeUS;
+} __attribute__((packed));
+
+/**
+ * one port in a datagram.
+ */
+struct sMvbcGwEntry
+{
+	uint16_t wPortAddr;
+	uint8_t cWords;
+
+	/** enum ePortType */
+	uint8_t cType;
+
+	/** time stamp relative to sMvbcGwHeader.ullTimeUS */
+	int32_t iTimeUS;
+} __attribute__((packed));
+
+/**
+ * gateway settings, 0/NULL selects the default.
+ */
+struct sMvbcGwCfg
+{
+	/** multicast group, e.g. "239.192.0.1" */
+	const char *pGroup;
+
+	/** UDP port */
+	uint16_t wPort;
+
+	/** address of the interface to send on / receive from, NULL = routing table */
+	const char *pInterface;
+
+	/** multicast TTL, default 1 */
+	int iTTL;
+
+	/** 1 = receivers on this host get the datagrams too (loopback tests) */
+	int iLoop;
+
+	/** datagram size limit in bytes, default and maximum MVBC_GW_MAX_DATAGRAM */
+	int iMaxDatagram;
+
+	/** unchanged ports are sent again after this time, 0 = only changes */
+	int iRefreshMS;
+};
+
+/**
+ * gateway counters.
+ */
+struct sMvbcGwStats
+{
+	/** records looked at */
+	uint64_t ullRecords;
+
+	/** records with a new payload */
+	uint64_t ullChanged;
+
+	/** entries sent */
+	uint64_t ullEntries;
+
+	uint64_t ullDatagrams;
+	uint64_t ullBytes;
+
+	/** sendmmsg() calls */
+	uint64_t ullSendCalls;
+
+	/** datagrams that could not be sent (their sequence numbers are lost) */
+	uint32_t uiSendErrors;
+};
+
+/**
+ * receiver state, tracks the sequence numbers of all groups.
+ */
+struct sMvbcGwRx
+{
+	uint32_t uiNextSeq[MAX_MVBC_DEVICES][MVBC_GW_GROUPS];
+
+	/** 1 after the first datagram of the group */
+	uint8_t cSeen[MAX_MVBC_DEVICES][MVBC_GW_GROUPS];
+
+	uint64_t ullDatagrams;
+	uint64_t ullEntries;
+
+	/** datagrams missing in the sequence */
+	uint64_t ullLost;
+
+	/** datagrams older than one already seen, dropped */
+	uint64_t ullLate;
+
+	/** datagrams with a bad header or length */
+	uint64_t ullInvalid;
+};
+
+struct sMvbcGw;
+
+/** called for every entry of a datagram, rec is valid during the call */
+typedef void (*mvbc_gw_rx_fn)(void *arg, int dev, const struct sPortData *rec);
+
+/**
+ * Create a gateway for the devices of a context. All ports are selected and the
+ * port images of the devices are enabled.
+ *
+ * @param ctx
+ * @param cfg
+ * @return gateway, NULL for error or if the context has a gateway already
+ */
+struct sMvbcGw *mvbc_gw_create(mvbc_ctx *ctx, const struct sMvbcGwCfg *cfg);
+
+/**
+ * Close the socket and free the gateway.
+ *
+ * @param gw
+ */
+void mvbc_gw_destroy(struct sMvbcGw *gw);
+
+/**
+ * Select the ports first...last of a device for publishing, or deselect them.
+ *
+ * @param gw
+ * @param dev
+ * @param first
+ * @param last
+ * @param on
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_gw_select(struct sMvbcGw *gw, const char *dev, int first, int last, int on);
+
+/**
+ * Take records read elsewhere from the context of the gateway (mvbc_read(), mvbc_loop.h)
+ * into the change detection.
+ *
+ * @param gw
+ * @param dev index of the device in the project
+ * @param recs
+ * @param count
+ * @return number of changed records, -1 for error
+ */
+int mvbc_gw_submit(struct sMvbcGw *gw, int dev, const struct sPortData *recs, int count);
+
+/**
+ * Send the dirty ports.
+ *
+ * @param gw
+ * @return number of datagrams sent, -1 for error
+ */
+int mvbc_gw_flush(struct sMvbcGw *gw);
+
+/**
+ * Wait for records of all devices, submit and flush them.
+ *
+ * @param gw
+ * @param timeout_ms
+ * @return number of datagrams sent, -1 for error
+ */
+int mvbc_gw_pump(struct sMvbcGw *gw, int timeout_ms);
+
+/**
+ * Get the counters.
+ *
+ * @param gw
+ * @param stats
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_gw_get_stats(const struct sMvbcGw *gw, struct sMvbcGwStats *stats);
+
+/**
+ * Open a socket receiving the datagrams of a gateway.
+ *
+ * @param cfg group, port and interface
+ * @return file descriptor, -1 for error
+ */
+int mvbc_gw_rx_open(const struct sMvbcGwCfg *cfg);
+
+/**
+ * Check one datagram and pass its entries on.
+ *
+ * @param rx zeroed before the first datagram
+ * @param buf
+ * @param len
+ * @param fn
+ * @param arg
+ * @return number of entries, -1 if the datagram was dropped
+ */
+int mvbc_gw_rx_parse(struct sMvbcGwRx *rx, const void *buf, int len, mvbc_gw_rx_fn fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -32,8 +32,24 @@
 #include <sys/ioctl.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "mvbc_ioctl_interface.h"
+#include "mvbc_app_interface.h"
+#include "mvbc_pool.h"
+#include "mvbc_static.h"
+#include "mvbc_emu.h"
+#include "mvbc_uio.h"
+#include "mvbc_watchdog.h"
+#include "mvbc_memtest.h"
+#include "mvbc_srv.h"
+#include "mvbc_prof.h"
+#include "mvbc_trace.h"
+#include "mvbc_metrics.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /** Error codes
  */
@@ -92,6 +108,9 @@ struct sMvbcPortCfg
 
 	/** Port contains numerical data (1) or non numerical data (0) */
 	int iNumData;
+
+	/** precomputed port control word (MVBC_PCS_W0), 0 = derive it from the fields above */
+	int iPCS_W0;
 };
 
 /**
@@ -216,9 +235,15 @@ struct sMvbcDevCfg
 	/** switch to activate/deactivate memory test during MVBC initialization */
 	int iTestTrafficMemory;
 
+	/** 0 = LineA, 1 = LineB, 2 = redundant LineA & LineB (enum eLineMode) */
+	int iLine;
+
 	/** MVBC device address */
 	int iDeviceAddr;
 
+	/** traffic memory mapped for mvbc_port_read/write() (e.g. /dev/uio0), empty = none */
+	char cUioPath[MAX_STRING_LENGTH];
+
 	/** configuration for allowed number and types of ports */
 	struct sMvbcPorts portSetup;
 
@@ -242,6 +267,9 @@ struct sProject
 	struct sMvbcDevCfg mvbc[MAX_MVBC_DEVICES];
 };
 
+/** minimal time between two register reads of the line supervision */
+#define MVBC_LINE_POLL_INTERVAL_MS 100
+
 /** Location of the configuration file.
  *  Can be overwritten on the programs command line.
  *
@@ -263,6 +291,9 @@ int mvbc_parse_project_configuration(const char *configFile, struct sProject *pP
 /** default mvbc_device memory_test off */
 #define MVBC_JSON_CONF_DEFAULT_DEVICE_MEMORY_TEST 0
 
+/** default mvbc_device line mode */
+#define MVBC_JSON_CONF_DEFAULT_DEVICE_LINE eLineAB
+
 /** default mvbc_port name */
 #define MVBC_JSON_CONF_DEFAULT_PORT_NAME "n/a"
 
@@ -281,4 +312,8 @@ int mvbc_parse_project_configuration(const char *configFile, struct sProject *pP
 /** default mvbc_port numerical data config */
 #define MVBC_JSON_CONF_DEFAULT_PORT_NUM_DATA 0
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
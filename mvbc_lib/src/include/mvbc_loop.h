@@ -0,0 +1,151 @@
+/**
+ * @file
+ *
+ * Single threaded event loop dispatching records and timers to waiters.
+ *
+ * A waiter is a caller owned sMvbcLoopWait registered for the next record
+ * of a port, the next batch of a device or a point in time. It is removed
+ * before its function is called (one shot) and may register again from
+ * inside the call, e.g. to get the following record of the same batch.
+ * Records are handed out from the batch buffer of the loop, valid until
+ * the function returns. Nothing is allocated per wait, so thousands of
+ * waiters (e.g. the coroutines of mvbc_coro.hpp) can share one thread.
+ */
+
+#ifndef MVBC_LOOP_INCLUDED
+#define MVBC_LOOP_INCLUDED 1
+
+#include <stdint.h>
+
+#include "mvbc_app_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** records read from a device at once */
+#define MVBC_LOOP_BATCH 64
+
+/** a device whose descriptor reports an error is left out for this time, then its descriptor is fetched again */
+#define MVBC_LOOP_RETRY_MS 100
+
+struct sMvbcLoop;
+struct sMvbcLoopWait;
+
+/** called when the wait is over, w is no longer registered */
+typedef void (*mvbc_loop_fn)(struct sMvbcLoopWait *w);
+
+/**
+ * one registered wait, owned by the caller.
+ */
+struct sMvbcLoopWait
+{
+	mvbc_loop_fn fn;
+	void *pArg;
+
+	/** port wait: the record, batch wait: the first record */
+	const struct sPortData *pRec;
+
+	/** batch wait: number of records */
+	int iCount;
+
+	/** timer wait: CLOCK_MONOTONIC in microseconds */
+	uint64_t ullDeadlineUS;
+
+	/** list link, owned by the loop while registered */
+	struct sMvbcLoopWait *pNext;
+};
+
+/**
+ * Create a loop over the devices of a context.
+ *
+ * @param ctx
+ * @return loop, NULL for error
+ */
+struct sMvbcLoop *mvbc_loop_create(mvbc_ctx *ctx);
+
+/**
+ * Free a loop. Waiters still registered are not called.
+ *
+ * @param loop
+ */
+void mvbc_loop_destroy(struct sMvbcLoop *loop);
+
+/**
+ * Add a device to the loop.
+ *
+ * @param loop
+ * @param dev
+ * @return device handle of the loop, -1 for error
+ */
+int mvbc_loop_device(struct sMvbcLoop *loop, const char *dev);
+
+/**
+ * Wait for the next record of a port.
+ *
+ * @param loop
+ * @param dev handle of mvbc_loop_device()
+ * @param addr
+ * @param w
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_loop_wait_port(struct sMvbcLoop *loop, int dev, int addr, struct sMvbcLoopWait *w);
+
+/**
+ * Wait for the next batch of records of a device.
+ *
+ * @param loop
+ * @param dev handle of mvbc_loop_device()
+ * @param w
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_loop_wait_batch(struct sMvbcLoop *loop, int dev, struct sMvbcLoopWait *w);
+
+/**
+ * Wait until w->ullDeadlineUS.
+ *
+ * @param loop
+ * @param w
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_loop_wait_until(struct sMvbcLoop *loop, struct sMvbcLoopWait *w);
+
+/**
+ * Current time of the loop timers.
+ *
+ * @return CLOCK_MONOTONIC in microseconds
+ */
+uint64_t mvbc_loop_now_us(void);
+
+/**
+ * Wait for records or timers once and call the waiters due. The descriptors
+ * of the devices are fetched on every call, a restarted device is polled
+ * with its new one; a descriptor reporting POLLERR, POLLHUP or POLLNVAL is
+ * left out for MVBC_LOOP_RETRY_MS.
+ *
+ * @param loop
+ * @param timeout_ms -1 = until something is due
+ * @return number of waiters called, -1 for error
+ */
+int mvbc_loop_run_once(struct sMvbcLoop *loop, int timeout_ms);
+
+/**
+ * Run until mvbc_loop_stop() or until no waiter is left.
+ *
+ * @param loop
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_loop_run(struct sMvbcLoop *loop);
+
+/**
+ * Let mvbc_loop_run() return, may be called from a waiter.
+ *
+ * @param loop
+ */
+void mvbc_loop_stop(struct sMvbcLoop *loop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,118 @@
+/**
+ * @file
+ *
+ * Traffic memory test without delaying init.
+ *
+ * "traffic_memory" of a device selects the test: 0 = none, 1 = run by the
+ * driver during the reset ioctl (blocks init), 2 = in the background after
+ * the device is running. The background test needs the mapped traffic
+ * memory (mvbc_uio.h) with the board layout built in (MVBC_UIO_BOARD_LAYOUT),
+ * and a device in static mode, where no port index is claimed while the
+ * device runs; otherwise it is eMemtestUnavailable. It works through the data pages of the port indices
+ * no port uses, a slice at a time, each word saved, tested with three
+ * patterns and restored. A slice runs when the device was idle for
+ * MVBC_MEMTEST_IDLE_MS (no records), or after MVBC_MEMTEST_MAX_DEFER
+ * deferrals so that the test still finishes on a busy bus.
+ *
+ * A passed test leaves a marker with the boot id in MVBC_MEMTEST_MARKER_DIR,
+ * so that later inits during the same boot skip either test.
+ */
+
+#ifndef MVBC_MEMTEST_INCLUDED
+#define MVBC_MEMTEST_INCLUDED 1
+
+#include <stdint.h>
+
+#include "mvbc_app_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** values of "traffic_memory" */
+#define MVBC_MEMTEST_OFF 0
+#define MVBC_MEMTEST_INIT 1
+#define MVBC_MEMTEST_BACKGROUND 2
+
+/** directory of the per boot markers */
+#ifndef MVBC_MEMTEST_MARKER_DIR
+#define MVBC_MEMTEST_MARKER_DIR "/run/mvbc"
+#endif
+
+/** words tested per slice */
+#define MVBC_MEMTEST_SLICE_WORDS 256
+
+/** time between two slices */
+#define MVBC_MEMTEST_PERIOD_MS 5
+
+/** silence of the device before a slice runs */
+#define MVBC_MEMTEST_IDLE_MS 2
+
+/** a slice deferred this often runs anyway */
+#define MVBC_MEMTEST_MAX_DEFER 20
+
+/** state of the traffic memory test */
+enum eMvbcMemtestState
+{
+	/** not configured */
+	eMemtestOff,
+
+	/** background test waiting for its first slice */
+	eMemtestPending,
+
+	/** background test in progress */
+	eMemtestRunning,
+
+	/** all words passed */
+	eMemtestPassed,
+
+	/** at least one word failed */
+	eMemtestFailed,
+
+	/** skipped, passed before during this boot */
+	eMemtestCached,
+
+	/** background test without mapped traffic memory, board layout or static mode */
+	eMemtestUnavailable
+};
+
+/**
+ * progress of the traffic memory test of one device.
+ */
+struct sMvbcMemtestStatus
+{
+	/** enum eMvbcMemtestState */
+	int iState;
+
+	/** words tested so far / to test */
+	uint32_t uiWordsTested;
+	uint32_t uiWordsTotal;
+
+	/** words that did not keep a pattern */
+	uint32_t uiErrors;
+
+	/** byte offset of the first failed word in the traffic memory */
+	uint32_t uiFirstErrorOffset;
+
+	/** slices run / deferred because the device was busy */
+	uint32_t uiSlices;
+	uint32_t uiDeferred;
+};
+
+/**
+ * Get the traffic memory test state of a device.
+ *
+ * @param dev
+ * @param status
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_get_memtest_status(const char *dev, struct sMvbcMemtestStatus *status);
+
+/** mvbc_get_memtest_status() on a context */
+int mvbc_ctx_get_memtest_status(mvbc_ctx *ctx, const char *dev, struct sMvbcMemtestStatus *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
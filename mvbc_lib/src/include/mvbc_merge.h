@@ -0,0 +1,147 @@
+/**
+ * @file
+ *
+ * Time ordered merge of the records of all configured MVBC devices.
+ *
+ * Every device delivers its records in time stamp order, but the streams of
+ * several devices interleave arbitrarily. The merge buffers the records per
+ * device and releases them in global time stamp order using a min-heap over
+ * the oldest buffered record of each device.
+ *
+ * Latency/ordering trade-off: a record is only released once it is older than
+ * the reorder window, so a record of a slower device arriving up to the window
+ * later still gets sorted in. Window 0 releases immediately (lowest latency,
+ * ordering only within one fill), larger windows give stricter ordering at the
+ * cost of that much added latency. A full device buffer forces its oldest
+ * record out regardless of the window.
+ */
+
+#ifndef MVBC_MERGE_INCLUDED
+#define MVBC_MERGE_INCLUDED 1
+
+#include "mvbc_lib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** records buffered per device, power of 2 */
+#define MVBC_MERGE_RING_SIZE 256
+
+/** default reorder window */
+#define MVBC_MERGE_DEFAULT_WINDOW_US 2000
+
+/**
+ * merge counters.
+ */
+struct sMvbcMergeStats
+{
+	/** records taken in */
+	uint64_t ullIn;
+
+	/** records released */
+	uint64_t ullOut;
+
+	/** records released out of order because they arrived after the window */
+	uint32_t uiLate;
+
+	/** records released before the window passed because the buffer was full */
+	uint32_t uiForced;
+
+	/** records rejected because the buffer was full */
+	uint32_t uiDropped;
+};
+
+/**
+ * records of one device waiting to be released.
+ */
+struct sMvbcMergeRing
+{
+	uint32_t uiHead;
+	uint32_t uiTail;
+	struct sPortData rec[MVBC_MERGE_RING_SIZE];
+};
+
+/**
+ * merge state, fully preallocated.
+ */
+struct sMvbcMerge
+{
+	/** context the devices belong to */
+	struct mvbc_ctx *ctx;
+
+	/** number of merged devices, index = project device index */
+	int iDevCount;
+
+	/** reorder window in microseconds */
+	int64_t llWindowUS;
+
+	/** time stamp of the last released record */
+	int64_t llLastOutUS;
+
+	/** devices with buffered records, ordered by their oldest record */
+	int iHeap[MAX_MVBC_DEVICES];
+	int iHeapSize;
+
+	struct sMvbcMergeStats stats;
+
+	struct sMvbcMergeRing ring[MAX_MVBC_DEVICES];
+};
+
+/**
+ * Prepare a merge over the devices configured by mvbc_ctx_init().
+ *
+ * @param ctx
+ * @param m
+ * @param window_us reorder window, -1 selects MVBC_MERGE_DEFAULT_WINDOW_US
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_ctx_merge_init(mvbc_ctx *ctx, struct sMvbcMerge *m, int window_us);
+
+/** mvbc_ctx_merge_init() on the default context */
+int mvbc_merge_init(struct sMvbcMerge *m, int window_us);
+
+/**
+ * Change the reorder window.
+ *
+ * @param m
+ * @param window_us
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_merge_set_window(struct sMvbcMerge *m, int window_us);
+
+/**
+ * Add a record of a device.
+ *
+ * @param m
+ * @param dev index of the device in the project configuration
+ * @param rec
+ * @return 0 in case of success, -1 if the device buffer is full
+ */
+int mvbc_merge_push(struct sMvbcMerge *m, int dev, const struct sPortData *rec);
+
+/**
+ * Read the FIFOs of all devices that have data into the merge buffers.
+ *
+ * @param m
+ * @param timeout_ms maximal time to wait for data, 0 = do not wait
+ * @return number of records taken in, -1 for error
+ */
+int mvbc_merge_fill(struct sMvbcMerge *m, int timeout_ms);
+
+/**
+ * Release the oldest record if it left the reorder window.
+ *
+ * @param m
+ * @param out released record
+ * @param dev returns the device index of the record, may be NULL
+ * @param now current time (same clock as the record time stamps), NULL = flush without window
+ * @return 1 if a record was released, 0 if none is due
+ */
+int mvbc_merge_pop(struct sMvbcMerge *m, struct sPortData *out, int *dev, const struct timeval *now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,170 @@
+/**
+ * @file
+ *
+ * Library counters in the Prometheus text exposition format.
+ *
+ * Exported are the ioctl calls per command with errors and a latency
+ * histogram, records per device and per port, queue overflows, record and
+ * message pool usage, stale devices and ports, and the duration of the init
+ * phases. Counters updated on hot paths live in per CPU slots and are
+ * incremented with relaxed atomics; a scrape sums the slots and reads the
+ * device counters and the configuration (mvbc_cfg.h) without taking a lock.
+ *
+ * The exporter thread rewrites a file, e.g. on tmpfs for the node exporter
+ * textfile collector, and answers every connection to a Unix stream socket
+ * with the current text:
+ *
+ * 	socat - UNIX-CONNECT:/run/mvbc.metrics
+ *
+ * The device and port counters can live in a shared memory file instead of
+ * process memory (struct sMvbcMetricsShm). Tools like mvbc-top map it read
+ * only and cost the monitored process nothing.
+ */
+
+#ifndef MVBC_METRICS_INCLUDED
+#define MVBC_METRICS_INCLUDED 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mvbc_ioctl_interface.h"
+#include "mvbc_app_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** a port counts as stale when its last record is older than this many poll intervals */
+#define MVBC_METRICS_STALE_FACTOR 3
+
+/** port addresses per device */
+#define MVBC_METRICS_PORTS 4096
+
+/** bucket b counts the records read less than 2^b microseconds after their time stamp, the last bucket all older ones */
+#define MVBC_METRICS_LAT_BUCKETS 24
+
+/** port names in struct sMvbcMetricsShm are cut to this length */
+#define MVBC_METRICS_NAME_LENGTH 16
+
+/** "MVBM" */
+#define MVBC_METRICS_SHM_MAGIC 0x4D56424D
+#define MVBC_METRICS_SHM_VERSION 1
+
+/**
+ * counters of one port address.
+ */
+struct sMvbcPortMetric
+{
+	uint64_t ullRecords;
+
+	/** CLOCK_MONOTONIC of the last read in microseconds, or of the start of counting */
+	int64_t llLastUS;
+
+	/** latency from the driver time stamp until the record was read */
+	uint32_t uiLatency[MVBC_METRICS_LAT_BUCKETS];
+};
+
+/**
+ * counters of one device.
+ */
+struct sMvbcDevMetric
+{
+	/** mvbc_read() calls that returned records */
+	uint64_t ullReads;
+
+	/** calls that filled the buffer of the caller, the FIFO may hold more */
+	uint64_t ullFullReads;
+
+	uint64_t ullRecords;
+
+	struct sMvbcPortMetric port[MVBC_METRICS_PORTS];
+};
+
+/**
+ * device and port counters of a context. Written with relaxed atomic stores
+ * by the threads reading the devices; the description of the devices and
+ * ports is rewritten by every init.
+ */
+struct sMvbcMetricsShm
+{
+	uint32_t uiMagic;
+	uint32_t uiVersion;
+
+	/** process counting */
+	int32_t iPid;
+
+	/** odd while the description below is rewritten */
+	uint32_t uiDescSeq;
+
+	/** shared memory file, empty if the counters are private */
+	char cFile[256];
+
+	int32_t iDevCount;
+	char cDevPath[MAX_MVBC_DEVICES][MAX_STRING_LENGTH];
+
+	/** poll interval of the configured sink ports, 0 for the other addresses */
+	uint16_t wPollMS[MAX_MVBC_DEVICES][MVBC_METRICS_PORTS];
+
+	char cPortName[MAX_MVBC_DEVICES][MVBC_METRICS_PORTS][MVBC_METRICS_NAME_LENGTH];
+
+	struct sMvbcDevMetric dev[MAX_MVBC_DEVICES];
+};
+
+/**
+ * exporter settings, 0/NULL selects the default.
+ */
+struct sMvbcMetricsCfg
+{
+	/** file rewritten every iPeriodMS (via a temporary file and rename()), NULL = none */
+	const char *pFile;
+
+	/** default 1000 */
+	int iPeriodMS;
+
+	/** Unix stream socket path, an existing socket file is replaced, NULL = none */
+	const char *pSocket;
+
+	/** file the counters are kept in (struct sMvbcMetricsShm), e.g. "/dev/shm/mvbc", NULL = process memory.
+	 *  The counters are created by the first start of a context and kept until it is destroyed. */
+	const char *pShm;
+};
+
+/**
+ * Format the counters of a context.
+ *
+ * @param ctx
+ * @param buf
+ * @param size
+ * @return length of the complete text like snprintf(), the text is cut if it is not less than size
+ */
+int mvbc_ctx_metrics_format(mvbc_ctx *ctx, char *buf, size_t size);
+
+/**
+ * Start the exporter thread. Counting per port begins here.
+ *
+ * @param cfg file, socket and/or shared memory
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_metrics_start(const struct sMvbcMetricsCfg *cfg);
+
+/**
+ * Stop the exporter thread and remove the socket file. The file is kept.
+ *
+ * @return 0 in case of success, -1 if not running
+ */
+int mvbc_metrics_stop(void);
+
+/** mvbc_ctx_metrics_format() on the default context */
+int mvbc_metrics_format(char *buf, size_t size);
+
+/** mvbc_metrics_start() on a context */
+int mvbc_ctx_metrics_start(mvbc_ctx *ctx, const struct sMvbcMetricsCfg *cfg);
+
+/** mvbc_metrics_stop() on a context */
+int mvbc_ctx_metrics_stop(mvbc_ctx *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
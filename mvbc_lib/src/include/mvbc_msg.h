@@ -0,0 +1,200 @@
+/**
+ * @file
+ *
+ * Message data (PP port) transport reassembly.
+ *
+ * Ports of type ePP deliver message data (F-Code 8, 9, 12, 13, 14) as single
+ * 16 word records. The reassembler collects the frames of one message per
+ * source/destination device pair in buffers taken from the message pool of
+ * the context and hands the complete message to a callback without copying
+ * it again.
+ *
+ * Frame layout inside sPortData.wPortData[]:
+ * 	word 0		destination device address (bits 11..0)
+ * 	word 1		source device address (bits 11..0)
+ * 	word 2		bits 15..8 transport control (MTC), bits 7..0 payload bytes in this frame
+ * 	word 3..15	payload, most significant byte first (max. 26 bytes)
+ */
+
+#ifndef MVBC_MSG_INCLUDED
+#define MVBC_MSG_INCLUDED 1
+
+#include "mvbc_app_interface.h"
+#include "mvbc_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** maximal number of messages reassembled at the same time */
+#define MVBC_MSG_MAX_SESSIONS 16
+
+/** maximal length of one reassembled message in bytes */
+#define MVBC_MSG_MAX_LENGTH 4096
+
+/** default time between two frames of one message before it is dropped */
+#define MVBC_MSG_DEFAULT_TIMEOUT_MS 500
+
+/** MTC: first frame of a message */
+#define MVBC_MSG_MTC_FIRST 0x80
+
+/** MTC: last frame of a message */
+#define MVBC_MSG_MTC_LAST 0x40
+
+/** MTC: frame sequence number modulo 8 */
+#define MVBC_MSG_MTC_SEQ_MASK 0x07
+
+/** number of payload bytes one frame can carry */
+#define MVBC_MSG_FRAME_PAYLOAD ((MAX_PORT_DATA_LENGTH - 3) * 2)
+
+/**
+ * complete message, only valid during the callback.
+ */
+struct sMvbcMessage
+{
+	/** source device address */
+	uint16_t wSrcDevice;
+
+	/** destination device address */
+	uint16_t wDstDevice;
+
+	/** port the last frame was received on */
+	uint16_t wPortAddr;
+
+	/** number of frames the message was made of */
+	uint16_t wFrameCount;
+
+	/** message length in bytes */
+	uint32_t uiLength;
+
+	/** message payload, points into the reassembly buffer */
+	const uint8_t *pData;
+
+	/** time stamp of the first frame */
+	struct timeval sFirstFrame;
+
+	/** time stamp of the last frame */
+	struct timeval sLastFrame;
+};
+
+/** called for every complete message */
+typedef void (*mvbc_msg_callback)(const struct sMvbcMessage *msg, void *arg);
+
+/**
+ * reassembly counters.
+ */
+struct sMvbcMsgStats
+{
+	/** frames fed to the reassembler */
+	uint32_t uiFrames;
+
+	/** complete messages delivered */
+	uint32_t uiMessages;
+
+	/** messages dropped because of a missing or repeated frame */
+	uint32_t uiSequenceErrors;
+
+	/** messages dropped because the next frame did not arrive in time */
+	uint32_t uiTimeouts;
+
+	/** messages dropped because they exceed MVBC_MSG_MAX_LENGTH */
+	uint32_t uiOverflows;
+
+	/** messages dropped because all slots were in use */
+	uint32_t uiEvictions;
+
+	/** messages dropped because the message pool was exhausted */
+	uint32_t uiNoBuffer;
+};
+
+/**
+ * reassembly buffer for one source/destination pair.
+ */
+struct sMvbcMsgSlot
+{
+	/** 1 if a message is being collected */
+	int iInUse;
+
+	uint16_t wSrcDevice;
+	uint16_t wDstDevice;
+
+	/** expected sequence number of the next frame */
+	uint16_t wNextSeq;
+
+	uint16_t wFrameCount;
+
+	uint32_t uiLength;
+
+	struct timeval sFirstFrame;
+	struct timeval sLastFrame;
+
+	/** MVBC_MSG_MAX_LENGTH bytes from the message pool while in use */
+	uint8_t *pData;
+};
+
+/**
+ * reassembler state.
+ */
+struct sMvbcMsgReassembler
+{
+	/** pool the reassembly buffers are taken from */
+	struct sMvbcPool *pPool;
+
+	/** drop a message if no frame was received for X milliseconds */
+	int iTimeoutMS;
+
+	mvbc_msg_callback callback;
+	void *pCallbackArg;
+
+	struct sMvbcMsgStats stats;
+
+	struct sMvbcMsgSlot slot[MVBC_MSG_MAX_SESSIONS];
+};
+
+/**
+ * Prepare a reassembler using the message pool of a context. The pool is
+ * created here if the context was not initialised yet.
+ *
+ * @param ctx
+ * @param r reassembler
+ * @param timeout_ms inter-frame timeout, 0 selects MVBC_MSG_DEFAULT_TIMEOUT_MS
+ * @param callback called for every complete message
+ * @param arg passed to callback
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_ctx_msg_init(mvbc_ctx *ctx, struct sMvbcMsgReassembler *r, int timeout_ms, mvbc_msg_callback callback, void *arg);
+
+/**
+ * Prepare a reassembler using the message pool of the default context.
+ *
+ * @param r reassembler
+ * @param timeout_ms inter-frame timeout, 0 selects MVBC_MSG_DEFAULT_TIMEOUT_MS
+ * @param callback called for every complete message
+ * @param arg passed to callback
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_msg_init(struct sMvbcMsgReassembler *r, int timeout_ms, mvbc_msg_callback callback, void *arg);
+
+/**
+ * Feed one record. Records of other port types than ePP are ignored.
+ *
+ * @param r reassembler
+ * @param rec record read from the device
+ * @return 1 if a message was delivered, 0 if not, -1 for error
+ */
+int mvbc_msg_feed(struct sMvbcMsgReassembler *r, const struct sPortData *rec);
+
+/**
+ * Drop all messages whose last frame is older than the timeout.
+ *
+ * @param r reassembler
+ * @param now current time, same clock as the record time stamps
+ * @return number of dropped messages
+ */
+int mvbc_msg_expire(struct sMvbcMsgReassembler *r, const struct timeval *now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
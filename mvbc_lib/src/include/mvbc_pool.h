@@ -0,0 +1,200 @@
+/**
+ * @file
+ *
+ * Fixed size object pools for the record and message buffers of the library.
+ *
+ * The record pool hands out blocks of MVBC_POOL_RECORD_BLOCK port data
+ * records: the read batches of event loops, servers and gateways, and the
+ * groups of port addresses of the latest-value images, which take a block
+ * when the first record of a group arrives. The message pool holds the
+ * message reassembly buffers.
+ *
+ * Both pools of a context are sized from its port setup in mvbc_ctx_init()
+ * (or before, on first use), so the receive path never calls malloc(). An
+ * init that needs more objects puts a bigger pool in place; the old one
+ * stays until mvbc_ctx_destroy() for the objects still taken from it.
+ * Objects are taken from a small per-thread cache first; the cache is
+ * refilled from and flushed to a lock free global free list in batches and
+ * given back when the thread exits.
+ */
+
+#ifndef MVBC_POOL_INCLUDED
+#define MVBC_POOL_INCLUDED 1
+
+#include <stddef.h>
+
+#include "mvbc_app_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** objects kept in the cache of one thread per pool */
+#define MVBC_POOL_CACHE_SIZE 32
+
+/** one thread caches at most this fraction (1/n) of the objects of a pool */
+#define MVBC_POOL_CACHE_SHARE 8
+
+/** number of pools one thread caches objects of */
+#define MVBC_POOL_THREAD_POOLS 4
+
+/** records per object of the record pool: one read batch or one group of port addresses */
+#define MVBC_POOL_RECORD_BLOCK 64
+
+/** record blocks per configured port group: the image of the library and the one of a server */
+#define MVBC_POOL_IMAGES 2
+
+/** record blocks for the read batches of event loops, servers and gateways */
+#define MVBC_POOL_BATCH_BLOCKS 16
+
+/** pool selectors of mvbc_ctx_get_pool_stats() */
+enum eMvbcPool
+{
+	/** MVBC_MSG_MAX_LENGTH message buffers */
+	eMessagePool,
+
+	/** blocks of MVBC_POOL_RECORD_BLOCK records */
+	eRecordPool
+};
+
+/**
+ * pool counters.
+ */
+struct sMvbcPoolStats
+{
+	/** number of objects */
+	uint32_t uiCapacity;
+
+	/** objects handed out to callers */
+	uint32_t uiInUse;
+
+	/** maximal value of uiInUse */
+	uint32_t uiHighWater;
+
+	/** successful allocations */
+	uint64_t ullAllocs;
+
+	/** allocations failed because the pool was empty */
+	uint64_t ullExhausted;
+};
+
+/**
+ * object pool.
+ */
+struct sMvbcPool
+{
+	/** object size in bytes */
+	size_t objSize;
+
+	/** number of objects */
+	uint32_t uiCount;
+
+	/** unique id, protects thread caches against a pool recreated at the same address */
+	uint32_t uiId;
+
+	/** objects one thread caches at most, 0 = no cache */
+	uint32_t uiCacheMax;
+
+	/** object memory */
+	uint8_t *pMem;
+
+	/** free list links, index of the next free object */
+	uint32_t *pNext;
+
+	/** free list head: bits 63..32 ABA tag, bits 31..0 object index */
+	uint64_t ullHead;
+
+	uint32_t uiInUse;
+	uint32_t uiHighWater;
+	uint64_t ullAllocs;
+	uint64_t ullExhausted;
+
+	/** list of the pools not destroyed yet (mvbc_pool.c) */
+	struct sMvbcPool *pNextLive;
+
+	/** next pool replaced by a bigger one, kept until destroy */
+	struct sMvbcPool *pNextRetired;
+};
+
+/**
+ * Allocate the memory of a pool.
+ *
+ * @param pool
+ * @param objSize
+ * @param count
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_pool_create(struct sMvbcPool *pool, size_t objSize, uint32_t count);
+
+/**
+ * Free the memory of a pool. No thread may use it anymore, objects still
+ * cached by threads are dropped.
+ *
+ * @param pool
+ */
+void mvbc_pool_destroy(struct sMvbcPool *pool);
+
+/**
+ * Get an object.
+ *
+ * @param pool
+ * @return object or NULL if the pool is exhausted
+ */
+void *mvbc_pool_alloc(struct sMvbcPool *pool);
+
+/**
+ * Return an object.
+ *
+ * @param pool
+ * @param obj
+ */
+void mvbc_pool_free(struct sMvbcPool *pool, void *obj);
+
+/**
+ * Return the objects cached by the calling thread to their pools. Done on thread exit as well.
+ */
+void mvbc_pool_thread_flush(void);
+
+/**
+ * Get pool counters.
+ *
+ * @param pool
+ * @param stats
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_pool_get_stats(struct sMvbcPool *pool, struct sMvbcPoolStats *stats);
+
+/**
+ * Get a block of MVBC_POOL_RECORD_BLOCK records from the record pool of a context.
+ *
+ * @param ctx
+ * @return block or NULL if the pool is exhausted or not created yet
+ */
+struct sPortData *mvbc_ctx_record_alloc(mvbc_ctx *ctx);
+
+/**
+ * Return a block of mvbc_ctx_record_alloc(), also to a pool replaced meanwhile.
+ *
+ * @param ctx
+ * @param block
+ */
+void mvbc_ctx_record_free(mvbc_ctx *ctx, struct sPortData *block);
+
+/**
+ * Get the counters of a pool of a context.
+ *
+ * @param ctx
+ * @param which enum eMvbcPool
+ * @param stats
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_ctx_get_pool_stats(mvbc_ctx *ctx, int which, struct sMvbcPoolStats *stats);
+
+/** mvbc_ctx_get_pool_stats() on the default context */
+int mvbc_get_pool_stats(int which, struct sMvbcPoolStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
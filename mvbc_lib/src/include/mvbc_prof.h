@@ -0,0 +1,117 @@
+/**
+ * @file
+ *
+ * Self profiling of the library phases with perf_event_open() counters.
+ *
+ * When enabled, every thread entering a phase opens one counter group for
+ * itself (cycles, instructions, cache misses, context switches) and the
+ * counts of each phase run are added to process wide totals. Counters the
+ * CPU or the kernel do not offer are left out and flagged unavailable;
+ * kernel time is excluded when perf_event_paranoid demands it. Disabled,
+ * a phase costs one load of a flag.
+ */
+
+#ifndef MVBC_PROF_INCLUDED
+#define MVBC_PROF_INCLUDED 1
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** counters of a group */
+enum eMvbcProfCounter
+{
+	eProfCycles,
+	eProfInstructions,
+	eProfCacheMisses,
+	eProfContextSwitches,
+	eProfCounterCount
+};
+
+/** profiled phases */
+enum eMvbcProfPhase
+{
+	/** JSON configuration parse */
+	eProfParse,
+
+	/** mvbc_send_cmd() per command */
+	eProfCmdReset,
+	eProfCmdSetDevice,
+	eProfCmdGetDevice,
+	eProfCmdSetPort,
+	eProfCmdGetPort,
+	eProfCmdRun,
+	eProfCmdShutdown,
+	eProfCmdOther,
+
+	/** read() of the device FIFO */
+	eProfRead,
+
+	/** PP message reassembly (mvbc_msg_feed()) */
+	eProfDecode,
+
+	/** records handed on: port image, waiters, event loop */
+	eProfDispatch,
+
+	eProfPhaseCount
+};
+
+/**
+ * totals of one phase.
+ */
+struct sMvbcProfStats
+{
+	/** phase runs counted */
+	uint64_t ullCalls;
+
+	/** records processed by these runs */
+	uint64_t ullRecords;
+
+	/** counter totals, by enum eMvbcProfCounter */
+	uint64_t ullCount[eProfCounterCount];
+
+	/** averages per run and per record (0 without records) */
+	double dPerCall[eProfCounterCount];
+	double dPerRecord[eProfCounterCount];
+
+	/** bit per enum eMvbcProfCounter the threads could open */
+	uint32_t uiAvailable;
+};
+
+/**
+ * Switch profiling on or off for all threads.
+ *
+ * @param on
+ * @return 0 in case of success, -1 if perf_event_open() is not permitted
+ */
+int mvbc_prof_enable(int on);
+
+/**
+ * Clear the totals of all phases.
+ */
+void mvbc_prof_reset(void);
+
+/**
+ * Get the totals of a phase.
+ *
+ * @param phase enum eMvbcProfPhase
+ * @param stats
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_prof_get(int phase, struct sMvbcProfStats *stats);
+
+/**
+ * Name of a phase, e.g. for reports.
+ *
+ * @param phase
+ * @return name, "?" for an unknown phase
+ */
+const char *mvbc_prof_phase_name(int phase);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
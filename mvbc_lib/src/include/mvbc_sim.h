@@ -0,0 +1,189 @@
+/**
+ * @file
+ *
+ * Emulated bus master driving an emulated device (mvbc_emu.h).
+ *
+ * The simulator polls the ports of a schedule at their periods on a virtual
+ * clock and hands the frames to mvbc_emu_bus_frames(), so the records reach
+ * the application through the normal reader. The virtual clock is not tied
+ * to real time: unpaced, the simulation runs as fast as the reader drains
+ * the FIFO, e.g. one hour of traffic in a few seconds. Frame time stamps
+ * follow the virtual clock and may be disturbed by jitter, drops and line
+ * faults. The same seed gives the same traffic.
+ */
+
+#ifndef MVBC_SIM_INCLUDED
+#define MVBC_SIM_INCLUDED 1
+
+#include "mvbc_lib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** maximal number of scheduled ports */
+#define MVBC_SIM_MAX_ENTRIES 4096
+
+/** frames handed to the device at once */
+#define MVBC_SIM_BATCH 64
+
+/**
+ * one periodically polled port, e.g. taken from a sniffer log.
+ */
+struct sMvbcSimEntry
+{
+	uint16_t wPortAddr;
+
+	/** selects the frame size */
+	uint16_t wFunctionCode;
+
+	/** poll period in milliseconds */
+	uint16_t wPeriodMS;
+
+	/** first poll after start in milliseconds */
+	uint16_t wPhaseMS;
+};
+
+/**
+ * disturbances, all 0 = perfect bus.
+ */
+struct sMvbcSimFaults
+{
+	/** time stamps are moved by up to +-iJitterUS */
+	int iJitterUS;
+
+	/** frames lost per million */
+	int iDropPPM;
+
+	/** a line fault starts every X ms of virtual time (0 = none) */
+	int iLineFaultEveryMS;
+
+	/** duration of one line fault */
+	int iLineFaultMS;
+
+	/** line hit by the faults: eLineA, eLineB or eLineAB (alternating) */
+	int iLineFaultLine;
+
+	/** random seed, 0 selects 1 */
+	uint32_t uiSeed;
+};
+
+/**
+ * fills the data of a frame, default: counter in word 0, port address in the others.
+ */
+typedef void (*mvbc_sim_fill)(void *arg, uint16_t addr, uint16_t *data, int words, uint64_t now_us);
+
+/**
+ * simulator counters.
+ */
+struct sMvbcSimStats
+{
+	/** frames put on the bus */
+	uint64_t ullFrames;
+
+	/** frames stored by the device */
+	uint64_t ullDelivered;
+
+	/** frames dropped by iDropPPM */
+	uint64_t ullDropped;
+
+	/** line faults injected */
+	uint32_t uiLineFaults;
+
+	/** virtual time in microseconds */
+	uint64_t ullNowUS;
+};
+
+/**
+ * scheduled port with its next due time.
+ */
+struct sMvbcSimSlot
+{
+	uint64_t ullDueUS;
+	uint16_t wPortAddr;
+	uint16_t wWords;
+	uint32_t uiPeriodUS;
+	uint16_t wCounter;
+};
+
+/**
+ * simulator state, fully preallocated.
+ */
+struct sMvbcSim
+{
+	char cDevPath[MAX_STRING_LENGTH];
+
+	struct sMvbcSimFaults faults;
+
+	mvbc_sim_fill fill;
+	void *pFillArg;
+
+	/** real time of virtual time 0 */
+	struct timeval sStart;
+
+	uint32_t uiRandom;
+
+	/** virtual time the current line fault ends, 0 = none active */
+	uint64_t ullFaultEndUS;
+	int iFaultLine;
+	uint64_t ullNextFaultUS;
+
+	struct sMvbcSimStats stats;
+
+	/** frames not yet handed to the device */
+	int iBatch;
+	struct sPortData batch[MVBC_SIM_BATCH];
+
+	/** min-heap on ullDueUS */
+	int iCount;
+	struct sMvbcSimSlot slot[MVBC_SIM_MAX_ENTRIES];
+};
+
+/**
+ * Prepare a simulation of a schedule. Switches the emulated device to external bus.
+ *
+ * @param sim
+ * @param dev emulated device (e.g. emu:mvbc0)
+ * @param schedule
+ * @param count
+ * @param faults NULL for a perfect bus
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_sim_init(struct sMvbcSim *sim, const char *dev, const struct sMvbcSimEntry *schedule, int count, const struct sMvbcSimFaults *faults);
+
+/**
+ * Prepare a simulation of the sink ports the project of a context configures for dev,
+ * each polled at its configured poll interval.
+ *
+ * @param ctx
+ * @param sim
+ * @param dev
+ * @param faults NULL for a perfect bus
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_ctx_sim_init(mvbc_ctx *ctx, struct sMvbcSim *sim, const char *dev, const struct sMvbcSimFaults *faults);
+
+/**
+ * Set the function filling the frame data.
+ *
+ * @param sim
+ * @param fill
+ * @param arg
+ */
+void mvbc_sim_set_fill(struct sMvbcSim *sim, mvbc_sim_fill fill, void *arg);
+
+/**
+ * Advance the virtual clock and put all frames due on the bus.
+ *
+ * @param sim
+ * @param duration_ms virtual time to simulate
+ * @param scale 0 = as fast as the reader takes the records, X = X times real time
+ * @return number of frames delivered to the device, -1 for error
+ */
+int64_t mvbc_sim_run(struct sMvbcSim *sim, uint64_t duration_ms, int scale);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
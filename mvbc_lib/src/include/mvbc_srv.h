@@ -0,0 +1,153 @@
+/**
+ * @file
+ *
+ * Subscription server for local processes on a Unix domain socket.
+ *
+ * The server thread becomes the reader of all devices of the context. Clients
+ * connect with SOCK_SEQPACKET, so every message is one frame: struct
+ * sMvbcSrvFrame in host byte order followed by uiLen payload bytes. A client
+ * subscribes port addresses or port names of a device and grants credits;
+ * every update frame it receives costs one credit and carries up to
+ * MVBC_SRV_BATCH records (struct sPortData) of one device. While a client has
+ * no credit or its socket is full, newer records of a port replace older ones
+ * not sent yet, so a slow client gets the latest values instead of a backlog.
+ *
+ * One epoll thread serves all clients. Client slots are preallocated and the
+ * records of an update frame are gathered by sendmsg() straight from the
+ * latest-value image of the server, nothing is allocated per message.
+ */
+
+#ifndef MVBC_SRV_INCLUDED
+#define MVBC_SRV_INCLUDED 1
+
+#include <stdint.h>
+
+#include "mvbc_app_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** clients served at once */
+#define MVBC_SRV_MAX_CLIENTS 32
+
+/** records per update frame */
+#define MVBC_SRV_BATCH 64
+
+/** largest request frame */
+#define MVBC_SRV_MAX_REQUEST 8192
+
+/** credits of a new client */
+#define MVBC_SRV_INITIAL_CREDIT 8
+
+/** request: subscribe uiCount port addresses (uint16_t) of device wDev */
+#define MVBC_SRV_SUBSCRIBE 1
+
+/** request: unsubscribe uiCount port addresses (uint16_t) */
+#define MVBC_SRV_UNSUBSCRIBE 2
+
+/** request: subscribe the ports with uiCount names (zero terminated, one after the other) */
+#define MVBC_SRV_SUBSCRIBE_NAME 3
+
+/** request: unsubscribe ports by name */
+#define MVBC_SRV_UNSUBSCRIBE_NAME 4
+
+/** request: grant uiCount more update frames, no payload */
+#define MVBC_SRV_CREDIT 5
+
+/** update: uiCount records of device wDev, uiSeq counts the update frames of the client */
+#define MVBC_SRV_UPDATE 0x81
+
+/** reply to a (un)subscribe: uiSeq of the request, uiCount ports matched, payload int32_t 0 or -1 */
+#define MVBC_SRV_REPLY 0x82
+
+/**
+ * header of every message.
+ */
+struct sMvbcSrvFrame
+{
+	uint16_t wType;
+
+	/** index of the device in the project */
+	uint16_t wDev;
+
+	/** payload bytes following the header */
+	uint32_t uiLen;
+
+	/** request: chosen by the client, echoed in the reply; update: frame counter */
+	uint32_t uiSeq;
+
+	/** number of payload items */
+	uint32_t uiCount;
+};
+
+/**
+ * server counters.
+ */
+struct sMvbcSrvStats
+{
+	/** clients connected now */
+	uint32_t uiClients;
+
+	/** connections refused because all slots were in use */
+	uint32_t uiRejected;
+
+	/** records read from the devices */
+	uint64_t ullRecords;
+
+	/** update frames / records sent */
+	uint64_t ullFrames;
+	uint64_t ullUpdates;
+
+	/** records replaced before they were sent */
+	uint64_t ullCoalesced;
+
+	/** sends that found a client socket full */
+	uint64_t ullBlocked;
+
+	uint64_t ullRequests;
+
+	/** malformed requests, the client is disconnected */
+	uint32_t uiBadRequests;
+
+	/** device descriptors registered again because the device was opened again */
+	uint32_t uiReopened;
+};
+
+/**
+ * Start the server thread.
+ *
+ * @param path socket path, an existing socket file is replaced
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_srv_start(const char *path);
+
+/**
+ * Stop the server thread, disconnect the clients and remove the socket file.
+ *
+ * @return 0 in case of success, -1 if not running
+ */
+int mvbc_srv_stop(void);
+
+/**
+ * Get the server counters.
+ *
+ * @param stats
+ * @return 0 in case of success, -1 if not running
+ */
+int mvbc_srv_get_stats(struct sMvbcSrvStats *stats);
+
+/** mvbc_srv_start() on a context */
+int mvbc_ctx_srv_start(mvbc_ctx *ctx, const char *path);
+
+/** mvbc_srv_stop() on a context */
+int mvbc_ctx_srv_stop(mvbc_ctx *ctx);
+
+/** mvbc_srv_get_stats() on a context */
+int mvbc_ctx_srv_get_stats(mvbc_ctx *ctx, struct sMvbcSrvStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,155 @@
+/**
+ * @file
+ *
+ * Project configuration linked into the application instead of parsed from JSON.
+ *
+ * The tables are plain const structures, so they can be placed in read only
+ * memory and written by hand, generated at build time or declared constexpr
+ * from C++ (see mvbc.hpp, where they are validated with static_assert).
+ * mvbc_ctx_init_static() takes them instead of a configuration file.
+ */
+
+#ifndef MVBC_STATIC_INCLUDED
+#define MVBC_STATIC_INCLUDED 1
+
+#include <stdint.h>
+
+#include "mvbc_app_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Port control and status word 0 as programmed into the MVBC.
+ *
+ * @param fcode F-Code 0..15
+ * @param direction 0 = sink, 1 = source
+ * @param irq 0 = polled, 1..7 = DTI1..DTI7
+ * @param num_data 1 = numerical data
+ */
+#define MVBC_PCS_W0(fcode, direction, irq, num_data) \
+	((uint16_t)(((fcode) << 12) | (1 << (10 + (direction))) | ((irq) << 5) | ((num_data) << 1)))
+
+/** data words of a port with this F-Code: 1 << fcode for process data, 16 for messages, 1 for device status */
+#define MVBC_FCODE_WORDS(fcode) (((fcode) <= 4) ? (1 << (fcode)) : (((fcode) == 15) ? 1 : 16))
+
+/** MVB bit rate in bits per millisecond */
+#define MVBC_BUS_BITS_PER_MS 1500
+
+/** bit times of a master frame: start delimiter, 16 bits, check sequence */
+#define MVBC_BUS_MASTER_FRAME_BITS 33
+
+/** bit times between two frames */
+#define MVBC_BUS_GAP_BITS 6
+
+/** bit times one exchange of a port of this F-Code occupies; slave frame: start delimiter, data, 8 bit check sequence per 64 data bits */
+#define MVBC_BUS_PORT_BITS(fcode) \
+	(MVBC_BUS_MASTER_FRAME_BITS + 9 + 16 * MVBC_FCODE_WORDS(fcode) + 8 * ((MVBC_FCODE_WORDS(fcode) + 3) / 4) + 2 * MVBC_BUS_GAP_BITS)
+
+/** bus time the static ports of one device may use, in 1/1000 of the bus capacity */
+#ifndef MVBC_STATIC_MAX_BUS_LOAD_PERMILLE
+#define MVBC_STATIC_MAX_BUS_LOAD_PERMILLE 700
+#endif
+
+/**
+ * one statically configured port.
+ */
+struct sMvbcStaticPort
+{
+	/** e.g. ADC or TEMP, NULL for the default name */
+	const char *pName;
+
+	/** 1...4095 */
+	uint16_t wPortAddr;
+
+	/** enum ePortType */
+	uint8_t cPortType;
+
+	/** enum ePortDirection */
+	uint8_t cPortDirection;
+
+	/** 0...15 */
+	uint8_t cFunctionCode;
+
+	/** 0 = polled, 1..7 = DTI1..DTI7 */
+	uint8_t cIrqNumber;
+
+	/** 1 = numerical data */
+	uint8_t cNumData;
+
+	/** 1, 2, 4 ... 1024 */
+	uint16_t wPollIntervalMS;
+
+	/** MVBC_PCS_W0() of the fields above, 0 = compute at init */
+	uint16_t wPCS_W0;
+};
+
+/**
+ * one statically configured MVBC device.
+ */
+struct sMvbcStaticDevice
+{
+	/** e.g. MVBC1 */
+	const char *pDescription;
+
+	/** e.g. /dev/mvbc1 */
+	const char *pDevPath;
+
+	/** enum eInterfaceType */
+	int iInterface;
+
+	/** enum eMode */
+	int iMode;
+
+	/** run the memory test during init */
+	int iTestTrafficMemory;
+
+	/** enum eLineMode */
+	int iLine;
+
+	/** 1...4095 */
+	int iDeviceAddr;
+
+	/** default port configuration used by the sniffer (dynamic and combined mode) */
+	uint16_t wDefaultPortType;
+	uint16_t wDefaultPollInterval;
+	int iDefaultIrqNumber;
+	int iDefaultNumData;
+
+	int iPortCount;
+	const struct sMvbcStaticPort *pPorts;
+
+	/** traffic memory for mvbc_port_read/write() (e.g. /dev/uio0), NULL = none */
+	const char *pUioPath;
+};
+
+/**
+ * statically configured project.
+ */
+struct sMvbcStaticProject
+{
+	const char *pName;
+	const char *pVersion;
+
+	int iDeviceCount;
+	const struct sMvbcStaticDevice *pDevices;
+};
+
+/**
+ * mvbc_ctx_init() with a linked in configuration: no file is read, nothing is parsed.
+ *
+ * @param ctx
+ * @param project
+ * @return 0 in case of success, errorMask for error
+ */
+int mvbc_ctx_init_static(mvbc_ctx *ctx, const struct sMvbcStaticProject *project);
+
+/** mvbc_ctx_init_static() on the default context */
+int mvbc_init_static(const struct sMvbcStaticProject *project);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+/**
+ * @file
+ *
+ * Static probe points (USDT, provider "mvbc") for bpftrace, perf and SystemTap.
+ *
+ * A probe is one NOP in the code and a note in .note.stapsdt; its arguments
+ * must already be in registers or memory. Arguments that cost something to
+ * compute are only computed while a tracer is attached, MVBC_TRACE_ENABLED()
+ * reads the semaphore the tracer increments. Without <sys/sdt.h> or with
+ * MVBC_NO_TRACE defined all probes compile to nothing.
+ *
+ * 	bpftrace -e 'usdt:./libmvbc.so:mvbc:cmd__return { @[str(arg0), arg1] = hist(arg3); }'
+ *
+ * Probes and arguments:
+ *
+ * 	cmd__entry      (const char *dev, int cmd)
+ * 	cmd__return     (const char *dev, int cmd, int rc, uint64_t latency_ns)
+ * 	port__config    (const char *dev, int addr, int fcode, int direction, int poll_ms)
+ * 	record__read    (const char *dev, int addr, int type, int words, int64_t age_us)
+ * 	dispatch        (const char *dev, int addr, int waiters), addr -1 for batch waiters
+ * 	queue__overflow (const char *queue, const char *dev, uint64_t count)
+ * 	stale           (const char *dev, int64_t silent_ms, int64_t limit_ms)
+ *
+ * age_us of record__read is the time from the driver time stamp of the
+ * record until it was read. queue names are "merge", "msg", "pool" and "emu".
+ */
+
+#ifndef MVBC_TRACE_INCLUDED
+#define MVBC_TRACE_INCLUDED 1
+
+#if !defined(MVBC_NO_TRACE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define MVBC_TRACE 1
+#endif
+#endif
+
+#ifdef MVBC_TRACE
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* semaphores, defined in mvbc_trace.c */
+extern unsigned short mvbc_cmd__entry_semaphore;
+extern unsigned short mvbc_cmd__return_semaphore;
+extern unsigned short mvbc_port__config_semaphore;
+extern unsigned short mvbc_record__read_semaphore;
+extern unsigned short mvbc_dispatch_semaphore;
+extern unsigned short mvbc_queue__overflow_semaphore;
+extern unsigned short mvbc_stale_semaphore;
+
+#ifdef __cplusplus
+}
+#endif
+
+/** 1 while a tracer is attached to the probe */
+#define MVBC_TRACE_ENABLED(name) __builtin_expect(mvbc_##name##_semaphore != 0, 0)
+
+#define MVBC_TRACE2(name, a1, a2) DTRACE_PROBE2(mvbc, name, a1, a2)
+#define MVBC_TRACE3(name, a1, a2, a3) DTRACE_PROBE3(mvbc, name, a1, a2, a3)
+#define MVBC_TRACE4(name, a1, a2, a3, a4) DTRACE_PROBE4(mvbc, name, a1, a2, a3, a4)
+#define MVBC_TRACE5(name, a1, a2, a3, a4, a5) DTRACE_PROBE5(mvbc, name, a1, a2, a3, a4, a5)
+
+#else
+
+/* the arguments stay referenced, so variables only computed for a probe do not warn */
+#define MVBC_TRACE_ENABLED(name) 0
+
+#define MVBC_TRACE2(name, a1, a2) do { if (0) { (void)(a1); (void)(a2); } } while (0)
+#define MVBC_TRACE3(name, a1, a2, a3) do { if (0) { (void)(a1); (void)(a2); (void)(a3); } } while (0)
+#define MVBC_TRACE4(name, a1, a2, a3, a4) do { if (0) { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } } while (0)
+#define MVBC_TRACE5(name, a1, a2, a3, a4, a5) do { if (0) { (void)(a1); (void)(a2); (void)(a3); (void)(a4); (void)(a5); } } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,223 @@
+/**
+ * @file
+ *
+ * Direct access to the MVBC traffic memory mapped into user space (UIO).
+ *
+ * The driver programs the device as usual; afterwards port data is read and
+ * written in the mapped memory without a system call. A sink port is read
+ * from its valid page and read again if the MVBC flipped the page meanwhile,
+ * a source port is written into the invalid page and then made valid. Any
+ * file of the right size can be mapped instead of /dev/uioX, e.g. to test
+ * against a memory backed file programmed with mvbc_uio_set_port().
+ *
+ * The built-in offsets and bits only describe such files. A board is mapped
+ * once the build sets them from its manual and defines MVBC_UIO_BOARD_LAYOUT
+ * (CMake option of the same name); without it only regular files are mapped.
+ */
+
+#ifndef MVBC_UIO_INCLUDED
+#define MVBC_UIO_INCLUDED 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mvbc_app_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** size of the mapping */
+#ifndef MVBC_UIO_MAP_SIZE
+#define MVBC_UIO_MAP_SIZE 0x100000
+#endif
+
+/** port index table: one 16 bit port index per port address, 0 = not configured */
+#ifndef MVBC_UIO_PIT_OFFSET
+#define MVBC_UIO_PIT_OFFSET 0x00000
+#endif
+
+/** port control and status: 4 words per port index */
+#ifndef MVBC_UIO_PCS_OFFSET
+#define MVBC_UIO_PCS_OFFSET 0x02000
+#endif
+
+/** registers SCR, MCR and DR, 32 bit apart */
+#ifndef MVBC_UIO_REG_OFFSET
+#define MVBC_UIO_REG_OFFSET 0x0FF80
+#endif
+
+/** data area: two pages of 16 words per port index */
+#ifndef MVBC_UIO_DATA_OFFSET
+#define MVBC_UIO_DATA_OFFSET 0x10000
+#endif
+
+/** number of port indices */
+#define MVBC_UIO_PORT_INDICES 4096
+
+/** PCS word 1: valid page */
+#ifndef MVBC_UIO_PCS1_VP
+#define MVBC_UIO_PCS1_VP 0x0001
+#endif
+
+/** PCS word 1: sink: frame stored since the last acknowledge, source: frame sent since the last write */
+#ifndef MVBC_UIO_PCS1_TACK
+#define MVBC_UIO_PCS1_TACK 0x0100
+#endif
+
+/** reads of a sink port repeated because of a page flip before giving up */
+#define MVBC_UIO_READ_RETRIES 4
+
+/**
+ * a mapped traffic memory.
+ */
+struct sMvbcUio
+{
+	/** descriptor of the mapped device or file, -1 = not mapped */
+	int iFd;
+
+	/** NULL = not mapped */
+	volatile uint8_t *pBase;
+
+	size_t ulSize;
+};
+
+/**
+ * resolved port, valid as long as the mapping. The mapping of a device is
+ * removed by the next init and by mvbc_ctx_destroy(), which invalidates all
+ * ports resolved from it.
+ */
+struct sMvbcUioPort
+{
+	/** the 4 PCS words */
+	volatile uint16_t *pPCS;
+
+	/** page 0 and 1 */
+	volatile uint16_t *pPage[2];
+
+	/** data words of the F-Code */
+	uint16_t wWords;
+
+	/** 1 = source port */
+	uint16_t wSource;
+};
+
+/**
+ * Map a traffic memory.
+ *
+ * @param uio
+ * @param path e.g. /dev/uio0 or a regular file
+ * @param size bytes to map, 0 = size of a regular file or MVBC_UIO_MAP_SIZE
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_uio_map(struct sMvbcUio *uio, const char *path, size_t size);
+
+/**
+ * Remove a mapping, nothing happens if uio is not mapped.
+ *
+ * @param uio
+ */
+void mvbc_uio_unmap(struct sMvbcUio *uio);
+
+/**
+ * Look up a port in the port index table.
+ *
+ * @param uio
+ * @param addr port address
+ * @param port
+ * @return 0 in case of success, -1 if the port is not configured
+ */
+int mvbc_uio_port(const struct sMvbcUio *uio, int addr, struct sMvbcUioPort *port);
+
+/**
+ * Read the valid page of a port.
+ *
+ * @param port
+ * @param data
+ * @param words size of data
+ * @param fresh NULL or gets 1 if the sink port received a frame since the last read (TACK, acknowledged by the read)
+ * @return number of words copied, -1 if the page flipped on every try
+ */
+int mvbc_uio_port_read(const struct sMvbcUioPort *port, uint16_t *data, int words, int *fresh);
+
+/**
+ * Write a source port: fill the invalid page and flip. One writer per port.
+ *
+ * @param port
+ * @param data
+ * @param words missing words are written as 0
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_uio_port_write(const struct sMvbcUioPort *port, const uint16_t *data, int words);
+
+/**
+ * Read the registers.
+ *
+ * @param uio
+ * @param scr NULL or gets SCR
+ * @param mcr NULL or gets MCR
+ * @param dr NULL or gets DR
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_uio_get_regs(const struct sMvbcUio *uio, uint16_t *scr, uint16_t *mcr, uint16_t *dr);
+
+/**
+ * Program a port the way the driver does: port index table, PCS word 0, both pages cleared.
+ * Only needed where no driver owns the memory, e.g. a file.
+ *
+ * @param uio
+ * @param index 1...MVBC_UIO_PORT_INDICES-1
+ * @param addr port address
+ * @param pcs_w0 MVBC_PCS_W0() of the port
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_uio_set_port(struct sMvbcUio *uio, int index, int addr, uint16_t pcs_w0);
+
+/**
+ * Resolve a port of a device whose configuration names a traffic memory ("uio").
+ * The fastest loops resolve their ports once and use mvbc_uio_port_read/write().
+ * The result must not be used once an init or destroy of the context started,
+ * mvbc_port_read/write() resolve and access under the device lock instead.
+ *
+ * @param ctx
+ * @param dev (e.g. /dev/mvbc1)
+ * @param addr port address
+ * @param port
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_ctx_uio_port(mvbc_ctx *ctx, const char *dev, int addr, struct sMvbcUioPort *port);
+
+/**
+ * Read a port of a device directly from its traffic memory.
+ *
+ * @param dev
+ * @param addr
+ * @param data
+ * @param words
+ * @param fresh see mvbc_uio_port_read()
+ * @return number of words copied, -1 for error
+ */
+int mvbc_port_read(const char *dev, int addr, uint16_t *data, int words, int *fresh);
+
+/**
+ * Write a source port of a device directly into its traffic memory.
+ *
+ * @param dev
+ * @param addr
+ * @param data
+ * @param words
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_port_write(const char *dev, int addr, const uint16_t *data, int words);
+
+/** mvbc_port_read() on a context */
+int mvbc_ctx_port_read(mvbc_ctx *ctx, const char *dev, int addr, uint16_t *data, int words, int *fresh);
+
+/** mvbc_port_write() on a context */
+int mvbc_ctx_port_write(mvbc_ctx *ctx, const char *dev, int addr, const uint16_t *data, int words);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
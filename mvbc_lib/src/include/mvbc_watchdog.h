@@ -0,0 +1,147 @@
+/**
+ * @file
+ *
+ * Health supervision and automatic recovery of single MVBC devices.
+ *
+ * The watchdog probes every running device (ioctl and SCR run state), looks at
+ * read errors and at the FIFO activity of devices that are being read. A device
+ * that failed is brought up again on its own from the parsed configuration:
+ * without memory test and with the port descriptors cached at init, while the
+ * other devices keep running. Devices stopped with mvbc_shutdown() are left alone.
+ *
+ * The configured sink ports of a device being read are supervised as well: a
+ * port whose records came without transfer acknowledge (wTACK 0) for
+ * MVBC_WATCHDOG_STALE_FACTOR of its poll intervals has no live source. Such
+ * ports are counted and logged, but do not restart the device, as that does
+ * not bring a source back.
+ */
+
+#ifndef MVBC_WATCHDOG_INCLUDED
+#define MVBC_WATCHDOG_INCLUDED 1
+
+#include <stdint.h>
+
+#include "mvbc_app_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** default time between two checks of the watchdog thread */
+#define MVBC_WATCHDOG_DEFAULT_PERIOD_MS 50
+
+/** default number of failed ioctls/reads in a row before a device is recovered */
+#define MVBC_WATCHDOG_DEFAULT_ERRORS 3
+
+/** silence of a device being read: multiple of its largest sink poll interval */
+#define MVBC_WATCHDOG_STALE_FACTOR 4
+
+/** silence of a device being read: lower bound */
+#define MVBC_WATCHDOG_STALE_MIN_MS 100
+
+/**
+ * watchdog settings, 0 selects the default.
+ */
+struct sMvbcWatchdogCfg
+{
+	/** time between two checks of the watchdog thread */
+	int iPeriodMS;
+
+	/** failed ioctls/reads in a row until recovery */
+	int iErrors;
+
+	/** no record for this long while the device is read means stale (default from the poll intervals, -1 = off) */
+	int iStaleMS;
+};
+
+/** reason of the last recovery */
+enum eMvbcWatchdogReason
+{
+	eWatchdogNone,
+
+	/** ioctl or read failed iErrors times in a row */
+	eWatchdogErrors,
+
+	/** the controller left run mode (reset, power glitch) */
+	eWatchdogNotRunning,
+
+	/** no records although the device is read */
+	eWatchdogStale
+};
+
+/**
+ * health counters of one device.
+ */
+struct sMvbcHealthStats
+{
+	/** successful recoveries */
+	uint32_t uiRecoveries;
+
+	/** recoveries that failed (retried at the next check) */
+	uint32_t uiRecoveryErrors;
+
+	/** failed ioctls/reads in a row */
+	uint32_t uiErrorsInRow;
+
+	/** enum eMvbcWatchdogReason of the last recovery */
+	int iLastReason;
+
+	/** duration of the last recovery in microseconds */
+	uint32_t uiLastRecoveryUS;
+
+	/** milliseconds since the last record, -1 = none yet */
+	int64_t llSilentMS;
+
+	/** configured sink ports without a record with transfer acknowledge for their stale time */
+	uint32_t uiStalePorts;
+};
+
+/**
+ * Check all devices once and recover the failed ones.
+ *
+ * @param cfg NULL for defaults
+ * @return number of devices recovered, -1 for error
+ */
+int mvbc_watchdog_check(const struct sMvbcWatchdogCfg *cfg);
+
+/**
+ * Run mvbc_watchdog_check() in a thread every cfg->iPeriodMS.
+ *
+ * @param cfg NULL for defaults
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_watchdog_start(const struct sMvbcWatchdogCfg *cfg);
+
+/**
+ * Stop the watchdog thread.
+ *
+ * @return 0 in case of success, -1 if not running
+ */
+int mvbc_watchdog_stop(void);
+
+/**
+ * Get the health counters of a device.
+ *
+ * @param dev
+ * @param stats
+ * @return 0 in case of success, -1 for error
+ */
+int mvbc_get_health(const char *dev, struct sMvbcHealthStats *stats);
+
+/** mvbc_watchdog_check() on a context */
+int mvbc_ctx_watchdog_check(mvbc_ctx *ctx, const struct sMvbcWatchdogCfg *cfg);
+
+/** mvbc_watchdog_start() on a context */
+int mvbc_ctx_watchdog_start(mvbc_ctx *ctx, const struct sMvbcWatchdogCfg *cfg);
+
+/** mvbc_watchdog_stop() on a context */
+int mvbc_ctx_watchdog_stop(mvbc_ctx *ctx);
+
+/** mvbc_get_health() on a context */
+int mvbc_ctx_get_health(mvbc_ctx *ctx, const char *dev, struct sMvbcHealthStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
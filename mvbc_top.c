@@ -0,0 +1,458 @@
+/**
+ * @file
+ *
+ * mvbc-top: live view of the busiest ports of a running library instance.
+ *
+ * Maps the shared counters of the instance (sMvbcMetricsCfg.pShm, see
+ * mvbc_metrics.h) read only; the monitored process does no work for it.
+ * Shows per device the record and read rates and how often a read filled
+ * the buffer of the caller (FIFO pressure), and per port the record rate
+ * against the configured poll interval and latency percentiles between the
+ * driver time stamp and the read.
+ *
+ * 	mvbc-top [-i interval_ms] [-n rows] [-1] [file]
+ *
+ * -1 prints one interval without screen control, e.g. for scripts.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <mvbc_metrics.h>
+
+#define DEFAULT_METRICS_FILE "/dev/shm/mvbc"
+#define DEFAULT_INTERVAL_MS 250
+#define DEFAULT_ROWS 20
+
+/** lines above the port table */
+#define HEADER_LINES (4 + MAX_MVBC_DEVICES)
+
+/**
+ * counters of one port at the last refresh.
+ */
+struct sTopPort
+{
+	uint64_t ullRecords;
+	uint32_t uiLatency[MVBC_METRICS_LAT_BUCKETS];
+};
+
+/**
+ * one line of the port table.
+ */
+struct sTopRow
+{
+	int iDev;
+	int iAddr;
+	double dRate;
+	int iStale;
+};
+
+static const struct sMvbcMetricsShm *gShm;
+
+/** copy of the description, taken while uiDescSeq was even and unchanged */
+static uint32_t gDescSeq = 1;
+static int gDevCount;
+static char gDevPath[MAX_MVBC_DEVICES][MAX_STRING_LENGTH];
+static uint16_t gPollMS[MAX_MVBC_DEVICES][MVBC_METRICS_PORTS];
+static char gPortName[MAX_MVBC_DEVICES][MVBC_METRICS_PORTS][MVBC_METRICS_NAME_LENGTH];
+
+static struct sTopPort gPrev[MAX_MVBC_DEVICES][MVBC_METRICS_PORTS];
+static struct sMvbcDevMetric gPrevDev[MAX_MVBC_DEVICES];
+static struct sTopRow gRows[MAX_MVBC_DEVICES * MVBC_METRICS_PORTS];
+
+static volatile sig_atomic_t gStop;
+static struct termios gTerm;
+static int gTermSaved;
+
+static void top_signal(int sig)
+{
+	(void)sig;
+	gStop = 1;
+}
+
+static void top_term_restore(void)
+{
+	if (gTermSaved)
+	{
+		tcsetattr(STDIN_FILENO, TCSANOW, &gTerm);
+		printf("\033[?25h");
+	}
+}
+
+static int64_t top_now_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Map the counters of an instance.
+ *
+ * @param file
+ * @return 0 in case of success, -1 for error
+ */
+static int top_open(const char *file)
+{
+	struct stat st;
+	void *p;
+	int fd = open(file, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+	{
+		fprintf(stderr, "cannot open %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+	if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(struct sMvbcMetricsShm)))
+	{
+		fprintf(stderr, "%s is no metrics file\n", file);
+		close(fd);
+		return -1;
+	}
+
+	p = mmap(NULL, sizeof(struct sMvbcMetricsShm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+	{
+		fprintf(stderr, "cannot map %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+
+	gShm = p;
+	if ((__atomic_load_n(&gShm->uiMagic, __ATOMIC_ACQUIRE) != MVBC_METRICS_SHM_MAGIC) || (gShm->uiVersion != MVBC_METRICS_SHM_VERSION))
+	{
+		fprintf(stderr, "%s: unknown layout\n", file);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Copy the description again after an init of the instance.
+ */
+static void top_describe(void)
+{
+	for (int tries = 0; tries < 100; tries++)
+	{
+		uint32_t seq = __atomic_load_n(&gShm->uiDescSeq, __ATOMIC_ACQUIRE);
+
+		if (seq == gDescSeq)
+		{
+			return;
+		}
+		if ((seq & 1) == 0)
+		{
+			gDevCount = gShm->iDevCount;
+			memcpy(gDevPath, gShm->cDevPath, sizeof(gDevPath));
+			memcpy(gPollMS, gShm->wPollMS, sizeof(gPollMS));
+			memcpy(gPortName, gShm->cPortName, sizeof(gPortName));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&gShm->uiDescSeq, __ATOMIC_RELAXED) == seq)
+			{
+				gDescSeq = seq;
+				gDevCount = (gDevCount < 0) ? 0 : ((gDevCount > MAX_MVBC_DEVICES) ? MAX_MVBC_DEVICES : gDevCount);
+				return;
+			}
+		}
+		usleep(1000);
+	}
+}
+
+/**
+ * Latency percentile of a histogram as the upper bound of its bucket.
+ *
+ * @param hist
+ * @param total
+ * @param pct
+ * @return microseconds
+ */
+static uint64_t top_percentile(const uint32_t *hist, uint64_t total, int pct)
+{
+	uint64_t need = (total * pct + 99) / 100;
+	uint64_t sum = 0;
+
+	for (int b = 0; b < MVBC_METRICS_LAT_BUCKETS; b++)
+	{
+		sum += hist[b];
+		if (sum >= need)
+		{
+			return (uint64_t)1 << b;
+		}
+	}
+	return (uint64_t)1 << (MVBC_METRICS_LAT_BUCKETS - 1);
+}
+
+static const char *top_fmt_us(char *buf, size_t size, uint64_t us)
+{
+	if (us < 1000)
+	{
+		snprintf(buf, size, "%lluus", (unsigned long long)us);
+	}
+	else if (us < 1000000)
+	{
+		snprintf(buf, size, "%llums", (unsigned long long)(us / 1000));
+	}
+	else
+	{
+		snprintf(buf, size, "%llus", (unsigned long long)(us / 1000000));
+	}
+	return buf;
+}
+
+static int top_cmp_rows(const void *a, const void *b)
+{
+	const struct sTopRow *ra = a;
+	const struct sTopRow *rb = b;
+
+	if (ra->dRate != rb->dRate)
+	{
+		return (ra->dRate < rb->dRate) ? 1 : -1;
+	}
+	if (ra->iStale != rb->iStale)
+	{
+		return rb->iStale - ra->iStale;
+	}
+	return (ra->iDev != rb->iDev) ? ra->iDev - rb->iDev : ra->iAddr - rb->iAddr;
+}
+
+/**
+ * Keep the counters of all devices and ports, also of the ports not shown, for the next interval.
+ */
+static void top_keep(void)
+{
+	for (int d = 0; d < gDevCount; d++)
+	{
+		gPrevDev[d].ullReads = __atomic_load_n(&gShm->dev[d].ullReads, __ATOMIC_RELAXED);
+		gPrevDev[d].ullRecords = __atomic_load_n(&gShm->dev[d].ullRecords, __ATOMIC_RELAXED);
+		gPrevDev[d].ullFullReads = __atomic_load_n(&gShm->dev[d].ullFullReads, __ATOMIC_RELAXED);
+		for (int addr = 0; addr < MVBC_METRICS_PORTS; addr++)
+		{
+			const struct sMvbcPortMetric *m = &gShm->dev[d].port[addr];
+
+			gPrev[d][addr].ullRecords = __atomic_load_n(&m->ullRecords, __ATOMIC_RELAXED);
+			for (int b = 0; b < MVBC_METRICS_LAT_BUCKETS; b++)
+			{
+				gPrev[d][addr].uiLatency[b] = __atomic_load_n(&m->uiLatency[b], __ATOMIC_RELAXED);
+			}
+		}
+	}
+}
+
+/**
+ * Print the rates since the last call.
+ *
+ * @param seconds since the last call
+ * @param rows port lines to print
+ * @param screen 1 = redraw the terminal
+ */
+static void top_refresh(double seconds, int rows, int screen)
+{
+	int64_t now = top_now_us();
+	int count = 0;
+	int staleTotal = 0;
+	int stale[MAX_MVBC_DEVICES];
+
+	top_describe();
+
+	/* ports with records in the interval or stale */
+	for (int d = 0; d < gDevCount; d++)
+	{
+		stale[d] = 0;
+		for (int addr = 0; addr < MVBC_METRICS_PORTS; addr++)
+		{
+			const struct sMvbcPortMetric *m = &gShm->dev[d].port[addr];
+			uint64_t records = __atomic_load_n(&m->ullRecords, __ATOMIC_RELAXED);
+			int64_t poll = gPollMS[d][addr];
+			int isStale = (poll > 0) && (now - __atomic_load_n(&m->llLastUS, __ATOMIC_RELAXED) > poll * 1000 * MVBC_METRICS_STALE_FACTOR);
+
+			stale[d] += isStale;
+			if ((records != gPrev[d][addr].ullRecords) || isStale)
+			{
+				gRows[count].iDev = d;
+				gRows[count].iAddr = addr;
+				gRows[count].dRate = (records - gPrev[d][addr].ullRecords) / seconds;
+				gRows[count].iStale = isStale;
+				count++;
+			}
+		}
+		staleTotal += stale[d];
+	}
+
+	qsort(gRows, count, sizeof(struct sTopRow), top_cmp_rows);
+
+	if (screen)
+	{
+		printf("\033[H\033[J");
+	}
+	printf("mvbc-top  pid %d%s  interval %.0f ms  ports active/stale %d/%d\n\n",
+		   gShm->iPid, ((kill(gShm->iPid, 0) != 0) && (errno == ESRCH)) ? " (gone)" : "", seconds * 1000, count - staleTotal, staleTotal);
+
+	printf("%-20s %10s %9s %9s %8s %6s\n", "DEVICE", "REC/S", "READS/S", "REC/READ", "FULL%", "STALE");
+	for (int d = 0; d < gDevCount; d++)
+	{
+		const struct sMvbcDevMetric *m = &gShm->dev[d];
+		uint64_t reads = __atomic_load_n(&m->ullReads, __ATOMIC_RELAXED) - gPrevDev[d].ullReads;
+		uint64_t recs = __atomic_load_n(&m->ullRecords, __ATOMIC_RELAXED) - gPrevDev[d].ullRecords;
+		uint64_t full = __atomic_load_n(&m->ullFullReads, __ATOMIC_RELAXED) - gPrevDev[d].ullFullReads;
+
+		printf("%-20.20s %10.0f %9.0f %9.1f %7.1f%% %6d\n", gDevPath[d], recs / seconds, reads / seconds,
+			   reads ? (double)recs / reads : 0.0, reads ? 100.0 * full / reads : 0.0, stale[d]);
+	}
+
+	printf("\n%-12s %-6s %-16s %9s %8s %7s %7s %7s %s\n", "DEVICE", "PORT", "NAME", "REC/S", "POLL_MS", "%POLL", "P50", "P99", "");
+	for (int i = 0; (i < count) && (i < rows); i++)
+	{
+		const struct sTopRow *r = &gRows[i];
+		const struct sMvbcPortMetric *m = &gShm->dev[r->iDev].port[r->iAddr];
+		struct sTopPort *prev = &gPrev[r->iDev][r->iAddr];
+		uint32_t hist[MVBC_METRICS_LAT_BUCKETS];
+		uint64_t total = 0;
+		int poll = gPollMS[r->iDev][r->iAddr];
+		char pct[16] = "-";
+		char p50[16] = "-";
+		char p99[16] = "-";
+
+		for (int b = 0; b < MVBC_METRICS_LAT_BUCKETS; b++)
+		{
+			hist[b] = __atomic_load_n(&m->uiLatency[b], __ATOMIC_RELAXED) - prev->uiLatency[b];
+			total += hist[b];
+		}
+		if (total > 0)
+		{
+			top_fmt_us(p50, sizeof(p50), top_percentile(hist, total, 50));
+			top_fmt_us(p99, sizeof(p99), top_percentile(hist, total, 99));
+		}
+		if (poll > 0)
+		{
+			/* 100 % = one record per poll interval */
+			snprintf(pct, sizeof(pct), "%.0f", r->dRate * poll / 10.0);
+		}
+
+		printf("%-12.12s 0x%03X  %-16.16s %9.1f %8d %7s %7s %7s %s\n", gDevPath[r->iDev], r->iAddr, gPortName[r->iDev][r->iAddr],
+			   r->dRate, poll, pct, p50, p99, r->iStale ? "STALE" : "");
+	}
+
+	top_keep();
+	fflush(stdout);
+}
+
+/**
+ * Main entry for the monitor
+ *
+ * @param argc
+ * @param argv
+ *
+ * @return 0, 1 for error
+ */
+int main(int argc, char* argv[])
+{
+	const char *file = DEFAULT_METRICS_FILE;
+	int interval = DEFAULT_INTERVAL_MS;
+	int rows = -1;
+	int once = 0;
+	int opt;
+	int64_t last;
+
+	while ((opt = getopt(argc, argv, "i:n:1h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'i':
+				interval = atoi(optarg);
+				break;
+			case 'n':
+				rows = atoi(optarg);
+				break;
+			case '1':
+				once = 1;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-i interval_ms] [-n rows] [-1] [file, default %s]\n", argv[0], DEFAULT_METRICS_FILE);
+				return 1;
+		}
+	}
+	if (optind < argc)
+	{
+		file = argv[optind];
+	}
+	if (interval <= 0)
+	{
+		interval = DEFAULT_INTERVAL_MS;
+	}
+
+	if (top_open(file) != 0)
+	{
+		return 1;
+	}
+
+	signal(SIGINT, top_signal);
+	signal(SIGTERM, top_signal);
+
+	if (!once && isatty(STDIN_FILENO) && (tcgetattr(STDIN_FILENO, &gTerm) == 0))
+	{
+		struct termios raw = gTerm;
+
+		/* single keys without echo, q quits */
+		raw.c_lflag &= ~(ICANON | ECHO);
+		raw.c_cc[VMIN] = 0;
+		raw.c_cc[VTIME] = 0;
+		tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+		gTermSaved = 1;
+		atexit(top_term_restore);
+		printf("\033[?25l");
+	}
+
+	/* the first interval starts with the counters as they are */
+	top_describe();
+	top_keep();
+	last = top_now_us();
+
+	while (!gStop)
+	{
+		struct pollfd pollDesc = { STDIN_FILENO, POLLIN, 0 };
+		int64_t now;
+		int shown = rows;
+
+		if (poll(&pollDesc, gTermSaved ? 1 : 0, interval) > 0)
+		{
+			char c;
+
+			if ((read(STDIN_FILENO, &c, 1) == 1) && (c == 'q'))
+			{
+				break;
+			}
+			continue;
+		}
+
+		now = top_now_us();
+		if (shown < 0)
+		{
+			struct winsize ws;
+
+			shown = ((ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0) && (ws.ws_row > HEADER_LINES)) ? ws.ws_row - HEADER_LINES - 1 : DEFAULT_ROWS;
+		}
+
+		top_refresh((now - last) / 1e6, shown, !once);
+		last = now;
+
+		if (once)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,470 @@
+/**
+ * @file
+ *
+ * Library test on emulated devices (see mvbc_emu.h), no board needed.
+ *
+ * Runs init, FIFO read, direct port access through a traffic memory file,
+ * mvbc_read_ports(), merge and deduplication of two devices, mvbc_wait_port()
+ * and a watchdog recovery, and prints the time of each step. A table that
+ * configures one port address twice is rejected by init.
+ *
+ * 	mvbc_emu_test [traffic memory file]
+ *
+ * @return 0 if all steps passed, 1 otherwise
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <mvbc_static.h>
+#include <mvbc_emu.h>
+#include <mvbc_uio.h>
+#include <mvbc_merge.h>
+#include <mvbc_dedup.h>
+#include <mvbc_watchdog.h>
+
+#define DEFAULT_UIO_FILE "/dev/shm/mvbc_emu_test"
+
+#define EMU_DEV_A MVBC_EMU_PREFIX "test0"
+#define EMU_DEV_B MVBC_EMU_PREFIX "test1"
+#define EMU_DEV_C MVBC_EMU_PREFIX "test2"
+
+#define TEST_PORTS 16
+#define TEST_PORT_BASE 0x100
+#define TEST_POLL_MS 16
+
+/** iterations of the timed loops */
+#define TEST_LOOPS 1000000
+
+/** frames sent to both devices for the merge and deduplication */
+#define TEST_FRAMES 200
+
+static struct sMvbcStaticPort gPorts[TEST_PORTS];
+static struct sMvbcStaticDevice gDevices[2];
+static const struct sMvbcStaticProject gProject = { "emu test", "1", 2, gDevices };
+
+static int gStop;
+static int gFailed;
+
+/**
+ * @return CLOCK_MONOTONIC in nanoseconds
+ */
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Print the result of a step.
+ *
+ * @param step
+ * @param ok
+ */
+static void check(const char *step, int ok)
+{
+	if (!ok)
+	{
+		gFailed++;
+	}
+	printf("%-12s %s\n", step, ok ? "ok" : "FAILED");
+}
+
+/**
+ * Read all records waiting in the FIFO of a device.
+ *
+ * @param dev
+ * @return number of records read
+ */
+static int drain(const char *dev)
+{
+	struct sPortData recs[256];
+	int total = 0;
+	int n;
+
+	while ((n = mvbc_read(dev, recs, 256)) > 0)
+	{
+		total += n;
+	}
+	return total;
+}
+
+/**
+ * Application reading both devices, needed by mvbc_wait_port() and the watchdog.
+ *
+ * @param arg unused
+ * @return NULL
+ */
+static void *reader(void *arg)
+{
+	(void)arg;
+	while (!__atomic_load_n(&gStop, __ATOMIC_RELAXED))
+	{
+		drain(EMU_DEV_A);
+		drain(EMU_DEV_B);
+		usleep(1000);
+	}
+	return NULL;
+}
+
+/**
+ * Program port TEST_PORT_BASE into a traffic memory file as the driver would.
+ *
+ * @param file
+ * @param uio mapping kept to act as the bus side
+ * @return 0 in case of success, -1 for error
+ */
+static int uio_file_setup(const char *file, struct sMvbcUio *uio)
+{
+	int fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+	if (ftruncate(fd, MVBC_UIO_MAP_SIZE) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	if (mvbc_uio_map(uio, file, 0) != 0)
+	{
+		return -1;
+	}
+	return mvbc_uio_set_port(uio, 1, TEST_PORT_BASE, MVBC_PCS_W0(3, eSink, 0, 0));
+}
+
+/**
+ * Store a frame in a sink port of the traffic memory the way the controller does.
+ *
+ * @param uio
+ * @param value written to all words
+ * @return 0 in case of success, -1 for error
+ */
+static int uio_bus_frame(const struct sMvbcUio *uio, uint16_t value)
+{
+	struct sMvbcUioPort port;
+	uint16_t vp;
+
+	if (mvbc_uio_port(uio, TEST_PORT_BASE, &port) != 0)
+	{
+		return -1;
+	}
+	vp = port.pPCS[1] & 1;
+	for (int i = 0; i < port.wWords; i++)
+	{
+		port.pPage[vp ^ 1][i] = value;
+	}
+	port.pPCS[1] = (vp ^ 1) | MVBC_UIO_PCS1_TACK;
+	return 0;
+}
+
+/**
+ * Direct port access: resolved port, acknowledge of TACK and mvbc_port_read().
+ *
+ * @param uio bus side of the traffic memory of EMU_DEV_A
+ */
+static void test_port_read(const struct sMvbcUio *uio)
+{
+	struct sMvbcUioPort port;
+	uint16_t data[MAX_PORT_DATA_LENGTH];
+	int fresh = 0;
+	uint64_t t;
+	int ok;
+
+	ok = (uio_bus_frame(uio, 0x1234) == 0)
+		&& (mvbc_ctx_uio_port(mvbc_default_ctx(), EMU_DEV_A, TEST_PORT_BASE, &port) == 0)
+		&& (mvbc_uio_port_read(&port, data, MAX_PORT_DATA_LENGTH, &fresh) == 8)
+		&& (fresh == 1) && (data[7] == 0x1234)
+		&& (mvbc_uio_port_read(&port, data, MAX_PORT_DATA_LENGTH, &fresh) == 8) && (fresh == 0)
+		&& (port.pPCS[1] == MVBC_UIO_PCS1_VP);
+
+	t = now_ns();
+	for (int i = 0; ok && (i < TEST_LOOPS); i++)
+	{
+		mvbc_uio_port_read(&port, data, 8, NULL);
+	}
+	if (ok)
+	{
+		printf("resolved port read: %.1f ns\n", (double)(now_ns() - t) / TEST_LOOPS);
+	}
+
+	t = now_ns();
+	for (int i = 0; ok && (i < TEST_LOOPS); i++)
+	{
+		ok = (mvbc_port_read(EMU_DEV_A, TEST_PORT_BASE, data, 8, NULL) == 8);
+	}
+	if (ok)
+	{
+		printf("mvbc_port_read: %.1f ns\n", (double)(now_ns() - t) / TEST_LOOPS);
+	}
+	check("port read", ok);
+}
+
+/**
+ * FIFO read and mvbc_read_ports() from the latest-value image.
+ */
+static void test_read(void)
+{
+	const uint16_t addrs[2] = { TEST_PORT_BASE, TEST_PORT_BASE + 1 };
+	struct sPortData out[2];
+	uint64_t records = 0;
+	uint64_t t;
+	int ok;
+
+	ok = (mvbc_emu_set_speed(EMU_DEV_B, 10) == 0) && (mvbc_enable_port_image(EMU_DEV_B) == 0);
+
+	drain(EMU_DEV_B);
+	t = now_ns();
+	while (ok && (now_ns() - t < 300000000ull))
+	{
+		records += drain(EMU_DEV_B);
+		usleep(1000);
+	}
+	printf("mvbc_read: %llu records in 300 ms\n", (unsigned long long)records);
+
+	ok = ok && (records > 0) && (mvbc_read_ports(EMU_DEV_B, addrs, 2, out) == 2);
+	t = now_ns();
+	for (int i = 0; ok && (i < TEST_LOOPS); i++)
+	{
+		ok = (mvbc_read_ports(EMU_DEV_B, addrs, 2, out) == 2);
+	}
+	if (ok)
+	{
+		printf("mvbc_read_ports, 2 ports: %.1f ns\n", (double)(now_ns() - t) / TEST_LOOPS);
+	}
+	mvbc_emu_set_speed(EMU_DEV_B, 1);
+	check("read", ok);
+}
+
+/**
+ * The same frames arrive on both devices, 300 us apart. The merge releases
+ * them in time stamp order and the deduplication lets one copy of each pass.
+ */
+static void test_merge(void)
+{
+	static struct sMvbcMerge merge;
+	static struct sMvbcDedup dedup;
+	static struct sPortData frames[TEST_FRAMES];
+	struct sPortData rec;
+	struct timeval ts;
+	int64_t last = -1;
+	int passed = 0;
+	int released = 0;
+	int ordered = 1;
+	uint64_t t;
+	int dev;
+	int ok;
+
+	ok = (mvbc_emu_set_external_bus(EMU_DEV_A, 1) == 0) && (mvbc_emu_set_external_bus(EMU_DEV_B, 1) == 0)
+		&& (mvbc_merge_init(&merge, -1) == 0) && (mvbc_dedup_init(&dedup, 0) == 0);
+	drain(EMU_DEV_A);
+	drain(EMU_DEV_B);
+
+	gettimeofday(&ts, NULL);
+	for (int k = 0; ok && (k < 2); k++)
+	{
+		for (int i = 0; i < TEST_FRAMES; i++)
+		{
+			int64_t us = (int64_t)ts.tv_sec * 1000000 + ts.tv_usec + i * 1000 + k * 300;
+
+			memset(&frames[i], 0, sizeof(frames[i]));
+			frames[i].wPortAddr = TEST_PORT_BASE + (i % TEST_PORTS);
+			frames[i].wNumOfWords = 4;
+			frames[i].wPortData[0] = i;
+			frames[i].sTimeStamp.tv_sec = us / 1000000;
+			frames[i].sTimeStamp.tv_usec = us % 1000000;
+		}
+		ok = (mvbc_emu_bus_frames(k ? EMU_DEV_B : EMU_DEV_A, frames, TEST_FRAMES) == TEST_FRAMES);
+	}
+
+	t = now_ns();
+	while (ok && (merge.stats.ullIn < 2 * TEST_FRAMES) && (mvbc_merge_fill(&merge, 100) > 0))
+	{
+	}
+	while (ok && mvbc_merge_pop(&merge, &rec, &dev, NULL))
+	{
+		int64_t us = (int64_t)rec.sTimeStamp.tv_sec * 1000000 + rec.sTimeStamp.tv_usec;
+
+		ordered = ordered && (us >= last);
+		last = us;
+		released++;
+		passed += (mvbc_dedup_check(&dedup, dev, &rec) == 1);
+	}
+	if (ok)
+	{
+		printf("merge/dedup: %d records, %d passed, %.1f us\n", released, passed, (double)(now_ns() - t) / 1000);
+	}
+
+	mvbc_emu_set_external_bus(EMU_DEV_A, 0);
+	mvbc_emu_set_external_bus(EMU_DEV_B, 0);
+	check("merge/dedup", ok && ordered && (released == 2 * TEST_FRAMES) && (passed == TEST_FRAMES));
+}
+
+/**
+ * mvbc_wait_port() while the reader thread runs.
+ */
+static void test_wait_port(void)
+{
+	uint32_t seq = 0;
+	uint32_t first;
+	int updates = 0;
+	uint64_t t;
+	int ok;
+
+	ok = (mvbc_port_seq(EMU_DEV_A, TEST_PORT_BASE, &seq) == 0);
+	first = seq;
+	t = now_ns();
+	while (ok && (now_ns() - t < 500000000ull))
+	{
+		int rc = mvbc_wait_port(EMU_DEV_A, TEST_PORT_BASE, seq, 100, &seq);
+
+		ok = (rc >= 0);
+		updates += (rc == 1);
+	}
+	printf("mvbc_wait_port: %d wake-ups for %u updates in 500 ms (poll %d ms)\n", updates, seq - first, TEST_POLL_MS);
+	check("wait port", ok && (updates > 0));
+}
+
+/**
+ * The bus of EMU_DEV_A falls silent, the watchdog restarts the device
+ * while EMU_DEV_B keeps running.
+ */
+static void test_watchdog(void)
+{
+	const struct sMvbcWatchdogCfg cfg = { 10, 0, 0 };
+	struct sMvbcHealthStats health;
+	struct sMvbcHealthStats other;
+	int ok;
+
+	ok = (mvbc_watchdog_start(&cfg) == 0);
+	usleep(100000);
+	ok = ok && (mvbc_emu_set_external_bus(EMU_DEV_A, 1) == 0);
+	usleep(300000);
+	mvbc_emu_set_external_bus(EMU_DEV_A, 0);
+	usleep(100000);
+	mvbc_watchdog_stop();
+
+	ok = ok && (mvbc_get_health(EMU_DEV_A, &health) == 0) && (mvbc_get_health(EMU_DEV_B, &other) == 0);
+	if (ok)
+	{
+		printf("watchdog: %u recoveries, reason %d, last %.2f ms, other device %u\n", health.uiRecoveries, health.iLastReason,
+			(double)health.uiLastRecoveryUS / 1000, other.uiRecoveries);
+	}
+	check("watchdog", ok && (health.uiRecoveries > 0) && (health.iLastReason == eWatchdogStale) && (other.uiRecoveries == 0));
+}
+
+/**
+ * A table that configures one port address twice is rejected by init and
+ * the device keeps running with the configuration before.
+ */
+static void test_duplicate_port(void)
+{
+	static const struct sMvbcStaticPort ports[] = {
+		{ NULL, TEST_PORT_BASE, eLA, eSink, 3, 0, 0, TEST_POLL_MS, 0 },
+		{ NULL, TEST_PORT_BASE, eLA, eSink, 3, 0, 0, TEST_POLL_MS, 0 }
+	};
+	static const struct sMvbcStaticDevice good[] = {
+		{ "C", EMU_DEV_C, 1, eStatic, 0, eLineAB, 3, eLA, TEST_POLL_MS, 0, 0, 1, ports, NULL }
+	};
+	static const struct sMvbcStaticDevice twice[] = {
+		{ "C", EMU_DEV_C, 1, eStatic, 0, eLineAB, 3, eLA, TEST_POLL_MS, 0, 0, 2, ports, NULL }
+	};
+	static const struct sMvbcStaticProject first = { "emu test duplicate", "1", 1, good };
+	static const struct sMvbcStaticProject second = { "emu test duplicate", "2", 1, twice };
+	struct sMvbcEmuStats stats;
+	struct sPortData recs[64];
+	mvbc_ctx *ctx = mvbc_ctx_create();
+	int records = 0;
+	int rejected;
+	uint64_t t;
+	int ok;
+
+	alarm(5);
+	ok = (ctx != NULL) && (mvbc_ctx_init_static(ctx, &first) >= 0);
+	rejected = ok && (mvbc_ctx_init_static(ctx, &second) == ERROR_PARSE_CONFIGURATION);
+	t = now_ns();
+	while (ok && (now_ns() - t < 200000000ull))
+	{
+		int n = mvbc_ctx_read(ctx, EMU_DEV_C, recs, 64);
+
+		records += (n > 0) ? n : 0;
+		usleep(1000);
+	}
+	ok = ok && rejected && (mvbc_emu_get_stats(EMU_DEV_C, &stats) == 0) && (stats.uiPorts == 1) && (records > 0);
+	alarm(0);
+
+	printf("duplicate port: init %s, %d records in 200 ms\n", rejected ? "rejected" : "accepted", records);
+	mvbc_ctx_destroy(ctx);
+	check("duplicate", ok);
+}
+
+/**
+ * Main entry for test application
+ *
+ * @param argc
+ * @param argv
+ *
+ * @return 0 if all steps passed
+ */
+int main(int argc, char* argv[])
+{
+	const char *file = (argc > 1) ? argv[1] : DEFAULT_UIO_FILE;
+	struct sMvbcUio uio;
+	pthread_t thread;
+	uint64_t t;
+	int rc;
+
+	printf("MVBC Lib Emulator Test\n");
+
+	for (int i = 0; i < TEST_PORTS; i++)
+	{
+		gPorts[i] = (struct sMvbcStaticPort){ NULL, TEST_PORT_BASE + i, eLA, eSink, 3, 0, 0, TEST_POLL_MS, 0 };
+	}
+	gDevices[0] = (struct sMvbcStaticDevice){ "A", EMU_DEV_A, 1, eStatic, 0, eLineAB, 1, eLA, TEST_POLL_MS, 0, 0, TEST_PORTS, gPorts, file };
+	gDevices[1] = (struct sMvbcStaticDevice){ "B", EMU_DEV_B, 1, eStatic, 0, eLineAB, 2, eLA, TEST_POLL_MS, 0, 0, TEST_PORTS, gPorts, NULL };
+
+	if (uio_file_setup(file, &uio) != 0)
+	{
+		fprintf(stderr, "unable to set up %s\n", file);
+		return 1;
+	}
+
+	t = now_ns();
+	rc = mvbc_init_static(&gProject);
+	printf("init: %.2f ms RC[%d]\n", (double)(now_ns() - t) / 1000000, rc);
+	check("init", rc >= 0);
+
+	if (rc >= 0)
+	{
+		test_port_read(&uio);
+		test_read();
+		test_merge();
+
+		pthread_create(&thread, NULL, reader, NULL);
+		test_wait_port();
+		test_watchdog();
+		__atomic_store_n(&gStop, 1, __ATOMIC_RELAXED);
+		pthread_join(thread, NULL);
+
+		test_duplicate_port();
+	}
+
+	mvbc_shutdown(EMU_DEV_A);
+	mvbc_shutdown(EMU_DEV_B);
+	mvbc_uio_unmap(&uio);
+	unlink(file);
+
+	printf("%s\n", gFailed ? "FAILED" : "passed");
+	return gFailed ? 1 : 0;
+}
@@ -0,0 +1,238 @@
+/**
+ * @file
+ *
+ * Gateway test on an emulated device (see mvbc_emu.h) with multicast over the
+ * loopback interface, no board and no network needed.
+ *
+ * Frames are delivered through the external bus of the emulator, the gateway
+ * publishes the changed ports and a receiver on the same host checks the
+ * datagrams: every port once, nothing for unchanged payloads, one entry for
+ * one changed port, no lost datagrams.
+ *
+ * 	mvbc_gw_test [multicast group]
+ *
+ * @return 0 if all steps passed, 1 otherwise
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <mvbc_lib.h>
+#include <mvbc_static.h>
+#include <mvbc_emu.h>
+#include <mvbc_gw.h>
+
+#define DEFAULT_GROUP "239.192.0.77"
+#define TEST_UDP_PORT 45977
+
+#define EMU_DEV MVBC_EMU_PREFIX "gw0"
+
+#define TEST_PORTS 16
+#define TEST_PORT_BASE 0x200
+
+/** F-Code 2: 4 words, 16 ports at 16 ms are far below the bus load limit */
+#define TEST_FCODE 2
+#define TEST_WORDS 4
+#define TEST_POLL_MS 16
+
+static struct sMvbcStaticPort gPorts[TEST_PORTS];
+static struct sMvbcStaticDevice gDevices[1];
+static const struct sMvbcStaticProject gProject = { "gw test", "1", 1, gDevices };
+
+static struct sMvbcGwRx gRx;
+static int gValue[TEST_PORTS];
+static int gSeen[TEST_PORTS];
+static int gFailed;
+
+/**
+ * Print the result of a step.
+ *
+ * @param step
+ * @param ok
+ */
+static void check(const char *step, int ok)
+{
+	if (!ok)
+	{
+		gFailed++;
+	}
+	printf("%-12s %s\n", step, ok ? "ok" : "FAILED");
+}
+
+/**
+ * Receiver callback: count the entries per port and compare the payload.
+ *
+ * @param arg unused
+ * @param dev
+ * @param rec
+ */
+static void on_record(void *arg, int dev, const struct sPortData *rec)
+{
+	int i = rec->wPortAddr - TEST_PORT_BASE;
+
+	(void)arg;
+	if ((dev != 0) || (i < 0) || (i >= TEST_PORTS) || (rec->wNumOfWords != TEST_WORDS) || (rec->wPortData[TEST_WORDS - 1] != gValue[i]))
+	{
+		gFailed++;
+		return;
+	}
+	gSeen[i]++;
+}
+
+/**
+ * Deliver one frame per port with the payload of gValue[].
+ *
+ * @return 0 in case of success, -1 for error
+ */
+static int bus_frames(void)
+{
+	struct sPortData frames[TEST_PORTS];
+	struct timeval ts;
+
+	gettimeofday(&ts, NULL);
+	for (int i = 0; i < TEST_PORTS; i++)
+	{
+		memset(&frames[i], 0, sizeof(frames[i]));
+		frames[i].wPortAddr = TEST_PORT_BASE + i;
+		frames[i].wNumOfWords = TEST_WORDS;
+		frames[i].sTimeStamp = ts;
+		for (int w = 0; w < TEST_WORDS; w++)
+		{
+			frames[i].wPortData[w] = gValue[i];
+		}
+	}
+	return (mvbc_emu_bus_frames(EMU_DEV, frames, TEST_PORTS) == TEST_PORTS) ? 0 : -1;
+}
+
+/**
+ * Pump the gateway until all records are read, then receive its datagrams.
+ *
+ * @param gw
+ * @param fd receiving socket
+ * @return number of entries received
+ */
+static int exchange(struct sMvbcGw *gw, int fd)
+{
+	uint8_t buf[MVBC_GW_MAX_DATAGRAM];
+	struct pollfd pollDesc = { fd, POLLIN, 0 };
+	uint64_t entries = gRx.ullEntries;
+
+	memset(gSeen, 0, sizeof(gSeen));
+
+	for (int i = 0; i < 5; i++)
+	{
+		mvbc_gw_pump(gw, 20);
+	}
+
+	while (poll(&pollDesc, 1, 100) > 0)
+	{
+		ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+
+		if (n > 0)
+		{
+			mvbc_gw_rx_parse(&gRx, buf, n, on_record, NULL);
+		}
+	}
+
+	return (int)(gRx.ullEntries - entries);
+}
+
+/**
+ * @param count
+ * @return 1 if every port was received count times
+ */
+static int all_seen(int count)
+{
+	for (int i = 0; i < TEST_PORTS; i++)
+	{
+		if (gSeen[i] != count)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Main entry for test application
+ *
+ * @param argc
+ * @param argv
+ *
+ * @return 0 if all steps passed
+ */
+int main(int argc, char* argv[])
+{
+	struct sMvbcGwCfg cfg = { (argc > 1) ? argv[1] : DEFAULT_GROUP, TEST_UDP_PORT, "127.0.0.1", 1, 1, 0, 0 };
+	struct sMvbcGwStats stats;
+	struct sMvbcGw *gw;
+	int fd;
+	int n;
+	int ok;
+
+	printf("MVBC Lib Gateway Test\n");
+
+	for (int i = 0; i < TEST_PORTS; i++)
+	{
+		gPorts[i] = (struct sMvbcStaticPort){ NULL, TEST_PORT_BASE + i, eLA, eSink, TEST_FCODE, 0, 0, TEST_POLL_MS, 0 };
+	}
+	gDevices[0] = (struct sMvbcStaticDevice){ "GW", EMU_DEV, 1, eStatic, 0, eLineAB, 1, eLA, TEST_POLL_MS, 0, 0, TEST_PORTS, gPorts, NULL };
+
+	ok = (mvbc_init_static(&gProject) >= 0) && (mvbc_emu_set_external_bus(EMU_DEV, 1) == 0);
+	check("init", ok);
+	if (!ok)
+	{
+		return 1;
+	}
+
+	/* records of the emulated time before the external bus took over go out before the receiver joins */
+	gw = mvbc_gw_create(mvbc_default_ctx(), &cfg);
+	for (int i = 0; (gw != NULL) && (i < 5); i++)
+	{
+		mvbc_gw_pump(gw, 20);
+	}
+	fd = mvbc_gw_rx_open(&cfg);
+	check("open", (fd >= 0) && (gw != NULL));
+
+	if ((fd >= 0) && (gw != NULL))
+	{
+		check("second gw", mvbc_gw_create(mvbc_default_ctx(), &cfg) == NULL);
+
+		for (int i = 0; i < TEST_PORTS; i++)
+		{
+			gValue[i] = 0x100 + i;
+		}
+		n = (bus_frames() == 0) ? exchange(gw, fd) : -1;
+		printf("first frames: %d entries\n", n);
+		check("changes", (n == TEST_PORTS) && all_seen(1));
+
+		n = (bus_frames() == 0) ? exchange(gw, fd) : -1;
+		printf("same frames: %d entries\n", n);
+		check("unchanged", n == 0);
+
+		gValue[3]++;
+		n = (bus_frames() == 0) ? exchange(gw, fd) : -1;
+		printf("one port changed: %d entries\n", n);
+		check("one change", (n == 1) && (gSeen[3] == 1));
+
+		mvbc_gw_get_stats(gw, &stats);
+		printf("gateway: %llu records, %llu changed, %llu datagrams, %u send errors, rx lost %llu invalid %llu\n",
+			(unsigned long long)stats.ullRecords, (unsigned long long)stats.ullChanged, (unsigned long long)stats.ullDatagrams,
+			stats.uiSendErrors, (unsigned long long)gRx.ullLost, (unsigned long long)gRx.ullInvalid);
+		check("sequence", (stats.uiSendErrors == 0) && (gRx.ullLost == 0) && (gRx.ullInvalid == 0) && (gRx.ullLate == 0));
+	}
+
+	mvbc_gw_destroy(gw);
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+	mvbc_shutdown(EMU_DEV);
+
+	printf("%s\n", gFailed ? "FAILED" : "passed");
+	return gFailed ? 1 : 0;
+}
@@ -0,0 +1,476 @@
+/**
+ * @file
+ *
+ * Metrics text test on an emulated device (see mvbc_metrics.h), no board
+ * needed.
+ *
+ * Checks the text against the Prometheus exposition format: HELP and TYPE
+ * once per family before its samples, label values escaped, numeric values,
+ * cumulative histogram buckets with +Inf equal to _count. Checks the port
+ * counters of frames read after the start, the stale ports, the snprintf()
+ * semantics of mvbc_metrics_format() and the text of the file and the socket.
+ *
+ * 	mvbc_metrics_test [directory for the file and the socket]
+ *
+ * @return 0 if all steps passed, 1 otherwise
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <mvbc_lib.h>
+#include <mvbc_static.h>
+#include <mvbc_emu.h>
+#include <mvbc_metrics.h>
+
+#define DEFAULT_DIR "/tmp"
+
+#define EMU_DEV MVBC_EMU_PREFIX "metrics0"
+
+/** read and counted after the start */
+#define TEST_PORT_READ 0x120
+
+/** configured, polled every 16 ms, never read after the start */
+#define TEST_PORT_SILENT 0x121
+
+/** records of TEST_PORT_READ */
+#define TEST_FRAMES 5
+
+/** the name needs escaping in a label */
+#define TEST_NAME "A\"B\\C"
+#define TEST_NAME_LABEL "A\\\"B\\\\C"
+
+#define TEST_PERIOD_MS 50
+
+/** largest text expected */
+#define TEST_TEXT_SIZE (256 * 1024)
+
+static const struct sMvbcStaticPort gPorts[] = {
+	{ TEST_NAME, TEST_PORT_READ, eLA, eSink, 1, 0, 0, 1024, 0 },
+	{ "SILENT", TEST_PORT_SILENT, eLA, eSink, 1, 0, 0, 16, 0 }
+};
+static const struct sMvbcStaticDevice gDevices[] = {
+	{ "MET", EMU_DEV, eEMD, eStatic, 0, eLineAB, 1, eLA, 16, 0, 0, 2, gPorts, NULL }
+};
+static const struct sMvbcStaticProject gProject = { "metrics test", "1", 1, gDevices };
+
+static char gText[TEST_TEXT_SIZE];
+static int gFailed;
+
+/**
+ * Print the result of a step.
+ *
+ * @param step
+ * @param ok
+ */
+static void check(const char *step, int ok)
+{
+	if (!ok)
+	{
+		gFailed++;
+	}
+	printf("%-12s %s\n", step, ok ? "ok" : "FAILED");
+}
+
+/**
+ * Read all records waiting in the FIFO.
+ *
+ * @return number of records read
+ */
+static int drain(void)
+{
+	struct sPortData recs[64];
+	int total = 0;
+	int n;
+
+	while ((n = mvbc_read(EMU_DEV, recs, 64)) > 0)
+	{
+		total += n;
+	}
+	return total;
+}
+
+/**
+ * Deliver TEST_FRAMES frames of TEST_PORT_READ and read them.
+ *
+ * @return number of records read, -1 for error
+ */
+static int read_frames(void)
+{
+	struct sPortData frames[TEST_FRAMES];
+	struct timeval ts;
+
+	gettimeofday(&ts, NULL);
+	for (int i = 0; i < TEST_FRAMES; i++)
+	{
+		memset(&frames[i], 0, sizeof(frames[i]));
+		frames[i].wPortAddr = TEST_PORT_READ;
+		frames[i].wNumOfWords = 2;
+		frames[i].sTimeStamp = ts;
+		frames[i].wPortData[0] = i;
+	}
+	return (mvbc_emu_bus_frames(EMU_DEV, frames, TEST_FRAMES) == TEST_FRAMES) ? drain() : -1;
+}
+
+/**
+ * Skip a label set {name="value",...}, value escapes are \\, \" and \n.
+ *
+ * @param p at '{'
+ * @return behind '}', NULL if malformed
+ */
+static const char *skip_labels(const char *p)
+{
+	p++;
+	while (*p != '}')
+	{
+		if ((*p < 'a') || (*p > 'z'))
+		{
+			return NULL;
+		}
+		while (((*p >= 'a') && (*p <= 'z')) || (*p == '_'))
+		{
+			p++;
+		}
+		if ((p[0] != '=') || (p[1] != '"'))
+		{
+			return NULL;
+		}
+		for (p += 2; *p != '"'; p++)
+		{
+			if ((*p == '\n') || (*p == '\0'))
+			{
+				return NULL;
+			}
+			if ((*p == '\\') && (p[1] != '\\') && (p[1] != '"') && (p[1] != 'n'))
+			{
+				return NULL;
+			}
+			p += (*p == '\\');
+		}
+		p++;
+		if (*p == ',')
+		{
+			p++;
+		}
+		else if (*p != '}')
+		{
+			return NULL;
+		}
+	}
+	return p + 1;
+}
+
+/**
+ * Check the exposition format line by line.
+ *
+ * @param text
+ * @return number of samples, -1 for a format error
+ */
+static int check_format(const char *text)
+{
+	static char families[256][64];
+	char family[64] = "";
+	char type[16] = "";
+	int count = 0;
+	int samples = 0;
+
+	if ((*text == '\0') || (text[strlen(text) - 1] != '\n'))
+	{
+		return -1;
+	}
+
+	for (const char *line = text; *line != '\0'; line = strchr(line, '\n') + 1)
+	{
+		char name[64];
+		char help[64];
+		const char *p;
+		char *end;
+		size_t len;
+
+		if (sscanf(line, "# HELP %63s", help) == 1)
+		{
+			/* TYPE follows, each family once */
+			if ((sscanf(strchr(line, '\n') + 1, "# TYPE %63s %15s", family, type) != 2) || (strcmp(help, family) != 0))
+			{
+				return -1;
+			}
+			for (int i = 0; i < count; i++)
+			{
+				if (strcmp(families[i], family) == 0)
+				{
+					return -1;
+				}
+			}
+			if (count < 256)
+			{
+				strcpy(families[count++], family);
+			}
+			line = strchr(line, '\n') + 1;
+			continue;
+		}
+
+		len = strspn(line, "abcdefghijklmnopqrstuvwxyz_");
+		if ((len == 0) || (len >= sizeof(name)) || (family[0] == '\0'))
+		{
+			return -1;
+		}
+		memcpy(name, line, len);
+		name[len] = '\0';
+
+		/* a sample of the family declared last, histograms add _bucket, _sum and _count */
+		if ((strncmp(name, family, strlen(family)) != 0) ||
+			((strcmp(type, "histogram") == 0) ? ((strcmp(name + strlen(family), "_bucket") != 0) &&
+				(strcmp(name + strlen(family), "_sum") != 0) && (strcmp(name + strlen(family), "_count") != 0)) :
+				(strcmp(name, family) != 0)))
+		{
+			return -1;
+		}
+
+		p = line + len;
+		if (*p == '{')
+		{
+			p = skip_labels(p);
+		}
+		if ((p == NULL) || (*p != ' '))
+		{
+			return -1;
+		}
+		strtod(p + 1, &end);
+		if ((end == p + 1) || (*end != '\n'))
+		{
+			return -1;
+		}
+		samples++;
+	}
+	return samples;
+}
+
+/**
+ * Histogram buckets of every command count up to +Inf, which equals _count.
+ *
+ * @param text
+ * @return 1 if all histograms are consistent
+ */
+static int check_histograms(const char *text)
+{
+	const char *p = text;
+	unsigned long long last = 0;
+	int histograms = 0;
+
+	while ((p = strstr(p, "mvbc_ioctl_duration_seconds_")) != NULL)
+	{
+		unsigned long long value;
+		const char *v = strchr(p, ' ');
+
+		if ((v == NULL) || (sscanf(v, " %llu", &value) != 1))
+		{
+			return 0;
+		}
+		if (strncmp(p, "mvbc_ioctl_duration_seconds_bucket", 34) == 0)
+		{
+			if (value < last)
+			{
+				return 0;
+			}
+			last = value;
+		}
+		else if (strncmp(p, "mvbc_ioctl_duration_seconds_count", 33) == 0)
+		{
+			if (value != last)
+			{
+				return 0;
+			}
+			/* the buckets of the next command start over */
+			last = 0;
+			histograms++;
+		}
+		p = v;
+	}
+	return histograms > 0;
+}
+
+/**
+ * @param text
+ * @param sample name with labels
+ * @param value gets the value
+ * @return 1 if the sample is in the text
+ */
+static int sample(const char *text, const char *sample, double *value)
+{
+	size_t len = strlen(sample);
+
+	for (const char *p = strstr(text, sample); p != NULL; p = strstr(p + 1, sample))
+	{
+		if (((p == text) || (p[-1] == '\n')) && (p[len] == ' '))
+		{
+			*value = strtod(p + len + 1, NULL);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Read the text of the exporter socket.
+ *
+ * @param path
+ * @param buf
+ * @param size
+ * @return length, -1 for error
+ */
+static int read_socket(const char *path, char *buf, int size)
+{
+	struct sockaddr_un addr;
+	struct pollfd pollDesc;
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	int len = 0;
+	ssize_t n = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	if ((fd < 0) || (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0))
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return -1;
+	}
+
+	pollDesc.fd = fd;
+	pollDesc.events = POLLIN;
+	while ((n > 0) && (len < size - 1) && (poll(&pollDesc, 1, 1000) > 0))
+	{
+		n = recv(fd, buf + len, size - 1 - len, 0);
+		len += (n > 0) ? n : 0;
+	}
+	buf[len] = '\0';
+	close(fd);
+
+	return (n == 0) ? len : -1;
+}
+
+/**
+ * Read a file.
+ *
+ * @param path
+ * @param buf
+ * @param size
+ * @return length, -1 for error
+ */
+static int read_file(const char *path, char *buf, int size)
+{
+	FILE *f = fopen(path, "r");
+	size_t len;
+
+	if (f == NULL)
+	{
+		return -1;
+	}
+	len = fread(buf, 1, size - 1, f);
+	buf[len] = '\0';
+	fclose(f);
+
+	return (int)len;
+}
+
+/**
+ * The text of mvbc_metrics_format().
+ */
+static void test_format(void)
+{
+	char small[10];
+	double value = 0;
+	int len;
+	int ok;
+
+	len = mvbc_metrics_format(NULL, 0);
+	ok = (len > 0) && (len < TEST_TEXT_SIZE) && (mvbc_metrics_format(gText, sizeof(gText)) == len) && ((int)strlen(gText) == len);
+	ok = ok && (mvbc_metrics_format(small, sizeof(small)) == len) && (strlen(small) == sizeof(small) - 1)
+		&& (strncmp(small, gText, sizeof(small) - 1) == 0);
+	check("length", ok);
+
+	len = ok ? check_format(gText) : -1;
+	printf("%d samples, %d bytes\n", len, (int)strlen(gText));
+	check("format", len > 0);
+	check("histogram", check_histograms(gText));
+
+	ok = sample(gText, "mvbc_port_records_total{dev=\"" EMU_DEV "\",port=\"0x120\",name=\"" TEST_NAME_LABEL "\"}", &value)
+		&& (value == TEST_FRAMES) && !sample(gText, "mvbc_port_records_total{dev=\"" EMU_DEV "\",port=\"0x121\",name=\"SILENT\"}", &value);
+	check("ports", ok);
+
+	ok = sample(gText, "mvbc_device_stale_ports{dev=\"" EMU_DEV "\"}", &value) && (value == 1);
+	check("stale", ok);
+}
+
+/**
+ * The exporter file and socket hold the same kind of text.
+ *
+ * @param file
+ * @param socket
+ */
+static void test_export(const char *file, const char *socket)
+{
+	static char text[TEST_TEXT_SIZE];
+	double value = 0;
+	int ok;
+
+	usleep(3 * TEST_PERIOD_MS * 1000);
+	ok = (read_file(file, text, sizeof(text)) > 0) && (check_format(text) > 0)
+		&& sample(text, "mvbc_device_records_total{dev=\"" EMU_DEV "\"}", &value);
+	check("file", ok);
+
+	ok = (read_socket(socket, text, sizeof(text)) > 0) && (check_format(text) > 0)
+		&& sample(text, "mvbc_device_records_total{dev=\"" EMU_DEV "\"}", &value);
+	check("socket", ok);
+}
+
+/**
+ * Main entry for test application
+ *
+ * @param argc
+ * @param argv
+ *
+ * @return 0 if all steps passed
+ */
+int main(int argc, char* argv[])
+{
+	const char *dir = (argc > 1) ? argv[1] : DEFAULT_DIR;
+	char file[256];
+	char socket[108];
+	struct sMvbcMetricsCfg cfg = { file, TEST_PERIOD_MS, socket, NULL };
+	int ok;
+
+	printf("MVBC Lib Metrics Test\n");
+
+	snprintf(file, sizeof(file), "%s/mvbc_metrics_test.prom", dir);
+	snprintf(socket, sizeof(socket), "%s/mvbc_metrics_test.sock", dir);
+
+	/* counting per port starts with the exporter, after the records of the emulated time */
+	ok = (mvbc_init_static(&gProject) >= 0) && (mvbc_emu_set_external_bus(EMU_DEV, 1) == 0);
+	drain();
+	ok = ok && (mvbc_metrics_start(&cfg) == 0) && (read_frames() == TEST_FRAMES);
+	check("init", ok);
+
+	if (ok)
+	{
+		/* the silent port gets stale after 3 * 16 ms, the other one not before 3 s */
+		usleep(100000);
+		test_format();
+		test_export(file, socket);
+	}
+
+	mvbc_metrics_stop();
+	mvbc_shutdown(EMU_DEV);
+	unlink(file);
+
+	printf("%s\n", gFailed ? "FAILED" : "passed");
+	return gFailed ? 1 : 0;
+}
@@ -0,0 +1,260 @@
+/**
+ * @file
+ *
+ * Message data reassembly test (see mvbc_msg.h), no board needed.
+ *
+ * Feeds hand made PP frames to a reassembler: single and multi frame
+ * messages, interleaved device pairs, a missing frame, an inter-frame
+ * timeout, an oversized message and records of other port types.
+ *
+ * 	mvbc_msg_test
+ *
+ * @return 0 if all steps passed, 1 otherwise
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <mvbc_lib.h>
+#include <mvbc_msg.h>
+
+#define TEST_PORT 0x300
+
+static struct sMvbcMsgReassembler gMsg;
+
+/** copy of the last delivered message */
+static struct sMvbcMessage gLast;
+static uint8_t gLastData[MVBC_MSG_MAX_LENGTH];
+static int gDelivered;
+static int gFailed;
+
+/**
+ * Print the result of a step.
+ *
+ * @param step
+ * @param ok
+ */
+static void check(const char *step, int ok)
+{
+	if (!ok)
+	{
+		gFailed++;
+	}
+	printf("%-12s %s\n", step, ok ? "ok" : "FAILED");
+}
+
+/**
+ * Reassembler callback: keep a copy of the message.
+ *
+ * @param msg
+ * @param arg unused
+ */
+static void on_message(const struct sMvbcMessage *msg, void *arg)
+{
+	(void)arg;
+	gLast = *msg;
+	memcpy(gLastData, msg->pData, msg->uiLength);
+	gLast.pData = gLastData;
+	gDelivered++;
+}
+
+/**
+ * Feed one frame.
+ *
+ * @param src source device
+ * @param dst destination device
+ * @param mtc transport control without the sequence number
+ * @param seq sequence number
+ * @param data payload
+ * @param len payload bytes, at most MVBC_MSG_FRAME_PAYLOAD
+ * @param ms time stamp in milliseconds
+ * @return result of mvbc_msg_feed()
+ */
+static int frame(int src, int dst, int mtc, int seq, const uint8_t *data, int len, long ms)
+{
+	struct sPortData rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.wPortAddr = TEST_PORT;
+	rec.wPortType = ePP;
+	rec.wNumOfWords = MAX_PORT_DATA_LENGTH;
+	rec.sTimeStamp.tv_sec = ms / 1000;
+	rec.sTimeStamp.tv_usec = (ms % 1000) * 1000;
+	rec.wPortData[0] = dst;
+	rec.wPortData[1] = src;
+	rec.wPortData[2] = ((mtc | (seq & MVBC_MSG_MTC_SEQ_MASK)) << 8) | len;
+	for (int i = 0; i < len; i++)
+	{
+		rec.wPortData[3 + i / 2] |= (i & 1) ? data[i] : (data[i] << 8);
+	}
+	return mvbc_msg_feed(&gMsg, &rec);
+}
+
+/**
+ * Feed a message as frames of MVBC_MSG_FRAME_PAYLOAD bytes, 1 ms apart.
+ *
+ * @param src
+ * @param dst
+ * @param data
+ * @param len
+ * @param ms time stamp of the first frame
+ * @return number of frames that delivered a message
+ */
+static int message(int src, int dst, const uint8_t *data, int len, long ms)
+{
+	int delivered = 0;
+	int seq = 0;
+
+	for (int pos = 0; pos < len; pos += MVBC_MSG_FRAME_PAYLOAD, seq++)
+	{
+		int part = (len - pos < MVBC_MSG_FRAME_PAYLOAD) ? len - pos : MVBC_MSG_FRAME_PAYLOAD;
+		int mtc = ((pos == 0) ? MVBC_MSG_MTC_FIRST : 0) | ((pos + part >= len) ? MVBC_MSG_MTC_LAST : 0);
+
+		delivered += (frame(src, dst, mtc, seq, data + pos, part, ms + seq) == 1);
+	}
+	return delivered;
+}
+
+/**
+ * One frame and several frames make one message each, with the payload in order.
+ *
+ * @param data test pattern
+ */
+static void test_single_multi(const uint8_t *data)
+{
+	int ok;
+
+	ok = (message(1, 2, data, 10, 1000) == 1) && (gLast.uiLength == 10) && (gLast.wFrameCount == 1)
+		&& (gLast.wSrcDevice == 1) && (gLast.wDstDevice == 2) && (gLast.wPortAddr == TEST_PORT)
+		&& (memcmp(gLastData, data, 10) == 0);
+	check("single", ok);
+
+	ok = (message(1, 2, data, 1000, 2000) == 1) && (gLast.uiLength == 1000)
+		&& (gLast.wFrameCount == (1000 + MVBC_MSG_FRAME_PAYLOAD - 1) / MVBC_MSG_FRAME_PAYLOAD)
+		&& (gLast.sFirstFrame.tv_sec == 2) && (gLast.sLastFrame.tv_usec > gLast.sFirstFrame.tv_usec)
+		&& (memcmp(gLastData, data, 1000) == 0);
+	check("multi", ok);
+}
+
+/**
+ * Frames of two device pairs interleaved give two messages.
+ *
+ * @param data test pattern
+ */
+static void test_interleaved(const uint8_t *data)
+{
+	int delivered = gDelivered;
+	int ok;
+
+	ok = (frame(3, 4, MVBC_MSG_MTC_FIRST, 0, data, MVBC_MSG_FRAME_PAYLOAD, 3000) == 0)
+		&& (frame(5, 4, MVBC_MSG_MTC_FIRST, 0, data + 100, MVBC_MSG_FRAME_PAYLOAD, 3001) == 0)
+		&& (frame(3, 4, MVBC_MSG_MTC_LAST, 1, data + MVBC_MSG_FRAME_PAYLOAD, 4, 3002) == 1)
+		&& (gLast.wSrcDevice == 3) && (gLast.uiLength == MVBC_MSG_FRAME_PAYLOAD + 4)
+		&& (memcmp(gLastData, data, MVBC_MSG_FRAME_PAYLOAD + 4) == 0)
+		&& (frame(5, 4, MVBC_MSG_MTC_LAST, 1, data + 100 + MVBC_MSG_FRAME_PAYLOAD, 2, 3003) == 1)
+		&& (gLast.wSrcDevice == 5) && (memcmp(gLastData, data + 100, MVBC_MSG_FRAME_PAYLOAD + 2) == 0);
+	check("interleaved", ok && (gDelivered == delivered + 2));
+}
+
+/**
+ * A missing frame, a frame after the timeout and expire() drop the message.
+ *
+ * @param data test pattern
+ */
+static void test_errors(const uint8_t *data)
+{
+	struct sMvbcMsgStats before = gMsg.stats;
+	struct timeval now = { 10, 0 };
+	int delivered = gDelivered;
+	int ok;
+
+	/* sequence number 2 instead of 1 */
+	ok = (frame(6, 7, MVBC_MSG_MTC_FIRST, 0, data, MVBC_MSG_FRAME_PAYLOAD, 4000) == 0)
+		&& (frame(6, 7, MVBC_MSG_MTC_LAST, 2, data, 4, 4001) == 0)
+		&& (gMsg.stats.uiSequenceErrors == before.uiSequenceErrors + 1);
+
+	/* last frame without a first one */
+	ok = ok && (frame(6, 7, MVBC_MSG_MTC_LAST, 1, data, 4, 4002) == 0)
+		&& (gMsg.stats.uiSequenceErrors == before.uiSequenceErrors + 2);
+	check("sequence", ok);
+
+	/* next frame later than the timeout */
+	ok = (frame(6, 7, MVBC_MSG_MTC_FIRST, 0, data, MVBC_MSG_FRAME_PAYLOAD, 5000) == 0)
+		&& (frame(6, 7, MVBC_MSG_MTC_LAST, 1, data, 4, 5000 + MVBC_MSG_DEFAULT_TIMEOUT_MS + 10) == 0)
+		&& (gMsg.stats.uiTimeouts == before.uiTimeouts + 1);
+
+	/* no next frame at all */
+	ok = ok && (frame(6, 7, MVBC_MSG_MTC_FIRST, 0, data, MVBC_MSG_FRAME_PAYLOAD, 9000) == 0)
+		&& (mvbc_msg_expire(&gMsg, &now) == 1) && (gMsg.stats.uiTimeouts == before.uiTimeouts + 2);
+	check("timeout", ok && (gDelivered == delivered));
+}
+
+/**
+ * A message longer than MVBC_MSG_MAX_LENGTH is dropped, the next one passes.
+ *
+ * @param data test pattern
+ */
+static void test_overflow(const uint8_t *data)
+{
+	uint32_t overflows = gMsg.stats.uiOverflows;
+	int seq = 1;
+	int ok = (frame(8, 9, MVBC_MSG_MTC_FIRST, 0, data, MVBC_MSG_FRAME_PAYLOAD, 11000) == 0);
+
+	for (int len = MVBC_MSG_FRAME_PAYLOAD; ok && (len <= MVBC_MSG_MAX_LENGTH); len += MVBC_MSG_FRAME_PAYLOAD, seq++)
+	{
+		ok = (frame(8, 9, 0, seq, data, MVBC_MSG_FRAME_PAYLOAD, 11000 + seq) == 0);
+	}
+	ok = ok && (gMsg.stats.uiOverflows == overflows + 1) && (message(8, 9, data, 20, 12000) == 1);
+	check("overflow", ok);
+}
+
+/**
+ * Records of other port types are not looked at.
+ */
+static void test_other_types(void)
+{
+	uint32_t frames = gMsg.stats.uiFrames;
+	struct sPortData rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.wPortType = eLA;
+	rec.wNumOfWords = MAX_PORT_DATA_LENGTH;
+	rec.wPortData[2] = (MVBC_MSG_MTC_FIRST | MVBC_MSG_MTC_LAST) << 8;
+	check("other types", (mvbc_msg_feed(&gMsg, &rec) == 0) && (gMsg.stats.uiFrames == frames));
+}
+
+/**
+ * Main entry for test application
+ *
+ * @param argc
+ * @param argv
+ *
+ * @return 0 if all steps passed
+ */
+int main(int argc, char* argv[])
+{
+	static uint8_t data[MVBC_MSG_MAX_LENGTH];
+
+	(void)argc;
+	(void)argv;
+
+	printf("MVBC Lib Message Reassembly Test\n");
+
+	for (int i = 0; i < MVBC_MSG_MAX_LENGTH; i++)
+	{
+		data[i] = (uint8_t)(i * 7 + 1);
+	}
+
+	check("init", mvbc_msg_init(&gMsg, 0, on_message, NULL) == 0);
+
+	test_single_multi(data);
+	test_interleaved(data);
+	test_errors(data);
+	test_overflow(data);
+	test_other_types();
+
+	printf("%u frames, %u messages\n", gMsg.stats.uiFrames, gMsg.stats.uiMessages);
+	printf("%s\n", gFailed ? "FAILED" : "passed");
+	return gFailed ? 1 : 0;
+}
@@ -3,7 +3,6 @@
  */
 
 #include <time.h>
-#include <linux/types.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,25 +12,8 @@
 
 #include <mvbc_app_interface.h>
 
-typedef __u64	SC_ADDR;
-typedef __u16	SC_UINT;
-typedef __u16	SC_WORD;
-typedef __u64	SC_DWORD;
-
 #define DEFAULT_MVB_DEVICE	"/dev/mvbc0"
 
-#define MAX_PORT_DATA_LENGTH 16
-
-struct sPortData
-{
-	SC_WORD  wPortAddr;		// MVB Port Address
-	SC_WORD  wPortType;		// LA, DA, PP type
-	SC_WORD  wNumOfWords;
-	SC_WORD  wTACK;
-	struct timeval sTimeStamp;
-	SC_WORD  wPortData[MAX_PORT_DATA_LENGTH];
-}__attribute__((packed));
-
 /**
  * Main entry for test application
  *
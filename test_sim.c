@@ -0,0 +1,318 @@
+/**
+ * @file
+ *
+ * Bus master simulation test on an emulated device (see mvbc_sim.h), no
+ * board needed.
+ *
+ * Checks the schedule on the virtual clock: every port at its phase and
+ * period, in time order, across several runs; the schedule made of the
+ * sink ports of a configuration; the same drops and jitter for the same
+ * seed; and the frames lost during injected line faults.
+ *
+ * 	mvbc_sim_test
+ *
+ * @return 0 if all steps passed, 1 otherwise
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <mvbc_lib.h>
+#include <mvbc_static.h>
+#include <mvbc_emu.h>
+#include <mvbc_sim.h>
+
+#define EMU_DEV MVBC_EMU_PREFIX "sim0"
+
+#define TEST_PORT_A 0x100
+#define TEST_PORT_B 0x101
+#define TEST_PORT_SOURCE 0x102
+
+/** records kept of one run */
+#define TEST_MAX_RECORDS 1024
+
+static const struct sMvbcStaticPort gPorts[] = {
+	{ NULL, TEST_PORT_A, eLA, eSink, 2, 0, 0, 4, 0 },
+	{ NULL, TEST_PORT_B, eLA, eSink, 0, 0, 0, 8, 0 },
+	{ NULL, TEST_PORT_SOURCE, eLA, eSource, 0, 0, 0, 8, 0 }
+};
+static const struct sMvbcStaticDevice gDevices[] = {
+	{ "SIM", EMU_DEV, eEMD, eStatic, 0, eLineA, 1, eLA, 16, 0, 0, 3, gPorts, NULL }
+};
+static const struct sMvbcStaticProject gProject = { "sim test", "1", 1, gDevices };
+
+/** port A every 4 ms from 0, port B every 10 ms from 3 ms */
+static const struct sMvbcSimEntry gSchedule[] = {
+	{ TEST_PORT_A, 2, 4, 0 },
+	{ TEST_PORT_B, 0, 10, 3 }
+};
+
+static struct sMvbcSim gSim;
+static struct sPortData gRecs[TEST_MAX_RECORDS];
+static int gFailed;
+
+/**
+ * Print the result of a step.
+ *
+ * @param step
+ * @param ok
+ */
+static void check(const char *step, int ok)
+{
+	if (!ok)
+	{
+		gFailed++;
+	}
+	printf("%-12s %s\n", step, ok ? "ok" : "FAILED");
+}
+
+/**
+ * Read the records waiting in the FIFO into gRecs[].
+ *
+ * @return number of records read, records beyond TEST_MAX_RECORDS are dropped
+ */
+static int collect(void)
+{
+	struct sPortData recs[64];
+	int total = 0;
+	int n;
+
+	while ((n = mvbc_read(EMU_DEV, recs, 64)) > 0)
+	{
+		for (int i = 0; (i < n) && (total < TEST_MAX_RECORDS); i++)
+		{
+			gRecs[total++] = recs[i];
+		}
+	}
+	return total;
+}
+
+/**
+ * @param rec
+ * @return time stamp of a record on the virtual clock in microseconds
+ */
+static int64_t virtual_us(const struct sPortData *rec)
+{
+	return (int64_t)(rec->sTimeStamp.tv_sec - gSim.sStart.tv_sec) * 1000000 + (rec->sTimeStamp.tv_usec - gSim.sStart.tv_usec);
+}
+
+/**
+ * The records of a run without faults follow the schedule exactly: poll
+ * counter in word 0, port address in the others, one period apart, in time
+ * order.
+ *
+ * @param n records in gRecs[]
+ * @param entries
+ * @param count schedule entries
+ * @return 1 if all records match
+ */
+static int follows_schedule(int n, const struct sMvbcSimEntry *entries, int count)
+{
+	int64_t last = -1;
+
+	for (int i = 0; i < n; i++)
+	{
+		const struct sPortData *rec = &gRecs[i];
+		const struct sMvbcSimEntry *e = NULL;
+		int64_t due;
+
+		for (int j = 0; j < count; j++)
+		{
+			e = (entries[j].wPortAddr == rec->wPortAddr) ? &entries[j] : e;
+		}
+		if ((e == NULL) || (rec->wNumOfWords != MVBC_FCODE_WORDS(e->wFunctionCode)) || (rec->wPortData[0] == 0))
+		{
+			return 0;
+		}
+
+		due = ((int64_t)e->wPhaseMS + (int64_t)(rec->wPortData[0] - 1) * e->wPeriodMS) * 1000;
+		if ((virtual_us(rec) != due) || (virtual_us(rec) < last))
+		{
+			return 0;
+		}
+		for (int w = 1; w < rec->wNumOfWords; w++)
+		{
+			if (rec->wPortData[w] != rec->wPortAddr)
+			{
+				return 0;
+			}
+		}
+		last = virtual_us(rec);
+	}
+	return 1;
+}
+
+/**
+ * Two runs of 100 ms: 25 polls of port A and 10 of port B each, the second
+ * run continues the virtual clock and the poll counters.
+ */
+static void test_schedule(void)
+{
+	struct sMvbcSimStats *stats = &gSim.stats;
+	int64_t delivered;
+	int n;
+	int ok;
+
+	ok = (mvbc_sim_init(&gSim, EMU_DEV, gSchedule, 2, NULL) == 0);
+	collect();
+
+	delivered = ok ? mvbc_sim_run(&gSim, 100, 0) : -1;
+	n = collect();
+	printf("first run: %lld delivered, %d read\n", (long long)delivered, n);
+	ok = ok && (delivered == 35) && (n == 35) && (stats->ullFrames == 35) && (stats->ullNowUS == 100000)
+		&& follows_schedule(n, gSchedule, 2);
+	check("schedule", ok);
+
+	delivered = ok ? mvbc_sim_run(&gSim, 100, 0) : -1;
+	n = collect();
+	ok = ok && (delivered == 35) && (n == 35) && (stats->ullFrames == 70) && (stats->ullNowUS == 200000)
+		&& (virtual_us(&gRecs[0]) == 100000) && follows_schedule(n, gSchedule, 2);
+	check("second run", ok);
+}
+
+/**
+ * The schedule of a configuration: each sink port at its poll interval with
+ * the phase address % interval, no source port.
+ */
+static void test_ctx_schedule(void)
+{
+	static const struct sMvbcSimEntry expected[] = {
+		{ TEST_PORT_A, 2, 4, TEST_PORT_A % 4 },
+		{ TEST_PORT_B, 0, 8, TEST_PORT_B % 8 }
+	};
+	int64_t delivered;
+	int n;
+	int ok;
+
+	ok = (mvbc_ctx_sim_init(mvbc_default_ctx(), &gSim, EMU_DEV, NULL) == 0) && (gSim.iCount == 2);
+	collect();
+
+	delivered = ok ? mvbc_sim_run(&gSim, 64, 0) : -1;
+	n = collect();
+	printf("configured schedule: %lld delivered\n", (long long)delivered);
+	check("ctx schedule", ok && (delivered == 24) && (n == 24) && follows_schedule(n, expected, 2));
+}
+
+/**
+ * One second with drops and jitter.
+ *
+ * @param faults
+ * @param seen time stamps on the virtual clock of the records read
+ * @return number of records read
+ */
+static int faulty_run(const struct sMvbcSimFaults *faults, int64_t *seen)
+{
+	int n = 0;
+
+	if (mvbc_sim_init(&gSim, EMU_DEV, gSchedule, 2, faults) == 0)
+	{
+		collect();
+		mvbc_sim_run(&gSim, 1000, 0);
+		n = collect();
+	}
+	for (int i = 0; i < n; i++)
+	{
+		seen[i] = virtual_us(&gRecs[i]) * 0x10000 + gRecs[i].wPortAddr;
+	}
+	return n;
+}
+
+/**
+ * The same seed drops the same frames and moves the same time stamps, by
+ * at most the jitter.
+ */
+static void test_seed(void)
+{
+	static int64_t first[TEST_MAX_RECORDS];
+	static int64_t second[TEST_MAX_RECORDS];
+	const struct sMvbcSimFaults faults = { 500, 100000, 0, 0, eLineA, 4711 };
+	uint64_t dropped;
+	int n;
+	int ok;
+
+	n = faulty_run(&faults, first);
+	dropped = gSim.stats.ullDropped;
+	ok = (n > 0) && (gSim.stats.ullFrames == 350) && (n + dropped == 350);
+
+	/* jitter relative to the due time of the poll counter */
+	for (int i = 0; ok && (i < n); i++)
+	{
+		const struct sMvbcSimEntry *e = (gRecs[i].wPortAddr == TEST_PORT_A) ? &gSchedule[0] : &gSchedule[1];
+		int64_t due = ((int64_t)e->wPhaseMS + (int64_t)(gRecs[i].wPortData[0] - 1) * e->wPeriodMS) * 1000;
+
+		ok = (virtual_us(&gRecs[i]) >= due - faults.iJitterUS) && (virtual_us(&gRecs[i]) <= due + faults.iJitterUS);
+	}
+	check("jitter", ok);
+
+	ok = ok && (faulty_run(&faults, second) == n) && (gSim.stats.ullDropped == dropped)
+		&& (memcmp(first, second, n * sizeof(int64_t)) == 0);
+	printf("seed %u: %llu of 350 frames dropped\n", faults.uiSeed, (unsigned long long)dropped);
+	check("same seed", ok);
+}
+
+/**
+ * A fault of line A every 100 ms for 20 ms: the device only listens on
+ * line A and loses the 6 polls of port A and the 2 of port B in each.
+ */
+static void test_line_faults(void)
+{
+	const struct sMvbcSimFaults faults = { 0, 0, 100, 20, eLineA, 0 };
+	int n = 0;
+	int ok;
+
+	ok = (mvbc_sim_init(&gSim, EMU_DEV, gSchedule, 2, &faults) == 0);
+	collect();
+	if (ok)
+	{
+		mvbc_sim_run(&gSim, 1000, 0);
+		n = collect();
+	}
+	printf("line faults: %u, %d of %llu frames stored\n", gSim.stats.uiLineFaults, n, (unsigned long long)gSim.stats.ullFrames);
+
+	/* the fault due at the end of the run starts and stays */
+	ok = ok && (gSim.stats.uiLineFaults == 10) && (gSim.stats.ullFrames == 350) && (n == 350 - 9 * 8)
+		&& (gSim.stats.ullDelivered == (uint64_t)n);
+	for (int i = 0; ok && (i < n); i++)
+	{
+		int64_t t = virtual_us(&gRecs[i]) % 100000;
+
+		ok = (virtual_us(&gRecs[i]) < 100000) || (t > 20000);
+	}
+	mvbc_emu_set_line_fault(EMU_DEV, eLineA, 0);
+	check("line faults", ok);
+}
+
+/**
+ * Main entry for test application
+ *
+ * @param argc
+ * @param argv
+ *
+ * @return 0 if all steps passed
+ */
+int main(int argc, char* argv[])
+{
+	int ok;
+
+	(void)argc;
+	(void)argv;
+
+	printf("MVBC Lib Bus Simulation Test\n");
+
+	ok = (mvbc_init_static(&gProject) >= 0);
+	check("init", ok);
+
+	if (ok)
+	{
+		test_schedule();
+		test_ctx_schedule();
+		test_seed();
+		test_line_faults();
+	}
+
+	mvbc_shutdown(EMU_DEV);
+
+	printf("%s\n", gFailed ? "FAILED" : "passed");
+	return gFailed ? 1 : 0;
+}
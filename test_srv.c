@@ -0,0 +1,367 @@
+/**
+ * @file
+ *
+ * Subscription server test on an emulated device (see mvbc_srv.h), no board
+ * needed.
+ *
+ * A client on the Unix socket subscribes the ports of the device and counts
+ * the update frames: the ports known at subscription come at once, every
+ * update costs a credit, without credit newer records replace older ones and
+ * one credit brings the latest values. After the device was opened again
+ * the server registers the new descriptor once and reads it.
+ *
+ * 	mvbc_srv_test [socket path]
+ *
+ * @return 0 if all steps passed, 1 otherwise
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <mvbc_lib.h>
+#include <mvbc_static.h>
+#include <mvbc_emu.h>
+#include <mvbc_srv.h>
+
+#define DEFAULT_SOCKET "/tmp/mvbc_srv_test.sock"
+
+#define EMU_DEV MVBC_EMU_PREFIX "srv0"
+
+#define TEST_PORTS 4
+#define TEST_PORT_BASE 0x300
+
+/** F-Code 1: 2 words */
+#define TEST_FCODE 1
+#define TEST_WORDS 2
+#define TEST_POLL_MS 16
+
+/** time an update may take to arrive */
+#define TEST_WAIT_MS 500
+
+/** time after which no update is expected any more */
+#define TEST_QUIET_MS 200
+
+static struct sMvbcStaticPort gPorts[TEST_PORTS];
+static struct sMvbcStaticDevice gDevices[1];
+static const struct sMvbcStaticProject gProject = { "srv test", "1", 1, gDevices };
+
+/** payload of the frames on the bus and of the last update per port */
+static uint16_t gValue;
+static uint16_t gReceived[TEST_PORTS];
+
+static uint32_t gSeq;
+static int gFailed;
+
+/**
+ * Print the result of a step.
+ *
+ * @param step
+ * @param ok
+ */
+static void check(const char *step, int ok)
+{
+	if (!ok)
+	{
+		gFailed++;
+	}
+	printf("%-12s %s\n", step, ok ? "ok" : "FAILED");
+}
+
+/**
+ * Deliver one frame per port with the payload gValue.
+ *
+ * @return 0 in case of success, -1 for error
+ */
+static int bus_frames(void)
+{
+	struct sPortData frames[TEST_PORTS];
+	struct timeval ts;
+
+	gettimeofday(&ts, NULL);
+	for (int i = 0; i < TEST_PORTS; i++)
+	{
+		memset(&frames[i], 0, sizeof(frames[i]));
+		frames[i].wPortAddr = TEST_PORT_BASE + i;
+		frames[i].wNumOfWords = TEST_WORDS;
+		frames[i].sTimeStamp = ts;
+		frames[i].wPortData[0] = gValue;
+	}
+	return (mvbc_emu_bus_frames(EMU_DEV, frames, TEST_PORTS) == TEST_PORTS) ? 0 : -1;
+}
+
+/**
+ * Send a request.
+ *
+ * @param fd
+ * @param type
+ * @param count
+ * @param payload
+ * @param len payload bytes
+ * @return 0 in case of success, -1 for error
+ */
+static int request(int fd, int type, uint32_t count, const void *payload, uint32_t len)
+{
+	uint8_t buf[sizeof(struct sMvbcSrvFrame) + 64];
+	struct sMvbcSrvFrame frame = { type, 0, len, ++gSeq, count };
+
+	memcpy(buf, &frame, sizeof(frame));
+	memcpy(buf + sizeof(frame), payload, len);
+	return (send(fd, buf, sizeof(frame) + len, MSG_NOSIGNAL) == (ssize_t)(sizeof(frame) + len)) ? 0 : -1;
+}
+
+/**
+ * Receive one frame; the records of an update are kept in gReceived[].
+ *
+ * @param fd
+ * @param timeout in milliseconds
+ * @param frame
+ * @return 1 if a frame was received, 0 after the timeout, -1 for error
+ */
+static int receive(int fd, int timeout, struct sMvbcSrvFrame *frame)
+{
+	static uint8_t buf[sizeof(struct sMvbcSrvFrame) + MVBC_SRV_BATCH * sizeof(struct sPortData)];
+	struct pollfd pollDesc = { fd, POLLIN, 0 };
+	struct sPortData rec;
+	ssize_t n;
+
+	if (poll(&pollDesc, 1, timeout) <= 0)
+	{
+		return 0;
+	}
+	n = recv(fd, buf, sizeof(buf), 0);
+	if (n < (ssize_t)sizeof(*frame))
+	{
+		return -1;
+	}
+	memcpy(frame, buf, sizeof(*frame));
+	if (frame->uiLen != n - sizeof(*frame))
+	{
+		return -1;
+	}
+
+	for (uint32_t i = 0; (frame->wType == MVBC_SRV_UPDATE) && (i < frame->uiCount); i++)
+	{
+		memcpy(&rec, buf + sizeof(*frame) + i * sizeof(rec), sizeof(rec));
+		if ((rec.wPortAddr >= TEST_PORT_BASE) && (rec.wPortAddr < TEST_PORT_BASE + TEST_PORTS))
+		{
+			gReceived[rec.wPortAddr - TEST_PORT_BASE] = rec.wPortData[0];
+		}
+	}
+	return 1;
+}
+
+/**
+ * Receive update frames until the server is quiet.
+ *
+ * @param fd
+ * @param records sum of the records of the updates
+ * @return number of update frames, -1 for error
+ */
+static int updates(int fd, int *records)
+{
+	struct sMvbcSrvFrame frame;
+	int frames = 0;
+	int rc;
+
+	*records = 0;
+	while ((rc = receive(fd, TEST_QUIET_MS, &frame)) > 0)
+	{
+		if (frame.wType != MVBC_SRV_UPDATE)
+		{
+			return -1;
+		}
+		frames++;
+		*records += frame.uiCount;
+	}
+	return (rc < 0) ? -1 : frames;
+}
+
+/**
+ * @param value
+ * @return 1 if the last update of every port carried value
+ */
+static int all_received(uint16_t value)
+{
+	for (int i = 0; i < TEST_PORTS; i++)
+	{
+		if (gReceived[i] != value)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Connect and subscribe all ports, the known values come with the first update.
+ *
+ * @param path
+ * @return socket, -1 for error
+ */
+static int subscribe(const char *path)
+{
+	struct sockaddr_un addr;
+	struct sMvbcSrvFrame frame;
+	uint16_t ports[TEST_PORTS];
+	int records;
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	int ok;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	for (int i = 0; i < TEST_PORTS; i++)
+	{
+		ports[i] = TEST_PORT_BASE + i;
+	}
+
+	ok = (fd >= 0) && (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+		&& (request(fd, MVBC_SRV_SUBSCRIBE, TEST_PORTS, ports, sizeof(ports)) == 0)
+		&& (receive(fd, TEST_WAIT_MS, &frame) == 1) && (frame.wType == MVBC_SRV_REPLY)
+		&& (frame.uiSeq == gSeq) && (frame.uiCount == TEST_PORTS);
+	ok = ok && (updates(fd, &records) == 1) && (records == TEST_PORTS) && all_received(gValue);
+	check("subscribe", ok);
+
+	if (!ok && (fd >= 0))
+	{
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+/**
+ * The first update took one of the MVBC_SRV_INITIAL_CREDIT credits; every
+ * further one takes another until none is left.
+ *
+ * @param fd
+ */
+static void test_credits(int fd)
+{
+	struct sMvbcSrvStats before;
+	struct sMvbcSrvStats after;
+	int frames = 0;
+	int records;
+	int ok = 1;
+
+	for (int i = 1; ok && (i < MVBC_SRV_INITIAL_CREDIT); i++)
+	{
+		gValue++;
+		ok = (bus_frames() == 0) && (updates(fd, &records) == 1) && (records == TEST_PORTS) && all_received(gValue);
+		frames += ok;
+	}
+	check("credits", ok && (frames == MVBC_SRV_INITIAL_CREDIT - 1));
+
+	/* no credit: the records wait and newer ones replace them */
+	mvbc_srv_get_stats(&before);
+	for (int i = 0; ok && (i < 5); i++)
+	{
+		gValue++;
+		ok = (bus_frames() == 0) && (updates(fd, &records) == 0);
+	}
+	mvbc_srv_get_stats(&after);
+	printf("without credit: %llu records read, %llu coalesced\n", (unsigned long long)(after.ullRecords - before.ullRecords),
+		(unsigned long long)(after.ullCoalesced - before.ullCoalesced));
+	check("no credit", ok && (after.ullRecords - before.ullRecords == 5 * TEST_PORTS)
+		&& (after.ullCoalesced - before.ullCoalesced == 4 * TEST_PORTS));
+
+	/* one credit brings the latest value of each port, once */
+	ok = ok && (request(fd, MVBC_SRV_CREDIT, 1, NULL, 0) == 0) && (updates(fd, &records) == 1)
+		&& (records == TEST_PORTS) && all_received(gValue);
+	check("latest", ok);
+}
+
+/**
+ * Open the device again while the server runs: the server registers the new
+ * descriptor once, even if it got the number of the old one, and reads it.
+ *
+ * @param fd
+ */
+static void test_rearm(int fd)
+{
+	struct sMvbcSrvStats before;
+	struct sMvbcSrvStats after;
+	int records = 0;
+	int frames = -1;
+	int ok;
+
+	ok = (request(fd, MVBC_SRV_CREDIT, 100, NULL, 0) == 0) && (mvbc_srv_get_stats(&before) == 0)
+		&& (mvbc_init_static(&gProject) >= 0) && (mvbc_emu_set_external_bus(EMU_DEV, 1) == 0);
+
+	/* records of the emulated time before the external bus took over */
+	if (ok)
+	{
+		updates(fd, &records);
+		gValue++;
+		ok = (bus_frames() == 0);
+		frames = ok ? updates(fd, &records) : -1;
+	}
+
+	/* idle re-arms keep the descriptor */
+	usleep(3 * TEST_QUIET_MS * 1000);
+	ok = ok && (mvbc_srv_get_stats(&after) == 0);
+	printf("after reopen: %d updates, %d records, %u descriptors registered again\n", frames, records,
+		after.uiReopened - before.uiReopened);
+	check("re-arm", ok && (frames >= 1) && all_received(gValue) && (after.uiReopened == before.uiReopened + 1));
+}
+
+/**
+ * Main entry for test application
+ *
+ * @param argc
+ * @param argv
+ *
+ * @return 0 if all steps passed
+ */
+int main(int argc, char* argv[])
+{
+	const char *path = (argc > 1) ? argv[1] : DEFAULT_SOCKET;
+	struct sMvbcSrvStats stats;
+	int fd = -1;
+	int ok;
+
+	printf("MVBC Lib Subscription Server Test\n");
+
+	for (int i = 0; i < TEST_PORTS; i++)
+	{
+		gPorts[i] = (struct sMvbcStaticPort){ NULL, TEST_PORT_BASE + i, eLA, eSink, TEST_FCODE, 0, 0, TEST_POLL_MS, 0 };
+	}
+	gDevices[0] = (struct sMvbcStaticDevice){ "SRV", EMU_DEV, eEMD, eStatic, 0, eLineAB, 1, eLA, TEST_POLL_MS, 0, 0, TEST_PORTS, gPorts, NULL };
+
+	/* the server reads the records of the emulated time before the external bus, the frames then replace them */
+	gValue = 0x100;
+	ok = (mvbc_init_static(&gProject) >= 0) && (mvbc_emu_set_external_bus(EMU_DEV, 1) == 0)
+		&& (mvbc_srv_start(path) == 0) && (bus_frames() == 0);
+	check("init", ok);
+
+	if (ok)
+	{
+		usleep(TEST_QUIET_MS * 1000);
+		fd = subscribe(path);
+	}
+	if (fd >= 0)
+	{
+		test_credits(fd);
+		test_rearm(fd);
+		close(fd);
+	}
+
+	if (ok && (mvbc_srv_get_stats(&stats) == 0))
+	{
+		printf("server: %llu records, %llu frames, %llu updates, %llu coalesced, %llu blocked, %u bad requests, %u reopened\n",
+			(unsigned long long)stats.ullRecords, (unsigned long long)stats.ullFrames, (unsigned long long)stats.ullUpdates,
+			(unsigned long long)stats.ullCoalesced, (unsigned long long)stats.ullBlocked, stats.uiBadRequests, stats.uiReopened);
+		check("requests", stats.uiBadRequests == 0);
+	}
+
+	mvbc_srv_stop();
+	mvbc_shutdown(EMU_DEV);
+
+	printf("%s\n", gFailed ? "FAILED" : "passed");
+	return gFailed ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+/**
+ * @file
+ *
+ * Linked in configuration test on an emulated device (see mvbc_emu.h and
+ * mvbc_static.h), no board needed.
+ *
+ * Compares the tables mvbc_gen made of test_static.json at build time with
+ * the JSON file: ranges, templates, types from the F-Code and precomputed
+ * control words. Then inits the emulator with them and hands init broken
+ * tables, which are rejected while the device keeps the ports before.
+ *
+ * 	mvbc_static_test
+ *
+ * @return 0 if all steps passed, 1 otherwise
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <mvbc_lib.h>
+#include <mvbc_static.h>
+#include <mvbc_emu.h>
+
+#include "test_static_cfg.h"
+
+#define EMU_DEV MVBC_EMU_PREFIX "static0"
+
+/** ports test_static.json configures */
+#define TEST_PORTS 7
+
+static int gFailed;
+
+/**
+ * Print the result of a step.
+ *
+ * @param step
+ * @param ok
+ */
+static void check(const char *step, int ok)
+{
+	if (!ok)
+	{
+		gFailed++;
+	}
+	printf("%-12s %s\n", step, ok ? "ok" : "FAILED");
+}
+
+/**
+ * Compare one generated port.
+ *
+ * @param p
+ * @param name
+ * @param addr
+ * @param type enum ePortType
+ * @param direction enum ePortDirection
+ * @param fcode
+ * @param irq
+ * @param numData
+ * @param poll
+ * @return 1 if all fields and the control word match
+ */
+static int port_is(const struct sMvbcStaticPort *p, const char *name, int addr, int type, int direction,
+	int fcode, int irq, int numData, int poll)
+{
+	return (p->pName != NULL) && (strcmp(p->pName, name) == 0) && (p->wPortAddr == addr) && (p->cPortType == type)
+		&& (p->cPortDirection == direction) && (p->cFunctionCode == fcode) && (p->cIrqNumber == irq)
+		&& (p->cNumData == numData) && (p->wPollIntervalMS == poll)
+		&& (p->wPCS_W0 == MVBC_PCS_W0(fcode, direction, irq, numData));
+}
+
+/**
+ * The generated tables hold what test_static.json says.
+ */
+static void test_tables(void)
+{
+	const struct sMvbcStaticDevice *d = test_static_cfg.pDevices;
+	const struct sMvbcStaticPort *p;
+	int ok;
+
+	ok = (strcmp(test_static_cfg.pName, "static test") == 0) && (strcmp(test_static_cfg.pVersion, "2") == 0)
+		&& (test_static_cfg.iDeviceCount == 1) && (d != NULL);
+	ok = ok && (strcmp(d->pDevPath, EMU_DEV) == 0) && (strcmp(d->pDescription, "GEN") == 0) && (d->iInterface == eEMD)
+		&& (d->iMode == eStatic) && (d->iLine == eLineA) && (d->iDeviceAddr == 5) && (d->pUioPath == NULL);
+	check("device", ok);
+
+	p = ok ? d->pPorts : NULL;
+	ok = ok && (d->iPortCount == TEST_PORTS) && (p != NULL)
+		&& port_is(&p[0], "SPEED", 256, eLA, eSink, 3, 0, 1, MVBC_JSON_CONF_DEFAULT_PORT_POLL_MS)
+		&& port_is(&p[5], "CMD", 300, eLA, eSource, 2, 2, 0, MVBC_JSON_CONF_DEFAULT_PORT_POLL_MS)
+		&& port_is(&p[6], "MSG", 301, ePP, eSink, 9, 0, 0, MVBC_JSON_CONF_DEFAULT_PORT_POLL_MS);
+	check("ports", ok);
+
+	/* a range of four ports from a template, names numbered by the index */
+	for (int i = 0; ok && (i < 4); i++)
+	{
+		char name[16];
+
+		snprintf(name, sizeof(name), "DOOR%d", i);
+		ok = port_is(&p[1 + i], name, 272 + 2 * i, eLA, eSink, 1, 0, 0, 32);
+	}
+	check("template", ok);
+}
+
+/**
+ * Init with one broken table.
+ *
+ * @param step
+ * @param ports
+ * @param count
+ */
+static void reject(const char *step, const struct sMvbcStaticPort *ports, int count)
+{
+	const struct sMvbcStaticDevice device = { "GEN", EMU_DEV, eEMD, eStatic, 0, eLineA, 5, eLA, 16, 0, 0, count, ports, NULL };
+	const struct sMvbcStaticProject project = { "static test broken", "3", 1, &device };
+	struct sMvbcEmuStats stats;
+	int ok;
+
+	ok = (mvbc_init_static(&project) == ERROR_PARSE_CONFIGURATION)
+		&& (mvbc_emu_get_stats(EMU_DEV, &stats) == 0) && (stats.uiPorts == TEST_PORTS);
+	check(step, ok);
+}
+
+/**
+ * Each rule of mvbc_check_project() rejects a table, the generated
+ * configuration stays; a bus load just below the limit passes.
+ */
+static void test_rejected(void)
+{
+	static const struct sMvbcStaticPort fcode[] = { { NULL, 256, eLA, eSink, 5, 0, 0, 16, 0 } };
+	static const struct sMvbcStaticPort type[] = { { NULL, 256, eDA, eSink, 3, 0, 0, 16, 0 } };
+	static const struct sMvbcStaticPort poll[] = { { NULL, 256, eLA, eSink, 3, 0, 0, 24, 0 } };
+	static const struct sMvbcStaticPort pcs[] = { { NULL, 256, eLA, eSink, 3, 0, 0, 16, MVBC_PCS_W0(3, eSource, 0, 0) } };
+	static const struct sMvbcStaticPort twice[] = {
+		{ NULL, 256, eLA, eSink, 3, 0, 0, 16, 0 },
+		{ NULL, 256, eLA, eSink, 2, 0, 0, 16, 0 }
+	};
+	/* F-Code 4 every millisecond: 3 ports use 684/1000 of the bus, 4 ports 912/1000 */
+	static const struct sMvbcStaticPort load[] = {
+		{ NULL, 256, eLA, eSink, 4, 0, 0, 1, 0 },
+		{ NULL, 257, eLA, eSink, 4, 0, 0, 1, 0 },
+		{ NULL, 258, eLA, eSink, 4, 0, 0, 1, 0 },
+		{ NULL, 259, eLA, eSink, 4, 0, 0, 1, 0 }
+	};
+	const struct sMvbcStaticDevice device = { "GEN", EMU_DEV, eEMD, eStatic, 0, eLineA, 5, eLA, 16, 0, 0, 3, load, NULL };
+	const struct sMvbcStaticProject project = { "static test load", "4", 1, &device };
+	struct sMvbcEmuStats stats;
+
+	reject("F-Code", fcode, 1);
+	reject("type", type, 1);
+	reject("poll", poll, 1);
+	reject("control word", pcs, 1);
+	reject("twice", twice, 2);
+	reject("bus load", load, 4);
+
+	check("load limit", (mvbc_init_static(&project) >= 0) && (mvbc_emu_get_stats(EMU_DEV, &stats) == 0) && (stats.uiPorts == 3));
+}
+
+/**
+ * Main entry for test application
+ *
+ * @param argc
+ * @param argv
+ *
+ * @return 0 if all steps passed
+ */
+int main(int argc, char* argv[])
+{
+	struct sMvbcEmuStats stats;
+	int ok;
+
+	(void)argc;
+	(void)argv;
+
+	printf("MVBC Lib Static Configuration Test\n");
+
+	test_tables();
+
+	ok = (test_static_cfg_init(mvbc_default_ctx()) >= 0) && (mvbc_emu_get_stats(EMU_DEV, &stats) == 0)
+		&& (stats.uiPorts == TEST_PORTS);
+	check("init", ok);
+
+	if (ok)
+	{
+		test_rejected();
+	}
+
+	mvbc_shutdown(EMU_DEV);
+
+	printf("%s\n", gFailed ? "FAILED" : "passed");
+	return gFailed ? 1 : 0;
+}